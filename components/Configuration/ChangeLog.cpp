@@ -0,0 +1,132 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "ChangeLog.h"
+#include "JsonConstants.h"
+#include "JsonWriter.h"
+
+#include <algorithm>
+#include <esp_system.h>
+#include <vector>
+
+ChangeLog::ChangeLog()
+{
+  // start from a random version so that a version held by a client from
+  // before a restart is unlikely to be treated as current.
+  version_ = (esp_random() >> 2) + 1;
+  oldest_ = version_;
+  log_.fill({0, 0, false});
+}
+
+uint32_t ChangeLog::version()
+{
+  AtomicHolder h(this);
+  return version_;
+}
+
+void ChangeLog::reset()
+{
+  AtomicHolder h(this);
+  version_++;
+  oldest_ = version_;
+}
+
+void ChangeLog::record(uint32_t key, bool removed)
+{
+  AtomicHolder h(this);
+  Change &change = log_[next_];
+  if (change.version)
+  {
+    // the change being replaced is no longer available for deltas.
+    oldest_ = change.version;
+  }
+  change.version = ++version_;
+  change.key = key;
+  change.removed = removed;
+  next_ = (next_ + 1) % LOG_SIZE;
+}
+
+static void erase_key(std::vector<uint32_t> &keys, uint32_t key)
+{
+  auto ent = std::find(keys.begin(), keys.end(), key);
+  if (ent != keys.end())
+  {
+    keys.erase(ent);
+  }
+}
+
+void ChangeLog::write_json(JsonWriter &writer, uint32_t since
+                         , EntryWriter entry, SnapshotWriter snapshot)
+{
+  std::array<Change, LOG_SIZE> log;
+  size_t next;
+  uint32_t version;
+  uint32_t oldest;
+  {
+    AtomicHolder h(this);
+    log = log_;
+    next = next_;
+    version = version_;
+    oldest = oldest_;
+  }
+  bool full = since < oldest || since > version;
+  std::vector<uint32_t> changed;
+  std::vector<uint32_t> removed;
+  writer.start_object()
+        .field(JSON_VERSION_NODE, version)
+        .field(JSON_FULL_NODE, full)
+        .key(JSON_CHANGED_NODE).start_array();
+  if (full)
+  {
+    snapshot(writer);
+  }
+  else
+  {
+    // walk the log from oldest to newest so the last change to a key wins.
+    for (size_t idx = 0; idx < LOG_SIZE; idx++)
+    {
+      const Change &change = log[(next + idx) % LOG_SIZE];
+      if (change.version <= since)
+      {
+        continue;
+      }
+      erase_key(changed, change.key);
+      erase_key(removed, change.key);
+      if (change.removed)
+      {
+        removed.push_back(change.key);
+      }
+      else
+      {
+        changed.push_back(change.key);
+      }
+    }
+    for (uint32_t key : changed)
+    {
+      if (!entry(writer, key))
+      {
+        removed.push_back(key);
+      }
+    }
+  }
+  writer.end_array().key(JSON_REMOVED_NODE).start_array();
+  for (uint32_t key : removed)
+  {
+    writer.value(key);
+  }
+  writer.end_array().end_object();
+}
@@ -0,0 +1,209 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "JsonEntryReader.h"
+#include "FileSystemManager.h"
+
+#include <stdio.h>
+#include <utils/logging.h>
+
+using nlohmann::json;
+
+bool JsonEntryReader::load(const std::string &name, const char *member
+                         , EntryCallback callback)
+{
+  auto fs = Singleton<FileSystemManager>::instance();
+  if (!fs->exists(name))
+  {
+    LOG(VERBOSE, "[FS] %s does not exist, no entries loaded", name.c_str());
+    return true;
+  }
+  std::string path = fs->getFilePath(name);
+  FILE *fp = fopen(path.c_str(), "r");
+  if (!fp)
+  {
+    LOG_ERROR("[FS] Unable to open %s", path.c_str());
+    return false;
+  }
+  LOG(VERBOSE, "[FS] Streaming %s", path.c_str());
+  setvbuf(fp, nullptr, _IOFBF, READ_CHUNK_SIZE);
+  JsonEntryReader reader(name, member, std::move(callback));
+  bool result = json::sax_parse(nlohmann::detail::input_adapter(fp), &reader);
+  fclose(fp);
+  return result;
+}
+
+bool JsonEntryReader::null()
+{
+  return value(nullptr);
+}
+
+bool JsonEntryReader::boolean(bool val)
+{
+  return value(val);
+}
+
+bool JsonEntryReader::number_integer(number_integer_t val)
+{
+  return value(val);
+}
+
+bool JsonEntryReader::number_unsigned(number_unsigned_t val)
+{
+  return value(val);
+}
+
+bool JsonEntryReader::number_float(number_float_t val, const string_t &s)
+{
+  return value(val);
+}
+
+bool JsonEntryReader::string(string_t &val)
+{
+  return value(std::move(val));
+}
+
+bool JsonEntryReader::start_object(std::size_t elements)
+{
+  return start_container(json::object());
+}
+
+bool JsonEntryReader::key(string_t &val)
+{
+  if (!stack_.empty())
+  {
+    memberValue_ = &(*stack_.back())[val];
+  }
+  else if (depth_ == 1)
+  {
+    memberMatched_ = member_ && val == member_;
+  }
+  return true;
+}
+
+bool JsonEntryReader::end_object()
+{
+  return end_container();
+}
+
+bool JsonEntryReader::start_array(std::size_t elements)
+{
+  if (stack_.empty() && !at_entry() && !entryDepth_)
+  {
+    // the entries are either the root array or the array held by the
+    // requested member of the root object.
+    if (depth_ == 0 || (depth_ == 1 && memberMatched_))
+    {
+      depth_++;
+      entryDepth_ = depth_;
+      return true;
+    }
+  }
+  return start_container(json::array());
+}
+
+bool JsonEntryReader::end_array()
+{
+  return end_container();
+}
+
+bool JsonEntryReader::parse_error(std::size_t position
+                                , const std::string &last_token
+                                , const nlohmann::detail::exception &ex)
+{
+  LOG_ERROR("[FS] Failed to parse %s at offset %zu: %s", name_.c_str()
+          , position, ex.what());
+  return false;
+}
+
+bool JsonEntryReader::value(json &&val)
+{
+  if (stack_.empty())
+  {
+    if (at_entry())
+    {
+      entry_ = std::move(val);
+      emit();
+    }
+    // values outside of the entries array are ignored.
+    return true;
+  }
+  json *parent = stack_.back();
+  if (parent->is_array())
+  {
+    parent->push_back(std::move(val));
+  }
+  else
+  {
+    *memberValue_ = std::move(val);
+  }
+  return true;
+}
+
+bool JsonEntryReader::start_container(json &&container)
+{
+  if (stack_.empty())
+  {
+    if (!at_entry())
+    {
+      // containers outside of the entries array are only tracked for depth.
+      depth_++;
+      return true;
+    }
+    entry_ = std::move(container);
+    stack_.push_back(&entry_);
+    return true;
+  }
+  json *parent = stack_.back();
+  if (parent->is_array())
+  {
+    parent->push_back(std::move(container));
+    stack_.push_back(&parent->back());
+  }
+  else
+  {
+    *memberValue_ = std::move(container);
+    stack_.push_back(memberValue_);
+  }
+  return true;
+}
+
+bool JsonEntryReader::end_container()
+{
+  if (stack_.empty())
+  {
+    if (entryDepth_ && depth_ == entryDepth_)
+    {
+      // end of the entries array, any later arrays will be ignored.
+      entryDepth_ = SIZE_MAX;
+    }
+    depth_--;
+    return true;
+  }
+  stack_.pop_back();
+  if (stack_.empty())
+  {
+    emit();
+  }
+  return true;
+}
+
+void JsonEntryReader::emit()
+{
+  callback_(entry_);
+  entry_ = nullptr;
+}
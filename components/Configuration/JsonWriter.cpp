@@ -0,0 +1,216 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "JsonWriter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/// Hex digits used for \u escapes.
+static constexpr const char *HEX_DIGITS = "0123456789abcdef";
+
+JsonWriter &JsonWriter::key(const char *name)
+{
+  separator();
+  write_string(name, strlen(name));
+  buffer_ += ':';
+  afterKey_ = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *value)
+{
+  separator();
+  return write_string(value, strlen(value));
+}
+
+JsonWriter &JsonWriter::value(const std::string &value)
+{
+  separator();
+  return write_string(value.data(), value.length());
+}
+
+JsonWriter &JsonWriter::value(bool value)
+{
+  separator();
+  if (value)
+  {
+    buffer_.append("true", 4);
+  }
+  else
+  {
+    buffer_.append("false", 5);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(double value, uint8_t precision)
+{
+  if (isnan(value) || isinf(value))
+  {
+    return null_value();
+  }
+  separator();
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.*f", precision, value);
+  if (len > 0)
+  {
+    buffer_.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::null_value()
+{
+  separator();
+  buffer_.append("null", 4);
+  return *this;
+}
+
+JsonWriter &JsonWriter::raw_value(const std::string &json)
+{
+  separator();
+  buffer_.append(json);
+  return *this;
+}
+
+void JsonWriter::escape(std::string &buffer, const char *value, size_t length)
+{
+  // characters which do not need to be escaped are appended in runs to avoid
+  // growing the buffer one character at a time.
+  const char *run = value;
+  const char *end = value + length;
+  for (const char *pos = value; pos < end; pos++)
+  {
+    uint8_t ch = *pos;
+    if (ch >= 0x20 && ch != '"' && ch != '\\')
+    {
+      continue;
+    }
+    buffer.append(run, pos - run);
+    run = pos + 1;
+    buffer += '\\';
+    switch (ch)
+    {
+      case '"':
+      case '\\':
+        buffer += ch;
+        break;
+      case '\b':
+        buffer += 'b';
+        break;
+      case '\f':
+        buffer += 'f';
+        break;
+      case '\n':
+        buffer += 'n';
+        break;
+      case '\r':
+        buffer += 'r';
+        break;
+      case '\t':
+        buffer += 't';
+        break;
+      default:
+        buffer.append("u00", 3);
+        buffer += HEX_DIGITS[ch >> 4];
+        buffer += HEX_DIGITS[ch & 0x0F];
+    }
+  }
+  buffer.append(run, end - run);
+}
+
+void JsonWriter::separator()
+{
+  if (afterKey_)
+  {
+    // values following a member name never need a separator.
+    afterKey_ = false;
+    return;
+  }
+  if (!depth_)
+  {
+    return;
+  }
+  uint32_t level = level_bit();
+  if (hasElements_ & level)
+  {
+    buffer_ += ',';
+  }
+  hasElements_ |= level;
+}
+
+JsonWriter &JsonWriter::start(char token)
+{
+  separator();
+  buffer_ += token;
+  depth_++;
+  hasElements_ &= ~level_bit();
+  return *this;
+}
+
+JsonWriter &JsonWriter::end(char token)
+{
+  buffer_ += token;
+  if (depth_)
+  {
+    depth_--;
+  }
+  return *this;
+}
+
+JsonWriter &JsonWriter::write_string(const char *value, size_t length)
+{
+  buffer_ += '"';
+  escape(buffer_, value, length);
+  buffer_ += '"';
+  return *this;
+}
+
+JsonWriter &JsonWriter::write_signed(int64_t value)
+{
+  separator();
+  uint64_t magnitude = value;
+  if (value < 0)
+  {
+    buffer_ += '-';
+    // negate via unsigned math so that INT64_MIN does not overflow.
+    magnitude = ~magnitude + 1;
+  }
+  append_digits(magnitude);
+  return *this;
+}
+
+JsonWriter &JsonWriter::write_unsigned(uint64_t value)
+{
+  separator();
+  append_digits(value);
+  return *this;
+}
+
+void JsonWriter::append_digits(uint64_t value)
+{
+  char buf[20];
+  char *pos = buf + sizeof(buf);
+  do
+  {
+    *--pos = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+  buffer_.append(pos, buf + sizeof(buf) - pos);
+}
@@ -0,0 +1,112 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef CHANGE_LOG_H_
+#define CHANGE_LOG_H_
+
+#include <array>
+#include <functional>
+#include <stdint.h>
+#include <utils/Atomic.hxx>
+
+class JsonWriter;
+
+/// Tracks a monotonically increasing version for a collection along with a
+/// bounded log of the entries which have changed.
+///
+/// Clients can use the version from a previous query to request only the
+/// entries which have been changed or removed since that version. When the
+/// requested version is no longer covered by the log a full snapshot is
+/// returned instead.
+///
+/// Changes are recorded without allocating memory and are safe to record
+/// while holding an @ref Atomic lock.
+class ChangeLog : private Atomic
+{
+public:
+  /// Callback used to serialize a single entry, should return false if the
+  /// entry no longer exists.
+  using EntryWriter = std::function<bool(JsonWriter &, uint32_t)>;
+
+  /// Callback used to serialize all entries.
+  using SnapshotWriter = std::function<void(JsonWriter &)>;
+
+  /// Constructor.
+  ChangeLog();
+
+  /// @return the current version of the collection.
+  uint32_t version();
+
+  /// Records that an entry has been added or modified.
+  ///
+  /// @param key is the unique identifier of the entry.
+  void changed(uint32_t key)
+  {
+    record(key, false);
+  }
+
+  /// Records that an entry has been removed.
+  ///
+  /// @param key is the unique identifier of the entry.
+  void removed(uint32_t key)
+  {
+    record(key, true);
+  }
+
+  /// Discards all recorded changes, all previous versions will receive a full
+  /// snapshot.
+  void reset();
+
+  /// Writes the changes since a previous version as a JSON object:
+  /// {"version":<version>,"full":<bool>,"changed":[...],"removed":[...]}
+  ///
+  /// @param writer is the @ref JsonWriter to write to.
+  /// @param since is the version previously returned to the client.
+  /// @param entry is used to write each entry which has changed.
+  /// @param snapshot is used to write all entries when @param since is not
+  /// covered by the log.
+  void write_json(JsonWriter &writer, uint32_t since, EntryWriter entry
+                , SnapshotWriter snapshot);
+
+private:
+  /// Number of changes retained in the log.
+  static constexpr size_t LOG_SIZE = 64;
+
+  /// A single recorded change.
+  struct Change
+  {
+    uint32_t version;
+    uint32_t key;
+    bool removed;
+  };
+
+  /// Ring buffer of the most recent changes.
+  std::array<Change, LOG_SIZE> log_;
+
+  /// Index in @ref log_ which will receive the next change.
+  size_t next_{0};
+
+  /// Current version.
+  uint32_t version_;
+
+  /// Oldest version for which all later changes are in @ref log_.
+  uint32_t oldest_;
+
+  void record(uint32_t key, bool removed);
+};
+
+#endif // CHANGE_LOG_H_
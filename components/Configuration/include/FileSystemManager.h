@@ -46,8 +46,8 @@ public:
   std::string load(const std::string &);
   void store(const char *, const std::string &);
   void force_factory_reset();
-private:
   std::string getFilePath(const std::string &);
+private:
   int configFd_{-1};
   sdmmc_card_t *sd_{nullptr};
 };
@@ -62,6 +62,7 @@ constexpr const char * JSON_PULLUP_NODE = "pullUp";
 
 constexpr const char * JSON_TURNOUTS_NODE = "turnouts";
 constexpr const char * JSON_TURNOUTS_READABLE_STRINGS_NODE = "readableStrings";
+constexpr const char * JSON_FAILED_NODE = "failed";
 
 constexpr const char * JSON_S88_NODE = "s88";
 constexpr const char * JSON_S88_SENSOR_BASE_NODE = "sensorIDBase";
@@ -79,6 +80,12 @@ constexpr const char * JSON_CREATE_NODE = "create";
 constexpr const char * JSON_OVERALL_STATE_NODE = "overallState";
 constexpr const char * JSON_LAST_UPDATE_NODE = "lastUpdate";
 
+constexpr const char * JSON_SINCE_NODE = "since";
+constexpr const char * JSON_VERSION_NODE = "version";
+constexpr const char * JSON_FULL_NODE = "full";
+constexpr const char * JSON_CHANGED_NODE = "changed";
+constexpr const char * JSON_REMOVED_NODE = "removed";
+
 constexpr const char * JSON_LCC_NODE = "lcc";
 constexpr const char * JSON_LCC_FORCE_RESET_NODE = "reset";
 constexpr const char * JSON_LCC_NODE_ID_NODE = "id";
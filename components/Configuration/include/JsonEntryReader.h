@@ -0,0 +1,126 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef JSON_ENTRY_READER_H_
+#define JSON_ENTRY_READER_H_
+
+#include <functional>
+#include <json.hpp>
+#include <string>
+#include <vector>
+
+/// Streaming loader for persisted JSON files which contain a list of entries.
+///
+/// The file is read in small fixed size chunks and fed through the nlohmann
+/// SAX parser, only the entry currently being parsed is held in memory as a
+/// json object. This avoids holding both the full file content and the full
+/// json document in memory while loading large files.
+///
+/// The entries can either be the root array of the document or an array held
+/// by a named member of the root object.
+///
+/// Example:
+///   JsonEntryReader::load("turnouts.json", nullptr, [](nlohmann::json &entry)
+///   {
+///     ...
+///   });
+class JsonEntryReader : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+  /// Callback invoked for each entry, the entry may be moved from.
+  using EntryCallback = std::function<void(nlohmann::json &)>;
+
+  /// Loads all entries from a persisted file.
+  ///
+  /// @param name is the name of the file to load, this will be resolved via
+  /// @ref FileSystemManager.
+  /// @param member is the name of the root object member which holds the
+  /// array of entries, when nullptr the entries are expected to be the root
+  /// array. A root array is always accepted.
+  /// @param callback will be invoked for each entry.
+  ///
+  /// @return false if the file could not be parsed, entries which were parsed
+  /// before the error will have been passed to the callback. A missing file is
+  /// not considered an error.
+  static bool load(const std::string &name, const char *member
+                 , EntryCallback callback);
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &s) override;
+  bool string(string_t &val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t position, const std::string &last_token
+                 , const nlohmann::detail::exception &ex) override;
+
+private:
+  /// Size of the buffer used when reading the file.
+  static constexpr size_t READ_CHUNK_SIZE = 512;
+
+  JsonEntryReader(const std::string &name, const char *member
+                , EntryCallback callback)
+    : name_(name), member_(member), callback_(std::move(callback))
+  {
+  }
+
+  /// Name of the file being loaded, used for logging.
+  const std::string &name_;
+
+  /// Name of the root member holding the entries, can be nullptr.
+  const char *member_;
+
+  /// Callback to invoke for each entry.
+  EntryCallback callback_;
+
+  /// Nesting depth of containers which are not part of an entry.
+  size_t depth_{0};
+
+  /// Depth at which the entries are found, zero until the array holding the
+  /// entries has been found.
+  size_t entryDepth_{0};
+
+  /// Set to true when the last root member name matched @ref member_.
+  bool memberMatched_{false};
+
+  /// Entry currently being parsed.
+  nlohmann::json entry_;
+
+  /// Containers of @ref entry_ which are currently open.
+  std::vector<nlohmann::json *> stack_;
+
+  /// Object member which will receive the next value.
+  nlohmann::json *memberValue_{nullptr};
+
+  /// @return true if the next value starts a new entry.
+  bool at_entry()
+  {
+    return stack_.empty() && entryDepth_ && depth_ == entryDepth_;
+  }
+
+  bool value(nlohmann::json &&val);
+  bool start_container(nlohmann::json &&container);
+  bool end_container();
+  void emit();
+};
+
+#endif // JSON_ENTRY_READER_H_
@@ -0,0 +1,179 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef JSON_WRITER_H_
+#define JSON_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+/// Streaming JSON serializer which appends directly to a caller provided
+/// buffer.
+///
+/// Separators between array elements and object members are inserted
+/// automatically and all strings are escaped. No temporary strings are
+/// created, the only allocations are from growing the buffer itself.
+///
+/// Example:
+///   std::string body;
+///   JsonWriter json(body);
+///   json.start_object()
+///       .field("address", 3)
+///       .field("name", name)
+///       .key("functions").start_array().value(true).value(false).end_array()
+///       .end_object();
+///
+/// NOTE: The writer does not validate that the generated document is well
+/// formed, start/end calls must be balanced by the caller and object members
+/// must be written via @ref key or @ref field.
+class JsonWriter
+{
+public:
+  /// Constructor.
+  ///
+  /// @param buffer is the buffer to append the serialized JSON to, existing
+  /// content will not be modified.
+  JsonWriter(std::string &buffer) : buffer_(buffer)
+  {
+  }
+
+  /// Starts a JSON object.
+  JsonWriter &start_object()
+  {
+    return start('{');
+  }
+
+  /// Ends the current JSON object.
+  JsonWriter &end_object()
+  {
+    return end('}');
+  }
+
+  /// Starts a JSON array.
+  JsonWriter &start_array()
+  {
+    return start('[');
+  }
+
+  /// Ends the current JSON array.
+  JsonWriter &end_array()
+  {
+    return end(']');
+  }
+
+  /// Writes the name of an object member, this must be followed by a value,
+  /// object or array.
+  ///
+  /// @param name is the name of the member.
+  JsonWriter &key(const char *name);
+
+  /// Writes a string value.
+  JsonWriter &value(const char *value);
+
+  /// Writes a string value.
+  JsonWriter &value(const std::string &value);
+
+  /// Writes a boolean value.
+  JsonWriter &value(bool value);
+
+  /// Writes an integer value.
+  template <typename T, typename std::enable_if<
+            std::is_integral<T>::value, int>::type = 0>
+  JsonWriter &value(T value)
+  {
+    return std::is_signed<T>::value ? write_signed(value)
+                                    : write_unsigned(value);
+  }
+
+  /// Writes a floating point value.
+  ///
+  /// @param value is the value to write, NaN and infinity are written as
+  /// null.
+  /// @param precision is the number of digits after the decimal point.
+  JsonWriter &value(double value, uint8_t precision = 2);
+
+  /// Writes a null value.
+  JsonWriter &null_value();
+
+  /// Writes a value which has already been serialized as JSON.
+  ///
+  /// @param json is the serialized JSON value.
+  JsonWriter &raw_value(const std::string &json);
+
+  /// Writes an object member.
+  ///
+  /// @param name is the name of the member.
+  /// @param value is the value of the member.
+  template <typename T>
+  JsonWriter &field(const char *name, const T &value)
+  {
+    key(name);
+    return this->value(value);
+  }
+
+  /// Writes an object member with a floating point value.
+  ///
+  /// @param name is the name of the member.
+  /// @param value is the value of the member.
+  /// @param precision is the number of digits after the decimal point.
+  JsonWriter &field(const char *name, double value, uint8_t precision)
+  {
+    key(name);
+    return this->value(value, precision);
+  }
+
+  /// Appends a string to the buffer with JSON escaping applied, quotes are
+  /// not added.
+  ///
+  /// @param buffer is the buffer to append to.
+  /// @param value is the string to escape.
+  /// @param length is the length of the string.
+  static void escape(std::string &buffer, const char *value, size_t length);
+
+private:
+  /// Maximum nesting depth of objects and arrays.
+  static constexpr uint8_t MAX_DEPTH = 31;
+
+  /// Buffer to append to.
+  std::string &buffer_;
+
+  /// Current nesting depth.
+  uint8_t depth_{0};
+
+  /// One bit per nesting level, set when the level has at least one element.
+  uint32_t hasElements_{0};
+
+  /// Set to true after a member name has been written.
+  bool afterKey_{false};
+
+  /// @return the bit in @ref hasElements_ for the current nesting level.
+  uint32_t level_bit()
+  {
+    return 1UL << (depth_ < MAX_DEPTH ? depth_ : MAX_DEPTH);
+  }
+
+  void separator();
+  JsonWriter &start(char token);
+  JsonWriter &end(char token);
+  JsonWriter &write_string(const char *value, size_t length);
+  JsonWriter &write_signed(int64_t value);
+  JsonWriter &write_unsigned(uint64_t value);
+  void append_digits(uint64_t value);
+};
+
+#endif // JSON_WRITER_H_
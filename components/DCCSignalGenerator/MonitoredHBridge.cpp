@@ -18,6 +18,7 @@ COPYRIGHT (c) 2019-2020 Mike Dunston
 #include "MonitoredHBridge.h"
 #include <dcc/ProgrammingTrackBackend.hxx>
 #include <json.hpp>
+#include <JsonWriter.h>
 #include <numeric>
 #include <StatusLED.h>
 
@@ -102,15 +103,15 @@ string HBridgeShortDetector::getState()
 
 string HBridgeShortDetector::getStateAsJson()
 {
-  return StringPrintf("{"
-                        "\"name\":\"%s\","
-                        "\"state\":\"%s\","
-                        "\"usage\":%.2f,"
-                        "\"prog\":%s"
-                      "}"
-                      , name_.c_str(), getState().c_str(), getUsage()
-                      , isProgrammingTrack() ? "true" : "false"
-                      );
+  string state;
+  JsonWriter writer(state);
+  writer.start_object()
+        .field("name", name_)
+        .field("state", getState())
+        .field("usage", getUsage(), 2)
+        .field("prog", isProgrammingTrack())
+        .end_object();
+  return state;
 }
 
 string HBridgeShortDetector::getStatusData()
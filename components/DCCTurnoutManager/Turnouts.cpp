@@ -21,6 +21,8 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #include <dcc/DccDebug.hxx>
 #include <dcc/UpdateLoop.hxx>
 #include <JsonConstants.h>
+#include <JsonEntryReader.h>
+#include <JsonWriter.h>
 #include <json.hpp>
 #include <utils/StringPrintf.hxx>
 
@@ -47,9 +49,7 @@ TurnoutManager::TurnoutManager(openlcb::Node *node, Service *service)
 {
   OSMutexLock h(&mux_);
   LOG(INFO, "[Turnout] Initializing DCC Turnout database");
-  json root = json::parse(
-    Singleton<FileSystemManager>::instance()->load(TURNOUTS_JSON_FILE));
-  for (auto turnout : root)
+  JsonEntryReader::load(TURNOUTS_JSON_FILE, nullptr, [&](json &turnout)
   {
     uint16_t address = turnout[JSON_ADDRESS_NODE].get<int>();
     uint16_t id = address;
@@ -60,7 +60,7 @@ TurnoutManager::TurnoutManager(openlcb::Node *node, Service *service)
     bool state = turnout[JSON_STATE_NODE].get<int>();
     TurnoutType type = (TurnoutType)turnout[JSON_TYPE_NODE].get<int>();
     turnouts_.push_back(std::make_unique<Turnout>(address, id, state, type));
-  }
+  });
   LOG(INFO, "[Turnout] Loaded %d DCC turnout(s)", turnouts_.size());
 }
 
@@ -72,6 +72,7 @@ void TurnoutManager::clear()
     turnout.reset(nullptr);
   }
   turnouts_.clear();
+  changes_.reset();
   dirty_ = true;
 }
 
@@ -129,12 +130,79 @@ string TurnoutManager::toggle(uint16_t address)
                     , turnouts_.back().get()->isThrown());
 }
 
+void TurnoutManager::set_batch(const std::vector<TurnoutUpdate> &updates
+                             , std::function<void(Turnout *)> callback)
+{
+  OSMutexLock h(&mux_);
+  for (auto &update : updates)
+  {
+    Turnout *turnout = nullptr;
+    uint16_t address = update.address;
+    auto const &elem = FIND_TURNOUT(address);
+    if (elem != turnouts_.end())
+    {
+      turnout = elem->get();
+    }
+    else
+    {
+      turnouts_.push_back(std::make_unique<Turnout>(address, address));
+      turnout = turnouts_.back().get();
+    }
+    // the packet is sent via the shared queue rather than registering each
+    // turnout as a refresh source.
+    turnout->set(update.toggle ? !turnout->isThrown() : update.thrown, false);
+    packetQueue_.add(turnout->getAddress(), turnout->isThrown());
+    callback(turnout);
+  }
+  // the batch is persisted in a single pass by the persistence flow.
+  dirty_ = true;
+}
+
 string TurnoutManager::getStateAsJson(bool readable)
 {
   OSMutexLock h(&mux_);
   return get_state_as_json(readable);
 }
 
+bool TurnoutManager::append_json(size_t index, string &json, bool readable)
+{
+  OSMutexLock h(&mux_);
+  if (index < turnouts_.size())
+  {
+    JsonWriter writer(json);
+    turnouts_[index]->writeJson(writer, readable);
+    return true;
+  }
+  return false;
+}
+
+string TurnoutManager::get_changes_as_json(uint32_t since, bool readable)
+{
+  OSMutexLock h(&mux_);
+  string content;
+  JsonWriter writer(content);
+  changes_.write_json(writer, since
+  , [&](JsonWriter &writer, uint32_t address)
+    {
+      auto const &elem = FIND_TURNOUT(address);
+      if (elem != turnouts_.end())
+      {
+        elem->get()->writeJson(writer, readable);
+        return true;
+      }
+      return false;
+    }
+  , [&](JsonWriter &writer)
+    {
+      for (const auto& turnout : turnouts_)
+      {
+        turnout->writeJson(writer, readable);
+      }
+    }
+  );
+  return content;
+}
+
 string TurnoutManager::get_state_for_dccpp()
 {
   OSMutexLock h(&mux_);
@@ -164,7 +232,12 @@ Turnout *TurnoutManager::createOrUpdate(const uint16_t address
     auto const &elem = FIND_TURNOUT_BY_ID(id);
     if (elem != turnouts_.end())
     {
+      if (elem->get()->getAddress() != address)
+      {
+        changes_.removed(elem->get()->getAddress());
+      }
       elem->get()->update(address, type, id);
+      changes_.changed(address);
       dirty_ = true;
       return elem->get();
     }
@@ -175,6 +248,7 @@ Turnout *TurnoutManager::createOrUpdate(const uint16_t address
     if (elem != turnouts_.end())
     {
       elem->get()->update(address, type);
+      changes_.changed(address);
       dirty_ = true;
       return elem->get();
     }
@@ -184,6 +258,7 @@ Turnout *TurnoutManager::createOrUpdate(const uint16_t address
     std::make_unique<Turnout>(address, id, false
                             , type != TurnoutType::NO_CHANGE ? type
                                                              : TurnoutType::LEFT));
+  changes_.changed(address);
   dirty_ = true;
   return turnouts_.back().get();
 }
@@ -196,6 +271,7 @@ bool TurnoutManager::remove(const uint16_t address)
   {
     LOG(CONFIG_TURNOUT_LOG_LEVEL, "[Turnout %d] Deleted", address);
     turnouts_.erase(elem);
+    changes_.removed(address);
     dirty_ = true;
     return true;
   }
@@ -271,20 +347,42 @@ void TurnoutManager::send(Buffer<dcc::Packet> *b, unsigned prio)
   b->unref();
 }
 
+void TurnoutManager::for_each(std::function<void(Turnout *)> callback)
+{
+  OSMutexLock h(&mux_);
+  for (auto &turnout : turnouts_)
+  {
+    callback(turnout.get());
+  }
+}
+
+void TurnoutManager::register_state_listener(TurnoutStateListener listener)
+{
+  OSMutexLock h(&mux_);
+  listeners_.push_back(std::move(listener));
+}
+
+void TurnoutManager::notify_state_listeners(Turnout *turnout)
+{
+  changes_.changed(turnout->getAddress());
+  // NOTE: listeners are only registered during startup so it is safe to walk
+  // the list without holding the lock.
+  for (auto &listener : listeners_)
+  {
+    listener(turnout->getAddress(), turnout->isThrown());
+  }
+}
+
 string TurnoutManager::get_state_as_json(bool readableStrings)
 {
-  string content = "[";
+  string content;
+  JsonWriter writer(content);
+  writer.start_array();
   for (const auto& turnout : turnouts_)
   {
-    // only add the seperator if we have already serialized at least one
-    // turnout.
-    if (content.length() > 1)
-    {
-      content += ",";
-    }
-    content += turnout->toJson(readableStrings);
+    turnout->writeJson(writer, readableStrings);
   }
-  content += "]";
+  writer.end_array();
   return content;
 }
 
@@ -346,20 +444,28 @@ void Turnout::update(uint16_t address, TurnoutType type, int16_t id)
 
 string Turnout::toJson(bool readableStrings)
 {
-  string serialized = StringPrintf("{\"%s\":%d,\"%s\":%d,\"%s\":%d,\"%s\":"
-  , JSON_ADDRESS_NODE, _address, JSON_ID_NODE, _id, JSON_TYPE_NODE, _type
-  , JSON_STATE_NODE);
+  string serialized;
+  JsonWriter writer(serialized);
+  writeJson(writer, readableStrings);
+  return serialized;
+}
+
+void Turnout::writeJson(JsonWriter &writer, bool readableStrings)
+{
+  writer.start_object()
+        .field(JSON_ADDRESS_NODE, _address)
+        .field(JSON_ID_NODE, _id)
+        .field(JSON_TYPE_NODE, (int)_type)
+        .key(JSON_STATE_NODE);
   if (readableStrings)
   {
-    serialized += StringPrintf("\"%s\"", _thrown ? JSON_VALUE_THROWN
-                                                 : JSON_VALUE_CLOSED);
+    writer.value(_thrown ? JSON_VALUE_THROWN : JSON_VALUE_CLOSED);
   }
   else
   {
-    serialized += integer_to_string(_thrown);
+    writer.value((int)_thrown);
   }
-  serialized += "}";
-  return serialized;
+  writer.end_object();
 }
 
 void Turnout::set(bool thrown, bool sendDCCPacket)
@@ -371,6 +477,10 @@ void Turnout::set(bool thrown, bool sendDCCPacket)
   }
   LOG(CONFIG_TURNOUT_LOG_LEVEL, "[Turnout %d (%d)] Set to %s", _id, _address
     , _thrown ? JSON_VALUE_THROWN : JSON_VALUE_CLOSED);
+  if (Singleton<TurnoutManager>::exists())
+  {
+    Singleton<TurnoutManager>::instance()->notify_state_listeners(this);
+  }
 }
 
 void Turnout::get_next_packet(unsigned code, dcc::Packet* packet)
@@ -387,4 +497,75 @@ void Turnout::get_next_packet(unsigned code, dcc::Packet* packet)
 
   // remove ourselves as turnouts are single fire sources
   packet_processor_remove_refresh_source(this);
-}
\ No newline at end of file
+}
+
+void AccessoryPacketQueue::add(uint16_t address, bool thrown)
+{
+  // shift address by one to account for the output pair state bit (thrown).
+  // decrement the address prior to shift to bring it into the 0-2047 range.
+  uint16_t addr = (((address - 1) << 1) | thrown);
+  bool needs_registration = false;
+  {
+    OSMutexLock h(&mux_);
+    auto elem = std::find_if(pending_.begin(), pending_.end(),
+      [addr](uint16_t queued)
+      {
+        return (queued >> 1) == (addr >> 1);
+      });
+    if (elem != pending_.end())
+    {
+      // only the most recent state for an accessory needs to be sent.
+      *elem = addr;
+    }
+    else
+    {
+      pending_.push_back(addr);
+    }
+    needs_registration = !registered_;
+    registered_ = true;
+  }
+  if (needs_registration)
+  {
+    packet_processor_add_refresh_source(this);
+  }
+}
+
+void AccessoryPacketQueue::get_next_packet(unsigned code, dcc::Packet* packet)
+{
+  bool drained = false;
+  {
+    OSMutexLock h(&mux_);
+    if (pending_.empty())
+    {
+      packet->set_dcc_idle();
+    }
+    else
+    {
+      // always send activate as true (sets C to 1)
+      packet->add_dcc_basic_accessory(pending_.front(), true);
+      pending_.pop_front();
+      LOG(CONFIG_TURNOUT_LOG_LEVEL, "[Turnout] Queued packet: %s (%zu pending)"
+        , packet_to_string(*packet, true).c_str(), pending_.size());
+    }
+    drained = pending_.empty();
+  }
+  if (!drained)
+  {
+    return;
+  }
+  // remove ourselves until more packets are queued. registered_ stays set
+  // until the removal completes so that add() does not register us again
+  // only to have this removal undo it.
+  packet_processor_remove_refresh_source(this);
+  bool needs_registration = false;
+  {
+    OSMutexLock h(&mux_);
+    // packets queued while we were being removed need us registered again.
+    needs_registration = !pending_.empty();
+    registered_ = needs_registration;
+  }
+  if (needs_registration)
+  {
+    packet_processor_add_refresh_source(this);
+  }
+}
@@ -19,10 +19,14 @@ COPYRIGHT (c) 2017-2019 Mike Dunston
 #define TURNOUTS_H_
 
 #include <AutoPersistCallbackFlow.h>
+#include <ChangeLog.h>
 #include <dcc/PacketFlowInterface.hxx>
 #include <dcc/PacketSource.hxx>
 #include <DCCppProtocol.h>
 #include <openlcb/DccAccyConsumer.hxx>
+#include <deque>
+#include <functional>
+#include <os/OS.hxx>
 #include <utils/Singleton.hxx>
 
 enum TurnoutType
@@ -35,6 +39,8 @@ enum TurnoutType
   MAX_TURNOUT_TYPES // NOTE: this must be the last entry in the enum.
 };
 
+class JsonWriter;
+
 void encodeDCCAccessoryAddress(uint16_t *board, int8_t *port, uint16_t address);
 uint16_t decodeDCCAccessoryAddress(uint16_t board, int8_t port);
 
@@ -47,6 +53,7 @@ public:
   void update(uint16_t address, TurnoutType type, int16_t id = -1);
   void set(bool thrown = false, bool sendDCCPacket = true);
   std::string toJson(bool readableStrings = false);
+  void writeJson(JsonWriter &writer, bool readableStrings = false);
   uint16_t getAddress()
   {
     return _address;
@@ -79,6 +86,56 @@ private:
   TurnoutType _type;
 };
 
+/// Callback used to notify interested parties of a turnout state change. The
+/// first parameter is the turnout address, the second is true when thrown.
+///
+/// NOTE: this will be called from the context which modified the turnout and
+/// may be called with the TurnoutManager lock held, implementations should
+/// not call back into the TurnoutManager.
+typedef std::function<void(uint16_t, bool)> TurnoutStateListener;
+
+/// Single requested change for @ref TurnoutManager::set_batch.
+struct TurnoutUpdate
+{
+  /// DCC address of the turnout, the turnout will be created if needed.
+  uint16_t address;
+
+  /// Requested state of the turnout, ignored when @ref toggle is true.
+  bool thrown;
+
+  /// When true the turnout will be set to the opposite of the current state.
+  bool toggle;
+};
+
+/// Packet source which sends one DCC accessory packet per refresh slot for
+/// each queued accessory state.
+///
+/// This is used for bulk turnout updates so that only a single refresh source
+/// is registered for the duration of the batch. The packets are paced by the
+/// update loop along with all other refresh sources.
+class AccessoryPacketQueue : public dcc::NonTrainPacketSource
+{
+public:
+  /// Queues a DCC accessory packet.
+  ///
+  /// @param address is the user visible DCC accessory address.
+  /// @param thrown is the state to send, if the address is already queued
+  /// the queued state will be replaced.
+  void add(uint16_t address, bool thrown);
+
+  void get_next_packet(unsigned code, dcc::Packet* packet) override;
+private:
+  /// Pending accessory states encoded as the on-the-wire address with the
+  /// output pair state bit.
+  std::deque<uint16_t> pending_;
+
+  /// Set to true while this source is registered with the update loop.
+  bool registered_{false};
+
+  /// Lock protecting @ref pending_ and @ref registered_.
+  OSMutex mux_;
+};
+
 class TurnoutManager : public dcc::PacketFlowInterface
                      , public Singleton<TurnoutManager>
 {
@@ -91,7 +148,11 @@ public:
   void clear();
   std::string set(uint16_t, bool=false, bool=true);
   std::string toggle(uint16_t);
+  void set_batch(const std::vector<TurnoutUpdate> &
+               , std::function<void(Turnout *)>);
   std::string getStateAsJson(bool=true);
+  bool append_json(size_t, std::string &, bool=true);
+  std::string get_changes_as_json(uint32_t, bool=true);
   std::string get_state_for_dccpp();
   Turnout *createOrUpdate(const uint16_t address
                         , const TurnoutType = TurnoutType::LEFT
@@ -101,10 +162,16 @@ public:
   Turnout *get(const uint16_t);
   uint16_t count();
   void send(Buffer<dcc::Packet> *, unsigned);
+  void for_each(std::function<void(Turnout *)>);
+  void register_state_listener(TurnoutStateListener);
+  void notify_state_listeners(Turnout *);
 private:
   std::string get_state_as_json(bool);
   void persist();
   std::vector<std::unique_ptr<Turnout>> turnouts_;
+  std::vector<TurnoutStateListener> listeners_;
+  ChangeLog changes_;
+  AccessoryPacketQueue packetQueue_;
   openlcb::DccAccyConsumer turnoutEventConsumer_;
   AutoPersistFlow persistFlow_;
   bool dirty_;
@@ -557,8 +557,14 @@ DCC_PROTOCOL_COMMAND_HANDLER(TurnoutExCommandAdapter,
     {
       return Singleton<TurnoutManager>::instance()->toggle(addr);
     }
-    TurnoutType type = (TurnoutType)std::stoi(arguments[1]);
-    if (Singleton<TurnoutManager>::instance()->createOrUpdate(addr, type))
+    int type = std::stoi(arguments[1]);
+    if (type < TurnoutType::LEFT || type >= TurnoutType::MAX_TURNOUT_TYPES)
+    {
+      LOG_ERROR("[DCC++ Turnout] Type %d is out of range, rejecting", type);
+      return COMMAND_FAILED_RESPONSE;
+    }
+    auto turnouts = Singleton<TurnoutManager>::instance();
+    if (turnouts->createOrUpdate(addr, (TurnoutType)type))
     {
       return COMMAND_SUCCESSFUL_RESPONSE;
     }
@@ -566,6 +572,48 @@ DCC_PROTOCOL_COMMAND_HANDLER(TurnoutExCommandAdapter,
   return COMMAND_FAILED_RESPONSE;
 })
 
+/*
+  <TB ADDRESS STATE [ADDRESS STATE ...]>: Sets multiple turnouts at once.
+      returns: <H ID THROW> for each turnout or <X> if any ADDRESS or STATE is
+               invalid, in which case no turnouts are changed.
+
+Note: Turnouts which do not exist will be created. The DCC packets for all
+turnouts are sent in sequence and the turnouts will be persisted once.
+where
+  ADDRESS:    the DCC decoder address for the turnout (1-2044)
+  STATE:      0 (unthrown), 1 (thrown) or 2 (toggle)
+*/
+DECLARE_DCC_PROTOCOL_COMMAND_CLASS(TurnoutBatchCommandAdapter, "TB", 2)
+DCC_PROTOCOL_COMMAND_HANDLER(TurnoutBatchCommandAdapter,
+[](const vector<string> arguments)
+{
+  if (arguments.size() % 2)
+  {
+    return COMMAND_FAILED_RESPONSE;
+  }
+  vector<TurnoutUpdate> updates;
+  for (size_t index = 0; index < arguments.size(); index += 2)
+  {
+    int addr = std::stoi(arguments[index]);
+    int state = std::stoi(arguments[index + 1]);
+    if (addr < 1 || addr > 2044 || state < 0 || state > 2)
+    {
+      LOG_ERROR("[DCC++ TB] Rejecting invalid address(%d), state(%d)", addr
+              , state);
+      return COMMAND_FAILED_RESPONSE;
+    }
+    updates.push_back({(uint16_t)addr, state == 1, state == 2});
+  }
+  string status;
+  Singleton<TurnoutManager>::instance()->set_batch(updates,
+  [&status](Turnout *turnout)
+  {
+    status += StringPrintf("<H %d %d>", turnout->getID()
+                         , turnout->isThrown());
+  });
+  return status;
+})
+
 /*
  <a BOARD INDEX THROW>: Throws a turnout (accessory decoder)
       returns: <H ID THROW>
@@ -714,6 +762,7 @@ void DCCPPProtocolHandler::init()
 #endif
   registerCommand(new TurnoutCommandAdapter());
   registerCommand(new TurnoutExCommandAdapter());
+  registerCommand(new TurnoutBatchCommandAdapter());
 #if defined(CONFIG_GPIO_SENSORS)
   registerCommand(new SensorCommandAdapter());
 #if defined(CONFIG_GPIO_S88)
@@ -725,14 +774,41 @@ void DCCPPProtocolHandler::init()
   registerCommand(new EStopCommand());
 }
 
+// Validates that a command argument is a decimal integer which can be safely
+// converted via std::stoi. C++ exceptions are disabled so any std::stoi
+// failure would otherwise abort the Command Station.
+static bool is_valid_argument(const string &arg)
+{
+  // nine digits (plus optional sign) will always fit into an int.
+  static constexpr size_t MAX_ARGUMENT_DIGITS = 9;
+  size_t start = (!arg.empty() && (arg[0] == '-' || arg[0] == '+')) ? 1 : 0;
+  if (arg.length() == start || arg.length() - start > MAX_ARGUMENT_DIGITS)
+  {
+    return false;
+  }
+  return std::all_of(arg.begin() + start, arg.end()
+                   , [](char ch) { return ch >= '0' && ch <= '9'; });
+}
+
 string DCCPPProtocolHandler::process(const string &commandString)
 {
   vector<string> parts;
-  http::tokenize(commandString, parts);
+  http::tokenize(commandString, parts, " ", true, true);
+  if (parts.empty())
+  {
+    LOG_ERROR("Discarding empty command");
+    return COMMAND_FAILED_RESPONSE;
+  }
   string commandID = parts.front();
   parts.erase(parts.begin());
   LOG(VERBOSE, "Command: %s, argument count: %d", commandID.c_str()
     , parts.size());
+  if (!std::all_of(parts.begin(), parts.end(), is_valid_argument))
+  {
+    LOG_ERROR("Rejecting [%s] due to non-numeric or out of range argument(s)"
+            , commandID.c_str());
+    return COMMAND_FAILED_RESPONSE;
+  }
   auto command = std::find_if(commands.begin(), commands.end()
   , [commandID](const auto &cmd)
     {
@@ -775,7 +851,7 @@ void DCCPPProtocolHandler::registerCommand(DCCPPProtocolCommand *cmd)
 
 DCCPPProtocolConsumer::DCCPPProtocolConsumer()
 {
-  _buffer.resize(256);
+  _buffer.reserve(MAX_COMMAND_LENGTH);
 }
 
 std::string DCCPPProtocolConsumer::feed(uint8_t *data, size_t len)
@@ -808,7 +884,14 @@ string DCCPPProtocolConsumer::processData()
     }
     s = e;
   }
-  // drop everything we used from the buffer.
-  _buffer.erase(_buffer.begin(), consumed);
+  // drop everything we used from the buffer along with any data preceding
+  // the start of the next (incomplete) command.
+  _buffer.erase(_buffer.begin(), std::find(consumed, _buffer.end(), '<'));
+  if (_buffer.size() > MAX_COMMAND_LENGTH)
+  {
+    LOG_ERROR("Discarding %zu bytes of unterminated command data"
+            , _buffer.size());
+    _buffer.clear();
+  }
   return response;
 }
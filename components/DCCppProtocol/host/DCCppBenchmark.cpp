@@ -0,0 +1,303 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Throughput benchmark for the DCC++ protocol layer.
+//
+// Replays scripted JMRI traffic through DCCPPProtocolConsumer::feed and
+// reports the number of commands processed per second along with the number
+// of heap allocations (and bytes) per command. The traffic scripts are:
+//
+//   heartbeat  : <s> status and <c> current polls as sent by JMRI.
+//   throttle   : speed ramps and function changes for several throttles.
+//   turnouts   : turnout storms via <T>, <a> and <TB> commands.
+//   mixed      : all of the above, interleaved.
+//   fragmented : the mixed script delivered in small random sized reads.
+//
+// Usage: dccpp_bench [--iterations N] [scenario...]
+
+#include "MockBackends.h"
+
+#include <algorithm>
+#include <chrono>
+#include <DCCppProtocol.h>
+#include <functional>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utils/StringPrintf.hxx>
+#include <vector>
+
+using std::string;
+
+/// Number of heap allocations made via operator new.
+static size_t alloc_count = 0;
+
+/// Number of bytes requested via operator new.
+static size_t alloc_bytes = 0;
+
+void *operator new(size_t size)
+{
+  alloc_count++;
+  alloc_bytes += size;
+  void *ptr = malloc(size ? size : 1);
+  if (!ptr)
+  {
+    // exceptions are disabled, the same as on the ESP32.
+    abort();
+  }
+  return ptr;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  alloc_count++;
+  alloc_bytes += size;
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+  return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+  free(ptr);
+}
+
+/// JMRI polls the command station status on connect and the track current
+/// periodically while connected.
+static string heartbeat_script()
+{
+  string script = "<s>";
+  for (int poll = 0; poll < 20; poll++)
+  {
+    script += "<c>";
+  }
+  return script;
+}
+
+/// Four throttles ramping their locomotives up and back down with the odd
+/// direction and function change, as happens when dragging a speed slider.
+static string throttle_script()
+{
+  static constexpr int LOCOS[] = {3, 44, 1234, 9983};
+  string script;
+  for (int speed = 0; speed <= 126; speed += 3)
+  {
+    for (size_t reg = 0; reg < 4; reg++)
+    {
+      script += StringPrintf("<t %zu %d %d 1>", reg + 1, LOCOS[reg], speed);
+    }
+  }
+  for (size_t reg = 0; reg < 4; reg++)
+  {
+    script += StringPrintf("<f %d 144>", LOCOS[reg]);
+    script += StringPrintf("<f %d 222 5>", LOCOS[reg]);
+    script += StringPrintf("<tex %d -1 0>", LOCOS[reg]);
+  }
+  for (int speed = 126; speed >= 0; speed -= 3)
+  {
+    for (size_t reg = 0; reg < 4; reg++)
+    {
+      script += StringPrintf("<t %zu %d %d 0>", reg + 1, LOCOS[reg], speed);
+    }
+  }
+  return script;
+}
+
+/// Route setting from a JMRI panel, a yard ladder of turnouts thrown and
+/// closed in sequence followed by batch updates and a turnout listing.
+static string turnout_script()
+{
+  string script;
+  for (int id = 1; id <= 32; id++)
+  {
+    script += StringPrintf("<T %d %d %d>", id, (id - 1) / 4, (id - 1) % 4);
+  }
+  for (int state = 1; state >= 0; state--)
+  {
+    for (int id = 1; id <= 32; id++)
+    {
+      script += StringPrintf("<T %d %d>", id, state);
+    }
+  }
+  for (int board = 0; board < 8; board++)
+  {
+    for (int port = 0; port < 4; port++)
+    {
+      script += StringPrintf("<a %d %d 1>", board, port);
+    }
+  }
+  script += "<TB 1 1 2 1 3 1 4 1 5 0 6 0 7 0 8 0>";
+  script += "<TB 9 2 10 2 11 2 12 2>";
+  script += "<T>";
+  return script;
+}
+
+static string mixed_script()
+{
+  string script = heartbeat_script();
+  string throttle = throttle_script();
+  string turnouts = turnout_script();
+  // interleave the throttle and turnout traffic a command at a time.
+  size_t throttle_pos = 0;
+  size_t turnout_pos = 0;
+  while (throttle_pos < throttle.size() || turnout_pos < turnouts.size())
+  {
+    for (auto src : {std::make_pair(&throttle, &throttle_pos)
+                   , std::make_pair(&turnouts, &turnout_pos)})
+    {
+      if (*src.second < src.first->size())
+      {
+        size_t end = src.first->find('>', *src.second) + 1;
+        script.append(*src.first, *src.second, end - *src.second);
+        *src.second = end;
+      }
+    }
+  }
+  script += "<s>";
+  return script;
+}
+
+struct Scenario
+{
+  const char *name;
+  std::function<string()> script;
+  /// Maximum number of bytes passed to a single feed() call, zero for random
+  /// sized reads of 1-16 bytes.
+  size_t read_size;
+};
+
+static void run(const Scenario &scenario, size_t iterations)
+{
+  string script = scenario.script();
+  size_t commands = std::count(script.begin(), script.end(), '<');
+  std::vector<uint8_t> data(script.begin(), script.end());
+  std::vector<size_t> reads;
+  srand(1);
+  for (size_t offs = 0; offs < data.size();)
+  {
+    size_t len = scenario.read_size ? scenario.read_size : (rand() % 16) + 1;
+    len = std::min(len, data.size() - offs);
+    reads.push_back(len);
+    offs += len;
+  }
+
+  mock_backends_reset();
+  DCCPPProtocolConsumer consumer;
+  size_t response_bytes = 0;
+  auto replay = [&]()
+  {
+    size_t offs = 0;
+    for (size_t len : reads)
+    {
+      response_bytes += consumer.feed(data.data() + offs, len).size();
+      offs += len;
+    }
+  };
+  // the first pass creates the trains and turnouts, only the steady state is
+  // measured.
+  replay();
+  response_bytes = 0;
+  alloc_count = 0;
+  alloc_bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t iteration = 0; iteration < iterations; iteration++)
+  {
+    replay();
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  size_t total = commands * iterations;
+  printf("%-12s %10zu %14.0f %12.2f %12.1f %12.1f\n", scenario.name, total
+       , total / elapsed.count(), (double)alloc_count / total
+       , (double)alloc_bytes / total, (double)response_bytes / total);
+}
+
+int main(int argc, char **argv)
+{
+  static const Scenario SCENARIOS[] =
+  {
+    {"heartbeat", heartbeat_script, 1460},
+    {"throttle", throttle_script, 1460},
+    {"turnouts", turnout_script, 1460},
+    {"mixed", mixed_script, 1460},
+    {"fragmented", mixed_script, 0},
+  };
+  size_t iterations = 200;
+  std::vector<string> selected;
+  for (int idx = 1; idx < argc; idx++)
+  {
+    if (!strcmp(argv[idx], "--iterations") && idx + 1 < argc)
+    {
+      iterations = strtoul(argv[++idx], nullptr, 10);
+    }
+    else
+    {
+      selected.push_back(argv[idx]);
+    }
+  }
+  if (!iterations)
+  {
+    fprintf(stderr, "Usage: %s [--iterations N] [scenario...]\n", argv[0]);
+    return 1;
+  }
+
+  mock_backends_init();
+  printf("%-12s %10s %14s %12s %12s %12s\n", "scenario", "commands"
+       , "commands/sec", "allocs/cmd", "bytes/cmd", "resp/cmd");
+  size_t ran = 0;
+  for (const auto &scenario : SCENARIOS)
+  {
+    if (selected.empty() ||
+        std::find(selected.begin(), selected.end(), scenario.name) !=
+          selected.end())
+    {
+      run(scenario, iterations);
+      ran++;
+    }
+  }
+  if (!ran)
+  {
+    fprintf(stderr, "No matching scenario\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// libFuzzer harness for DCCPPProtocolConsumer::feed.
+//
+// Each input is split into chunks which are fed to a fresh consumer, this
+// exercises both the command parsing and the reassembly of commands which
+// are split across socket reads. The first input byte selects the chunk size
+// so the fuzzer controls where the splits happen.
+
+#include "MockBackends.h"
+
+#include <algorithm>
+#include <DCCppProtocol.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  mock_backends_init();
+  if (size == 0)
+  {
+    return 0;
+  }
+  size_t chunk_size = (data[0] % 64) + 1;
+  // feed() takes a mutable buffer, copy the input so the fuzzer's data is
+  // never modified.
+  std::vector<uint8_t> input(data + 1, data + size);
+  DCCPPProtocolConsumer consumer;
+  for (size_t offs = 0; offs < input.size(); offs += chunk_size)
+  {
+    size_t len = std::min(chunk_size, input.size() - offs);
+    consumer.feed(input.data() + offs, len);
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Replays fuzzer inputs through LLVMFuzzerTestOneInput when the compiler does
+// not provide libFuzzer (GCC), this allows the corpus and any crash inputs to
+// be checked under the sanitizers.
+//
+// Usage: dccpp_fuzz_replay <file or directory>...
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static size_t replay(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+  {
+    fprintf(stderr, "Unable to access %s\n", path.c_str());
+    return 0;
+  }
+  if (S_ISDIR(st.st_mode))
+  {
+    size_t count = 0;
+    DIR *dir = opendir(path.c_str());
+    while (struct dirent *ent = readdir(dir))
+    {
+      if (ent->d_name[0] != '.')
+      {
+        count += replay(path + "/" + ent->d_name);
+      }
+    }
+    closedir(dir);
+    return count;
+  }
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+  {
+    fprintf(stderr, "Unable to open %s\n", path.c_str());
+    return 0;
+  }
+  std::vector<uint8_t> data(st.st_size);
+  size_t len = fread(data.data(), 1, data.size(), f);
+  fclose(f);
+  LLVMFuzzerTestOneInput(data.data(), len);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  size_t count = 0;
+  for (int idx = 1; idx < argc; idx++)
+  {
+    count += replay(argv[idx]);
+  }
+  printf("Replayed %zu input(s)\n", count);
+  return count ? 0 : 1;
+}
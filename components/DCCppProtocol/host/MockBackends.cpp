@@ -0,0 +1,549 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "MockBackends.h"
+
+#include <AllTrainNodes.hxx>
+#include <algorithm>
+#include <array>
+#include <DCCppProtocol.h>
+#include <DCCProgrammer.h>
+#include <DCCSignalVFS.h>
+#include <esp_ota_ops.h>
+#include <esp_wifi.h>
+#include <map>
+#include <RemoteSensors.h>
+#include <Sensors.h>
+#include <stdlib.h>
+#include <Turnouts.h>
+#include <utils/logging.h>
+#include <utils/StringPrintf.hxx>
+
+using commandstation::AllTrainNodes;
+using commandstation::DccMode;
+using commandstation::MockTrain;
+using std::string;
+using std::vector;
+
+/// Number of DCC packets generated since the last reset.
+static size_t packet_count = 0;
+
+/// Current track power state.
+static bool track_power = false;
+
+/// Values of the CVs on the programming track, these start out as zero.
+static std::array<uint8_t, 1024> cv_values;
+
+/// Sensor ID to (pin, pull-up) for GPIO sensors.
+static std::map<uint16_t, std::pair<int, bool>> sensors;
+
+/// Sensor ID to value for remote sensors.
+static std::map<uint16_t, uint16_t> remote_sensors;
+
+void mock_backends_init()
+{
+  static bool initialized = false;
+  if (!initialized)
+  {
+    new AllTrainNodes();
+    new TurnoutManager();
+    DCCPPProtocolHandler::init();
+    initialized = true;
+  }
+  mock_backends_reset();
+}
+
+void mock_backends_reset()
+{
+  Singleton<AllTrainNodes>::instance()->clear();
+  Singleton<TurnoutManager>::instance()->clear();
+  sensors.clear();
+  remote_sensors.clear();
+  cv_values.fill(0);
+  packet_count = 0;
+  track_power = false;
+}
+
+size_t mock_backends_packet_count()
+{
+  return packet_count;
+}
+
+/// Discards log output unless DCCPP_HOST_LOG is set in the environment so
+/// the formatting cost is still paid as it would be on the ESP32.
+void log_output(char *buf, int size)
+{
+  static bool enabled = getenv("DCCPP_HOST_LOG") != nullptr;
+  if (enabled && size > 0)
+  {
+    fwrite(buf, size, 1, stderr);
+    fwrite("\n", 1, 1, stderr);
+  }
+}
+
+namespace commandstation
+{
+
+openlcb::TrainImpl *AllTrainNodes::get_train_impl(openlcb::NodeID id
+                                                , bool allocate)
+{
+  // node IDs are assigned as the index of the train plus one.
+  if (id && id <= trains_.size())
+  {
+    return trains_[id - 1].get();
+  }
+  return nullptr;
+}
+
+openlcb::TrainImpl *AllTrainNodes::get_train_impl(DccMode drive_type
+                                                , int address)
+{
+  auto it = std::find_if(trains_.begin(), trains_.end()
+  , [address](const std::unique_ptr<MockTrain> &train)
+    {
+      return train->legacy_address() == (uint32_t)address;
+    });
+  if (it != trains_.end())
+  {
+    return it->get();
+  }
+  trains_.emplace_back(new MockTrain(address));
+  return trains_.back().get();
+}
+
+openlcb::NodeID AllTrainNodes::get_train_node_id_ext(size_t id, bool allocate)
+{
+  return id < trains_.size() ? id + 1 : 0;
+}
+
+size_t AllTrainNodes::size()
+{
+  return trains_.size();
+}
+
+void AllTrainNodes::clear()
+{
+  trains_.clear();
+}
+
+} // namespace commandstation
+
+void encodeDCCAccessoryAddress(uint16_t *board, int8_t *port
+                             , uint16_t address)
+{
+  *board = ((address - 1) / 4);
+  *port = (address - 1) % 4;
+}
+
+uint16_t decodeDCCAccessoryAddress(uint16_t board, int8_t port)
+{
+  uint32_t addr = (board << 2) + (port + 1);
+  return (uint16_t)(addr & 0xFFFF);
+}
+
+Turnout::Turnout(uint16_t address, int16_t id, bool thrown, TurnoutType type)
+               : _address(address), _id(id > 0 ? id : address), _thrown(thrown)
+               , _type(type)
+{
+}
+
+void Turnout::update(uint16_t address, TurnoutType type, int16_t id)
+{
+  _address = address;
+  if (type != TurnoutType::NO_CHANGE)
+  {
+    _type = type;
+  }
+  _id = (id != -1) ? id : address;
+}
+
+void Turnout::set(bool thrown, bool sendDCCPacket)
+{
+  _thrown = thrown;
+  if (sendDCCPacket)
+  {
+    packet_count++;
+  }
+}
+
+#define FIND_TURNOUT(addr)                                      \
+  std::find_if(turnouts_.begin(), turnouts_.end(),              \
+    [addr](const std::unique_ptr<Turnout> &turnout) -> bool     \
+    {                                                           \
+      return (turnout->getAddress() == addr);                   \
+    }                                                           \
+  )
+
+#define FIND_TURNOUT_BY_ID(id)                                  \
+  std::find_if(turnouts_.begin(), turnouts_.end(),              \
+    [id](const std::unique_ptr<Turnout> &turnout) -> bool       \
+    {                                                           \
+      return (turnout->getID() == id);                          \
+    }                                                           \
+  )
+
+void TurnoutManager::clear()
+{
+  turnouts_.clear();
+}
+
+string TurnoutManager::set(uint16_t address, bool thrown, bool sendDCC)
+{
+  auto const &elem = FIND_TURNOUT(address);
+  if (elem != turnouts_.end())
+  {
+    elem->get()->set(thrown, sendDCC);
+    return StringPrintf("<H %d %d>", elem->get()->getID()
+                      , elem->get()->isThrown());
+  }
+  turnouts_.push_back(std::make_unique<Turnout>(address, address));
+  turnouts_.back().get()->set(thrown, sendDCC);
+  return StringPrintf("<H %d %d>", turnouts_.back().get()->getID()
+                    , turnouts_.back().get()->isThrown());
+}
+
+string TurnoutManager::toggle(uint16_t address)
+{
+  auto const &elem = FIND_TURNOUT(address);
+  if (elem != turnouts_.end())
+  {
+    elem->get()->toggle();
+    return StringPrintf("<H %d %d>", elem->get()->getID()
+                      , elem->get()->isThrown());
+  }
+  turnouts_.push_back(std::make_unique<Turnout>(address, address));
+  turnouts_.back().get()->toggle();
+  return StringPrintf("<H %d %d>", turnouts_.back().get()->getID()
+                    , turnouts_.back().get()->isThrown());
+}
+
+void TurnoutManager::set_batch(const vector<TurnoutUpdate> &updates
+                             , std::function<void(Turnout *)> callback)
+{
+  for (auto &update : updates)
+  {
+    Turnout *turnout = nullptr;
+    uint16_t address = update.address;
+    auto const &elem = FIND_TURNOUT(address);
+    if (elem != turnouts_.end())
+    {
+      turnout = elem->get();
+    }
+    else
+    {
+      turnouts_.push_back(std::make_unique<Turnout>(address, address));
+      turnout = turnouts_.back().get();
+    }
+    turnout->set(update.toggle ? !turnout->isThrown() : update.thrown, false);
+    packet_count++;
+    callback(turnout);
+  }
+}
+
+string TurnoutManager::get_state_for_dccpp()
+{
+  if (turnouts_.empty())
+  {
+    return COMMAND_FAILED_RESPONSE;
+  }
+  string status;
+  for (auto& turnout : turnouts_)
+  {
+    uint16_t board;
+    int8_t port;
+    encodeDCCAccessoryAddress(&board, &port, turnout->getAddress());
+    status += StringPrintf("<H %d %d %d %d>", turnout->getID(), board, port
+                         , turnout->isThrown());
+  }
+  return status;
+}
+
+Turnout *TurnoutManager::createOrUpdate(const uint16_t address
+                                      , const TurnoutType type
+                                      , const int16_t id)
+{
+  if (id != -1)
+  {
+    auto const &elem = FIND_TURNOUT_BY_ID(id);
+    if (elem != turnouts_.end())
+    {
+      elem->get()->update(address, type, id);
+      return elem->get();
+    }
+  }
+  else
+  {
+    auto const &elem = FIND_TURNOUT(address);
+    if (elem != turnouts_.end())
+    {
+      elem->get()->update(address, type);
+      return elem->get();
+    }
+  }
+  turnouts_.push_back(
+    std::make_unique<Turnout>(address, id, false
+                            , type != TurnoutType::NO_CHANGE ? type
+                                                             : TurnoutType::LEFT));
+  return turnouts_.back().get();
+}
+
+bool TurnoutManager::remove(const uint16_t address)
+{
+  auto const &elem = FIND_TURNOUT(address);
+  if (elem != turnouts_.end())
+  {
+    turnouts_.erase(elem);
+    return true;
+  }
+  return false;
+}
+
+Turnout *TurnoutManager::getByID(const uint16_t id)
+{
+  auto const &elem = FIND_TURNOUT_BY_ID(id);
+  if (elem != turnouts_.end())
+  {
+    return elem->get();
+  }
+  return nullptr;
+}
+
+Turnout *TurnoutManager::get(const uint16_t address)
+{
+  auto const &elem = FIND_TURNOUT(address);
+  if (elem != turnouts_.end())
+  {
+    return elem->get();
+  }
+  return nullptr;
+}
+
+uint16_t TurnoutManager::count()
+{
+  return turnouts_.size();
+}
+
+DCC_PROTOCOL_COMMAND_HANDLER(SensorCommandAdapter,
+[](const vector<string> arguments)
+{
+  if(arguments.empty())
+  {
+    string status = SensorManager::get_state_for_dccpp();
+    status += RemoteSensorManager::get_state_for_dccpp();
+    return status;
+  }
+  else
+  {
+    uint16_t sensorID = std::stoi(arguments[0]);
+    if (arguments.size() == 1 && SensorManager::remove(sensorID))
+    {
+      return COMMAND_SUCCESSFUL_RESPONSE;
+    }
+    else if (arguments.size() == 3)
+    {
+      SensorManager::createOrUpdate(sensorID, std::stoi(arguments[1])
+                                  , arguments[2][0] == '1');
+      return COMMAND_SUCCESSFUL_RESPONSE;
+    }
+  }
+  return COMMAND_FAILED_RESPONSE;
+})
+
+void SensorManager::clear()
+{
+  sensors.clear();
+}
+
+uint16_t SensorManager::store()
+{
+  return sensors.size();
+}
+
+bool SensorManager::createOrUpdate(const uint16_t id, const int pin
+                                 , const bool pull_up)
+{
+  sensors[id] = std::make_pair(pin, pull_up);
+  return true;
+}
+
+bool SensorManager::remove(const uint16_t id)
+{
+  return sensors.erase(id) > 0;
+}
+
+string SensorManager::get_state_for_dccpp()
+{
+  string status;
+  for (const auto &sensor : sensors)
+  {
+    status += StringPrintf("<Q %d %d %d>", sensor.first, sensor.second.first
+                         , sensor.second.second);
+  }
+  return status;
+}
+
+DCC_PROTOCOL_COMMAND_HANDLER(RemoteSensorsCommandAdapter,
+[](const vector<string> arguments)
+{
+  if(arguments.empty())
+  {
+    return RemoteSensorManager::get_state_for_dccpp();
+  }
+  else
+  {
+    uint16_t sensorID = std::stoi(arguments[0]);
+    if (arguments.size() == 1 && RemoteSensorManager::remove(sensorID))
+    {
+      return COMMAND_SUCCESSFUL_RESPONSE;
+    }
+    else if (arguments.size() == 2)
+    {
+      RemoteSensorManager::createOrUpdate(sensorID, std::stoi(arguments[1]));
+      return COMMAND_SUCCESSFUL_RESPONSE;
+    }
+  }
+  return COMMAND_FAILED_RESPONSE;
+})
+
+void RemoteSensorManager::createOrUpdate(const uint16_t id
+                                       , const uint16_t value)
+{
+  remote_sensors[id] = value;
+}
+
+bool RemoteSensorManager::remove(const uint16_t id)
+{
+  return remote_sensors.erase(id) > 0;
+}
+
+string RemoteSensorManager::get_state_for_dccpp()
+{
+  string status;
+  for (const auto &sensor : remote_sensors)
+  {
+    status += StringPrintf("<RS %d %d>", sensor.first, sensor.second);
+  }
+  return status;
+}
+
+int16_t readCV(const uint16_t cv)
+{
+  if (cv == 0 || cv > cv_values.size())
+  {
+    return -1;
+  }
+  return cv_values[cv - 1];
+}
+
+bool writeProgCVByte(const uint16_t cv, const uint8_t value)
+{
+  if (cv == 0 || cv > cv_values.size())
+  {
+    return false;
+  }
+  cv_values[cv - 1] = value;
+  return true;
+}
+
+bool writeProgCVBit(const uint16_t cv, const uint8_t bit, const bool value)
+{
+  if (cv == 0 || cv > cv_values.size() || bit > 7)
+  {
+    return false;
+  }
+  cv_values[cv - 1] = value ? cv_values[cv - 1] | (1 << bit)
+                            : cv_values[cv - 1] & ~(1 << bit);
+  return true;
+}
+
+void writeOpsCVByte(const uint16_t loco, const uint16_t cv
+                  , const uint8_t value)
+{
+  packet_count++;
+}
+
+void writeOpsCVBit(const uint16_t loco, const uint16_t cv, const uint8_t bit
+                 , const bool value)
+{
+  packet_count++;
+}
+
+namespace esp32cs
+{
+
+void toggle_estop()
+{
+  packet_count++;
+}
+
+void enable_ops_track_output()
+{
+  track_power = true;
+}
+
+void disable_track_outputs()
+{
+  track_power = false;
+}
+
+string get_track_state_for_dccpp()
+{
+  if (track_power)
+  {
+    return StringPrintf("<p1 %s><a %s %d>", CONFIG_OPS_TRACK_NAME
+                      , CONFIG_OPS_TRACK_NAME, 0);
+  }
+  return StringPrintf("<p0 %s>", CONFIG_OPS_TRACK_NAME);
+}
+
+} // namespace esp32cs
+
+// normally provided by os/os.c, only HASSERT and DIE record into these.
+int g_death_lineno;
+const char *g_death_file;
+
+ssize_t os_get_free_heap()
+{
+  return 128 * 1024;
+}
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+  static const esp_app_desc_t app_desc =
+  {
+    "host", "ESP32CommandStation", __TIME__, __DATE__
+  };
+  return &app_desc;
+}
+
+esp_err_t esp_wifi_get_mode(wifi_mode_t *mode)
+{
+  *mode = WIFI_MODE_STA;
+  return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if
+                                  , tcpip_adapter_ip_info_t *ip_info)
+{
+  if (tcpip_if == TCPIP_ADAPTER_IF_STA)
+  {
+    // 192.168.1.100 in network byte order.
+    ip_info->ip.addr = 0x6401A8C0;
+    return ESP_OK;
+  }
+  return ESP_FAIL;
+}
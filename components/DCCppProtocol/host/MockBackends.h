@@ -0,0 +1,35 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef MOCK_BACKENDS_H_
+#define MOCK_BACKENDS_H_
+
+#include <stddef.h>
+
+/// Creates the mocked train, turnout and sensor back ends and registers the
+/// DCC++ commands, this is safe to call more than once.
+void mock_backends_init();
+
+/// Discards all trains, turnouts, sensors and CV values so that each run
+/// starts from the same state.
+void mock_backends_reset();
+
+/// @return the number of DCC packets the back ends would have sent to the
+/// track since the last @ref mock_backends_reset.
+size_t mock_backends_packet_count();
+
+#endif // MOCK_BACKENDS_H_
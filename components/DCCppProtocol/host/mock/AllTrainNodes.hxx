@@ -0,0 +1,144 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host replacement for
+// components/LCCTrainSearchProtocol/include/AllTrainNodes.hxx, trains are
+// plain in-memory objects and commands are run inline rather than on the
+// train service executor.
+
+#ifndef _COMMANDSTATION_ALLTRAINNODES_HXX_
+#define _COMMANDSTATION_ALLTRAINNODES_HXX_
+
+#include <functional>
+#include <memory>
+#include <openlcb/Defs.hxx>
+#include <openlcb/TrainInterface.hxx>
+#include <TrainDbDefs.hxx>
+#include <utils/Singleton.hxx>
+#include <vector>
+
+namespace commandstation
+{
+
+/// Locomotive which only records the state it has been set to.
+class MockTrain : public openlcb::TrainImpl
+{
+public:
+  MockTrain(uint32_t address) : address_(address)
+  {
+  }
+
+  void set_speed(openlcb::SpeedType speed) override
+  {
+    speed_ = speed;
+    estop_ = false;
+  }
+
+  openlcb::SpeedType get_speed() override
+  {
+    return speed_;
+  }
+
+  void set_emergencystop() override
+  {
+    speed_.set_mph(0);
+    estop_ = true;
+  }
+
+  bool get_emergencystop() override
+  {
+    return estop_;
+  }
+
+  void set_fn(uint32_t address, uint16_t value) override
+  {
+    if (address < 32)
+    {
+      functions_ = value ? functions_ | (1UL << address)
+                         : functions_ & ~(1UL << address);
+    }
+  }
+
+  uint16_t get_fn(uint32_t address) override
+  {
+    return address < 32 ? (functions_ >> address) & 1 : 0;
+  }
+
+  uint32_t legacy_address() override
+  {
+    return address_;
+  }
+
+  dcc::TrainAddressType legacy_address_type() override
+  {
+    return address_ > 127 ? dcc::TrainAddressType::DCC_LONG_ADDRESS
+                          : dcc::TrainAddressType::DCC_SHORT_ADDRESS;
+  }
+
+private:
+  uint32_t address_;
+  openlcb::SpeedType speed_;
+  uint32_t functions_{0};
+  bool estop_{false};
+};
+
+class AllTrainNodes : public Singleton<AllTrainNodes>
+{
+public:
+  /// Runs callbacks inline, there is only a single thread on the host.
+  class InlineExecutor
+  {
+  public:
+    void sync_run(std::function<void()> fn)
+    {
+      fn();
+    }
+  };
+
+  /// Provides the executor used by the GET_LOCO_VIA_EXECUTOR macro.
+  class InlineService
+  {
+  public:
+    InlineExecutor *executor()
+    {
+      return &executor_;
+    }
+  private:
+    InlineExecutor executor_;
+  };
+
+  InlineService *train_service()
+  {
+    return &service_;
+  }
+
+  openlcb::TrainImpl* get_train_impl(openlcb::NodeID id, bool allocate=true);
+  openlcb::TrainImpl* get_train_impl(DccMode drive_type, int address);
+  openlcb::NodeID get_train_node_id_ext(size_t id, bool allocate=true);
+  size_t size();
+
+  /// Removes all trains.
+  void clear();
+
+private:
+  InlineService service_;
+  std::vector<std::unique_ptr<MockTrain>> trains_;
+};
+
+} // namespace commandstation
+
+#endif // _COMMANDSTATION_ALLTRAINNODES_HXX_
@@ -0,0 +1,33 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef DCC_SIGNAL_VFS_H_
+#define DCC_SIGNAL_VFS_H_
+
+#include <string>
+
+namespace esp32cs
+{
+
+void toggle_estop();
+void enable_ops_track_output();
+void disable_track_outputs();
+std::string get_track_state_for_dccpp();
+
+} // namespace esp32cs
+
+#endif // DCC_SIGNAL_VFS_H_
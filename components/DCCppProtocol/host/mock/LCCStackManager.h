@@ -0,0 +1,27 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// The DCC++ protocol does not use the LCC stack directly, this only exists so
+// DCCppProtocol.cpp can be built without the LCC stack. StringPrintf is
+// normally pulled in by CSConfigDescriptor.h.
+
+#ifndef LCC_STACK_MANAGER_H_
+#define LCC_STACK_MANAGER_H_
+
+#include <utils/StringPrintf.hxx>
+
+#endif // LCC_STACK_MANAGER_H_
@@ -0,0 +1,39 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host replacement for components/GPIO/include/RemoteSensors.h.
+
+#ifndef REMOTE_SENSORS_H_
+#define REMOTE_SENSORS_H_
+
+#include <DCCppProtocol.h>
+#include <stdint.h>
+#include <string>
+
+#include "Sensors.h"
+
+DECLARE_DCC_PROTOCOL_COMMAND_CLASS(RemoteSensorsCommandAdapter, "RS", 0)
+
+class RemoteSensorManager
+{
+public:
+  static void createOrUpdate(const uint16_t, const uint16_t=0);
+  static bool remove(const uint16_t);
+  static std::string get_state_for_dccpp();
+};
+
+#endif // REMOTE_SENSORS_H_
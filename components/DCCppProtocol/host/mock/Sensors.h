@@ -0,0 +1,40 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host replacement for components/GPIO/include/Sensors.h, sensors are kept in
+// memory and are not backed by GPIO pins.
+
+#ifndef SENSORS_H_
+#define SENSORS_H_
+
+#include <DCCppProtocol.h>
+#include <stdint.h>
+#include <string>
+
+DECLARE_DCC_PROTOCOL_COMMAND_CLASS(SensorCommandAdapter, "S", 0)
+
+class SensorManager
+{
+public:
+  static void clear();
+  static uint16_t store();
+  static bool createOrUpdate(const uint16_t, const int, const bool);
+  static bool remove(const uint16_t);
+  static std::string get_state_for_dccpp();
+};
+
+#endif // SENSORS_H_
@@ -0,0 +1,109 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host replacement for components/DCCTurnoutManager/include/Turnouts.h, this
+// provides the subset of the TurnoutManager API used by the DCC++ protocol
+// without the LCC event consumer, persistence or DCC packet generation.
+
+#ifndef TURNOUTS_H_
+#define TURNOUTS_H_
+
+#include <DCCppProtocol.h>
+#include <dcc/PacketSource.hxx>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utils/Singleton.hxx>
+#include <vector>
+
+enum TurnoutType
+{
+  LEFT=0,
+  RIGHT,
+  WYE,
+  MULTI,
+  NO_CHANGE,
+  MAX_TURNOUT_TYPES // NOTE: this must be the last entry in the enum.
+};
+
+void encodeDCCAccessoryAddress(uint16_t *board, int8_t *port, uint16_t address);
+uint16_t decodeDCCAccessoryAddress(uint16_t board, int8_t port);
+
+class Turnout
+{
+public:
+  Turnout(uint16_t address, int16_t id = -1, bool thrown = false
+        , TurnoutType type = TurnoutType::LEFT);
+  void update(uint16_t address, TurnoutType type, int16_t id = -1);
+  void set(bool thrown = false, bool sendDCCPacket = true);
+  uint16_t getAddress()
+  {
+    return _address;
+  }
+  uint16_t getID()
+  {
+    return _id;
+  }
+  bool isThrown()
+  {
+    return _thrown;
+  }
+  void toggle()
+  {
+    set(!_thrown);
+  }
+private:
+  uint16_t _address;
+  uint16_t _id;
+  bool _thrown;
+  TurnoutType _type;
+};
+
+/// Single requested change for @ref TurnoutManager::set_batch.
+struct TurnoutUpdate
+{
+  /// DCC address of the turnout, the turnout will be created if needed.
+  uint16_t address;
+
+  /// Requested state of the turnout, ignored when @ref toggle is true.
+  bool thrown;
+
+  /// When true the turnout will be set to the opposite of the current state.
+  bool toggle;
+};
+
+class TurnoutManager : public Singleton<TurnoutManager>
+{
+public:
+  void clear();
+  std::string set(uint16_t, bool=false, bool=true);
+  std::string toggle(uint16_t);
+  void set_batch(const std::vector<TurnoutUpdate> &
+               , std::function<void(Turnout *)>);
+  std::string get_state_for_dccpp();
+  Turnout *createOrUpdate(const uint16_t address
+                        , const TurnoutType = TurnoutType::LEFT
+                        , const int16_t id = -1);
+  bool remove(const uint16_t);
+  Turnout *getByID(const uint16_t id);
+  Turnout *get(const uint16_t);
+  uint16_t count();
+private:
+  std::vector<std::unique_ptr<Turnout>> turnouts_;
+};
+
+#endif // TURNOUTS_H_
@@ -0,0 +1,42 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef ESP_OTA_OPS_H_
+#define ESP_OTA_OPS_H_
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+  char version[32];
+  char project_name[32];
+  char time[16];
+  char date[16];
+} esp_app_desc_t;
+
+/// @return the application description used in the <s> response.
+const esp_app_desc_t *esp_ota_get_app_description(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ESP_OTA_OPS_H_
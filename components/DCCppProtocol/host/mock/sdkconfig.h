@@ -0,0 +1,28 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+// Host build configuration for the DCC++ protocol host target, only the
+// options referenced by DCCppProtocol.cpp are defined.
+
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+#define CONFIG_OPS_TRACK_NAME "OPS"
+#define CONFIG_PROG_TRACK_NAME "PROG"
+#define CONFIG_GPIO_SENSORS 1
+
+#endif // SDKCONFIG_H_
@@ -0,0 +1,59 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef TCPIP_ADAPTER_H_
+#define TCPIP_ADAPTER_H_
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  TCPIP_ADAPTER_IF_STA = 0,
+  TCPIP_ADAPTER_IF_AP,
+  TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+typedef struct
+{
+  uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct
+{
+  esp_ip4_addr_t ip;
+  esp_ip4_addr_t netmask;
+  esp_ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) (int)((ipaddr)->addr & 0xFF),                          \
+                       (int)(((ipaddr)->addr >> 8) & 0xFF),                   \
+                       (int)(((ipaddr)->addr >> 16) & 0xFF),                  \
+                       (int)(((ipaddr)->addr >> 24) & 0xFF)
+
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if
+                                  , tcpip_adapter_ip_info_t *ip_info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TCPIP_ADAPTER_H_
@@ -70,6 +70,9 @@ public:
   DCCPPProtocolConsumer();
   std::string feed(uint8_t *, size_t);
 private:
+  // Maximum number of bytes to retain for a single incomplete command, no
+  // valid DCC++ command comes close to this length.
+  static constexpr size_t MAX_COMMAND_LENGTH = 256;
   std::string processData();
   std::vector<uint8_t> _buffer;
 };
@@ -22,6 +22,8 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include <FileSystemManager.h>
 #include <DCCppProtocol.h>
 #include <JsonConstants.h>
+#include <JsonEntryReader.h>
+#include <JsonWriter.h>
 #include <driver/gpio.h>
 
 #include "GPIOValidation.h"
@@ -35,16 +37,14 @@ static constexpr const char * OUTPUTS_JSON_FILE = "outputs.json";
 void OutputManager::init()
 {
   LOG(INFO, "[Output] Initializing outputs");
-  nlohmann::json root = nlohmann::json::parse(
-    Singleton<FileSystemManager>::instance()->load(OUTPUTS_JSON_FILE));
-  if(root.contains(JSON_COUNT_NODE))
-  {
-    for(auto output : root[JSON_OUTPUTS_NODE])
+  JsonEntryReader::load(OUTPUTS_JSON_FILE, JSON_OUTPUTS_NODE
+  , [](nlohmann::json &output)
     {
-      string data = output.dump();
+      // outputs are persisted as serialized json strings.
+      string data = output.is_string() ? output.get<string>() : output.dump();
       outputs.push_back(std::make_unique<Output>(data));
     }
-  }
+  );
   LOG(INFO, "[Output] Loaded %d outputs", outputs.size());
 }
 
@@ -107,19 +107,28 @@ bool OutputManager::toggle(uint16_t id)
 
 std::string OutputManager::getStateAsJson()
 {
-  string state = "[";
+  string state;
+  JsonWriter writer(state);
+  writer.start_array();
   for (const auto& output : outputs)
   {
-    if (state.length() > 1)
-    {
-      state += ",";
-    }
-    state += output->toJson(true);
+    output->writeJson(writer, true);
   }
-  state += "]";
+  writer.end_array();
   return state;
 }
 
+bool OutputManager::appendJson(size_t index, string &json)
+{
+  if (index < outputs.size())
+  {
+    JsonWriter writer(json);
+    outputs[index]->writeJson(writer, true);
+    return true;
+  }
+  return false;
+}
+
 string OutputManager::get_state_for_dccpp()
 {
   string status;
@@ -247,22 +256,28 @@ void Output::update(gpio_num_t pin, uint8_t flags)
 
 string Output::toJson(bool readableStrings)
 {
-  nlohmann::json object =
-  {
-    { JSON_ID_NODE, _id },
-    { JSON_PIN_NODE, (uint8_t)_pin },
-  };
+  string serialized;
+  JsonWriter writer(serialized);
+  writeJson(writer, readableStrings);
+  return serialized;
+}
+
+void Output::writeJson(JsonWriter &writer, bool readableStrings)
+{
+  writer.start_object()
+        .field(JSON_ID_NODE, _id)
+        .field(JSON_PIN_NODE, (uint8_t)_pin);
   if(readableStrings)
   {
-    object[JSON_FLAGS_NODE] = getFlagsAsString();
-    object[JSON_STATE_NODE] = isActive() ? JSON_VALUE_ON : JSON_VALUE_OFF;
+    writer.field(JSON_FLAGS_NODE, getFlagsAsString())
+          .field(JSON_STATE_NODE, isActive() ? JSON_VALUE_ON : JSON_VALUE_OFF);
   }
   else
   {
-    object[JSON_FLAGS_NODE] = _flags;
-    object[JSON_STATE_NODE] = _active;
+    writer.field(JSON_FLAGS_NODE, _flags)
+          .field(JSON_STATE_NODE, _active);
   }
-  return object.dump();
+  writer.end_object();
 }
 
 string Output::getStateAsJson()
@@ -23,6 +23,7 @@ COPYRIGHT (c) 2018-2020 Mike Dunston
 #include <json.hpp>
 #include <DCCppProtocol.h>
 #include <JsonConstants.h>
+#include <JsonWriter.h>
 #include <utils/StringPrintf.hxx>
 
 #include "GPIOValidation.h"
@@ -93,19 +94,28 @@ bool RemoteSensorManager::remove(const uint16_t id)
 
 string RemoteSensorManager::getStateAsJson()
 {
-  string output = "[";
+  string output;
+  JsonWriter writer(output);
+  writer.start_array();
   for (const auto& sensor : remoteSensors)
   {
-    if (output.length() > 1)
-    {
-      output += ",";
-    }
-    output += sensor->toJson();
+    sensor->writeJson(writer);
   }
-  output += "]";
+  writer.end_array();
   return output;
 }
 
+bool RemoteSensorManager::appendJson(size_t index, string &json)
+{
+  if (index < remoteSensors.size())
+  {
+    JsonWriter writer(json);
+    remoteSensors[index]->writeJson(writer);
+    return true;
+  }
+  return false;
+}
+
 string RemoteSensorManager::get_state_for_dccpp()
 {
   if (remoteSensors.empty())
@@ -143,18 +153,16 @@ string RemoteSensor::get_state_for_dccpp()
   return StringPrintf("<RS %d %d>", getRawID(), _value);
 }
 
-string RemoteSensor::toJson(bool includeState)
+void RemoteSensor::writeJson(JsonWriter &writer, bool includeState)
 {
-  nlohmann::json object =
-  {
-    { JSON_ID_NODE, getRawID() },
-    { JSON_VALUE_NODE, getSensorValue() },
-    { JSON_STATE_NODE, isActive() },
-    { JSON_LAST_UPDATE_NODE, getLastUpdate() },
-    { JSON_PIN_NODE, getPin() },
-    { JSON_PULLUP_NODE, isPullUp() },
-  };
-  return object.dump();
+  writer.start_object()
+        .field(JSON_ID_NODE, getRawID())
+        .field(JSON_VALUE_NODE, getSensorValue())
+        .field(JSON_STATE_NODE, isActive())
+        .field(JSON_LAST_UPDATE_NODE, getLastUpdate())
+        .field(JSON_PIN_NODE, (int)getPin())
+        .field(JSON_PULLUP_NODE, isPullUp())
+        .end_object();
 }
 
 DCC_PROTOCOL_COMMAND_HANDLER(RemoteSensorsCommandAdapter,
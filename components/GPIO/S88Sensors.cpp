@@ -49,6 +49,8 @@ S88 Sensors are reported in the same manner as generic Sensors:
 #include <freertos_drivers/esp32/Esp32Gpio.hxx>
 #include <json.hpp>
 #include <JsonConstants.h>
+#include <JsonEntryReader.h>
+#include <JsonWriter.h>
 #include <os/OS.hxx>
 #include <utils/GpioInitializer.hxx>
 #include <utils/StringPrintf.hxx>
@@ -101,14 +103,16 @@ S88BusManager::S88BusManager(openlcb::Node *node) : poller_(node, {this})
   S88PinInit::hw_init();
 
   LOG(INFO, "[S88] Initializing SensorBus list");
-  nlohmann::json root = nlohmann::json::parse(
-    Singleton<FileSystemManager>::instance()->load(S88_SENSORS_JSON_FILE));
-  for (auto bus : root[JSON_SENSORS_NODE])
-  {
-    buses_.push_back(
-      std::make_unique<S88SensorBus>(bus[JSON_ID_NODE], bus[JSON_PIN_NODE]
-                                   , bus[JSON_COUNT_NODE]));
-  }
+  // buses are persisted as a json array, older versions stored them under
+  // the sensors node.
+  JsonEntryReader::load(S88_SENSORS_JSON_FILE, JSON_SENSORS_NODE
+  , [&](nlohmann::json &bus)
+    {
+      buses_.push_back(
+        std::make_unique<S88SensorBus>(bus[JSON_ID_NODE], bus[JSON_PIN_NODE]
+                                     , bus[JSON_COUNT_NODE]));
+    }
+  );
   LOG(INFO, "[S88] Loaded %d Sensor Buses", buses_.size());
   os_thread_create(&taskHandle_, "s88", 1, 2048, s88_task, this);
 }
@@ -122,25 +126,22 @@ S88BusManager::~S88BusManager()
 void S88BusManager::clear()
 {
   buses_.clear();
+  changes_.reset();
 }
 
 uint16_t S88BusManager::store()
 {
   AtomicHolder l(this);
   uint16_t count = 0;
-  string content = "[";
+  string content;
+  JsonWriter writer(content);
+  writer.start_array();
   for (const auto& bus : buses_)
   {
-    // only add the seperator if we have already serialized at least one
-    // bus.
-    if (content.length() > 1)
-    {
-      content += ",";
-    }
-    content += bus->toJson();
+    bus->writeJson(writer);
     count += bus->getSensorCount();
   }
-  content += "]";
+  writer.end_array();
   Singleton<FileSystemManager>::instance()->store(S88_SENSORS_JSON_FILE
                                                 , content);
   return count;
@@ -191,6 +192,13 @@ void S88BusManager::poll()
     S88_CLOCK_Pin::set(false);
     ets_delay_us(S88_SENSOR_READ_TIME);
   }
+  for (const auto& sensorBus : buses_)
+  {
+    if (sensorBus->isChanged())
+    {
+      changes_.changed(sensorBus->getID());
+    }
+  }
 }
 
 bool S88BusManager::createOrUpdateBus(const uint8_t id, const gpio_num_t dataPin, const uint16_t sensorCount)
@@ -212,6 +220,7 @@ bool S88BusManager::createOrUpdateBus(const uint8_t id, const gpio_num_t dataPin
     if (sensorBus->getID() == id)
     {
       sensorBus->update(dataPin, sensorCount);
+      changes_.changed(id);
       return true;
     }
   }
@@ -221,6 +230,7 @@ bool S88BusManager::createOrUpdateBus(const uint8_t id, const gpio_num_t dataPin
     return false;
   }
   buses_.push_back(std::make_unique<S88SensorBus>(id, dataPin, sensorCount));
+  changes_.changed(id);
   return true;
 }
 
@@ -235,6 +245,7 @@ bool S88BusManager::removeBus(const uint8_t id)
   if (ent != buses_.end())
   {
     buses_.erase(ent);
+    changes_.removed(id);
     return true;
   }
   return false;
@@ -243,16 +254,57 @@ bool S88BusManager::removeBus(const uint8_t id)
 string S88BusManager::get_state_as_json()
 {
   AtomicHolder l(this);
-  string state = "[";
+  string state;
+  JsonWriter writer(state);
+  writer.start_array();
   for (const auto& sensorBus : buses_)
   {
-    if (state.length() > 1)
+    sensorBus->writeJson(writer, true);
+  }
+  writer.end_array();
+  return state;
+}
+
+bool S88BusManager::append_json(size_t index, string &json)
+{
+  AtomicHolder l(this);
+  if (index < buses_.size())
+  {
+    JsonWriter writer(json);
+    buses_[index]->writeJson(writer, true);
+    return true;
+  }
+  return false;
+}
+
+string S88BusManager::get_changes_as_json(uint32_t since)
+{
+  AtomicHolder l(this);
+  string state;
+  JsonWriter writer(state);
+  changes_.write_json(writer, since
+  , [&](JsonWriter &writer, uint32_t id)
     {
-      state += ",";
+      const auto & ent = std::find_if(buses_.begin(), buses_.end(),
+      [id](std::unique_ptr<S88SensorBus> & bus) -> bool
+      {
+        return bus->getID() == id;
+      });
+      if (ent != buses_.end())
+      {
+        (*ent)->writeJson(writer, true);
+        return true;
+      }
+      return false;
     }
-    state += sensorBus->toJson(true);
-  }
-  state += "]";
+  , [&](JsonWriter &writer)
+    {
+      for (const auto& sensorBus : buses_)
+      {
+        sensorBus->writeJson(writer, true);
+      }
+    }
+  );
   return state;
 }
 
@@ -304,16 +356,24 @@ void S88SensorBus::update(const gpio_num_t dataPin, const uint16_t sensorCount)
 
 string S88SensorBus::toJson(bool includeState)
 {
-  string serialized = StringPrintf(
-    "{\"%s\":%d,\"%s\":%d,\"%s\":%d,\"%s\":%d"
-  , JSON_ID_NODE, _id, JSON_PIN_NODE, _dataPin
-  , JSON_S88_SENSOR_BASE_NODE, _sensorIDBase, JSON_COUNT_NODE, _sensors.size());
+  string serialized;
+  JsonWriter writer(serialized);
+  writeJson(writer, includeState);
+  return serialized;
+}
+
+void S88SensorBus::writeJson(JsonWriter &writer, bool includeState)
+{
+  writer.start_object()
+        .field(JSON_ID_NODE, _id)
+        .field(JSON_PIN_NODE, (int)_dataPin)
+        .field(JSON_S88_SENSOR_BASE_NODE, _sensorIDBase)
+        .field(JSON_COUNT_NODE, _sensors.size());
   if (includeState)
   {
-    serialized += StringPrintf(",\"%s\":\"%s\"", JSON_STATE_NODE, getStateString().c_str());
+    writer.field(JSON_STATE_NODE, getStateString());
   }
-  serialized += "}";
-  return serialized;
+  writer.end_object();
 }
 
 void S88SensorBus::addSensors(int16_t sensorCount)
@@ -367,7 +427,13 @@ string S88SensorBus::getStateString()
 void S88SensorBus::readNext()
 {
   // sensors need to pull pin LOW for ACTIVE
-  _sensors[_nextSensorToRead++]->setState(gpio_get_level(_dataPin));
+  auto sensor = _sensors[_nextSensorToRead++];
+  bool state = gpio_get_level(_dataPin);
+  if (sensor->isActive() != state)
+  {
+    _changed = true;
+  }
+  sensor->setState(state);
 }
 
 string S88SensorBus::get_state_for_dccpp()
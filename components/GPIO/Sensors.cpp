@@ -24,6 +24,8 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include <driver/gpio.h>
 #include <json.hpp>
 #include <JsonConstants.h>
+#include <JsonEntryReader.h>
+#include <JsonWriter.h>
 #include <utils/StringPrintf.hxx>
 
 #include "GPIOValidation.h"
@@ -34,6 +36,8 @@ std::vector<std::unique_ptr<Sensor>> sensors;
 
 TaskHandle_t SensorManager::_taskHandle;
 OSMutex SensorManager::_lock;
+std::vector<SensorStateListener> SensorManager::_listeners;
+ChangeLog SensorManager::_changes;
 static constexpr UBaseType_t SENSOR_TASK_PRIORITY = 1;
 static constexpr uint32_t SENSOR_TASK_STACK_SIZE = 2048;
 
@@ -42,16 +46,14 @@ static constexpr const char * SENSORS_JSON_FILE = "sensors.json";
 void SensorManager::init()
 {
   LOG(INFO, "[Sensors] Initializing sensors");
-  nlohmann::json root = nlohmann::json::parse(
-    Singleton<FileSystemManager>::instance()->load(SENSORS_JSON_FILE));
-  if(root.contains(JSON_COUNT_NODE))
-  {
-    for(auto sensor : root[JSON_SENSORS_NODE])
+  JsonEntryReader::load(SENSORS_JSON_FILE, JSON_SENSORS_NODE
+  , [](nlohmann::json &sensor)
     {
-      string data = sensor.dump();
+      // sensors are persisted as serialized json strings.
+      string data = sensor.is_string() ? sensor.get<string>() : sensor.dump();
       sensors.push_back(std::make_unique<Sensor>(data));
     }
-  }
+  );
   LOG(INFO, "[Sensors] Loaded %d sensors", sensors.size());
   xTaskCreate(sensorTask, "SensorManager", SENSOR_TASK_STACK_SIZE, NULL, SENSOR_TASK_PRIORITY, &_taskHandle);
 }
@@ -59,6 +61,7 @@ void SensorManager::init()
 void SensorManager::clear()
 {
   sensors.clear();
+  _changes.reset();
 }
 
 uint16_t SensorManager::store()
@@ -100,16 +103,57 @@ void SensorManager::sensorTask(void *param)
 string SensorManager::getStateAsJson()
 {
   OSMutexLock l(&_lock);
-  string status = "[";
+  string status;
+  JsonWriter writer(status);
+  writer.start_array();
   for (const auto& sensor : sensors)
   {
-    if (status.length() > 1)
+    sensor->writeJson(writer, true);
+  }
+  writer.end_array();
+  return status;
+}
+
+bool SensorManager::appendJson(size_t index, string &json)
+{
+  OSMutexLock l(&_lock);
+  if (index < sensors.size())
+  {
+    JsonWriter writer(json);
+    sensors[index]->writeJson(writer, true);
+    return true;
+  }
+  return false;
+}
+
+string SensorManager::getChangesAsJson(uint32_t since)
+{
+  OSMutexLock l(&_lock);
+  string status;
+  JsonWriter writer(status);
+  _changes.write_json(writer, since
+  , [](JsonWriter &writer, uint32_t id)
     {
-      status += ",";
+      const auto & ent = std::find_if(sensors.begin(), sensors.end(),
+      [id](std::unique_ptr<Sensor> & sensor) -> bool
+      {
+        return sensor->getID() == id;
+      });
+      if (ent != sensors.end())
+      {
+        (*ent)->writeJson(writer, true);
+        return true;
+      }
+      return false;
     }
-    status += sensor->toJson(true);
-  }
-  status += "]";
+  , [](JsonWriter &writer)
+    {
+      for (const auto& sensor : sensors)
+      {
+        sensor->writeJson(writer, true);
+      }
+    }
+  );
   return status;
 }
 
@@ -139,10 +183,12 @@ bool SensorManager::createOrUpdate(const uint16_t id, const gpio_num_t pin, cons
   if (sens)
   {
     sens->update(pin, pullUp);
+    _changes.changed(id);
     return true;
   }
   // add the new sensor
   sensors.push_back(std::make_unique<Sensor>(id, pin, pullUp));
+  _changes.changed(id);
   return true;
 }
 
@@ -158,6 +204,7 @@ bool SensorManager::remove(const uint16_t id)
   {
     LOG(INFO, "[Sensors] Removing Sensor(%d)", (*ent)->getID());
     sensors.erase(ent);
+    _changes.removed(id);
     return true;
   }
   return false;
@@ -183,6 +230,28 @@ string SensorManager::get_state_for_dccpp()
   return res;
 }
 
+void SensorManager::register_state_listener(SensorStateListener listener)
+{
+  OSMutexLock l(&_lock);
+  _listeners.push_back(std::move(listener));
+}
+
+void SensorManager::notify_state_listeners(Sensor *sensor)
+{
+  // NOTE: listeners are only registered during startup so it is safe to walk
+  // the list without holding the lock, the lock may also already be held by
+  // the sensor task.
+  if (sensor->getPin() != NON_STORED_SENSOR_PIN)
+  {
+    // only GPIO sensors are part of the sensors collection.
+    _changes.changed(sensor->getID());
+  }
+  for (auto &listener : _listeners)
+  {
+    listener(sensor);
+  }
+}
+
 Sensor::Sensor(uint16_t sensorID, gpio_num_t pin, bool pullUp, bool announce, bool initialState)
   : _sensorID(sensorID), _pin(pin), _pullUp(pullUp), _lastState(initialState)
 {
@@ -222,17 +291,23 @@ Sensor::Sensor(string &data) : _lastState(false)
 
 string Sensor::toJson(bool includeState)
 {
-  nlohmann::json object =
-  {
-    { JSON_ID_NODE, _sensorID },
-    { JSON_PIN_NODE, (uint8_t)_pin },
-    { JSON_PULLUP_NODE, _pullUp },
-  };
+  string serialized;
+  JsonWriter writer(serialized);
+  writeJson(writer, includeState);
+  return serialized;
+}
+
+void Sensor::writeJson(JsonWriter &writer, bool includeState)
+{
+  writer.start_object()
+        .field(JSON_ID_NODE, _sensorID)
+        .field(JSON_PIN_NODE, (uint8_t)_pin)
+        .field(JSON_PULLUP_NODE, _pullUp);
   if (includeState)
   {
-    object[JSON_STATE_NODE] = _lastState;
+    writer.field(JSON_STATE_NODE, _lastState);
   }
-  return object.dump();
+  writer.end_object();
 }
 
 void Sensor::update(gpio_num_t pin, bool pullUp)
@@ -267,6 +342,7 @@ string Sensor::set(bool state)
   {
     _lastState = state;
     LOG(INFO, "Sensor: %d :: %s", _sensorID, _lastState ? "ACTIVE" : "INACTIVE");
+    SensorManager::notify_state_listeners(this);
     // TODO: find a way to send this out on the JMRI interface
     return StringPrintf("<%c %d>", state ? 'Q' : 'q', _sensorID);
   }
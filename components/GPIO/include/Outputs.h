@@ -25,6 +25,8 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 DECLARE_DCC_PROTOCOL_COMMAND_CLASS(OutputCommandAdapter, "Z", 0)
 DECLARE_DCC_PROTOCOL_COMMAND_CLASS(OutputExCommandAdapter, "Zex", 1)
 
+class JsonWriter;
+
 const uint8_t OUTPUT_IFLAG_INVERT = BIT0;
 const uint8_t OUTPUT_IFLAG_RESTORE_STATE = BIT1;
 const uint8_t OUTPUT_IFLAG_FORCE_STATE = BIT2;
@@ -37,6 +39,7 @@ public:
   std::string set(bool=false, bool=true);
   void update(gpio_num_t, uint8_t);
   std::string toJson(bool=false);
+  void writeJson(JsonWriter &, bool=false);
   uint16_t getID()
   {
     return _id;
@@ -103,6 +106,7 @@ class OutputManager
     static Output *getOutput(uint16_t);
     static bool toggle(uint16_t);
     static std::string getStateAsJson();
+    static bool appendJson(size_t, std::string &);
     static std::string get_state_for_dccpp();
     static bool createOrUpdate(const uint16_t, const gpio_num_t, const uint8_t);
     static bool remove(const uint16_t);
@@ -49,7 +49,7 @@ public:
   }
   virtual void check();
   std::string get_state_for_dccpp() override;
-  virtual std::string toJson(bool=false) override;
+  void writeJson(JsonWriter &, bool=false) override;
 private:
   uint16_t _rawID;
   uint16_t _value;
@@ -63,6 +63,7 @@ public:
   static void createOrUpdate(const uint16_t, const uint16_t=0);
   static bool remove(const uint16_t);
   static std::string getStateAsJson();
+  static bool appendJson(size_t, std::string &);
   static std::string get_state_for_dccpp();
 };
 
@@ -34,6 +34,9 @@ public:
   S88Sensor(uint16_t, uint16_t);
   virtual ~S88Sensor() {}
   void check() {}
+  bool isS88() {
+    return true;
+  }
   void setState(bool state) {
     set(state);
   }
@@ -53,6 +56,7 @@ public:
   S88SensorBus(const uint8_t, const gpio_num_t, const uint16_t);
   void update(const gpio_num_t, const uint16_t);
   std::string toJson(bool=false);
+  void writeJson(JsonWriter &, bool=false);
   void addSensors(int16_t);
   void removeSensors(int16_t);
   std::string getStateString();
@@ -75,6 +79,11 @@ public:
   void prepForRead()
   {
     _nextSensorToRead = 0;
+    _changed = false;
+  }
+  bool isChanged()
+  {
+    return _changed;
   }
   bool hasMore()
   {
@@ -88,6 +97,7 @@ private:
   uint16_t _sensorIDBase;
   uint8_t _nextSensorToRead;
   uint16_t _lastSensorID;
+  bool _changed{false};
   std::vector<S88Sensor *> _sensors;
 };
 
@@ -104,10 +114,13 @@ public:
   bool createOrUpdateBus(const uint8_t, const gpio_num_t, const uint16_t);
   bool removeBus(const uint8_t);
   std::string get_state_as_json();
+  bool append_json(size_t, std::string &);
+  std::string get_changes_as_json(uint32_t);
   std::string get_state_for_dccpp();
 private:
   openlcb::RefreshLoop poller_;
   std::vector<std::unique_ptr<S88SensorBus>> buses_;
+  ChangeLog changes_;
   os_thread_t taskHandle_;
 };
 
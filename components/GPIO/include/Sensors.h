@@ -18,11 +18,16 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #ifndef SENSORS_H_
 #define SENSORS_H_
 
+#include <ChangeLog.h>
 #include <DCCppProtocol.h>
 #include <driver/gpio.h>
+#include <functional>
+#include <vector>
 
 DECLARE_DCC_PROTOCOL_COMMAND_CLASS(SensorCommandAdapter, "S", 0)
 
+class JsonWriter;
+
 static constexpr gpio_num_t NON_STORED_SENSOR_PIN = (gpio_num_t)-1;
 
 class Sensor
@@ -32,7 +37,8 @@ public:
   Sensor(std::string &);
   virtual ~Sensor() {}
   void update(gpio_num_t, bool=false);
-  virtual std::string toJson(bool=false);
+  std::string toJson(bool=false);
+  virtual void writeJson(JsonWriter &, bool=false);
   uint16_t getID()
   {
     return _sensorID;
@@ -51,6 +57,10 @@ public:
   }
   virtual void check();
   virtual std::string get_state_for_dccpp();
+  virtual bool isS88()
+  {
+    return false;
+  }
 protected:
   virtual std::string set(bool);
   void setID(uint16_t id)
@@ -64,6 +74,8 @@ private:
   bool _lastState;
 };
 
+typedef std::function<void(Sensor *)> SensorStateListener;
+
 class SensorManager
 {
 public:
@@ -72,14 +84,20 @@ public:
   static uint16_t store();
   static void sensorTask(void *param);
   static std::string getStateAsJson();
+  static bool appendJson(size_t, std::string &);
+  static std::string getChangesAsJson(uint32_t);
   static Sensor *getSensor(uint16_t);
   static bool createOrUpdate(const uint16_t, const gpio_num_t, const bool);
   static bool remove(const uint16_t);
   static gpio_num_t getSensorPin(const uint16_t);
   static std::string get_state_for_dccpp();
+  static void register_state_listener(SensorStateListener);
+  static void notify_state_listeners(Sensor *);
 private:
   static TaskHandle_t _taskHandle;
   static OSMutex _lock;
+  static std::vector<SensorStateListener> _listeners;
+  static ChangeLog _changes;
 };
 
 #endif // SENSORS_H_
\ No newline at end of file
@@ -0,0 +1,411 @@
+/** \copyright
+ * Copyright (c) 2019-2020, Mike Dunston
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file HttpServerTest.cpp
+ *
+ * Tests for the HTTP server using loopback TCP connections.
+ *
+ * @author Mike Dunston
+ * @date 18 Oct 2020
+ */
+
+#include "Httpd.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace http;
+
+OVERRIDE_CONST(httpd_keepalive_idle_ms, 1000);
+
+/// Response received by @ref HttpClient.
+struct ClientResponse
+{
+  /// HTTP status code, zero when no response was received.
+  int code{0};
+
+  /// Raw response headers (excluding the status line).
+  std::string headers;
+
+  /// Response body, chunked bodies have been decoded.
+  std::string body;
+};
+
+/// Minimal blocking HTTP/1.1 client for a single connection.
+class HttpClient
+{
+public:
+  /// Constructor.
+  ///
+  /// @param fd is the connected socket.
+  HttpClient(int fd) : fd_(fd)
+  {
+    struct timeval tv = {5, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  ~HttpClient()
+  {
+    ::close(fd_);
+  }
+
+  /// Sends the provided raw request data.
+  void send(const std::string &data)
+  {
+    ASSERT_EQ((ssize_t)data.size(), ::send(fd_, data.data(), data.size(), 0));
+  }
+
+  /// Sends a GET request which keeps the connection open.
+  void get(const std::string &uri)
+  {
+    send("GET " + uri + " HTTP/1.1\r\nHost: test\r\n"
+         "Connection: keep-alive\r\n\r\n");
+  }
+
+  /// Sends an application/x-www-form-urlencoded POST request which keeps the
+  /// connection open.
+  void post_form(const std::string &uri, const std::string &body)
+  {
+    send("POST " + uri + " HTTP/1.1\r\nHost: test\r\n"
+         "Connection: keep-alive\r\n"
+         "Content-Type: application/x-www-form-urlencoded\r\n"
+         "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" +
+         body);
+  }
+
+  /// Reads one response from the connection.
+  ClientResponse read_response()
+  {
+    ClientResponse res;
+    std::string status;
+    if (!read_line(status))
+    {
+      return res;
+    }
+    res.code = std::stoi(status.substr(status.find(' ') + 1, 3));
+    size_t content_length = 0;
+    bool chunked = false;
+    std::string line;
+    while (read_line(line) && !line.empty())
+    {
+      res.headers.append(line).append("\n");
+      std::string lower = line;
+      std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+      if (!lower.compare(0, 15, "content-length:"))
+      {
+        content_length = std::stoul(line.substr(15));
+      }
+      else if (lower.find("transfer-encoding: chunked") == 0)
+      {
+        chunked = true;
+      }
+    }
+    if (!chunked)
+    {
+      read_bytes(res.body, content_length);
+      return res;
+    }
+    while (read_line(line))
+    {
+      size_t len = std::stoul(line, nullptr, 16);
+      if (!len)
+      {
+        // empty trailer
+        read_line(line);
+        break;
+      }
+      read_bytes(res.body, len);
+      read_line(line);
+    }
+    return res;
+  }
+
+  /// Waits for the server to close the connection.
+  ///
+  /// @param timeout_ms is the maximum time to wait.
+  ///
+  /// @return true if the server closed the connection.
+  bool wait_for_close(int timeout_ms)
+  {
+    struct timeval tv = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char ch;
+    if (!buf_.empty())
+    {
+      return false;
+    }
+    // a connection closed with unread data is reset rather than shut down.
+    ssize_t len = ::recv(fd_, &ch, 1, 0);
+    return len == 0 || (len < 0 && errno == ECONNRESET);
+  }
+
+private:
+  /// Reads more data into @ref buf_.
+  bool fill()
+  {
+    char data[512];
+    ssize_t len = ::recv(fd_, data, sizeof(data), 0);
+    if (len <= 0)
+    {
+      return false;
+    }
+    buf_.append(data, len);
+    return true;
+  }
+
+  /// Reads a CRLF terminated line, the line terminator is removed.
+  bool read_line(std::string &line)
+  {
+    size_t eol;
+    while ((eol = buf_.find("\r\n")) == std::string::npos)
+    {
+      if (!fill())
+      {
+        return false;
+      }
+    }
+    line = buf_.substr(0, eol);
+    buf_.erase(0, eol + 2);
+    return true;
+  }
+
+  /// Reads exactly @param len bytes and appends them to @param data.
+  void read_bytes(std::string &data, size_t len)
+  {
+    while (buf_.size() < len && fill())
+    {
+    }
+    size_t count = std::min(len, buf_.size());
+    data.append(buf_, 0, count);
+    buf_.erase(0, count);
+  }
+
+  /// Socket handle.
+  int fd_;
+
+  /// Received data which has not been consumed yet.
+  std::string buf_;
+};
+
+class HttpServerTest : public ::testing::Test
+{
+protected:
+  static void SetUpTestCase()
+  {
+    server_ = new Httpd(nullptr, 0, "httpd-test");
+    // wait for the request flows to reach their initial state, a connection
+    // can not be handed to a flow before that.
+    server_->executor()->sync_run([](){});
+    server_->uri("/count", HttpMethod::GET, [](HttpRequest *req)
+    {
+      return new StringResponse(std::to_string(++count_)
+                              , MIME_TYPE_TEXT_PLAIN);
+    });
+    server_->uri("/chunked", HttpMethod::GET, [](HttpRequest *req)
+    {
+      size_t id = ++count_;
+      return new ChunkedResponse([id](size_t index, std::string &body)
+      {
+        body.append(StringPrintf("%zu-%zu;", id, index));
+        return index < 2;
+      }, MIME_TYPE_TEXT_PLAIN);
+    });
+    server_->uri("/form", HttpMethod::POST, [](HttpRequest *req)
+    {
+      return new StringResponse(req->param("value"), MIME_TYPE_TEXT_PLAIN);
+    });
+
+    // loopback listener used to create the connections which are handed to
+    // the server, this bypasses the socket listener in the server.
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(0, ::bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)));
+    ASSERT_EQ(0, ::listen(listen_fd_, 16));
+    ASSERT_EQ(0, ::getsockname(listen_fd_, (sockaddr *)&addr, &addr_len));
+    listen_addr_ = addr;
+  }
+
+  static void TearDownTestCase()
+  {
+    // the server is not destroyed since the request flows may still be
+    // waiting on timers for connections which are being closed.
+    ::close(listen_fd_);
+  }
+
+  /// Opens a new connection to the server.
+  ///
+  /// @return the client side socket.
+  int connect()
+  {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    EXPECT_EQ(0, ::connect(fd, (sockaddr *)&listen_addr_
+                         , sizeof(listen_addr_)));
+    int server_fd = ::accept(listen_fd_, nullptr, nullptr);
+    EXPECT_LE(0, server_fd);
+    server_->new_connection(server_fd);
+    return fd;
+  }
+
+  static Httpd *server_;
+  static int listen_fd_;
+  static struct sockaddr_in listen_addr_;
+  static std::atomic<size_t> count_;
+};
+
+Httpd *HttpServerTest::server_;
+int HttpServerTest::listen_fd_;
+struct sockaddr_in HttpServerTest::listen_addr_;
+std::atomic<size_t> HttpServerTest::count_;
+
+TEST_F(HttpServerTest, keep_alive_sends_new_response)
+{
+  HttpClient client(connect());
+  size_t first = count_ + 1;
+
+  client.get("/count");
+  ClientResponse res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(std::to_string(first), res.body);
+
+  // the second request on the same connection must be sent the response
+  // created by the handler for that request.
+  client.get("/count");
+  res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(std::to_string(first + 1), res.body);
+}
+
+TEST_F(HttpServerTest, keep_alive_chunked_response)
+{
+  HttpClient client(connect());
+  size_t first = count_ + 1;
+
+  client.get("/chunked");
+  ClientResponse res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(StringPrintf("%zu-0;%zu-1;%zu-2;", first, first, first)
+          , res.body);
+
+  // the first response has been fully generated, it can not be sent again.
+  client.get("/chunked");
+  res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(StringPrintf("%zu-0;%zu-1;%zu-2;", first + 1, first + 1
+                       , first + 1), res.body);
+}
+
+TEST_F(HttpServerTest, idle_keep_alive_is_closed)
+{
+  HttpClient client(connect());
+  client.get("/count");
+  EXPECT_EQ(200, client.read_response().code);
+
+  // no further requests are sent, the server will close the connection once
+  // httpd_keepalive_idle_ms has elapsed.
+  uint64_t start = esp_timer_get_time();
+  EXPECT_TRUE(client.wait_for_close(3000));
+  uint64_t elapsed = USEC_TO_MSEC(esp_timer_get_time() - start);
+  EXPECT_GE(elapsed, 900U);
+  EXPECT_LT(elapsed, 2000U);
+}
+
+TEST_F(HttpServerTest, pending_connection_preempts_idle_keep_alive)
+{
+  // occupy all request flows with idle kept-alive connections.
+  std::vector<std::unique_ptr<HttpClient>> idle;
+  for (int idx = 0; idx < config_httpd_max_connections(); idx++)
+  {
+    idle.emplace_back(new HttpClient(connect()));
+    idle.back()->get("/count");
+    EXPECT_EQ(200, idle.back()->read_response().code);
+  }
+
+  // the new connection is queued until one of the idle connections is
+  // closed, this must happen well before httpd_keepalive_idle_ms.
+  uint64_t start = esp_timer_get_time();
+  HttpClient client(connect());
+  client.get("/count");
+  EXPECT_EQ(200, client.read_response().code);
+  EXPECT_LT(USEC_TO_MSEC(esp_timer_get_time() - start), 500U);
+
+  size_t closed = 0;
+  for (auto &conn : idle)
+  {
+    if (conn->wait_for_close(10))
+    {
+      closed++;
+    }
+  }
+  EXPECT_EQ(1U, closed);
+}
+
+TEST_F(HttpServerTest, form_data_is_parsed)
+{
+  HttpClient client(connect());
+  client.post_form("/form", "value=hello+world&other=1");
+  ClientResponse res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ("hello world", res.body);
+
+  // a form body at the size limit is accepted, the connection remains
+  // usable afterwards.
+  std::string value(config_httpd_max_form_size() - 6, 'x');
+  client.post_form("/form", "value=" + value);
+  res = client.read_response();
+  EXPECT_EQ(200, res.code);
+  EXPECT_EQ(value, res.body);
+
+  client.get("/count");
+  EXPECT_EQ(200, client.read_response().code);
+}
+
+TEST_F(HttpServerTest, oversized_form_data_is_rejected)
+{
+  HttpClient client(connect());
+  std::string value(config_httpd_max_form_size(), 'x');
+  client.post_form("/form", "value=" + value);
+  ClientResponse res = client.read_response();
+  EXPECT_EQ(413, res.code);
+  EXPECT_EQ(std::string::npos, res.body.find(value));
+
+  // the body was not consumed so the connection is closed.
+  EXPECT_TRUE(client.wait_for_close(1000));
+}
+
+/// Entry point called by os.c once the OS layer has been initialized.
+int appl_main(int argc, char *argv[])
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,59 @@
+/** \copyright
+ * Copyright (c) 2019-2020, Mike Dunston
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file MDNS.hxx
+ *
+ * Host build replacement for the OpenMRN MDNS class, the Linux version
+ * depends on avahi which is not needed for the HTTP server tests.
+ *
+ * @author Mike Dunston
+ * @date 18 Oct 2020
+ */
+
+#ifndef _OS_MDNS_HXX_
+#define _OS_MDNS_HXX_
+
+#include <stdint.h>
+
+/// MDNS abstraction object, nothing is published by the host build.
+class MDNS
+{
+public:
+  /// Publish an mDNS name.
+  /// @param name local "username" or "nodename" of the service
+  /// @param service service name, example: "_openlcb._tcp"
+  /// @param port port number
+  void publish(const char *name, const char *service, uint16_t port)
+  {
+  }
+
+  /// Commit the mDNS publisher.
+  void commit()
+  {
+  }
+};
+
+#endif // _OS_MDNS_HXX_
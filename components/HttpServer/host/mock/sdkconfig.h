@@ -0,0 +1,47 @@
+/** \copyright
+ * Copyright (c) 2019-2020, Mike Dunston
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file sdkconfig.h
+ *
+ * Host build replacement for the ESP-IDF generated sdkconfig.h, only the
+ * HTTP server log levels are defined.
+ *
+ * @author Mike Dunston
+ * @date 18 Oct 2020
+ */
+
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+// VERBOSE logging is disabled (matching the "Minimal" Kconfig choice).
+#define CONFIG_HTTP_DNS_LOG_LEVEL 4
+#define CONFIG_HTTP_SERVER_LOG_LEVEL 4
+#define CONFIG_HTTP_REQ_LOG_LEVEL 4
+#define CONFIG_HTTP_RESP_LOG_LEVEL 4
+#define CONFIG_HTTP_REQ_FLOW_LOG_LEVEL 4
+#define CONFIG_HTTP_WS_LOG_LEVEL 4
+
+#endif // SDKCONFIG_H_
@@ -147,39 +147,64 @@ static inline string string_join(const vector<string>::iterator first
   return string_join(vec, delimeter);
 }
 
-/// Helper which URL decodes a string as described in RFC-1738 sec. 2.2.
+/// Helper which URL decodes a buffer in place as described in RFC-1738
+/// sec. 2.2.
 ///
-/// @param source is the string to be decoded.
-/// @return the decoded string.
+/// @param str is the buffer to be decoded.
+/// @param len is the number of characters in the buffer.
+/// @return the number of characters in the decoded buffer, this will always be
+/// less than or equal to len.
 /// RFC: https://www.ietf.org/rfc/rfc1738.txt
-static inline string url_decode(const string source)
+static inline size_t url_decode_in_place(char *str, size_t len)
 {
-  string decoded = source;
-
-  // replace + with space
-  std::replace(decoded.begin(), decoded.end(), '+', ' ');
-
-  // search and replace %{hex}{hex} with hex decoded character
-  while (decoded.find("%") != string::npos)
+  auto hex_value = [](char ch) -> int
+  {
+    if (ch >= '0' && ch <= '9')
+    {
+      return ch - '0';
+    }
+    else if (ch >= 'a' && ch <= 'f')
+    {
+      return ch - 'a' + 10;
+    }
+    else if (ch >= 'A' && ch <= 'F')
+    {
+      return ch - 'A' + 10;
+    }
+    return -1;
+  };
+  size_t out = 0;
+  for (size_t idx = 0; idx < len; idx++, out++)
   {
-    // find the % character
-    auto pos = decoded.find("%");
-    if (pos + 2 < decoded.size())
+    if (str[idx] == '+')
+    {
+      // replace + with space
+      str[out] = ' ';
+    }
+    else if (str[idx] == '%' && idx + 2 < len &&
+             hex_value(str[idx + 1]) >= 0 && hex_value(str[idx + 2]) >= 0)
     {
-      // decode the character
-      auto sub = decoded.substr(pos + 1, 2);
-      char ch = std::stoi(sub, nullptr, 16);
-      // insert the replacement
-      decoded.insert(pos, 1, ch);
-      // remove the decoded piece
-      decoded.erase(pos + 1, 3);
+      // replace %{hex}{hex} with hex decoded character
+      str[out] = (hex_value(str[idx + 1]) << 4) | hex_value(str[idx + 2]);
+      idx += 2;
     }
     else
     {
-      // the % is not followed by at least two characters.
-      break;
+      str[out] = str[idx];
     }
   }
+  return out;
+}
+
+/// Helper which URL decodes a string as described in RFC-1738 sec. 2.2.
+///
+/// @param source is the string to be decoded.
+/// @return the decoded string.
+/// RFC: https://www.ietf.org/rfc/rfc1738.txt
+static inline string url_decode(const string source)
+{
+  string decoded = source;
+  decoded.resize(url_decode_in_place(&decoded[0], decoded.size()));
   return decoded;
 }
 
@@ -38,7 +38,9 @@
 #define HTTPD_H_
 
 #include <algorithm>
+#include <deque>
 #include <map>
+#include <memory>
 #include <stdint.h>
 
 #include <executor/Service.hxx>
@@ -94,6 +96,11 @@ DECLARE_CONST(httpd_max_param_count);
 /// this limit will be forcibly aborted.
 DECLARE_CONST(httpd_max_req_size);
 
+/// Maximum size of an application/x-www-form-urlencoded request body. These
+/// are held in memory while being parsed, larger bodies will be rejected with
+/// @ref HttpStatusCode::STATUS_ENTITY_TOO_LARGE. Default is 2048.
+DECLARE_CONST(httpd_max_form_size);
+
 /// This is the maximum number of HTTP requests which should be processed for a
 /// single connection with keep-alive active before the connection will be
 /// closed with the "Connection: close" header.
@@ -107,6 +114,12 @@ DECLARE_CONST(httpd_req_timeout_ms);
 /// timeouts.
 DECLARE_CONST(httpd_socket_timeout_ms);
 
+/// This is the number of milliseconds a connection can remain idle between
+/// requests before it is closed and the @ref HttpRequestFlow is released. An
+/// idle kept-alive connection is closed immediately when another connection
+/// is waiting for a @ref HttpRequestFlow. Default is 2000.
+DECLARE_CONST(httpd_keepalive_idle_ms);
+
 /// This is the number of milliseconds to use as the read timeout for all
 /// websocket connections. When this limit and the max_XX_attempts limit have
 /// been exceeded the send/receive attempt is aborted and the inverse operation
@@ -130,10 +143,56 @@ DECLARE_CONST(httpd_websocket_max_uris);
 /// Default is 10.
 DECLARE_CONST(httpd_websocket_max_clients);
 
+/// This is the maximum payload size of a single outbound websocket frame,
+/// larger messages will be sent as multiple fragments. Default is 2048.
+DECLARE_CONST(httpd_websocket_fragment_size);
+
+/// This is the maximum number of bytes that can be queued for a single
+/// websocket client, messages exceeding this limit will be dropped. Default
+/// is 16384.
+DECLARE_CONST(httpd_websocket_max_queue_size);
+
+/// This is the number of consecutive messages that can be dropped for a single
+/// websocket client before it is disconnected as a slow consumer. Default is
+/// 8.
+DECLARE_CONST(httpd_websocket_max_dropped);
+
+/// This is the maximum size of a websocket message that will be reassembled
+/// and delivered to the @ref WebSocketHandler as a single event, larger
+/// messages will be delivered in pieces. Default is 4096.
+DECLARE_CONST(httpd_websocket_max_message_size);
+
 /// This controls the Cache-Control: max-age=XXX value in the response headers
 /// for static content.
 DECLARE_CONST(httpd_cache_max_age_sec);
 
+/// This controls how many HTTP connections can be processed at one time, the
+/// @ref HttpRequestFlow instances (and their buffers) are allocated up front.
+/// Default is 4.
+DECLARE_CONST(httpd_max_connections);
+
+/// This is the number of milliseconds a @ref REQUEST_CLASS_BULK request can
+/// run before it will yield the executor for httpd_bulk_yield_ms.
+DECLARE_CONST(httpd_bulk_time_slice_ms);
+
+/// This is the number of milliseconds a @ref REQUEST_CLASS_BULK request will
+/// yield the executor for once the time slice has been used.
+DECLARE_CONST(httpd_bulk_yield_ms);
+
+/// This is the maximum number of bytes per second that a single
+/// @ref REQUEST_CLASS_BULK request will transfer. A value of zero disables
+/// the rate limit.
+DECLARE_CONST(httpd_bulk_rate_limit);
+
+/// This controls how many URIs will have individual metrics collected, any
+/// additional URIs will be combined into a single entry. Default is 24.
+DECLARE_CONST(httpd_metrics_max_uris);
+
+/// This controls how many accepted HTTP connections can wait for a free
+/// @ref HttpRequestFlow, any further connections will receive a 503 (Service
+/// Unavailable) response. A value of zero disables the queue. Default is 8.
+DECLARE_CONST(httpd_connection_queue_size);
+
 /// Commonly used HTTP status codes.
 /// @enum HttpStatusCode
 enum HttpStatusCode
@@ -210,22 +269,30 @@ enum HttpMethod
 enum HttpHeader
 {
   ACCEPT,
+  ACCEPT_RANGES,
   CACHE_CONTROL,
   CONNECTION,
   CONTENT_ENCODING,
   CONTENT_TYPE,
   CONTENT_LENGTH,
   CONTENT_DISPOSITION,
+  CONTENT_RANGE,
+  ETAG,
   EXPECT,
   HOST,
   IF_MODIFIED_SINCE,
+  IF_NONE_MATCH,
   LAST_MODIFIED,
   LOCATION,
   ORIGIN,
+  RANGE,
+  TRANSFER_ENCODING,
   UPGRADE,
   WS_VERSION,
   WS_KEY,
   WS_ACCEPT,
+  /// Number of well-known headers, this must always be the last entry.
+  HTTP_HEADER_COUNT
 };
 
 /// Commonly used and well-known values for the Content-Type HTTP header.
@@ -239,6 +306,19 @@ enum ContentType
   UNKNOWN_TYPE
 };
 
+/// Scheduling class of an HTTP request.
+enum RequestClass : uint8_t
+{
+  /// Latency sensitive request (locomotive, turnout, power, etc), these are
+  /// processed without any throttling.
+  REQUEST_CLASS_CONTROL,
+
+  /// Large transfer (OTA, static content, file system, etc), these will
+  /// periodically yield the executor and are rate limited so that
+  /// @ref REQUEST_CLASS_CONTROL requests are not delayed.
+  REQUEST_CLASS_BULK
+};
+
 /// WebSocket events for the @ref WebSocketHandler callback.
 typedef enum
 {
@@ -248,15 +328,43 @@ typedef enum
   /// A WebSocket connection has been closed.
   WS_EVENT_DISCONNECT,
 
-  /// A TEXT message has been received from a WebSocket. Note that it may be
-  /// sent to the handler in pieces.
+  /// A TEXT message has been received from a WebSocket. Note that messages
+  /// larger than httpd_websocket_max_message_size will be sent to the handler
+  /// in pieces.
   WS_EVENT_TEXT,
   
-  /// A BINARY message has been received from a WebSocket. Note that it may be
-  /// sent to the handler in pieces.
+  /// A BINARY message has been received from a WebSocket. Note that messages
+  /// larger than httpd_websocket_max_message_size will be sent to the handler
+  /// in pieces.
   WS_EVENT_BINARY
 } WebSocketEvent;
 
+/// WebSocket frame opcodes.
+typedef enum
+{
+  /// Continuation of a fragmented message.
+  OP_CONTINUATION = 0x0,
+
+  /// TEXT message.
+  OP_TEXT         = 0x1,
+
+  /// BINARY message.
+  OP_BINARY       = 0x2,
+
+  /// Connection close.
+  OP_CLOSE        = 0x8,
+
+  /// Ping request, the peer will respond with @ref OP_PONG.
+  OP_PING         = 0x9,
+
+  /// Ping response.
+  OP_PONG         = 0xA,
+} WebSocketOpcode;
+
+/// Encoded WebSocket frame(s) for a single message, this can be shared by
+/// multiple @ref WebSocketFlow instances.
+typedef std::shared_ptr<const std::string> WebSocketFrame;
+
 // Values for Cache-Control
 // TODO: introduce enum constants for these
 static constexpr const char * HTTP_CACHE_CONTROL_NO_CACHE = "no-cache";
@@ -266,6 +374,10 @@ static constexpr const char * HTTP_CACHE_CONTROL_MAX_AGE = "max-age";
 static constexpr const char * HTTP_CACHE_CONTROL_PUBLIC = "public";
 static constexpr const char * HTTP_CACHE_CONTROL_PRIVATE = "private";
 static constexpr const char * HTTP_CACHE_CONTROL_MUST_REVALIDATE = "must-revalidate";
+static constexpr const char * HTTP_CACHE_CONTROL_IMMUTABLE = "immutable";
+
+/// Cache-Control: max-age=XXX value for immutable static content (one year).
+static constexpr uint32_t HTTP_CACHE_IMMUTABLE_MAX_AGE_SEC = 31536000;
 
 // Values for Connection header
 // TODO: introduce enum constants for these
@@ -276,6 +388,12 @@ static constexpr const char * HTTP_CONNECTION_UPGRADE = "Upgrade";
 // TODO: introduce enum constant for this value
 static constexpr const char * HTTP_UPGRADE_HEADER_WEBSOCKET = "websocket";
 
+// Values for Transfer-Encoding header
+static constexpr const char * HTTP_TRANSFER_ENCODING_CHUNKED = "chunked";
+
+// Range unit for the Range, Content-Range and Accept-Ranges headers
+static constexpr const char * HTTP_RANGE_UNIT_BYTES = "bytes";
+
 // HTTP end of line characters
 static constexpr const char * HTML_EOL = "\r\n";
 
@@ -308,6 +426,14 @@ class HttpRequestFlow;
 /// various classes.
 class Httpd;
 
+/// Forward declaration of the HttpRequest so it can be used by the
+/// @ref FileResponse.
+class HttpRequest;
+
+/// Forward declaration of the HttpRoute so it can access internal methods of
+/// various classes.
+class HttpRoute;
+
 /// This is the base class for an HTTP response.
 class AbstractHttpResponse
 {
@@ -373,6 +499,39 @@ public:
     return 0;
   }
 
+  /// Reads the next block of the response body for responses which do not
+  /// keep the body in memory (@ref get_body returns nullptr).
+  ///
+  /// @param buf is the buffer to fill.
+  /// @param size is the number of bytes to read.
+  ///
+  /// @return the number of bytes read, a value less than size indicates an
+  /// error.
+  ///
+  /// Note: this method should be overriden by sub-classes which stream the
+  /// response body.
+  virtual size_t read_body(uint8_t *buf, size_t size)
+  {
+    return 0;
+  }
+
+  /// @return true if the response body is generated on demand via
+  /// @ref next_chunk and sent using "Transfer-Encoding: chunked".
+  virtual bool is_chunked()
+  {
+    return false;
+  }
+
+  /// Generates the next block of a chunked response body.
+  ///
+  /// @param body is the buffer to append the generated content to.
+  ///
+  /// @return false when the response body is complete.
+  virtual bool next_chunk(std::string &body)
+  {
+    return false;
+  }
+
   /// @return the mime type to include in the HTTP response header.
   ///
   /// Note: this method should be overriden by sub-classes to supply the
@@ -395,6 +554,14 @@ protected:
   /// @param value is the HTTP header value to add.
   void header(const HttpHeader name, const std::string &value);
 
+  /// Updates the @ref HttpStatusCode for the response.
+  ///
+  /// @param code is the new @ref HttpStatusCode to use.
+  void set_status(HttpStatusCode code)
+  {
+    code_ = code;
+  }
+
 private:
   /// Collection of headers and values for this HTTP response.
   std::map<std::string, std::string> headers_;
@@ -473,9 +640,24 @@ public:
   /// @param mime_type is the value to send in the Content-Type HTTP header.
   /// @param encoding is the optional encoding to send in the Content-Encoding
   /// HTTP Header.
+  /// @param immutable when true the client will be instructed to cache the
+  /// payload without revalidation.
   StaticResponse(const uint8_t *payload, const size_t length
                , const std::string mime_type
-               , const std::string encoding = HTTP_ENCODING_NONE);
+               , const std::string encoding = HTTP_ENCODING_NONE
+               , bool immutable = false);
+
+  /// @return the entity tag for the payload.
+  const std::string &etag()
+  {
+    return etag_;
+  }
+
+  /// @return the Cache-Control header value for the payload.
+  const std::string &cache_control()
+  {
+    return cache_control_;
+  }
 
   /// @return the pre-formatted body of this response.
   const uint8_t *get_body() override
@@ -495,6 +677,24 @@ private:
 
   /// Length of the payload to return for this URI.
   const size_t length_;
+
+  /// Entity tag for the payload, this is calculated from the payload content.
+  std::string etag_;
+
+  /// Cache-Control header value for the payload.
+  std::string cache_control_;
+};
+
+/// HTTP Response object used when the client has an up-to-date copy of a
+/// @ref StaticResponse.
+class NotModifiedResponse : public AbstractHttpResponse
+{
+public:
+  /// Constructor.
+  ///
+  /// @param response is the @ref StaticResponse to copy the validators and
+  /// caching directives from.
+  NotModifiedResponse(StaticResponse *response);
 };
 
 /// HTTP Response object which can be used to return a string based response to
@@ -549,10 +749,133 @@ public:
   }
 };
 
+/// HTTP Response object which streams the content of a file to the client.
+///
+/// The file is read in blocks as the response is transmitted so the memory
+/// usage does not depend on the size of the file. A single byte range may be
+/// requested via the @ref HttpHeader::RANGE header.
+class FileResponse : public AbstractHttpResponse
+{
+public:
+  /// Constructor.
+  ///
+  /// @param path is the file to send as the HTTP response body.
+  /// @param mime_type is the value to use for the Content-Type HTTP header.
+  /// @param request is the @ref HttpRequest being responded to, when provided
+  /// the @ref HttpHeader::RANGE header will be honored.
+  FileResponse(const std::string &path, const std::string &mime_type
+             , HttpRequest *request = nullptr);
+
+  /// Destructor.
+  ~FileResponse();
+
+  /// @return nullptr as the body is read via @ref read_body.
+  const uint8_t *get_body() override
+  {
+    return nullptr;
+  }
+
+  /// @return the number of bytes that will be sent for this response.
+  size_t get_body_length() override
+  {
+    return length_;
+  }
+
+  /// Reads the next block of the file.
+  ///
+  /// @param buf is the buffer to fill.
+  /// @param size is the number of bytes to read.
+  ///
+  /// @return the number of bytes read.
+  size_t read_body(uint8_t *buf, size_t size) override;
+
+private:
+  /// Parses the @ref HttpHeader::RANGE header value and updates the response
+  /// status and headers accordingly.
+  ///
+  /// @param range is the value of the @ref HttpHeader::RANGE header.
+  /// @param size is the total size of the file.
+  void parse_range(const std::string &range, size_t size);
+
+  /// File handle for the file being sent.
+  int fd_{-1};
+
+  /// Number of bytes to send from the file.
+  size_t length_{0};
+};
+
+/// Callback used by @ref ChunkedResponse to generate the response body.
+///
+/// The first parameter is the number of times the callback has been invoked
+/// previously for the response. The second parameter is the buffer to append
+/// content to. The return value should be false once the body is complete.
+typedef std::function<bool(size_t /** index */
+                         , std::string & /** body */)> BodyGenerator;
+
+/// HTTP Response object which generates the response body on demand and sends
+/// it using "Transfer-Encoding: chunked".
+///
+/// The generator will be invoked repeatedly until it has produced at least
+/// config_httpd_response_chunk_size() bytes or it indicates the body is
+/// complete, the accumulated content is then sent as a single chunk. This
+/// keeps the memory usage of the response independent of the body size.
+class ChunkedResponse : public AbstractHttpResponse
+{
+public:
+  /// Constructor.
+  ///
+  /// @param generator is the @ref BodyGenerator for the response body.
+  /// @param mime_type is the value to use for the Content-Type HTTP header.
+  ChunkedResponse(BodyGenerator generator, const std::string &mime_type);
+
+  /// @return true.
+  bool is_chunked() override
+  {
+    return true;
+  }
+
+  /// Generates the next block of the response body.
+  ///
+  /// @param body is the buffer to append the generated content to.
+  ///
+  /// @return false when the response body is complete.
+  bool next_chunk(std::string &body) override
+  {
+    return generator_(index_++, body);
+  }
+
+private:
+  /// @ref BodyGenerator for the response body.
+  BodyGenerator generator_;
+
+  /// Number of times the @ref BodyGenerator has been invoked.
+  size_t index_{0};
+};
+
+/// Specialized @ref ChunkedResponse which generates a JSON array one element
+/// at a time.
+class JsonArrayResponse : public ChunkedResponse
+{
+public:
+  /// Constructor.
+  ///
+  /// @param generator is the @ref BodyGenerator for the array elements, it
+  /// will be called with the index of the element to append and should return
+  /// false (without appending any content) when there are no more elements.
+  JsonArrayResponse(BodyGenerator generator);
+};
+
 /// Runtime state of an HTTP Request.
+///
+/// The request line, headers and any url-encoded form body are stored in a
+/// single buffer which is parsed in place. Headers and parameters reference
+/// regions of this buffer rather than holding copies of the data.
 class HttpRequest
 {
 public:
+  /// Constructor.
+  HttpRequest();
+
   /// @return the parsed well-known @ref HttpMethod.
   HttpMethod method();
 
@@ -571,11 +894,26 @@ public:
 
   /// @return the value of the named HTTP Header or a blank string if it does
   /// not exist.
-  const std::string &header(const std::string name);
+  std::string header(const std::string &name);
 
   /// @return the value of the well-known @ref HttpHeader or a blank string if
   /// it does not exist.
-  const std::string &header(const HttpHeader name);
+  std::string header(const HttpHeader name);
+
+  /// @return true if the well-known @ref HttpHeader exists and matches the
+  /// provided value (case-insensitive).
+  /// @param name is the @ref HttpHeader to check.
+  /// @param value is the value to compare against.
+  bool header_equals(const HttpHeader name, const char *value);
+
+  /// @return the value of the @ref HttpHeader::CONTENT_LENGTH header or zero
+  /// if it is not present or not a valid number.
+  size_t content_length();
+
+  /// @return true if the @ref HttpHeader::IF_NONE_MATCH header is present and
+  /// contains the provided entity tag (or "*").
+  /// @param etag is the entity tag to check for, including quotes.
+  bool if_none_match(const std::string &etag);
 
   /// @return true if the well-known @ref HttpHeader::CONNECTION header exists
   /// with a value of "keep-alive".
@@ -626,35 +964,109 @@ private:
   /// Gives @ref HttpRequestFlow access to protected/private members.
   friend class HttpRequestFlow;
 
+  /// Gives @ref Httpd access to protected/private members.
+  friend class Httpd;
+
+  /// Gives @ref HttpRoute access to protected/private members.
+  friend class HttpRoute;
+
+  /// Reference to a region of @ref raw_.
+  struct Segment
+  {
+    /// Offset of the first character in @ref raw_.
+    uint32_t offs;
+
+    /// Number of characters in the region.
+    uint32_t len;
+  };
+
+  /// Name/value pair referencing regions of @ref raw_.
+  struct Field
+  {
+    /// Name of the field.
+    Segment name;
+
+    /// Value of the field.
+    Segment value;
+  };
+
+  /// Path parameter captured by the @ref HttpRoute matching this request.
+  struct PathParam
+  {
+    /// Name of the parameter, this is owned by the @ref HttpRoute.
+    const std::string *name;
+
+    /// Value of the parameter.
+    Segment value;
+  };
+
   /// Sets the @ref HttpMethod if it is well-known, otherwise only the unparsed
   /// value will be available.
   ///
   /// @param value is the raw value parsed from the first line of the HTTP
   /// request stream.
-  void method(const std::string &value);
+  /// @param len is the length of the value.
+  void method(const char *value, size_t len);
 
-  /// Sets the URI of the HttpRequest.
+  /// Parses the request line (METHOD URI VERSION) in place.
   ///
-  /// @param value is the value of the URI.
-  void uri(const std::string &value);
+  /// @param offs is the offset in @ref raw_ of the start of the line.
+  /// @param len is the length of the line (excluding EOL).
+  /// @return true if the line was parsed successfully.
+  bool parse_request_line(size_t offs, size_t len);
 
-  /// Adds a URI parameter to the request.
+  /// Parses a single header line in place.
   ///
-  /// @param name is the name of the parameter.
-  /// @param value is the value of the parameter.
-  void param(const string &name, const string &value);
+  /// @param offs is the offset in @ref raw_ of the start of the line.
+  /// @param len is the length of the line (excluding EOL).
+  void parse_header_line(size_t offs, size_t len);
 
-  /// Adds an HTTP Header to the request.
+  /// Parses '&' delimited name=value pairs in place, the names and values
+  /// will be URL decoded.
   ///
-  /// @param name is the name of the header.
-  /// @param value is the value of the header.
-  void header(const string &name, const string &value);
+  /// @param offs is the offset in @ref raw_ of the first character.
+  /// @param len is the number of characters to parse.
+  void parse_params(size_t offs, size_t len);
 
   /// Adds/replaces a HTTP Header to the request.
   ///
   /// @param header is the @ref HttpHeader to add/replace.
   /// @param value is the value for the header.
-  void header(HttpHeader header, std::string value);
+  void header(HttpHeader header, const std::string &value);
+
+  /// @return pointer to the start of a @ref Segment.
+  const char *data(const Segment &segment)
+  {
+    return raw_.data() + segment.offs;
+  }
+
+  /// @return true if the @ref Segment matches the provided string.
+  /// @param segment is the @ref Segment to compare.
+  /// @param value is the value to compare against.
+  /// @param ignore_case will use a case-insensitive comparison when true.
+  bool matches(const Segment &segment, const char *value
+             , bool ignore_case = false);
+
+  /// @return the @ref Field with the provided name, nullptr if not found.
+  /// @param fields is the collection of @ref Field to search.
+  /// @param name is the name of the @ref Field to search for.
+  /// @param ignore_case will use a case-insensitive comparison when true.
+  Field *find(std::vector<Field> &fields, const std::string &name
+            , bool ignore_case);
+
+  /// @return the value of the named path, query or form parameter, nullptr
+  /// if not found. Path parameters take precedence over query and form
+  /// parameters.
+  /// @param name is the name of the parameter to search for.
+  const Segment *find_param(const std::string &name);
+
+  /// Records a path parameter for this request.
+  ///
+  /// @param name is the name of the parameter.
+  /// @param offs is the offset of the value in @ref uri_.
+  /// @param len is the length of the value.
+  /// @return false if the maximum number of parameters has been reached.
+  bool add_path_param(const std::string *name, size_t offs, size_t len);
 
   /// Resets the internal state of the @ref HttpRequest to defaults so it can
   /// be reused for subsequent requests.
@@ -668,12 +1080,35 @@ private:
   /// default return value when a requested header or parameter is not known.
   const std::string no_value_{""};
 
+  /// Raw request data, this contains the request line, headers and the body
+  /// payload of an application/x-www-form-urlencoded request. Up to
+  /// httpd_max_header_size bytes of capacity is retained across requests.
+  std::string raw_;
+
+  /// Well-known headers that have been parsed from the HTTP request stream,
+  /// indexed by @ref HttpHeader.
+  Segment known_headers_[HttpHeader::HTTP_HEADER_COUNT];
+
+  /// Bit mask of the @ref known_headers_ entries that are present.
+  uint32_t known_header_mask_{0};
+
   /// Collection of HTTP Headers that have been parsed from the HTTP request
-  /// stream.
-  std::map<std::string, std::string> headers_;
+  /// stream which are not one of the well-known @ref HttpHeader values.
+  std::vector<Field> headers_;
+
+  /// Collection of parameters supplied with the HTTP Request after the URI or
+  /// via an application/x-www-form-urlencoded body payload.
+  std::vector<Field> params_;
+
+  /// Collection of parameters captured from the URI path by the
+  /// @ref HttpRoute matching this request.
+  std::vector<PathParam> path_params_;
 
-  /// Collection of parameters supplied with the HTTP Request after the URI.
-  std::map<std::string, std::string> params_;
+  /// @ref HttpRoute matching this request, nullptr if there is none.
+  HttpRoute *route_{nullptr};
+
+  /// Offset of the URI in @ref raw_.
+  uint32_t uri_offs_{0};
 
   /// Parsed @ref HttpMethod for this @ref HttpRequest.
   HttpMethod method_;
@@ -740,6 +1175,94 @@ AbstractHttpResponse * name (HttpRequest * request                        \
                              , size_t offset, bool final, bool * abort)
 
 
+/// Node of the @ref Httpd URI routing trie.
+///
+/// Each node represents a single path segment of a registered URI. A segment
+/// can be a literal value, "{name}" which matches any single path segment or
+/// "{name:int}" which matches a path segment of decimal digits. Matched
+/// parameter segments are available via @ref HttpRequest::param. Literal
+/// segments take precedence over parameter segments when matching.
+///
+/// Routes are matched in O(path length) without allocating memory.
+class HttpRoute
+{
+public:
+  /// Constructor.
+  ///
+  /// @param segment is the path segment for this node.
+  HttpRoute(const std::string &segment);
+
+  /// Adds a URI pattern below this node.
+  ///
+  /// @param uri is the URI pattern to add, this must start with a "/".
+  ///
+  /// @return the @ref HttpRoute for the last segment of the URI pattern.
+  HttpRoute *add(const std::string &uri);
+
+  /// Searches for the @ref HttpRoute matching the URI of a request.
+  ///
+  /// @param request is the @ref HttpRequest to match, any path parameters
+  /// will be recorded in it.
+  /// @param offs is the offset in the URI of the next path segment.
+  ///
+  /// @return the @ref HttpRoute for the URI or nullptr if there is none.
+  HttpRoute *match(HttpRequest *request, size_t offs = 1);
+
+  /// @return the URI pattern that was registered for this node, this will be
+  /// empty for intermediate nodes.
+  const std::string &uri()
+  {
+    return uri_;
+  }
+
+private:
+  /// Types of path segments.
+  enum SegmentType : uint8_t
+  {
+    /// Path segment must match exactly.
+    LITERAL,
+
+    /// Path segment must be one or more decimal digits.
+    INT_PARAM,
+
+    /// Path segment can be any non-empty value.
+    PARAM
+  };
+
+  /// @return true if a path segment matches this node.
+  /// @param segment is the start of the path segment.
+  /// @param len is the length of the path segment.
+  bool matches(const char *segment, size_t len);
+
+  /// Literal path segment or name of the parameter.
+  std::string name_;
+
+  /// URI pattern registered for this node.
+  std::string uri_;
+
+  /// @ref SegmentType of this node.
+  SegmentType type_{LITERAL};
+
+  /// @ref HttpMethod values accepted by this node, zero when the node is only
+  /// an intermediate segment.
+  size_t method_mask_{0};
+
+  /// @ref RequestProcessor for this node.
+  RequestProcessor handler_{nullptr};
+
+  /// @ref StreamProcessor for this node.
+  StreamProcessor stream_handler_{nullptr};
+
+  /// @ref RequestClass for requests handled by this node.
+  RequestClass request_class_{REQUEST_CLASS_CONTROL};
+
+  /// Child nodes, ordered by @ref SegmentType.
+  std::vector<std::unique_ptr<HttpRoute>> children_;
+
+  /// Gives @ref Httpd access to protected/private members.
+  friend class Httpd;
+};
+
 /// WebSocket processing Handler.
 ///
 /// This method will be invoked when there is an event to be processed.
@@ -770,6 +1293,222 @@ void name (WebSocketFlow *, WebSocketEvent, const uint8_t *, size_t);
 void name (WebSocketFlow * websocket, WebSocketEvent event \
            , const uint8_t * data, size_t length)
 
+/// Fixed size latency histogram, all values are in microseconds.
+struct HttpLatencyHistogram
+{
+  /// Number of buckets in the histogram, the last bucket has no upper bound.
+  static constexpr size_t BUCKET_COUNT = 11;
+
+  /// Upper bound (inclusive) of each bucket in microseconds.
+  static const uint32_t BUCKET_LIMITS[BUCKET_COUNT - 1];
+
+  /// Records a single value in the histogram.
+  ///
+  /// @param usec is the value to record.
+  void record(uint32_t usec);
+
+  /// Number of values recorded in each bucket (not cumulative).
+  uint32_t buckets[BUCKET_COUNT]{0};
+
+  /// Number of values recorded.
+  uint32_t count{0};
+
+  /// Sum of all values recorded.
+  uint64_t sum{0};
+};
+
+/// Performance metrics for the @ref Httpd server.
+///
+/// All storage is allocated when this object is created, requests for URIs
+/// beyond httpd_metrics_max_uris are combined into a single "(other)" entry.
+class HttpMetrics
+{
+public:
+  /// Constructor.
+  HttpMetrics();
+
+  /// Records a completed HTTP request.
+  ///
+  /// @param uri is the registered URI pattern (or URI) of the request.
+  /// @param error should be true if the request was not successful.
+  /// @param reused should be true if the connection was kept alive from a
+  /// previous request.
+  /// @param bytes_in is the number of bytes received for the request.
+  /// @param bytes_out is the number of bytes sent for the response.
+  /// @param parse_usec is the time spent receiving and parsing the request.
+  /// @param handler_usec is the time spent generating the response.
+  /// @param send_usec is the time spent sending the response.
+  void record_request(const std::string &uri, bool error, bool reused
+                    , size_t bytes_in, size_t bytes_out, uint32_t parse_usec
+                    , uint32_t handler_usec, uint32_t send_usec);
+
+  /// Records that a connection has been assigned to an @ref HttpRequestFlow.
+  void connection_opened();
+
+  /// Records that a connection has been released by an @ref HttpRequestFlow.
+  void connection_closed();
+
+  /// Records that a connection has been rejected due to no available
+  /// @ref HttpRequestFlow.
+  void connection_rejected();
+
+  /// Records that a @ref WebSocketFlow has been registered.
+  void websocket_opened();
+
+  /// Records that a @ref WebSocketFlow has been removed.
+  void websocket_closed();
+
+  /// Records a WebSocket frame received from a client.
+  ///
+  /// @param len is the payload length of the frame.
+  void websocket_frame_received(size_t len);
+
+  /// Records a WebSocket frame sent to a client.
+  ///
+  /// @param len is the payload length of the frame.
+  void websocket_frame_sent(size_t len);
+
+  /// Records a WebSocket message dropped due to a full client queue.
+  void websocket_message_dropped();
+
+  /// Records a WebSocket client disconnected as a slow consumer.
+  void websocket_slow_consumer();
+
+  /// Generates the metrics as a JSON document, this is intended to be used
+  /// as the @ref BodyGenerator for a @ref ChunkedResponse.
+  ///
+  /// @param index is the index of the section to generate.
+  /// @param body is the buffer to append the section to.
+  ///
+  /// @return false when the document is complete.
+  bool to_json(size_t index, std::string &body);
+
+  /// Generates the metrics in the Prometheus text exposition format, this is
+  /// intended to be used as the @ref BodyGenerator for a
+  /// @ref ChunkedResponse.
+  ///
+  /// @param index is the index of the section to generate.
+  /// @param body is the buffer to append the section to.
+  ///
+  /// @return false when the document is complete.
+  bool to_prometheus(size_t index, std::string &body);
+
+private:
+  /// Metrics for a single URI.
+  struct UriMetrics
+  {
+    /// URI pattern (or URI) for these metrics.
+    std::string uri;
+
+    /// Number of requests received.
+    uint32_t requests{0};
+
+    /// Number of requests which resulted in an error.
+    uint32_t errors{0};
+
+    /// Number of bytes received.
+    uint64_t bytes_in{0};
+
+    /// Number of bytes sent.
+    uint64_t bytes_out{0};
+
+    /// Total time spent receiving and parsing requests.
+    uint64_t parse_usec{0};
+
+    /// Total time spent generating responses.
+    uint64_t handler_usec{0};
+
+    /// Total time spent sending responses.
+    uint64_t send_usec{0};
+
+    /// Total request processing time.
+    HttpLatencyHistogram latency;
+  };
+
+  /// WebSocket frame counters for a single direction.
+  struct FrameMetrics
+  {
+    /// Number of frames.
+    uint32_t frames{0};
+
+    /// Number of payload bytes.
+    uint64_t bytes{0};
+
+    /// Start of the current rate measurement window.
+    uint64_t window_start{0};
+
+    /// Number of frames in the current rate measurement window.
+    uint32_t window_frames{0};
+
+    /// Frames per second from the last completed measurement window.
+    float rate{0};
+
+    /// Records a frame and updates the rate.
+    ///
+    /// @param len is the payload length of the frame.
+    /// @param now is the current time.
+    void record(size_t len, uint64_t now);
+
+    /// Updates the rate if the measurement window has elapsed.
+    ///
+    /// @param now is the current time.
+    void update(uint64_t now);
+  };
+
+  /// @return the @ref UriMetrics for the URI, if the table is full the
+  /// "(other)" entry will be returned.
+  /// @param uri is the URI to find.
+  UriMetrics *find(const std::string &uri);
+
+  /// Lock protecting all metrics.
+  OSMutex lock_;
+
+  /// Per-URI metrics, the last entry is always "(other)".
+  std::vector<UriMetrics> uris_;
+
+  /// Number of entries used in @ref uris_ (excluding "(other)").
+  size_t uri_count_{0};
+
+  /// Time spent receiving and parsing requests.
+  HttpLatencyHistogram parse_;
+
+  /// Time spent generating responses.
+  HttpLatencyHistogram handler_;
+
+  /// Time spent sending responses.
+  HttpLatencyHistogram send_;
+
+  /// Number of requests received.
+  uint32_t requests_{0};
+
+  /// Number of requests received on a kept-alive connection.
+  uint32_t reused_requests_{0};
+
+  /// Number of connections accepted.
+  uint32_t connections_{0};
+
+  /// Number of connections currently being processed.
+  uint32_t active_connections_{0};
+
+  /// Number of connections rejected.
+  uint32_t rejected_connections_{0};
+
+  /// Number of WebSocket clients currently connected.
+  uint32_t websockets_{0};
+
+  /// Frames received from WebSocket clients.
+  FrameMetrics frames_in_;
+
+  /// Frames sent to WebSocket clients.
+  FrameMetrics frames_out_;
+
+  /// Number of WebSocket messages dropped due to a full client queue.
+  uint32_t ws_dropped_{0};
+
+  /// Number of WebSocket clients disconnected as slow consumers.
+  uint32_t ws_slow_consumers_{0};
+};
+
 /// HTTP Server implementation
 class Httpd : public Service, public Singleton<Httpd>
 {
@@ -804,7 +1543,8 @@ public:
 
   /// Registers a URI with the provided handler.
   ///
-  /// @param uri is the URI to call the provided handler for.
+  /// @param uri is the URI to call the provided handler for, this may include
+  /// path parameters as described in @ref HttpRoute.
   /// @param method_mask is the @ref HttpMethod for this URI, when multiple
   /// @ref HttpMethod values are required they must be ORed together.
   /// @param handler is the @ref RequestProcessor to invoke when this URI is
@@ -812,9 +1552,12 @@ public:
   /// function will not be invoked.
   /// @param stream_handler is the @ref StreamProcessor to invoke when this URI
   /// is requested as POST/PUT and the request has a body payload.
+  /// @param request_class is the @ref RequestClass for this URI, this should
+  /// be @ref REQUEST_CLASS_BULK for URIs that transfer large payloads.
   void uri(const std::string &uri, const size_t method_mask
          , RequestProcessor handler
-         , StreamProcessor stream_handler = nullptr);
+         , StreamProcessor stream_handler = nullptr
+         , RequestClass request_class = REQUEST_CLASS_CONTROL);
 
   /// Registers a URI with the provided handler that can process all
   /// @ref HttpMethod values. Note that any request with a body payload will
@@ -846,9 +1589,13 @@ public:
   /// @param mime_type is the Content-Type parameter to return to the client.
   /// @param encoding is the encoding for the content, if not specified the
   /// Content-Encoding header will not be transmitted.
+  /// @param immutable when true the client will be allowed to cache the
+  /// content without revalidation, this should only be used when the URI
+  /// referenced by clients changes when the content changes.
   void static_uri(const std::string &uri, const uint8_t *content
                 , const size_t length, const std::string &mime_type
-                , const std::string &encoding = HTTP_ENCODING_NONE);
+                , const std::string &encoding = HTTP_ENCODING_NONE
+                , bool immutable = false);
 
   /// Registers a WebSocket handler for a given URI.  ///
   /// @param uri is the URI to process as a WebSocket endpoint.
@@ -862,24 +1609,46 @@ public:
   /// @param data is the binary data to send to the websocket client.
   /// @param length is the length of the binary data to send to the websocket
   /// client.
-  ///
-  /// Note: this is currently unimplemented.
-  void send_websocket_binary(int id, uint8_t *data, size_t length);
+  void send_websocket_binary(int id, const uint8_t *data, size_t length);
 
   /// Sends a text message to a single WebSocket.
   /// 
   /// @param id is the ID of the WebSocket to send the text to.
   /// @param text is the text to send to the WebSocket client.
-  void send_websocket_text(int id, std::string &text);
+  void send_websocket_text(int id, const std::string &text);
+
+  /// Sends a pre-encoded message to a single WebSocket.
+  ///
+  /// @param id is the ID of the WebSocket to send the message to.
+  /// @param frame is the encoded message, see @ref WebSocketFlow::encode.
+  void send_websocket_frame(int id, WebSocketFrame frame);
 
   /// Broadcasts a text message to all connected WebSocket clients.
   ///
   /// @param text is the text to send to all WebSocket clients.
-  void broadcast_websocket_text(std::string &text);
+  void broadcast_websocket_text(const std::string &text);
 
-  /// Creates a new @ref HttpRequestFlow for the provided socket handle.
+  /// Broadcasts a binary message to all connected WebSocket clients.
+  ///
+  /// @param data is the binary data to send to all WebSocket clients.
+  /// @param length is the length of the binary data.
+  void broadcast_websocket_binary(const uint8_t *data, size_t length);
+
+  /// Broadcasts a pre-encoded message to all connected WebSocket clients.
+  ///
+  /// @param frame is the encoded message, see @ref WebSocketFlow::encode.
+  ///
+  /// NOTE: The message is encoded only once and shared by all clients.
+  void broadcast_websocket_frame(WebSocketFrame frame);
+
+  /// Assigns an idle @ref HttpRequestFlow to the provided socket handle.
   ///
   /// @param fd is the socket handle.
+  ///
+  /// When all @ref HttpRequestFlow instances are busy the socket handle will
+  /// be queued until one is released, if the queue is also full the client
+  /// will receive @ref HttpStatusCode::STATUS_SERVICE_UNAVAILABLE and the
+  /// socket will be closed.
   void new_connection(int fd);
 
   /// Enables processing of known captive portal endpoints.
@@ -915,6 +1684,12 @@ public:
                     , std::string auth_uri = "/captiveauth"
                     , uint64_t auth_timeout = UINT32_MAX);
 
+  /// @return the @ref HttpMetrics collected by this server.
+  HttpMetrics *metrics()
+  {
+    return &metrics_;
+  }
+
 private:
   /// Gives @ref WebSocketFlow access to protected/private members.
   friend class WebSocketFlow;
@@ -928,6 +1703,24 @@ private:
   /// Schedules the Executable to be cleaned up in an asynchronous fashion.
   void schedule_cleanup(Executable *flow);
 
+  /// Returns an @ref HttpRequestFlow to the pool of idle flows or assigns it
+  /// the next queued connection.
+  ///
+  /// @param flow is the @ref HttpRequestFlow which has released its
+  /// connection.
+  void release_request_flow(HttpRequestFlow *flow);
+
+  /// @return true if there are accepted connections waiting for a
+  /// @ref HttpRequestFlow.
+  bool has_pending_connections();
+
+  /// Sends a canned @ref HttpStatusCode::STATUS_SERVICE_UNAVAILABLE response
+  /// and closes the socket.
+  ///
+  /// @param fd is the socket handle.
+  /// @param remote_ip is the remote IP address of the client.
+  void reject_connection(int fd, uint32_t remote_ip);
+
   /// Starts the HTTP socket listener.
   void start_http_listener();
 
@@ -956,13 +1749,29 @@ private:
   /// @param id of the WebSocket client to remove.
   void remove_websocket(int id);
 
-  /// @return the @ref RequestProcessor for a URI.
-  /// @param uri is the URI to retrieve the @ref RequestProcessor for.
-  RequestProcessor handler(HttpMethod method, const std::string &uri);
-
-  /// @return the @ref StreamProcessor for a URI.
-  /// @param uri is the URI to retrieve the @ref StreamProcessor for.
-  StreamProcessor stream_handler(const std::string &uri);
+  /// Finds the @ref HttpRoute for a request and records it in the request.
+  ///
+  /// @param request is the @ref HttpRequest to route.
+  ///
+  /// @return the @ref HttpRoute for the request or nullptr if there is none.
+  HttpRoute *route(HttpRequest *request);
+
+  /// @return the @ref RequestProcessor for a request or nullptr if there is
+  /// none for the request URI and method.
+  /// @param request is the @ref HttpRequest to retrieve the
+  /// @ref RequestProcessor for.
+  RequestProcessor *handler(HttpRequest *request);
+
+  /// @return the @ref StreamProcessor for a request or nullptr if there is
+  /// none for the request URI.
+  /// @param request is the @ref HttpRequest to retrieve the
+  /// @ref StreamProcessor for.
+  StreamProcessor *stream_handler(HttpRequest *request);
+
+  /// @return the @ref RequestClass for a request, static URIs are always
+  /// @ref REQUEST_CLASS_BULK.
+  /// @param request is the @ref HttpRequest to classify.
+  RequestClass request_class(HttpRequest *request);
 
   /// @return the @ref WebSocketHandler for the provided URI.
   /// @param uri is the URI to retrieve the @ref WebSocketHandler for.
@@ -976,8 +1785,9 @@ private:
   /// evaluate the request for static_uri and redirect registered endpoints.
   ///
   /// For a static_uri endpoint the request headers will be evaluated for the
-  /// presence of @ref HttpHeader::IF_MODIFIED_SINCE and will return either the
-  /// requested resource or a @ref AbstractHttpResponse with
+  /// presence of @ref HttpHeader::IF_NONE_MATCH (or
+  /// @ref HttpHeader::IF_MODIFIED_SINCE when not present) and will return
+  /// either the requested resource or a @ref AbstractHttpResponse with
   /// @ref HttpStatusCode::STATUS_NOT_MODIFIED as the code if the resource has
   /// not been modified.
   std::shared_ptr<AbstractHttpResponse> response(HttpRequest *request);
@@ -1022,16 +1832,15 @@ private:
   /// Internal state flag for the dns_ being active.
   bool dns_active_{false};
 
-  /// Internal map of all registered @ref RequestProcessor handlers.
-  std::map<std::string, std::pair<size_t, RequestProcessor>> handlers_;
-
-  /// Internal map of all registered @ref RequestProcessor handlers.
-  std::map<std::string, StreamProcessor> stream_handlers_;
+  /// Root of the routing trie for all registered @ref RequestProcessor and
+  /// @ref StreamProcessor handlers.
+  HttpRoute routes_{""};
 
   /// Internal map of all registered static URIs to use when the client does
-  /// not specify the @ref HttpHeader::IF_MODIFIED_SINCE or the value is not
-  /// the current version.
-  std::map<std::string, std::shared_ptr<AbstractHttpResponse>> static_uris_;
+  /// not specify the @ref HttpHeader::IF_NONE_MATCH or
+  /// @ref HttpHeader::IF_MODIFIED_SINCE or the value is not the current
+  /// version.
+  std::map<std::string, std::shared_ptr<StaticResponse>> static_uris_;
 
   /// Internal map of all registeres static URIs to use when resource has not
   /// been modified since the client last retrieved it.
@@ -1049,6 +1858,23 @@ private:
   /// Lock object for websockets_.
   OSMutex websocketsLock_;
 
+  /// All @ref HttpRequestFlow instances owned by this server, these are
+  /// created when the server is initialized and reused for all connections.
+  std::vector<HttpRequestFlow *> request_flows_;
+
+  /// @ref HttpRequestFlow instances which are not assigned a connection.
+  std::vector<HttpRequestFlow *> idle_request_flows_;
+
+  /// Accepted connections (socket handle and remote IP) which are waiting
+  /// for an @ref HttpRequestFlow to be released.
+  std::vector<std::pair<int, uint32_t>> pending_connections_;
+
+  /// Lock object for idle_request_flows_ and pending_connections_.
+  OSMutex requestFlowsLock_;
+
+  /// Performance metrics for this server.
+  HttpMetrics metrics_;
+
   /// Captive portal response for HTTP 204 NO CONTENT.
   std::shared_ptr<AbstractHttpResponse> captive_no_content_;
 
@@ -1092,14 +1918,23 @@ class HttpRequestFlow : private StateFlowBase
 public:
   /// Constructor.
   ///
-  /// @param server is the @ref Httpd server owning this request.
-  /// @param fd is the socket handle.
-  /// @param remote_ip is the remote IP address of the client.
-  HttpRequestFlow(Httpd *server, int fd, uint32_t remote_ip);
+  /// @param server is the @ref Httpd server owning this request flow.
+  ///
+  /// The flow will wait for a connection to be assigned via @ref start.
+  HttpRequestFlow(Httpd *server);
 
   /// Destructor.
   ~HttpRequestFlow();
 
+  /// Assigns a newly accepted socket connection to this flow and wakes it up
+  /// to start processing requests.
+  ///
+  /// @param fd is the socket handle.
+  /// @param remote_ip is the remote IP address of the client.
+  ///
+  /// Note: This must only be called on an idle flow.
+  void start(int fd, uint32_t remote_ip);
+
 private:
   /// @ref StateFlowTimedSelectHelper which assists in reading/writing of the
   /// request data stream.
@@ -1115,21 +1950,25 @@ private:
   /// body.
   const size_t body_read_size_{(size_t)config_httpd_body_chunk_size()};
 
+  /// Maximum size of the request line and headers.
+  const size_t max_header_size_{(size_t)config_httpd_max_header_size()};
+
   /// @ref Httpd instance that owns this request.
   Httpd *server_;
 
-  /// Underlying socket handle for this request.
-  int fd_;
+  /// Underlying socket handle for this request, -1 when idle.
+  int fd_{-1};
 
   /// Remote client IP (if known).
-  uint32_t remote_ip_;
+  uint32_t remote_ip_{0};
 
-  /// @ref HttpRequest data holder.
+  /// @ref HttpRequest data holder, this is retained (including the buffers)
+  /// while the flow is idle.
   HttpRequest req_;
 
   /// Flag to indicate that the underlying socket handle should be closed when
-  /// this @ref HttpRequestFlow is deleted. In the case of a WebSocket the
-  /// socket needs to be preserved.
+  /// the connection is released. In the case of a WebSocket the socket needs
+  /// to be preserved.
   bool close_{true};
 
   /// Temporary buffer used for reading the HTTP request.
@@ -1141,18 +1980,61 @@ private:
   /// Total size of the request body.
   size_t body_len_;
 
-  /// Temporary accumulator for the HTTP header data as it is being parsed.
+  /// Temporary accumulator for the multipart/form-data segment headers as
+  /// they are being parsed.
   std::string raw_header_;
 
+  /// Offset into the @ref HttpRequest buffer of the next unparsed line.
+  size_t parse_offs_{0};
+
   /// @ref AbstractHttpResponse that represents the response to this request.
   std::shared_ptr<AbstractHttpResponse> res_;
 
   /// Index into the response body payload.
   size_t response_body_offs_{0};
 
-  /// Request start time.
+  /// Number of bytes of the response body sent by the last write.
+  size_t response_body_chunk_{0};
+
+  /// Buffer for the current chunk of a chunked response body.
+  std::string response_chunk_;
+
+  /// Request start time, this is when the first data for the request was
+  /// received.
   uint64_t start_time_;
 
+  /// Time when the flow started waiting for the request, this is used to
+  /// close idle connections.
+  uint64_t idle_start_;
+
+  /// Time when the request handler was invoked.
+  uint64_t handler_time_;
+
+  /// Time when sending of the response started.
+  uint64_t send_time_;
+
+  /// Number of bytes sent for the response.
+  size_t bytes_out_;
+
+  /// Set to true when the current request is a @ref REQUEST_CLASS_BULK
+  /// request.
+  bool bulk_{false};
+
+  /// Time when the bulk transfer started.
+  uint64_t bulk_start_;
+
+  /// Number of bytes transferred by the bulk request.
+  uint64_t bulk_bytes_;
+
+  /// Start of the current bulk processing time slice.
+  uint64_t slice_start_;
+
+  /// State to continue with after @ref throttle_bulk.
+  Callback throttle_next_;
+
+  /// Timer used to delay bulk requests.
+  StateFlowTimer timer_{this};
+
   /// Current request number for this client connection.
   uint8_t req_count_{0};
 
@@ -1185,15 +2067,17 @@ private:
 
   /// Temporary holder of the @ref StreamProcessor to avoid subsequent lookups
   /// during streaming of the parts.
-  StreamProcessor part_stream_{nullptr};
+  StreamProcessor *part_stream_{nullptr};
 
   /// Response to send when a PUT/POST of multipart/form-data is received this
   /// needs to be sent before the client will send the content to be processed.
   std::string multipart_res_{"HTTP/1.1 100 Continue\r\n\r\n"};
 
+  STATE_FLOW_STATE(wait_for_connection);
   STATE_FLOW_STATE(start_request);
   STATE_FLOW_STATE(read_more_data);
   STATE_FLOW_STATE(parse_header_data);
+  STATE_FLOW_STATE(headers_complete);
   STATE_FLOW_STATE(process_request);
   STATE_FLOW_STATE(process_request_handler);
   STATE_FLOW_STATE(stream_body);
@@ -1207,10 +2091,24 @@ private:
   STATE_FLOW_STATE(send_response_headers);
   STATE_FLOW_STATE(send_response_body);
   STATE_FLOW_STATE(send_response_body_split);
+  STATE_FLOW_STATE(send_response_chunk);
   STATE_FLOW_STATE(request_complete);
   STATE_FLOW_STATE(upgrade_to_websocket);
   STATE_FLOW_STATE(abort_request_with_response);
   STATE_FLOW_STATE(abort_request);
+  STATE_FLOW_STATE(throttle_bulk);
+
+  /// @return the state to use after a bulk transfer step, for a
+  /// @ref REQUEST_CLASS_BULK request this will be @ref throttle_bulk which
+  /// will continue with the next state once the time slice and rate limit
+  /// allow it.
+  /// @param next is the state to continue with.
+  /// @param bytes is the number of bytes being transferred.
+  Callback throttle(Callback next, size_t bytes);
+
+  /// Closes the socket (if needed) and returns this flow to the @ref Httpd
+  /// for reuse.
+  Action release_connection();
 };
 
 /// WebSocket processor implementing the @ref StateFlowBase interface.
@@ -1238,7 +2136,35 @@ public:
   /// Sends text to this WebSocket at the next possible interval.
   ///
   /// @param text is the text to send.
-  void send_text(std::string &text);
+  ///
+  /// @return false if the message was dropped.
+  bool send_text(const std::string &text);
+
+  /// Sends binary data to this WebSocket at the next possible interval.
+  ///
+  /// @param data is the data to send.
+  /// @param len is the length of the data.
+  ///
+  /// @return false if the message was dropped.
+  bool send_binary(const uint8_t *data, size_t len);
+
+  /// Queues a pre-encoded message to be sent to this WebSocket.
+  ///
+  /// @param frame is the encoded message, see @ref encode.
+  ///
+  /// @return false if the message was dropped.
+  bool send_frame(WebSocketFrame frame);
+
+  /// Encodes a message as one or more WebSocket frames, messages larger than
+  /// httpd_websocket_fragment_size will be fragmented.
+  ///
+  /// @param opcode is the @ref WebSocketOpcode for the message.
+  /// @param data is the message payload.
+  /// @param len is the length of the payload.
+  ///
+  /// @return the encoded message.
+  static WebSocketFrame encode(WebSocketOpcode opcode, const uint8_t *data
+                             , size_t len);
 
   /// @return the ID of the WebSocket.
   int id();
@@ -1255,6 +2181,9 @@ public:
   void request_close();
 
 private:
+  /// Maximum payload size of a control frame.
+  static constexpr size_t WEBSOCKET_MAX_CONTROL_PAYLOAD = 125;
+
   /// @ref StateFlowTimedSelectHelper which assists in reading/writing of the
   /// request data stream.
   StateFlowTimedSelectHelper helper_{this};
@@ -1274,11 +2203,33 @@ private:
   /// Maximum size to read/write of a frame in one call.
   const uint64_t max_frame_size_;
 
-  /// Temporary buffer used for reading/writing WebSocket frame data.
-  uint8_t *data_;
+  /// Maximum size of a message that will be reassembled in @ref data_.
+  const size_t max_message_size_;
+
+  /// Buffer used for reassembling received WebSocket messages, this is
+  /// @ref max_frame_size_ bytes and will be grown as needed (up to
+  /// @ref max_message_size_) while receiving larger messages.
+  uint8_t *data_{nullptr};
+
+  /// Current size of @ref data_.
+  size_t data_capacity_{0};
 
-  /// Size of the used data in the temporary buffer.
+  /// Size of the data being read into @ref data_ by the current read.
   size_t data_size_;
+
+  /// Opcode of the data message being received.
+  uint8_t message_opcode_{OP_CONTINUATION};
+
+  /// Number of bytes of the current message stored in @ref data_.
+  size_t message_len_{0};
+
+  /// When true the current message exceeds @ref max_message_size_ and is
+  /// being delivered to the handler in pieces.
+  bool streaming_{false};
+
+  /// Buffer for control frame payloads, these may arrive between the
+  /// fragments of a data message.
+  uint8_t control_[WEBSOCKET_MAX_CONTROL_PAYLOAD];
   
   /// Temporary holder for the WebSocket handshake response.
   std::string handshake_;
@@ -1293,6 +2244,9 @@ private:
   /// Parsed op code from the header data.
   uint8_t opcode_;
 
+  /// When true this frame is the last frame of the message.
+  bool final_;
+
   /// When true the frame data is XOR masked with a 32bit XOR mask.
   bool masked_;
 
@@ -1308,12 +2262,24 @@ private:
   /// 32bit XOR mask to apply to the data when @ref masked_ is true.
   uint32_t maskingKey_;
 
-  /// Lock for the @ref textToSend_ buffer.
-  OSMutex textLock_;
+  /// Number of bytes of the current frame that have been received, used to
+  /// align the mask for frames that are received in pieces.
+  uint64_t frameOffset_;
+
+  /// Lock for the @ref queue_.
+  OSMutex queueLock_;
+
+  /// Encoded messages waiting to be sent to the client.
+  std::deque<WebSocketFrame> queue_;
 
-  /// Buffer of raw text message(s) to send to the client. Multiple messages
-  /// can be sent as one frame if they are sent to this client rapidly.
-  std::string textToSend_;
+  /// Number of bytes in @ref queue_.
+  size_t queued_bytes_{0};
+
+  /// Number of consecutive messages dropped due to @ref queue_ being full.
+  size_t dropped_{0};
+
+  /// Message currently being sent to the client.
+  WebSocketFrame sending_;
 
   /// When set to true the @ref WebSocketFlow will attempt to shutdown the
   /// WebSocket connection at it's next opportunity.
@@ -1345,6 +2311,19 @@ private:
   STATE_FLOW_STATE(frame_data_len_received);
   STATE_FLOW_STATE(start_recv_frame_data);
   STATE_FLOW_STATE(recv_frame_data);
+  STATE_FLOW_STATE(recv_next_frame_data);
+
+  /// Processes a received control frame.
+  STATE_FLOW_STATE(process_control_frame);
+
+  /// Removes the XOR mask from received frame data.
+  ///
+  /// @param data is the data to unmask.
+  /// @param len is the length of the data.
+  /// @param mask is the masking key from the frame header.
+  /// @param offset is the offset of the data within the frame payload.
+  static void unmask(uint8_t *data, size_t len, uint32_t mask
+                   , uint64_t offset);
   STATE_FLOW_STATE(shutdown_connection);
   STATE_FLOW_STATE(send_frame_header);
   STATE_FLOW_STATE(frame_sent);
@@ -0,0 +1,463 @@
+/** \copyright
+ * Copyright (c) 2019-2020, Mike Dunston
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file HttpMetrics.cpp
+ *
+ * Performance metrics collection for the Httpd server.
+ *
+ * @author Mike Dunston
+ * @date 18 Oct 2020
+ */
+
+#include "Httpd.h"
+
+namespace http
+{
+
+/// Name used for the metrics of all URIs which do not fit in the table.
+static constexpr const char * OTHER_URI_NAME = "(other)";
+
+/// Bucket upper bounds as seconds for the Prometheus "le" label.
+static constexpr const char * BUCKET_LABELS[HttpLatencyHistogram::BUCKET_COUNT] =
+{
+  "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5"
+, "1", "+Inf"
+};
+
+/// Duration of the WebSocket frame rate measurement window.
+static constexpr uint64_t FRAME_RATE_WINDOW_USEC = SEC_TO_USEC(1);
+
+const uint32_t HttpLatencyHistogram::BUCKET_LIMITS[BUCKET_COUNT - 1] =
+{
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+void HttpLatencyHistogram::record(uint32_t usec)
+{
+  size_t bucket = 0;
+  while (bucket < BUCKET_COUNT - 1 && usec > BUCKET_LIMITS[bucket])
+  {
+    bucket++;
+  }
+  buckets[bucket]++;
+  count++;
+  sum += usec;
+}
+
+void HttpMetrics::FrameMetrics::record(size_t len, uint64_t now)
+{
+  update(now);
+  frames++;
+  bytes += len;
+  window_frames++;
+}
+
+void HttpMetrics::FrameMetrics::update(uint64_t now)
+{
+  uint64_t elapsed = now - window_start;
+  if (elapsed >= FRAME_RATE_WINDOW_USEC)
+  {
+    // when the window has been idle for more than one period the rate will
+    // be reported as the average over the idle period.
+    rate = (window_frames * 1000000.0f) / elapsed;
+    window_frames = 0;
+    window_start = now;
+  }
+}
+
+HttpMetrics::HttpMetrics()
+{
+  uris_.resize(config_httpd_metrics_max_uris() + 1);
+  uris_.back().uri.assign(OTHER_URI_NAME);
+}
+
+HttpMetrics::UriMetrics *HttpMetrics::find(const string &uri)
+{
+  for (size_t idx = 0; idx < uri_count_; idx++)
+  {
+    if (uris_[idx].uri == uri)
+    {
+      return &uris_[idx];
+    }
+  }
+  if (uri_count_ < uris_.size() - 1)
+  {
+    uris_[uri_count_].uri.assign(uri);
+    return &uris_[uri_count_++];
+  }
+  return &uris_.back();
+}
+
+void HttpMetrics::record_request(const string &uri, bool error, bool reused
+                               , size_t bytes_in, size_t bytes_out
+                               , uint32_t parse_usec, uint32_t handler_usec
+                               , uint32_t send_usec)
+{
+  OSMutexLock l(&lock_);
+  requests_++;
+  if (reused)
+  {
+    reused_requests_++;
+  }
+  parse_.record(parse_usec);
+  handler_.record(handler_usec);
+  send_.record(send_usec);
+
+  UriMetrics *metrics = find(uri);
+  metrics->requests++;
+  if (error)
+  {
+    metrics->errors++;
+  }
+  metrics->bytes_in += bytes_in;
+  metrics->bytes_out += bytes_out;
+  metrics->parse_usec += parse_usec;
+  metrics->handler_usec += handler_usec;
+  metrics->send_usec += send_usec;
+  metrics->latency.record(parse_usec + handler_usec + send_usec);
+}
+
+void HttpMetrics::connection_opened()
+{
+  OSMutexLock l(&lock_);
+  connections_++;
+  active_connections_++;
+}
+
+void HttpMetrics::connection_closed()
+{
+  OSMutexLock l(&lock_);
+  if (active_connections_)
+  {
+    active_connections_--;
+  }
+}
+
+void HttpMetrics::connection_rejected()
+{
+  OSMutexLock l(&lock_);
+  rejected_connections_++;
+}
+
+void HttpMetrics::websocket_opened()
+{
+  OSMutexLock l(&lock_);
+  websockets_++;
+}
+
+void HttpMetrics::websocket_closed()
+{
+  OSMutexLock l(&lock_);
+  if (websockets_)
+  {
+    websockets_--;
+  }
+}
+
+void HttpMetrics::websocket_frame_received(size_t len)
+{
+  OSMutexLock l(&lock_);
+  frames_in_.record(len, esp_timer_get_time());
+}
+
+void HttpMetrics::websocket_frame_sent(size_t len)
+{
+  OSMutexLock l(&lock_);
+  frames_out_.record(len, esp_timer_get_time());
+}
+
+void HttpMetrics::websocket_message_dropped()
+{
+  OSMutexLock l(&lock_);
+  ws_dropped_++;
+}
+
+void HttpMetrics::websocket_slow_consumer()
+{
+  OSMutexLock l(&lock_);
+  ws_slow_consumers_++;
+}
+
+/// Escapes a value for use in a JSON string or Prometheus label value, both
+/// require backslash and double quote to be escaped.
+///
+/// @param value is the value to escape.
+///
+/// @return the escaped value.
+static string escape_value(const string &value)
+{
+  string escaped;
+  escaped.reserve(value.length());
+  for (char ch : value)
+  {
+    if (ch == '"' || ch == '\\')
+    {
+      escaped += '\\';
+    }
+    if (ch >= ' ')
+    {
+      escaped += ch;
+    }
+  }
+  return escaped;
+}
+
+/// Converts a histogram to a JSON object.
+///
+/// @param histogram is the @ref HttpLatencyHistogram to convert.
+///
+/// @return the JSON object.
+static string histogram_json(const HttpLatencyHistogram &histogram)
+{
+  string json =
+    StringPrintf("{\"count\":%u,\"sum_us\":%llu,\"buckets\":["
+               , histogram.count, (unsigned long long)histogram.sum);
+  for (size_t idx = 0; idx < HttpLatencyHistogram::BUCKET_COUNT; idx++)
+  {
+    if (idx)
+    {
+      json += ',';
+    }
+    json += integer_to_string(histogram.buckets[idx]);
+  }
+  json += "]}";
+  return json;
+}
+
+/// Converts a histogram to Prometheus histogram samples.
+///
+/// @param name is the metric name.
+/// @param labels are the labels to add to each sample, without braces and
+/// with a trailing comma when not empty.
+/// @param histogram is the @ref HttpLatencyHistogram to convert.
+///
+/// @return the Prometheus samples.
+static string histogram_prometheus(const char *name, const string &labels
+                                 , const HttpLatencyHistogram &histogram)
+{
+  string text;
+  uint32_t cumulative = 0;
+  for (size_t idx = 0; idx < HttpLatencyHistogram::BUCKET_COUNT; idx++)
+  {
+    cumulative += histogram.buckets[idx];
+    text += StringPrintf("%s_bucket{%sle=\"%s\"} %u\n", name, labels.c_str()
+                       , BUCKET_LABELS[idx], cumulative);
+  }
+  string sum_labels = labels;
+  if (!sum_labels.empty())
+  {
+    // remove the trailing comma and wrap the labels in braces.
+    sum_labels.pop_back();
+    sum_labels = "{" + sum_labels + "}";
+  }
+  text += StringPrintf("%s_sum%s %.6f\n", name, sum_labels.c_str()
+                     , histogram.sum / 1000000.0);
+  text += StringPrintf("%s_count%s %u\n", name, sum_labels.c_str()
+                     , histogram.count);
+  return text;
+}
+
+bool HttpMetrics::to_json(size_t index, string &body)
+{
+  OSMutexLock l(&lock_);
+  if (index == 0)
+  {
+    body += "{\"bucket_limits_us\":[";
+    for (size_t idx = 0; idx < HttpLatencyHistogram::BUCKET_COUNT - 1; idx++)
+    {
+      if (idx)
+      {
+        body += ',';
+      }
+      body += integer_to_string(HttpLatencyHistogram::BUCKET_LIMITS[idx]);
+    }
+    body +=
+      StringPrintf("],\"connections\":{\"total\":%u,\"active\":%u"
+                   ",\"rejected\":%u},\"requests\":{\"total\":%u"
+                   ",\"reused\":%u,\"reuse_ratio\":%.3f}"
+                 , connections_, active_connections_, rejected_connections_
+                 , requests_, reused_requests_
+                 , requests_ ? (float)reused_requests_ / requests_ : 0.0f);
+    body += ",\"parse\":" + histogram_json(parse_);
+    body += ",\"handler\":" + histogram_json(handler_);
+    body += ",\"send\":" + histogram_json(send_);
+    body += ",\"uris\":[";
+    return true;
+  }
+  // one entry per URI, all entries before uri_count_ have been used.
+  size_t idx = index - 1;
+  if (idx < uris_.size())
+  {
+    UriMetrics &metrics = uris_[idx];
+    if (metrics.requests)
+    {
+      body +=
+        StringPrintf("%s{\"uri\":\"%s\",\"requests\":%u,\"errors\":%u"
+                     ",\"bytes_in\":%llu,\"bytes_out\":%llu"
+                     ",\"parse_us\":%llu,\"handler_us\":%llu,\"send_us\":%llu"
+                     ",\"latency\":"
+                   , idx ? "," : "", escape_value(metrics.uri).c_str()
+                   , metrics.requests, metrics.errors
+                   , (unsigned long long)metrics.bytes_in
+                   , (unsigned long long)metrics.bytes_out
+                   , (unsigned long long)metrics.parse_usec
+                   , (unsigned long long)metrics.handler_usec
+                   , (unsigned long long)metrics.send_usec);
+      body += histogram_json(metrics.latency);
+      body += '}';
+    }
+    return true;
+  }
+  uint64_t now = esp_timer_get_time();
+  frames_in_.update(now);
+  frames_out_.update(now);
+  body +=
+    StringPrintf("],\"websocket\":{\"clients\":%u,\"frames_in\":%u"
+                 ",\"frames_out\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu"
+                 ",\"frames_in_per_sec\":%.2f,\"frames_out_per_sec\":%.2f"
+                 ",\"dropped\":%u,\"slow_consumers\":%u}}"
+               , websockets_, frames_in_.frames, frames_out_.frames
+               , (unsigned long long)frames_in_.bytes
+               , (unsigned long long)frames_out_.bytes
+               , frames_in_.rate, frames_out_.rate, ws_dropped_
+               , ws_slow_consumers_);
+  return false;
+}
+
+/// Names of the per-URI counters in the Prometheus output.
+static constexpr const char * URI_COUNTERS[] =
+{
+  "requests_total", "request_errors_total", "received_bytes_total"
+, "sent_bytes_total", "parse_seconds_total", "handler_seconds_total"
+, "send_seconds_total"
+};
+
+bool HttpMetrics::to_prometheus(size_t index, string &body)
+{
+  OSMutexLock l(&lock_);
+  if (index == 0)
+  {
+    body +=
+      StringPrintf("# TYPE httpd_connections_total counter\n"
+                   "httpd_connections_total %u\n"
+                   "# TYPE httpd_connections_active gauge\n"
+                   "httpd_connections_active %u\n"
+                   "# TYPE httpd_connections_rejected_total counter\n"
+                   "httpd_connections_rejected_total %u\n"
+                   "# TYPE httpd_requests_reused_total counter\n"
+                   "httpd_requests_reused_total %u\n"
+                 , connections_, active_connections_, rejected_connections_
+                 , reused_requests_);
+    body += "# TYPE httpd_phase_duration_seconds histogram\n";
+    body += histogram_prometheus("httpd_phase_duration_seconds"
+                               , "phase=\"parse\",", parse_);
+    body += histogram_prometheus("httpd_phase_duration_seconds"
+                               , "phase=\"handler\",", handler_);
+    body += histogram_prometheus("httpd_phase_duration_seconds"
+                               , "phase=\"send\",", send_);
+    return true;
+  }
+
+  // per-URI counters, all samples of a metric must be grouped together.
+  size_t counter = index - 1;
+  if (counter < ARRAYSIZE(URI_COUNTERS))
+  {
+    body += StringPrintf("# TYPE httpd_%s counter\n", URI_COUNTERS[counter]);
+    for (auto &metrics : uris_)
+    {
+      if (!metrics.requests)
+      {
+        continue;
+      }
+      uint64_t value[] =
+      {
+        metrics.requests, metrics.errors, metrics.bytes_in, metrics.bytes_out
+      , metrics.parse_usec, metrics.handler_usec, metrics.send_usec
+      };
+      string label = escape_value(metrics.uri);
+      if (counter < 4)
+      {
+        body += StringPrintf("httpd_%s{uri=\"%s\"} %llu\n"
+                           , URI_COUNTERS[counter], label.c_str()
+                           , (unsigned long long)value[counter]);
+      }
+      else
+      {
+        // the timing counters are reported in seconds.
+        body += StringPrintf("httpd_%s{uri=\"%s\"} %.6f\n"
+                           , URI_COUNTERS[counter], label.c_str()
+                           , value[counter] / 1000000.0);
+      }
+    }
+    return true;
+  }
+
+  // per-URI latency histograms.
+  size_t idx = counter - ARRAYSIZE(URI_COUNTERS);
+  if (idx < uris_.size())
+  {
+    if (idx == 0)
+    {
+      body += "# TYPE httpd_request_duration_seconds histogram\n";
+    }
+    UriMetrics &metrics = uris_[idx];
+    if (metrics.requests)
+    {
+      body += histogram_prometheus("httpd_request_duration_seconds"
+                                 , "uri=\"" + escape_value(metrics.uri) + "\","
+                                 , metrics.latency);
+    }
+    return true;
+  }
+
+  uint64_t now = esp_timer_get_time();
+  frames_in_.update(now);
+  frames_out_.update(now);
+  body +=
+    StringPrintf("# TYPE httpd_websocket_clients gauge\n"
+                 "httpd_websocket_clients %u\n"
+                 "# TYPE httpd_websocket_frames_total counter\n"
+                 "httpd_websocket_frames_total{direction=\"in\"} %u\n"
+                 "httpd_websocket_frames_total{direction=\"out\"} %u\n"
+                 "# TYPE httpd_websocket_bytes_total counter\n"
+                 "httpd_websocket_bytes_total{direction=\"in\"} %llu\n"
+                 "httpd_websocket_bytes_total{direction=\"out\"} %llu\n"
+                 "# TYPE httpd_websocket_frames_per_second gauge\n"
+                 "httpd_websocket_frames_per_second{direction=\"in\"} %.2f\n"
+                 "httpd_websocket_frames_per_second{direction=\"out\"} %.2f\n"
+                 "# TYPE httpd_websocket_dropped_total counter\n"
+                 "httpd_websocket_dropped_total %u\n"
+                 "# TYPE httpd_websocket_slow_consumers_total counter\n"
+                 "httpd_websocket_slow_consumers_total %u\n"
+               , websockets_, frames_in_.frames, frames_out_.frames
+               , (unsigned long long)frames_in_.bytes
+               , (unsigned long long)frames_out_.bytes
+               , frames_in_.rate, frames_out_.rate, ws_dropped_
+               , ws_slow_consumers_);
+  return false;
+}
+
+} // namespace http
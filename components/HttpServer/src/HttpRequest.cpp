@@ -33,6 +33,10 @@
  */
 
 #include "Httpd.h"
+#include "HttpStringUtils.h"
+
+#include <string.h>
+#include <strings.h>
 
 namespace http
 {
@@ -47,29 +51,43 @@ static constexpr const char * HTTP_METHOD_PUT = "PUT";
 std::map<HttpHeader, const char *> well_known_http_headers =
 {
   { ACCEPT, "Accept" }
+, { ACCEPT_RANGES, "Accept-Ranges" }
 , { CACHE_CONTROL, "Cache-Control" }
 , { CONNECTION, "Connection" }
 , { CONTENT_ENCODING, "Content-Encoding" }
 , { CONTENT_TYPE, "Content-Type" }
 , { CONTENT_LENGTH, "Content-Length" }
 , { CONTENT_DISPOSITION, "Content-Disposition" }
+, { CONTENT_RANGE, "Content-Range" }
+, { ETAG, "ETag" }
 , { EXPECT, "Expect" }
 , { HOST, "Host" }
 , { IF_MODIFIED_SINCE, "If-Modified-Since" }
+, { IF_NONE_MATCH, "If-None-Match" }
 , { LAST_MODIFIED, "Last-Modified" }
 , { LOCATION, "Location" }
 , { ORIGIN, "Origin" }
+, { RANGE, "Range" }
+, { TRANSFER_ENCODING, "Transfer-Encoding" }
 , { UPGRADE, "Upgrade" }
 , { WS_VERSION, "Sec-WebSocket-Version" }
 , { WS_KEY, "Sec-WebSocket-Key" }
 , { WS_ACCEPT, "Sec-WebSocket-Accept"}
 };
 
-void HttpRequest::method(const string &value)
+HttpRequest::HttpRequest()
+{
+  raw_.reserve(config_httpd_max_header_size());
+  headers_.reserve(config_httpd_max_header_count());
+  params_.reserve(config_httpd_max_param_count());
+  path_params_.reserve(config_httpd_max_param_count());
+}
+
+void HttpRequest::method(const char *value, size_t len)
 {
+  raw_method_.assign(value, len);
   LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-    , "[HttpReq %p] Setting Method: %s", this, value.c_str());
-  raw_method_.assign(std::move(value));
+    , "[HttpReq %p] Setting Method: %s", this, raw_method_.c_str());
   if (!raw_method_.compare(HTTP_METHOD_DELETE))
   {
     method_ = HttpMethod::DELETE;
@@ -111,100 +129,295 @@ const string &HttpRequest::uri()
   return uri_;
 }
 
-void HttpRequest::uri(const string &value)
+bool HttpRequest::parse_request_line(size_t offs, size_t len)
 {
+  // request line format: METHOD SP REQUEST-TARGET SP HTTP-VERSION
+  char *line = &raw_[offs];
+  char *end = line + len;
+  char *method_end = std::find(line, end, ' ');
+  if (method_end == end || method_end == line)
+  {
+    return false;
+  }
+  char *target = method_end + 1;
+  char *target_end = std::find(target, end, ' ');
+  if (target_end == end || target_end == target ||
+      std::find(target_end + 1, end, ' ') != end)
+  {
+    return false;
+  }
+  method(line, method_end - line);
+
+  // split the request target into the URI and query string (if present).
+  char *query = std::find(target, target_end, '?');
+  uri_.assign(target, query - target);
+  uri_offs_ = target - raw_.data();
   LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-    , "[HttpReq %p] Setting URI: %s", this, value.c_str());
-  uri_.assign(std::move(value));
+    , "[HttpReq %p] Setting URI: %s", this, uri_.c_str());
+  if (query != target_end)
+  {
+    query++;
+    parse_params(query - raw_.data(), target_end - query);
+  }
+  return true;
 }
 
-void HttpRequest::param(const string &name, const string &value)
+void HttpRequest::parse_header_line(size_t offs, size_t len)
 {
-  if (params_.size() < config_httpd_max_param_count())
+  const char *line = raw_.data() + offs;
+  const char *end = line + len;
+  const char *sep = std::find(line, end, ':');
+  if (sep == end || sep == line)
   {
-    LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[HttpReq %p] Adding param: %s: %s", this, name.c_str()
-      , value.c_str());
-    params_[name] = value;
+    LOG_ERROR("[HttpReq %p] Discarding malformed header: %s", this
+            , string(line, len).c_str());
+    return;
   }
-  else
+  const char *value = sep + 1;
+  // trim optional whitespace around the header value
+  while (value < end && (*value == ' ' || *value == '\t'))
   {
-    LOG_ERROR("[HttpReq %p] Discarding parameter '%s' as max parameter count "
-              "has been reached!", this, name.c_str());
+    value++;
   }
-}
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+  {
+    end--;
+  }
+  Field field{{(uint32_t)offs, (uint32_t)(sep - line)}
+            , {(uint32_t)(value - raw_.data()), (uint32_t)(end - value)}};
 
-void HttpRequest::header(const string &name, const string &value)
-{
-  if (headers_.size() < config_httpd_max_header_count())
+  // check if it is one of the well-known headers.
+  for (auto &ent : well_known_http_headers)
+  {
+    if (matches(field.name, ent.second, true))
+    {
+      LOG(CONFIG_HTTP_REQ_LOG_LEVEL
+        , "[HttpReq %p] Adding header: %s: %s", this, ent.second
+        , string(data(field.value), field.value.len).c_str());
+      known_headers_[ent.first] = field.value;
+      known_header_mask_ |= BIT(ent.first);
+      return;
+    }
+  }
+
+  if (headers_.size() < (size_t)config_httpd_max_header_count())
   {
     LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[HttpReq %p] Adding header: %s: %s", this, name.c_str()
-      , value.c_str());
-    headers_[name] = value;
+      , "[HttpReq %p] Adding header: %s", this, string(line, len).c_str());
+    headers_.push_back(field);
   }
   else
   {
     LOG_ERROR("[HttpReq %p] Discarding header '%s' as maximum header limit "
-              "has been reached!", this, name.c_str());
+              "has been reached!", this, string(line, sep - line).c_str());
   }
 }
 
-void HttpRequest::header(HttpHeader header, std::string value)
+void HttpRequest::parse_params(size_t offs, size_t len)
 {
-  if (has_header(header))
+  size_t end = offs + len;
+  while (offs < end)
   {
-    LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[HttpReq %p] Replacing header: %s: %s (old: %s)", this
-      , well_known_http_headers[header], value.c_str()
-      , headers_[well_known_http_headers[header]].c_str());
+    size_t param_end = raw_.find('&', offs);
+    if (param_end == string::npos || param_end > end)
+    {
+      param_end = end;
+    }
+    if (param_end != offs)
+    {
+      if (params_.size() >= (size_t)config_httpd_max_param_count())
+      {
+        LOG_ERROR("[HttpReq %p] Discarding parameter(s) as max parameter "
+                  "count has been reached!", this);
+        return;
+      }
+      size_t sep = raw_.find('=', offs);
+      if (sep == string::npos || sep > param_end)
+      {
+        sep = param_end;
+      }
+      // URL decode the parameter name and value, the decoded length will
+      // never exceed the encoded length so the trailing characters are left
+      // as-is in the buffer.
+      Field field;
+      field.name.offs = offs;
+      field.name.len = url_decode_in_place(&raw_[offs], sep - offs);
+      field.value.offs = std::min(sep + 1, param_end);
+      field.value.len =
+        url_decode_in_place(&raw_[field.value.offs]
+                          , param_end - field.value.offs);
+      LOG(CONFIG_HTTP_REQ_LOG_LEVEL
+        , "[HttpReq %p] Adding param: %s: %s", this
+        , string(data(field.name), field.name.len).c_str()
+        , string(data(field.value), field.value.len).c_str());
+      params_.push_back(field);
+    }
+    offs = param_end + 1;
   }
-  else if (headers_.size() < config_httpd_max_header_count())
+}
+
+bool HttpRequest::matches(const Segment &segment, const char *value
+                        , bool ignore_case)
+{
+  size_t len = strlen(value);
+  if (segment.len != len)
   {
-    LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[HttpReq %p] Adding header: %s: %s", this
-      , well_known_http_headers[header], value.c_str());
+    return false;
   }
-  else
+  if (ignore_case)
   {
-    LOG_ERROR("[HttpReq %p] Discarding header '%s' as maximum header limit "
-              "has been reached!", this
-            , well_known_http_headers[header]);
-    return;
+    return !strncasecmp(data(segment), value, len);
+  }
+  return !strncmp(data(segment), value, len);
+}
+
+HttpRequest::Field *HttpRequest::find(std::vector<Field> &fields
+                                    , const string &name, bool ignore_case)
+{
+  auto it = std::find_if(fields.begin(), fields.end()
+  , [&](const Field &field)
+    {
+      return matches(field.name, name.c_str(), ignore_case);
+    });
+  if (it == fields.end())
+  {
+    return nullptr;
   }
-  headers_[well_known_http_headers[header]] = value;
+  return &(*it);
+}
+
+void HttpRequest::header(HttpHeader header, const std::string &value)
+{
+  LOG(CONFIG_HTTP_REQ_LOG_LEVEL
+    , "[HttpReq %p] Setting header: %s: %s", this
+    , well_known_http_headers[header], value.c_str());
+  known_headers_[header] = {(uint32_t)raw_.size(), (uint32_t)value.size()};
+  known_header_mask_ |= BIT(header);
+  raw_.append(value);
 }
 
 bool HttpRequest::has_header(const string &name)
 {
-  return headers_.find(name) != headers_.end();
+  for (auto &ent : well_known_http_headers)
+  {
+    if (!strcasecmp(ent.second, name.c_str()))
+    {
+      return has_header(ent.first);
+    }
+  }
+  return find(headers_, name, true) != nullptr;
 }
 
 bool HttpRequest::has_header(const HttpHeader name)
 {
-  return has_header(well_known_http_headers[name]);
+  return known_header_mask_ & BIT(name);
+}
+
+string HttpRequest::header(const string &name)
+{
+  for (auto &ent : well_known_http_headers)
+  {
+    if (!strcasecmp(ent.second, name.c_str()))
+    {
+      return header(ent.first);
+    }
+  }
+  Field *field = find(headers_, name, true);
+  if (field)
+  {
+    return string(data(field->value), field->value.len);
+  }
+  return no_value_;
 }
 
-const string &HttpRequest::header(const string name)
+string HttpRequest::header(const HttpHeader name)
 {
   if (!has_header(name))
   {
     return no_value_;
   }
-  return headers_[name];
+  return string(data(known_headers_[name]), known_headers_[name].len);
 }
 
-const string &HttpRequest::header(const HttpHeader name)
+bool HttpRequest::header_equals(const HttpHeader name, const char *value)
 {
-  return header(well_known_http_headers[name]);
+  return has_header(name) && matches(known_headers_[name], value, true);
+}
+
+size_t HttpRequest::content_length()
+{
+  if (!has_header(HttpHeader::CONTENT_LENGTH))
+  {
+    return 0;
+  }
+  const Segment &segment = known_headers_[HttpHeader::CONTENT_LENGTH];
+  size_t value = 0;
+  for (size_t idx = 0; idx < segment.len; idx++)
+  {
+    char ch = raw_[segment.offs + idx];
+    if (ch < '0' || ch > '9' || value > (SIZE_MAX / 10))
+    {
+      return 0;
+    }
+    value = (value * 10) + (ch - '0');
+  }
+  return value;
+}
+
+bool HttpRequest::if_none_match(const std::string &etag)
+{
+  if (!has_header(HttpHeader::IF_NONE_MATCH))
+  {
+    return false;
+  }
+  // The header value is a comma separated list of entity tags, each may be
+  // prefixed with "W/" for weak validation which is acceptable for a GET.
+  const Segment &value = known_headers_[HttpHeader::IF_NONE_MATCH];
+  const char *pos = data(value);
+  const char *end = pos + value.len;
+  while (pos < end)
+  {
+    while (pos < end && (*pos == ' ' || *pos == ','))
+    {
+      pos++;
+    }
+    const char *tag_end = std::find(pos, end, ',');
+    const char *tag = pos;
+    if (tag_end - tag > 2 && tag[0] == 'W' && tag[1] == '/')
+    {
+      tag += 2;
+    }
+    size_t len = tag_end - tag;
+    while (len && tag[len - 1] == ' ')
+    {
+      len--;
+    }
+    if ((len == 1 && *tag == '*') ||
+        (len == etag.length() && !etag.compare(0, len, tag, len)))
+    {
+      return true;
+    }
+    pos = tag_end;
+  }
+  return false;
 }
 
 void HttpRequest::reset()
 {
   LOG(CONFIG_HTTP_REQ_LOG_LEVEL
     , "[HttpReq %p] Resetting to blank request", this);
+  raw_.clear();
+  // release any additional capacity used by a form-data body payload.
+  if (raw_.capacity() > config_httpd_max_header_size())
+  {
+    string().swap(raw_);
+    raw_.reserve(config_httpd_max_header_size());
+  }
+  known_header_mask_ = 0;
   headers_.clear();
   params_.clear();
+  path_params_.clear();
+  route_ = nullptr;
   raw_method_.clear();
   method_ = HttpMethod::UNKNOWN_METHOD;
   uri_.clear();
@@ -217,7 +430,7 @@ bool HttpRequest::keep_alive()
   {
     return false;
   }
-  return header(HttpHeader::CONNECTION).compare(HTTP_CONNECTION_CLOSE);
+  return !header_equals(HttpHeader::CONNECTION, HTTP_CONNECTION_CLOSE);
 }
 
 void HttpRequest::error(bool value)
@@ -234,17 +447,23 @@ bool HttpRequest::error()
 
 ContentType HttpRequest::content_type()
 {
-  static const string MULTIPART_FORM = "multipart/form-data";
-  static const string FORM_URLENCODED = "application/x-www-form-urlencoded";
+  static constexpr const char * MULTIPART_FORM = "multipart/form-data";
+  static constexpr const char * FORM_URLENCODED =
+    "application/x-www-form-urlencoded";
+  if (!has_header(HttpHeader::CONTENT_TYPE))
+  {
+    return ContentType::UNKNOWN_TYPE;
+  }
+  const Segment &type = known_headers_[HttpHeader::CONTENT_TYPE];
   // For a multipart/form-data the Content-Type value will look like:
   // multipart/form-data; boundary=----WebKitFormBoundary4Aq7x8166jGWkA0q
-  if (!header(HttpHeader::CONTENT_TYPE).compare(0, MULTIPART_FORM.size()
-                                              , MULTIPART_FORM))
+  if (type.len >= strlen(MULTIPART_FORM) &&
+      !strncasecmp(data(type), MULTIPART_FORM, strlen(MULTIPART_FORM)))
   {
     return ContentType::MULTIPART_FORMDATA;
   }
-  if (!header(HttpHeader::CONTENT_TYPE).compare(0, FORM_URLENCODED.size()
-                                              , FORM_URLENCODED))
+  if (type.len >= strlen(FORM_URLENCODED) &&
+      !strncasecmp(data(type), FORM_URLENCODED, strlen(FORM_URLENCODED)))
   {
     return ContentType::FORM_URLENCODED;
   }
@@ -258,16 +477,18 @@ void HttpRequest::set_status(HttpStatusCode code)
 
 size_t HttpRequest::params()
 {
-  return params_.size();
+  return params_.size() + path_params_.size();
 }
 
 string HttpRequest::param(string name)
 {
-  if (params_.find(name) != params_.end())
+  const Segment *segment = find_param(name);
+  if (segment)
   {
+    string value(data(*segment), segment->len);
     LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[Req %p] Param %s -> %s", this, name.c_str(), params_[name].c_str());
-    return params_[name];
+      , "[Req %p] Param %s -> %s", this, name.c_str(), value.c_str());
+    return value;
   }
   LOG(CONFIG_HTTP_REQ_LOG_LEVEL
     , "[Req %p] Param %s doesn't exist", this, name.c_str());
@@ -276,31 +497,72 @@ string HttpRequest::param(string name)
 
 bool HttpRequest::param(string name, bool def)
 {
-  if (params_.find(name) != params_.end())
+  const Segment *segment = find_param(name);
+  if (segment)
   {
-    LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[Req %p] Param %s -> %s", this, name.c_str(), params_[name].c_str());
-    auto value = params_[name];
-    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
-    return value.compare("false");
+    return !matches(*segment, "false", true);
   }
   return def;
 }
 
 int HttpRequest::param(string name, int def)
 {
-  if (params_.find(name) != params_.end())
+  const Segment *segment = find_param(name);
+  if (segment && segment->len)
   {
-    LOG(CONFIG_HTTP_REQ_LOG_LEVEL
-      , "[Req %p] Param %s -> %s", this, name.c_str(), params_[name].c_str());
-    return std::stoi(params_[name]);
+    // the value is not NUL terminated in the buffer, copy it to a local
+    // buffer for conversion. Values which are not numeric will result in the
+    // default value being returned.
+    char value[16];
+    size_t len = std::min((size_t)segment->len, sizeof(value) - 1);
+    memcpy(value, data(*segment), len);
+    value[len] = '\0';
+    char *end = nullptr;
+    long result = strtol(value, &end, 10);
+    if (end != value)
+    {
+      return result;
+    }
   }
   return def;
 }
 
 bool HttpRequest::has_param(string name)
 {
-  return params_.find(name) != params_.end();
+  return find_param(name) != nullptr;
+}
+
+const HttpRequest::Segment *HttpRequest::find_param(const string &name)
+{
+  for (auto &ent : path_params_)
+  {
+    if (*ent.name == name)
+    {
+      return &ent.value;
+    }
+  }
+  Field *field = find(params_, name, false);
+  if (field)
+  {
+    return &field->value;
+  }
+  return nullptr;
+}
+
+bool HttpRequest::add_path_param(const string *name, size_t offs, size_t len)
+{
+  if (params_.size() + path_params_.size() >=
+      (size_t)config_httpd_max_param_count())
+  {
+    LOG_ERROR("[HttpReq %p] Discarding path parameter %s as max parameter "
+              "count has been reached!", this, name->c_str());
+    return false;
+  }
+  // the URI is a copy of the request target in the raw buffer so the value
+  // can reference the raw buffer directly.
+  path_params_.push_back(
+    {name, {(uint32_t)(uri_offs_ + offs), (uint32_t)len}});
+  return true;
 }
 
 string HttpRequest::to_string()
@@ -308,18 +570,36 @@ string HttpRequest::to_string()
   string res = StringPrintf("[HttpReq %p] method:%s uri:%s,error:%d,"
                             "header-count:%zu,param-count:%zu"
                           , this, raw_method_.c_str(), uri_.c_str(), error_
-                          , headers_.size(), params_.size());
+                          , __builtin_popcount(known_header_mask_) +
+                            headers_.size()
+                          , params());
+  for (auto &ent : well_known_http_headers)
+  {
+    if (has_header(ent.first))
+    {
+      res.append(StringPrintf("\nheader: %s: %s%s", ent.second
+                            , header(ent.first).c_str(), HTML_EOL));
+    }
+  }
   for (auto &ent : headers_)
   {
     res.append(
-      StringPrintf("\nheader: %s: %s%s", ent.first.c_str(), ent.second.c_str()
-                  , HTML_EOL));
+      StringPrintf("\nheader: %s: %s%s"
+                 , string(data(ent.name), ent.name.len).c_str()
+                 , string(data(ent.value), ent.value.len).c_str(), HTML_EOL));
   }
   for (auto &ent : params_)
   {
     res.append(
-      StringPrintf("\nparam: %s: %s%s", ent.first.c_str(), ent.second.c_str()
-                  , HTML_EOL));
+      StringPrintf("\nparam: %s: %s%s"
+                 , string(data(ent.name), ent.name.len).c_str()
+                 , string(data(ent.value), ent.value.len).c_str(), HTML_EOL));
+  }
+  for (auto &ent : path_params_)
+  {
+    res.append(
+      StringPrintf("\npath-param: %s: %s%s", ent.name->c_str()
+                 , string(data(ent.value), ent.value.len).c_str(), HTML_EOL));
   }
   return res;
 }
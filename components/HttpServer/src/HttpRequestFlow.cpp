@@ -51,31 +51,54 @@ static vector<string> captive_portal_uris =
   "/kindle-wifi/wifistub.html"      // Kindle
 };
 
-HttpRequestFlow::HttpRequestFlow(Httpd *server, int fd
-                               , uint32_t remote_ip)
+/// Name used for metrics of requests which do not match a registered URI.
+static const string UNROUTED_METRICS_URI = "(unrouted)";
+
+HttpRequestFlow::HttpRequestFlow(Httpd *server)
                                : StateFlowBase(server)
                                , server_(server)
-                               , fd_(fd)
-                               , remote_ip_(remote_ip)
 {
-  raw_header_.reserve(header_read_size_ + 1);
-  start_flow(STATE(start_request));
-  LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] Connected.", fd_);
+  // preallocate the body buffer so the heap usage for this flow does not vary
+  // between requests.
+  buf_.reserve(body_read_size_);
+  start_flow(STATE(wait_for_connection));
 }
 
 HttpRequestFlow::~HttpRequestFlow()
 {
-  if (close_)
+  if (close_ && fd_ >= 0)
   {
     LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] Closed", fd_);
     ::close(fd_);
   }
 }
 
+void HttpRequestFlow::start(int fd, uint32_t remote_ip)
+{
+  fd_ = fd;
+  remote_ip_ = remote_ip;
+  close_ = true;
+  req_count_ = 0;
+  LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] Connected.", fd_);
+  server_->metrics_.connection_opened();
+  notify();
+}
+
+StateFlowBase::Action HttpRequestFlow::wait_for_connection()
+{
+  return wait_and_call(STATE(start_request));
+}
+
 StateFlowBase::Action HttpRequestFlow::start_request()
 {
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] reading header", fd_);
   req_.reset();
+  // the response from the previous request on a kept-alive connection has
+  // already been sent (streamed responses can not be sent again).
+  res_.reset();
+  response_body_offs_ = 0;
+  response_body_chunk_ = 0;
+  response_chunk_.clear();
   part_boundary_.clear();
   part_boundary_.shrink_to_fit();
   part_filename_.clear();
@@ -83,191 +106,160 @@ StateFlowBase::Action HttpRequestFlow::start_request()
   part_type_.clear();
   part_type_.shrink_to_fit();
   raw_header_.clear();
-  start_time_ = esp_timer_get_time();
-  buf_.resize(header_read_size_);
-  return read_repeated_with_timeout(&helper_, timeout_, fd_, buf_.data()
-                                  , header_read_size_
-                                  , STATE(parse_header_data));
+  parse_offs_ = 0;
+  body_len_ = 0;
+  body_offs_ = 0;
+  // the request timing starts when the first data is received so that the
+  // idle time of a kept-alive connection is not included.
+  start_time_ = 0;
+  idle_start_ = esp_timer_get_time();
+  handler_time_ = 0;
+  send_time_ = 0;
+  bytes_out_ = 0;
+  bulk_ = false;
+  return call_immediately(STATE(read_more_data));
 }
 
 StateFlowBase::Action HttpRequestFlow::parse_header_data()
 {
+  // trim the request buffer to the data that was actually received.
+  req_.raw_.resize(req_.raw_.size() - helper_.remaining_);
   if (helper_.hasError_)
   {
     return call_immediately(STATE(abort_request));
   }
-  else if (helper_.remaining_ == header_read_size_ || buf_.empty())
+  if (!start_time_ && !req_.raw_.empty())
   {
-    return yield_and_call(STATE(read_more_data));
+    start_time_ = esp_timer_get_time();
   }
-
-  raw_header_.append((char *)buf_.data()
-                   , header_read_size_ - helper_.remaining_);
-
-  // if we don't have an EOL string in the data yet, get more data
-  if (raw_header_.find(HTML_EOL) == string::npos)
+  else if (!start_time_)
   {
+    // nothing has been received for this request yet, the flow is only held
+    // by an idle connection. Release it once the idle time has elapsed or
+    // when it is a kept-alive connection and another connection is waiting
+    // for a flow, the client will retry the request on a new connection.
+    uint64_t idle = esp_timer_get_time() - idle_start_;
+    if (idle >= (uint64_t)MSEC_TO_USEC(config_httpd_keepalive_idle_ms()) ||
+        (req_count_ && server_->has_pending_connections()))
+    {
+      LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
+        , "[Httpd fd:%d] Closing idle connection after %u ms", fd_
+        , (uint32_t)USEC_TO_MSEC(idle));
+      return release_connection();
+    }
     return yield_and_call(STATE(read_more_data));
   }
 
-  // parse the data we have into delimited lines of header data, this will
-  // leave some data in the raw_header_ which will need to be pushed back
-  // into the buf_ after we reach the body segment.
-  vector<string> lines;
-  size_t parsed = tokenize(raw_header_, lines, HTML_EOL, false);
-
-  // drop whatever has been tokenized so we don't process it again
-  raw_header_.erase(0, parsed);
-
-  // the first line is always the request line
-  if (req_.raw_method().empty())
+  // process all complete lines that have been received, any partial line will
+  // be left in the buffer until the remainder of the line has been received.
+  size_t eol;
+  while ((eol = req_.raw_.find(HTML_EOL, parse_offs_)) != string::npos)
   {
-    vector<string> request;
-    tokenize(lines[0], request, " ");
-    if (request.size() != 3)
-    {
-      LOG_ERROR("[Httpd fd:%d] Malformed request: %s.", fd_, lines[0].c_str());
-      req_.set_status(HttpStatusCode::STATUS_BAD_REQUEST);
-      return call_immediately(STATE(abort_request_with_response));
-    }
-    req_.method(request[0]);
-    vector<string> uri_parts;
-    tokenize(request[1], uri_parts, "?");
-    req_.uri(uri_parts[0]);
-    uri_parts.erase(uri_parts.begin());
-    for (string &part : uri_parts)
+    size_t line_offs = parse_offs_;
+    size_t line_len = eol - parse_offs_;
+    parse_offs_ = eol + strlen(HTML_EOL);
+
+    // the first line is always the request line
+    if (req_.raw_method().empty())
     {
-      vector<string> params;
-      tokenize(part, params, "&");
-      for (auto param : params)
+      if (!req_.parse_request_line(line_offs, line_len))
       {
-        auto p = break_string(param, "=");
-        // URL decode the parameter name and value
-        p.first = url_decode(p.first);
-        p.second = url_decode(p.second);
-        req_.param(p.first, p.second);
+        LOG_ERROR("[Httpd fd:%d] Malformed request: %s.", fd_
+                , req_.raw_.substr(line_offs, line_len).c_str());
+        req_.set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+        return call_immediately(STATE(abort_request_with_response));
       }
     }
-    // remove the first line since we processed it
-    lines.erase(lines.begin());
+    else if (line_len)
+    {
+      req_.parse_header_line(line_offs, line_len);
+    }
+    else
+    {
+      // a blank line has been reached, this is immediately after the last
+      // header in the request.
+      return call_immediately(STATE(headers_complete));
+    }
   }
 
-  // process any remaining lines as headers until we reach a blank line
-  size_t processed_lines = 0;
-  for (auto &line : lines)
+  return yield_and_call(STATE(read_more_data));
+}
+
+StateFlowBase::Action HttpRequestFlow::headers_complete()
+{
+  // Now that we have the request headers parsed we can check if the
+  // request exceeds the size limits of the server.
+  if (server_->is_request_too_large(&req_))
   {
-    processed_lines++;
-    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-      , "[Httpd fd:%d,uri:%s] line(%zu/%zu): ||%s||", fd_, req_.uri().c_str()
-      , processed_lines, lines.size(), line.c_str());
-    // check if we have reached a blank line, this is immediately after the
-    // last header in the request.
-    if (line.empty())
+    // If the request has the EXPECT header we can reject the request with
+    // the EXPECTATION_FAILED (417) status, otherwise reject it with
+    // BAD_REQUEST (400).
+    req_.set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+    if (req_.has_header(HttpHeader::EXPECT))
+    {
+      req_.set_status(HttpStatusCode::STATUS_EXPECATION_FAILED);
+    }
+    LOG_ERROR("[Httpd fd:%d,uri:%s] Request body is too large, "
+              "aborting with status %d"
+            , fd_, req_.uri().c_str(), req_.status_);
+    return call_immediately(STATE(abort_request_with_response));
+  }
+
+  if (!server_->is_servicable_uri(&req_))
+  {
+    // check if it is a captive portal request
+    if (server_->captive_active_ &&
+        std::find_if(captive_portal_uris.begin(), captive_portal_uris.end()
+                  , [&](const string &ent) {return !ent.compare(req_.uri());})
+        != captive_portal_uris.end() && remote_ip_)
     {
-      // Now that we have the request headers parsed we can check if the
-      // request exceeds the size limits of the server.
-      if (server_->is_request_too_large(&req_))
+      if (!server_->captive_auth_.count(remote_ip_) ||
+          (server_->captive_auth_[remote_ip_] > server_->captive_timeout_ &&
+          server_->captive_timeout_ != UINT32_MAX))
       {
-        // If the request has the EXPECT header we can reject the request with
-        // the EXPECTATION_FAILED (417) status, otherwise reject it with
-        // BAD_REQUEST (400).
-        req_.set_status(HttpStatusCode::STATUS_BAD_REQUEST);
-        if (req_.has_header(HttpHeader::EXPECT))
-        {
-          req_.set_status(HttpStatusCode::STATUS_EXPECATION_FAILED);
-        }
-        LOG_ERROR("[Httpd fd:%d,uri:%s] Request body is too large, "
-                  "aborting with status %d"
-                , fd_, req_.uri().c_str(), res_->code_);
-        return call_immediately(STATE(abort_request_with_response));
+        // new client or authentication expired
+        res_ = server_->captive_response_;
       }
-
-      if (!server_->is_servicable_uri(&req_))
+      else if (req_.uri().find("_204") > 0 ||
+              req_.uri().find("status.php") > 0)
       {
-        // check if it is a captive portal request
-        if (server_->captive_active_ &&
-            std::find_if(captive_portal_uris.begin(), captive_portal_uris.end()
-                      , [&](const string &ent) {return !ent.compare(req_.uri());})
-            != captive_portal_uris.end() && remote_ip_)
-        {
-          if (!server_->captive_auth_.count(remote_ip_) ||
-              (server_->captive_auth_[remote_ip_] > server_->captive_timeout_ &&
-              server_->captive_timeout_ != UINT32_MAX))
-          {
-            // new client or authentication expired
-            res_ = server_->captive_response_;
-          }
-          else if (req_.uri().find("_204") > 0 ||
-                  req_.uri().find("status.php") > 0)
-          {
-            // These URIs require a generic response with code 204
-            res_ = server_->captive_no_content_;
-          }
-          else if (req_.uri().find("ncsi.txt") > 0)
-          {
-            // Windows success page content
-            res_ = server_->captive_msft_ncsi_;
-          }
-          else if (req_.uri().find("success.txt") > 0)
-          {
-            // Generic success.txt page content
-            res_ = server_->captive_success_;
-          }
-          else
-          {
-            // iOS success page content
-            res_ = server_->captive_success_ios_;
-          }
-        }
-        else if (server_->captive_active_ &&
-                !server_->captive_auth_uri_.compare(req_.uri()))
-        {
-          server_->captive_auth_[remote_ip_] =
-            esp_timer_get_time() + server_->captive_timeout_;
-          res_ = server_->captive_ok_;
-        }
-        else
-        {
-          LOG_ERROR("[Httpd fd:%d,uri:%s] Unknown URI, sending 404", fd_
-                  , req_.uri().c_str());
-          res_.reset(new UriNotFoundResponse(req_.uri()));
-        }
-        req_.error(true);
-        return call_immediately(STATE(send_response_headers));
+        // These URIs require a generic response with code 204
+        res_ = server_->captive_no_content_;
       }
-
-      // Check if we have processed all parsed lines, if not add them back to
-      // the buffer for deferred processing.
-      if (processed_lines != lines.size())
+      else if (req_.uri().find("ncsi.txt") > 0)
       {
-        LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-          , "[Httpd fd:%d,uri:%s] Processed %zu/%zu lines, adding remaining "
-            "lines to body payload"
-          , fd_, req_.uri().c_str(), processed_lines, lines.size());
-        string unprocessed = string_join(lines.begin() + processed_lines
-                                       , lines.end(), HTML_EOL) + raw_header_;
-        raw_header_.assign(unprocessed);
+        // Windows success page content
+        res_ = server_->captive_msft_ncsi_;
+      }
+      else if (req_.uri().find("success.txt") > 0)
+      {
+        // Generic success.txt page content
+        res_ = server_->captive_success_;
+      }
+      else
+      {
+        // iOS success page content
+        res_ = server_->captive_success_ios_;
       }
-
-      return yield_and_call(STATE(process_request));
+    }
+    else if (server_->captive_active_ &&
+            !server_->captive_auth_uri_.compare(req_.uri()))
+    {
+      server_->captive_auth_[remote_ip_] =
+        esp_timer_get_time() + server_->captive_timeout_;
+      res_ = server_->captive_ok_;
     }
     else
     {
-      // it appears to be a header entry
-
-      // split header into name/value pair
-      auto h = break_string(line, ": ");
-
-      // URL decode the header name and value
-      h.first = url_decode(h.first);
-      h.second = url_decode(h.second);
-
-      // stash the header for later retrieval
-      req_.header(h.first, h.second);
+      LOG_ERROR("[Httpd fd:%d,uri:%s] Unknown URI, sending 404", fd_
+              , req_.uri().c_str());
+      res_.reset(new UriNotFoundResponse(req_.uri()));
     }
+    req_.error(true);
+    return call_immediately(STATE(send_response_headers));
   }
 
-  return yield_and_call(STATE(read_more_data));
+  return yield_and_call(STATE(process_request));
 }
 
 StateFlowBase::Action HttpRequestFlow::process_request()
@@ -275,7 +267,15 @@ StateFlowBase::Action HttpRequestFlow::process_request()
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] %s", fd_
     , req_.to_string().c_str());
 
-  if (!req_.header(HttpHeader::UPGRADE).compare(HTTP_UPGRADE_HEADER_WEBSOCKET))
+  if (server_->request_class(&req_) == REQUEST_CLASS_BULK)
+  {
+    bulk_ = true;
+    bulk_start_ = esp_timer_get_time();
+    slice_start_ = bulk_start_;
+    bulk_bytes_ = 0;
+  }
+
+  if (req_.header_equals(HttpHeader::UPGRADE, HTTP_UPGRADE_HEADER_WEBSOCKET))
   {
     // upgrade to websocket!
     if (!req_.has_header(HttpHeader::WS_VERSION) ||
@@ -294,16 +294,6 @@ StateFlowBase::Action HttpRequestFlow::process_request()
   // handler.
   if (req_.method() == HttpMethod::POST || req_.method() == HttpMethod::PUT)
   {
-    // move the raw unparsed header bits back to the buffer
-    if (!raw_header_.empty())
-    {
-      // resize for the reading of the body payload
-      buf_.clear();
-      buf_.reserve(body_read_size_);
-      std::move(raw_header_.begin(), raw_header_.end(), std::back_inserter(buf_));
-      raw_header_.assign("");
-    }
-
     // If we do not have a Content-Length header outright reject the request
     // as there is no telling how big the payload is without reading it in
     // full.
@@ -316,24 +306,51 @@ StateFlowBase::Action HttpRequestFlow::process_request()
     }
 
     // extract the body length from the content length header
-    body_len_ = std::stoul(req_.header(HttpHeader::CONTENT_LENGTH));
+    body_len_ = req_.content_length();
     LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
       , "[Httpd fd:%d,uri:%s] body (header): %zu", fd_, req_.uri().c_str()
       , body_len_);
 
+    if (req_.content_type() == ContentType::FORM_URLENCODED)
+    {
+      // the body payload is held in memory while it is parsed, reject any
+      // which exceed the form-data limit. The body is not consumed so the
+      // connection will be closed after the response.
+      if (body_len_ > config_httpd_max_form_size())
+      {
+        LOG_ERROR("[Httpd fd:%d,uri:%s] Form data is too large (%zu bytes), "
+                  "aborting.", fd_, req_.uri().c_str(), body_len_);
+        req_.header(HttpHeader::CONNECTION, HTTP_CONNECTION_CLOSE);
+        req_.set_status(HttpStatusCode::STATUS_ENTITY_TOO_LARGE);
+        return call_immediately(STATE(abort_request_with_response));
+      }
+      // the body payload is appended to the request buffer after any data
+      // that was received along with the headers and parsed in place once it
+      // has been fully received.
+      LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
+        , "Converting to application/x-www-form-urlencoded req");
+      return call_immediately(STATE(read_form_data));
+    }
+
+    // move any body payload that was received with the headers to the buffer
+    // used for streaming the body payload.
+    buf_.clear();
+    buf_.reserve(body_read_size_);
+    buf_.insert(buf_.end(), req_.raw_.begin() + parse_offs_, req_.raw_.end());
+    req_.raw_.resize(parse_offs_);
+
+    // cache the stream handler for this URI
+    part_stream_ = server_->stream_handler(&req_);
     if (req_.content_type() == ContentType::MULTIPART_FORMDATA)
     {
       // If we do not have a streaming handler for the URI abort the request.
-      if (!server_->stream_handler(req_.uri()))
+      if (!part_stream_)
       {
         LOG_ERROR("[Httpd fd:%d] No streaming handler to receive payload, "
                   "aborting!", fd_);
         req_.set_status(HttpStatusCode::STATUS_SERVER_ERROR);
         return call_immediately(STATE(abort_request_with_response));
       }
-      // cache the stream handler for this URI
-      part_stream_ = server_->stream_handler(req_.uri());
-
       // force request to be concluded at end of processing
       req_.header(HttpHeader::CONNECTION, HTTP_CONNECTION_CLOSE);
 
@@ -341,36 +358,26 @@ StateFlowBase::Action HttpRequestFlow::process_request()
         , "Converting to multipart/form-data req");
       return call_immediately(STATE(start_multipart_processing));
     }
-    else if (req_.content_type() == ContentType::FORM_URLENCODED)
-    {
-      // convert the request body from form url-encoded to parameters and send
-      // it for processing
-      LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-        , "Converting to application/x-www-form-urlencoded req");
-      return call_immediately(STATE(read_form_data));
-    }
-    else if (server_->stream_handler(req_.uri()))
+    else if (part_stream_)
     {
-      // cache the stream handler for this URI
-      part_stream_ = server_->stream_handler(req_.uri());
-
       // we have some of the body already read in, process it before requesting
       // more data
       if (!buf_.empty())
       {
+        helper_.hasError_ = 0;
+        helper_.remaining_ = 0;
         return yield_and_call(STATE(stream_body));
       }
       else
       {
         // read the payload and process it in chunks
+        buf_.resize(std::min(body_len_, body_read_size_));
         return read_repeated_with_timeout(&helper_, timeout_, fd_
-                                        , buf_.data()
-                                        , std::min(body_len_, body_read_size_)
+                                        , buf_.data(), buf_.size()
                                         , STATE(stream_body));
       }
     }
-    else if (req_.has_header(HttpHeader::CONTENT_LENGTH) &&
-             std::stol(req_.header(HttpHeader::CONTENT_LENGTH)) > 0)
+    else if (body_len_ > 0)
     {
       // the POST/PUT request has a payload but unrecognized Content-Type,
       // abort the request as we can't process it.
@@ -386,16 +393,17 @@ StateFlowBase::Action HttpRequestFlow::process_request()
 
 StateFlowBase::Action HttpRequestFlow::process_request_handler()
 {
+  handler_time_ = esp_timer_get_time();
   if (server_->have_known_response(req_.uri()))
   {
     res_ = server_->response(&req_);
   }
   else
   {
-    auto handler = server_->handler(req_.method(), req_.uri());
+    auto handler = server_->handler(&req_);
     if (handler)
     {
-      auto res = handler(&req_);
+      auto res = (*handler)(&req_);
       if (res && !res_)
       {
         res_.reset(res);
@@ -414,11 +422,22 @@ StateFlowBase::Action HttpRequestFlow::process_request_handler()
 
 StateFlowBase::Action HttpRequestFlow::read_more_data()
 {
-  // we need more data to parse the request
+  // we need more data to parse the request, the data is read directly into
+  // the request buffer after any data that has not yet been parsed.
+  size_t used = req_.raw_.size();
+  if (used >= max_header_size_)
+  {
+    LOG_ERROR("[Httpd fd:%d] Received %zu bytes without being able to parse "
+              "headers, aborting.", fd_, used);
+    req_.set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+    return call_immediately(STATE(abort_request_with_response));
+  }
+  size_t data_req = std::min(header_read_size_, max_header_size_ - used);
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-    , "[Httpd fd:%d] Requesting more data to process request", fd_);
-  return read_repeated_with_timeout(&helper_, timeout_, fd_, buf_.data()
-                              , header_read_size_, STATE(parse_header_data));
+    , "[Httpd fd:%d] Requesting %zu bytes to process request", fd_, data_req);
+  req_.raw_.resize(used + data_req);
+  return read_repeated_with_timeout(&helper_, timeout_, fd_, &req_.raw_[used]
+                                  , data_req, STATE(parse_header_data));
 }
 
 StateFlowBase::Action HttpRequestFlow::stream_body()
@@ -428,14 +447,14 @@ StateFlowBase::Action HttpRequestFlow::stream_body()
     return call_immediately(STATE(abort_request));
   }
   HASSERT(part_stream_);
-  size_t data_len = body_read_size_ - helper_.remaining_;
+  size_t data_len = buf_.size() - helper_.remaining_;
   // if we received some data pass it on to the handler
   if (data_len)
   {
     bool abort_req = false;
-    auto res = part_stream_(&req_, "", body_len_, buf_.data(), data_len
-                          , body_offs_, (body_offs_ + data_len) >= body_len_
-                          , &abort_req);
+    auto res = (*part_stream_)(&req_, "", body_len_, buf_.data(), data_len
+                             , body_offs_, (body_offs_ + data_len) >= body_len_
+                             , &abort_req);
     body_offs_ += data_len;
     if (res && !res_)
     {
@@ -448,9 +467,11 @@ StateFlowBase::Action HttpRequestFlow::stream_body()
   }
   if (body_offs_ < body_len_)
   {
-    size_t data_req = std::min(body_len_ - body_offs_, body_read_size_);
+    buf_.resize(std::min(body_len_ - body_offs_, body_read_size_));
     return read_repeated_with_timeout(&helper_, timeout_, fd_, buf_.data()
-                                    , data_req, STATE(stream_body));
+                                    , buf_.size()
+                                    , throttle(STATE(stream_body)
+                                             , buf_.size()));
   }
   return yield_and_call(STATE(send_response_headers));
 }
@@ -459,7 +480,7 @@ StateFlowBase::Action HttpRequestFlow::start_multipart_processing()
 {
   // check if the request has the "Expect: 100-continue" header. If it does
   // send the 100/continue line so the client starts streaming data.
-  if (!req_.header(HttpHeader::EXPECT).compare("100-continue"))
+  if (req_.header_equals(HttpHeader::EXPECT, "100-continue"))
   {
     LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d,uri:%s] Sending:%s", fd_
       , req_.uri().c_str(), multipart_res_.c_str());
@@ -698,7 +719,8 @@ StateFlowBase::Action HttpRequestFlow::parse_multipart_headers()
     // read the payload and process it in chunks
     return read_repeated_with_timeout(&helper_, timeout_, fd_
                                     , buf_.data() + buf_.size(), data_req
-                                    , STATE(stream_multipart_body));
+                                    , throttle(STATE(stream_multipart_body)
+                                             , data_req));
   }
   return yield_and_call(STATE(read_multipart_headers));
 }
@@ -746,9 +768,10 @@ StateFlowBase::Action HttpRequestFlow::stream_multipart_body()
       , "[Httpd fd:%d,uri:%s] Received %zu/%zu bytes", fd_, req_.uri().c_str()
       , part_offs_, part_len_);
     bool abort_req = false;
-    auto res = part_stream_(&req_, part_filename_, part_len_, buf_.data()
-                          , data_len, part_offs_
-                          , (part_offs_ + data_len) >= part_len_, &abort_req);
+    auto res = (*part_stream_)(&req_, part_filename_, part_len_, buf_.data()
+                             , data_len, part_offs_
+                             , (part_offs_ + data_len) >= part_len_
+                             , &abort_req);
     part_offs_ += data_len;
     if (res && !res_)
     {
@@ -768,7 +791,9 @@ StateFlowBase::Action HttpRequestFlow::stream_multipart_body()
       , "[Httpd fd:%d,uri:%s] Requesting %zu bytes", fd_, req_.uri().c_str()
       , data_req);
     return read_repeated_with_timeout(&helper_, timeout_, fd_, buf_.data()
-                                    , data_req, STATE(stream_multipart_body));
+                                    , data_req
+                                    , throttle(STATE(stream_multipart_body)
+                                             , data_req));
   }
   if (body_len_)
   {
@@ -780,77 +805,36 @@ StateFlowBase::Action HttpRequestFlow::stream_multipart_body()
 
 StateFlowBase::Action HttpRequestFlow::read_form_data()
 {
-  // Request enough data for at least header_read_size_ number of bytes.
+  // the body payload starts immediately after the headers in the request
+  // buffer.
+  size_t received = req_.raw_.size() - parse_offs_;
+  if (received >= body_len_)
+  {
+    // convert the request body from form url-encoded to parameters and send
+    // it for processing
+    req_.parse_params(parse_offs_, body_len_);
+    return yield_and_call(STATE(process_request_handler));
+  }
+
+  size_t used = req_.raw_.size();
+  size_t data_req = std::min(body_len_ - received, header_read_size_);
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
     , "[Httpd fd:%d,uri:%s] requesting %zu bytes for form-data processing", fd_
-    , req_.uri().c_str(), header_read_size_ - buf_.size());
-  return read_repeated_with_timeout(&helper_, timeout_, fd_
-                                  , buf_.data() + buf_.size()
-                                  , header_read_size_ - buf_.size()
-                                  , STATE(parse_form_data));
+    , req_.uri().c_str(), data_req);
+  req_.raw_.resize(used + data_req);
+  return read_repeated_with_timeout(&helper_, timeout_, fd_, &req_.raw_[used]
+                                  , data_req, STATE(parse_form_data));
 }
 
 StateFlowBase::Action HttpRequestFlow::parse_form_data()
 {
+  // trim the request buffer to the data that was actually received.
+  req_.raw_.resize(req_.raw_.size() - helper_.remaining_);
   if (helper_.hasError_)
   {
     return call_immediately(STATE(abort_request));
   }
-  else if (helper_.remaining_ == header_read_size_ || buf_.empty())
-  {
-    return yield_and_call(STATE(read_form_data));
-  }
-
-  raw_header_.append((char *)buf_.data()
-                   , header_read_size_ - helper_.remaining_);
-  buf_.clear();
-
-  LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "body: %zu, received: %zu", body_len_
-    , (header_read_size_ - helper_.remaining_));
-
-  // track how much we have read in of the body payload
-  if (body_len_ > (header_read_size_ - helper_.remaining_))
-  {
-    body_len_ -= (header_read_size_ - helper_.remaining_);
-  }
-  else
-  {
-    body_len_ = 0;
-  }
-
-  vector<string> params;
-  size_t parsed = tokenize(raw_header_, params, "&", body_len_ == 0);
-
-  // drop whatever has been tokenized so we don't process it again
-  raw_header_.erase(0, parsed);
-
-  for (auto param : params)
-  {
-    auto p = break_string(param, "=");
-
-    // URL decode the parameter name and value
-    p.first = url_decode(p.first);
-    p.second = url_decode(p.second);
-
-    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-      , "param: %s, value: %s", p.first.c_str(), p.second.c_str());
-    // add the parameter to the request
-    req_.param(p.first, p.second);
-  }
-
-  // If there is more body payload to read request more data before processing
-  // the request fully.
-  if (body_len_)
-  {
-    size_t data_req = std::min(body_len_, header_read_size_);
-    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-      , "[Httpd fd:%d,uri:%s] Requesting %zu bytes", fd_, req_.uri().c_str()
-      , data_req);
-    return read_repeated_with_timeout(&helper_, timeout_, fd_, buf_.data()
-                                    , data_req, STATE(parse_form_data));
-  }
-
-  return yield_and_call(STATE(process_request_handler));
+  return yield_and_call(STATE(read_form_data));
 }
 
 StateFlowBase::Action HttpRequestFlow::send_response_headers()
@@ -864,6 +848,7 @@ StateFlowBase::Action HttpRequestFlow::send_response_headers()
       , fd_, req_.uri().c_str(), req_.status_);
     res_.reset(new AbstractHttpResponse(req_.status_));
   }
+  send_time_ = esp_timer_get_time();
   size_t len = 0;
   bool keep_alive = req_.keep_alive() &&
                     req_count_ < config_httpd_max_req_per_connection();
@@ -871,6 +856,7 @@ StateFlowBase::Action HttpRequestFlow::send_response_headers()
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
     , "[Httpd fd:%d,uri:%s] Sending headers using %zu bytes (%d)."
     , fd_, req_.uri().c_str(), len, res_->code_);
+  bytes_out_ += len;
   return write_repeated(&helper_, fd_, payload, len, STATE(send_response_body));
 }
 
@@ -882,28 +868,38 @@ StateFlowBase::Action HttpRequestFlow::send_response_body()
       , "[Httpd fd:%d,uri:%s] HEAD request, no body required.", fd_
       , req_.uri().c_str());
   }
+  else if (res_->is_chunked())
+  {
+    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
+      , "[Httpd fd:%d,uri:%s] Sending chunked body.", fd_
+      , req_.uri().c_str());
+    return call_immediately(STATE(send_response_chunk));
+  }
   else if (res_->get_body_length())
   {
     LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-      , "[Httpd fd:%d,uri:%s] Sending body of %d bytes.", fd_
+      , "[Httpd fd:%d,uri:%s] Sending body of %zu bytes.", fd_
       , req_.uri().c_str(), res_->get_body_length());
-    // check if we can send the entire response in one call or not.
-    if (res_->get_body_length() > config_httpd_response_chunk_size())
+    response_body_offs_ = 0;
+    response_body_chunk_ = 0;
+    if (res_->get_body() == nullptr)
     {
+      // the response body is not held in memory, it will be read one chunk at
+      // a time into the request buffer as it is sent.
       LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
         , "[Httpd fd:%d,uri:%s] Converting to streamed response.", fd_
         , req_.uri().c_str());
-      response_body_offs_ = 0;
-      LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-        , "[Httpd fd:%d,uri:%s] Sending [%d-%d/%d]", fd_
-        , req_.uri().c_str(), response_body_offs_
-        , config_httpd_response_chunk_size(), res_->get_body_length());
+      buf_.resize(std::min(res_->get_body_length()
+                         , (size_t)config_httpd_response_chunk_size()));
+    }
+    else if (res_->get_body_length() <= config_httpd_response_chunk_size())
+    {
+      // the entire response can be sent in one call.
+      bytes_out_ += res_->get_body_length();
       return write_repeated(&helper_, fd_, res_->get_body()
-                          , config_httpd_response_chunk_size()
-                          , STATE(send_response_body_split));
+                          , res_->get_body_length(), STATE(request_complete));
     }
-    return write_repeated(&helper_, fd_, res_->get_body()
-                        , res_->get_body_length(), STATE(request_complete));
+    return call_immediately(STATE(send_response_body_split));
   }
   return yield_and_call(STATE(request_complete));
 }
@@ -915,28 +911,122 @@ StateFlowBase::Action HttpRequestFlow::send_response_body_split()
   {
     return yield_and_call(STATE(abort_request));
   }
-  response_body_offs_ += (config_httpd_response_chunk_size() -
-                          helper_.remaining_);
+  response_body_offs_ += (response_body_chunk_ - helper_.remaining_);
   if (response_body_offs_ >= res_->get_body_length())
   {
-    // the body has been sent fully
+    // the body has been sent fully, release the streaming buffer (the
+    // capacity is retained for reuse by the next request).
+    buf_.clear();
     return yield_and_call(STATE(request_complete));
   }
-  size_t remaining = res_->get_body_length() - response_body_offs_;
-  if (remaining > config_httpd_response_chunk_size())
+  response_body_chunk_ = res_->get_body_length() - response_body_offs_;
+  if (response_body_chunk_ > config_httpd_response_chunk_size())
   {
-    remaining = config_httpd_response_chunk_size();
+    response_body_chunk_ = config_httpd_response_chunk_size();
   }
   LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
-    , "[Httpd fd:%d,uri:%s] Sending [%d-%d/%d]", fd_, req_.uri().c_str()
-    , response_body_offs_, response_body_offs_ + remaining
+    , "[Httpd fd:%d,uri:%s] Sending [%zu-%zu/%zu]", fd_, req_.uri().c_str()
+    , response_body_offs_, response_body_offs_ + response_body_chunk_
     , res_->get_body_length());
-  return write_repeated(&helper_, fd_, res_->get_body() + response_body_offs_
-                      , remaining, STATE(send_response_body_split));
+  const uint8_t *payload = res_->get_body();
+  if (payload)
+  {
+    payload += response_body_offs_;
+  }
+  else if (res_->read_body(buf_.data(), response_body_chunk_) !=
+           response_body_chunk_)
+  {
+    LOG_ERROR("[Httpd fd:%d,uri:%s] Failed to read response body at offset "
+              "%zu, aborting.", fd_, req_.uri().c_str(), response_body_offs_);
+    return yield_and_call(STATE(abort_request));
+  }
+  else
+  {
+    payload = buf_.data();
+  }
+  bytes_out_ += response_body_chunk_;
+  return write_repeated(&helper_, fd_, payload, response_body_chunk_
+                      , throttle(STATE(send_response_body_split)
+                               , response_body_chunk_));
+}
+
+/// Number of bytes reserved at the start of each chunk for the chunk size and
+/// line terminator, the size is sent as eight hex digits (with leading zeros).
+static constexpr size_t CHUNK_HEADER_SIZE = 10;
+
+StateFlowBase::Action HttpRequestFlow::send_response_chunk()
+{
+  // check if there has been an error and abort if needed
+  if (helper_.hasError_)
+  {
+    return yield_and_call(STATE(abort_request));
+  }
+
+  // reserve space for the chunk size, it will be filled in once the content
+  // has been generated.
+  response_chunk_.assign(CHUNK_HEADER_SIZE, '0');
+  bool more = true;
+  while (more && response_chunk_.size() <
+         CHUNK_HEADER_SIZE + config_httpd_response_chunk_size())
+  {
+    more = res_->next_chunk(response_chunk_);
+  }
+  size_t len = response_chunk_.size() - CHUNK_HEADER_SIZE;
+  if (len)
+  {
+    char header[CHUNK_HEADER_SIZE + 1];
+    snprintf(header, sizeof(header), "%08zx%s", len, HTML_EOL);
+    response_chunk_.replace(0, CHUNK_HEADER_SIZE, header, CHUNK_HEADER_SIZE);
+    response_chunk_.append(HTML_EOL);
+  }
+  else
+  {
+    response_chunk_.clear();
+  }
+  LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
+    , "[Httpd fd:%d,uri:%s] Sending chunk of %zu bytes%s", fd_
+    , req_.uri().c_str(), len, more ? "" : " (final)");
+  if (!more)
+  {
+    // last-chunk followed by an empty trailer
+    response_chunk_.append(StringPrintf("0%s%s", HTML_EOL, HTML_EOL));
+    bytes_out_ += response_chunk_.size();
+    return write_repeated(&helper_, fd_, response_chunk_.data()
+                        , response_chunk_.size(), STATE(request_complete));
+  }
+  bytes_out_ += response_chunk_.size();
+  return write_repeated(&helper_, fd_, response_chunk_.data()
+                      , response_chunk_.size()
+                      , throttle(STATE(send_response_chunk)
+                               , response_chunk_.size()));
 }
 
 StateFlowBase::Action HttpRequestFlow::request_complete()
 {
+  response_chunk_.clear();
+  response_chunk_.shrink_to_fit();
+
+  // record the request metrics, any phase which was not reached (due to an
+  // error) is treated as zero length.
+  uint64_t now = esp_timer_get_time();
+  if (!start_time_)
+  {
+    start_time_ = now;
+  }
+  if (!send_time_)
+  {
+    send_time_ = now;
+  }
+  if (!handler_time_)
+  {
+    handler_time_ = send_time_;
+  }
+  bool failed = req_.error() || (res_ && res_->code_ >= 400);
+  server_->metrics_.record_request(
+    req_.route_ ? req_.route_->uri() :
+      failed ? UNROUTED_METRICS_URI : req_.uri()
+  , failed, req_count_ > 0, req_.raw_.size() + body_offs_, bytes_out_
+  , handler_time_ - start_time_, send_time_ - handler_time_, now - send_time_);
 #if CONFIG_HTTP_REQ_FLOW_LOG_LEVEL == VERBOSE
   if (!req_.uri().empty())
   {
@@ -967,9 +1057,7 @@ StateFlowBase::Action HttpRequestFlow::request_complete()
       res_->code_ == HttpStatusCode::STATUS_FOUND ||
       res_->code_ == HttpStatusCode::STATUS_MOVED_PERMANENTLY)
   {
-    req_.reset();
-    server_->schedule_cleanup(this);
-    return exit();
+    return release_connection();
   }
 
   return call_immediately(STATE(start_request));
@@ -995,9 +1083,7 @@ StateFlowBase::Action HttpRequestFlow::upgrade_to_websocket()
       , "[Httpd fd:%d,uri:%s] Upgrading to WebSocket", fd_
       , req_.uri().c_str());
   }
-  req_.reset();
-  server_->schedule_cleanup(this);
-  return exit();
+  return release_connection();
 }
 
 StateFlowBase::Action HttpRequestFlow::abort_request_with_response()
@@ -1012,5 +1098,69 @@ StateFlowBase::Action HttpRequestFlow::abort_request()
   return call_immediately(STATE(request_complete));
 }
 
+StateFlowBase::Callback HttpRequestFlow::throttle(Callback next, size_t bytes)
+{
+  if (!bulk_)
+  {
+    return next;
+  }
+  bulk_bytes_ += bytes;
+  throttle_next_ = next;
+  return STATE(throttle_bulk);
+}
+
+StateFlowBase::Action HttpRequestFlow::throttle_bulk()
+{
+  uint64_t now = esp_timer_get_time();
+  uint64_t delay = 0;
+  if (config_httpd_bulk_rate_limit())
+  {
+    // delay until the bytes transferred so far are within the rate limit.
+    uint64_t target = bulk_start_ +
+      (bulk_bytes_ * 1000000ULL) / config_httpd_bulk_rate_limit();
+    if (target > now)
+    {
+      delay = target - now;
+    }
+  }
+  if (!delay && (now - slice_start_) >=
+      (uint64_t)MSEC_TO_USEC(config_httpd_bulk_time_slice_ms()))
+  {
+    // the time slice has been used, give the executor to other flows.
+    delay = MSEC_TO_USEC(config_httpd_bulk_yield_ms());
+  }
+  if (delay)
+  {
+    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL
+      , "[Httpd fd:%d,uri:%s] Throttling bulk request for %llu us", fd_
+      , req_.uri().c_str(), (unsigned long long)delay);
+    slice_start_ = now + delay;
+    return sleep_and_call(&timer_, USEC_TO_NSEC(delay), throttle_next_);
+  }
+  return yield_and_call(throttle_next_);
+}
+
+StateFlowBase::Action HttpRequestFlow::release_connection()
+{
+  if (close_)
+  {
+    LOG(CONFIG_HTTP_REQ_FLOW_LOG_LEVEL, "[Httpd fd:%d] Closed", fd_);
+    ::close(fd_);
+  }
+  fd_ = -1;
+  server_->metrics_.connection_closed();
+  // release all per-request state in one step, the buffers are retained for
+  // the next connection.
+  req_.reset();
+  res_.reset();
+  buf_.clear();
+  part_stream_ = nullptr;
+
+  // NOTE: the flow may be assigned a new connection as soon as it has been
+  // released, no members should be modified after this call.
+  server_->release_request_flow(this);
+  return call_immediately(STATE(wait_for_connection));
+}
+
 } // namespace http
 
@@ -42,21 +42,12 @@
 namespace http
 {
 
-typedef enum
-{
-  OP_CONTINUATION = 0x0, // Continuation Frame
-  OP_TEXT         = 0x1, // Text Frame
-  OP_BINARY       = 0x2, // Binary Frame
-  OP_CLOSE        = 0x8, // Connection Close Frame
-  OP_PING         = 0x9, // Ping Frame
-  OP_PONG         = 0xA, // Pong Frame
-} WebSocketOpcode;
-
 static constexpr uint8_t WEBSOCKET_FINAL_FRAME = 0x80;
 static constexpr uint8_t WEBSOCKET_FRAME_IS_MASKED = 0x80;
 static constexpr uint8_t WEBSOCKET_FRAME_LEN_SINGLE = 126;
 static constexpr uint8_t WEBSOCKET_FRAME_LEN_UINT16 = 126;
 static constexpr uint8_t WEBSOCKET_FRAME_LEN_UINT64 = 127;
+static constexpr uint8_t WEBSOCKET_CONTROL_FRAME = 0x08;
 
 // This is the WebSocket UUID it is used as part of the handshake process.
 static constexpr const char * WEBSOCKET_UUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
@@ -70,6 +61,7 @@ WebSocketFlow::WebSocketFlow(Httpd *server, int fd, uint32_t remote_ip
                            , remote_ip_(remote_ip)
                            , timeout_(MSEC_TO_NSEC(config_httpd_websocket_timeout_ms()))
                            , max_frame_size_(config_httpd_websocket_max_frame_size())
+                           , max_message_size_(config_httpd_websocket_max_message_size())
                            , handler_(handler)
 {
   if(server_->add_websocket(fd, this))
@@ -100,6 +92,7 @@ WebSocketFlow::WebSocketFlow(Httpd *server, int fd, uint32_t remote_ip
       data_ = (uint8_t *)malloc(max_frame_size_);
       if (data_)
       {
+        data_capacity_ = max_frame_size_;
         start_flow(STATE(send_handshake));
         return;
       }
@@ -128,13 +121,86 @@ WebSocketFlow::~WebSocketFlow()
   {
     free(data_);
   }
-  textToSend_.clear();
 }
 
-void WebSocketFlow::send_text(string &text)
+bool WebSocketFlow::send_text(const string &text)
+{
+  return send_frame(encode(OP_TEXT, (const uint8_t *)text.data()
+                         , text.length()));
+}
+
+bool WebSocketFlow::send_binary(const uint8_t *data, size_t len)
 {
-  OSMutexLock l(&textLock_);
-  textToSend_.append(text);
+  return send_frame(encode(OP_BINARY, data, len));
+}
+
+bool WebSocketFlow::send_frame(WebSocketFrame frame)
+{
+  OSMutexLock l(&queueLock_);
+  // the in-flight message is not counted so that a single message larger
+  // than the queue limit can still be delivered to an idle client.
+  if (!queue_.empty() &&
+      queued_bytes_ + frame->length() > config_httpd_websocket_max_queue_size())
+  {
+    server_->metrics_.websocket_message_dropped();
+    dropped_++;
+    LOG(CONFIG_HTTP_WS_LOG_LEVEL
+      , "[WebSocket fd:%d] Queue full (%zu bytes), dropped %zu message(s)"
+      , fd_, queued_bytes_, dropped_);
+    if (dropped_ == config_httpd_websocket_max_dropped())
+    {
+      LOG(WARNING, "[WebSocket fd:%d] Disconnecting slow consumer", fd_);
+      server_->metrics_.websocket_slow_consumer();
+      close_requested_ = true;
+    }
+    return false;
+  }
+  queued_bytes_ += frame->length();
+  queue_.push_back(std::move(frame));
+  return true;
+}
+
+WebSocketFrame WebSocketFlow::encode(WebSocketOpcode opcode
+                                   , const uint8_t *data, size_t len)
+{
+  const size_t fragment_size = config_httpd_websocket_fragment_size();
+  string frame;
+  // reserve space for the payload and the largest header per fragment.
+  frame.reserve(len + ((len / fragment_size) + 1) * 10);
+  size_t offs = 0;
+  do
+  {
+    size_t payload = std::min(len - offs, fragment_size);
+    // only the first fragment carries the opcode, the remainder are sent as
+    // continuations with the final fragment flagged.
+    uint8_t header = offs ? OP_CONTINUATION : opcode;
+    if (offs + payload == len)
+    {
+      header |= WEBSOCKET_FINAL_FRAME;
+    }
+    frame.push_back(header);
+    if (payload < WEBSOCKET_FRAME_LEN_SINGLE)
+    {
+      frame.push_back(payload);
+    }
+    else if (payload <= UINT16_MAX)
+    {
+      frame.push_back(WEBSOCKET_FRAME_LEN_UINT16);
+      frame.push_back((payload >> 8) & 0xFF);
+      frame.push_back(payload & 0xFF);
+    }
+    else
+    {
+      frame.push_back(WEBSOCKET_FRAME_LEN_UINT64);
+      for (int shift = 56; shift >= 0; shift -= 8)
+      {
+        frame.push_back(((uint64_t)payload >> shift) & 0xFF);
+      }
+    }
+    frame.append((const char *)data + offs, payload);
+    offs += payload;
+  } while (offs < len);
+  return std::make_shared<const string>(std::move(frame));
 }
 
 int WebSocketFlow::id()
@@ -238,7 +304,6 @@ StateFlowBase::Action WebSocketFlow::read_frame_header()
   frameLenType_ = 0;
   frameLength_ = 0;
   maskingKey_ = 0;
-  bzero(data_, max_frame_size_);
   LOG(CONFIG_HTTP_WS_LOG_LEVEL, "[WebSocket fd:%d] Reading WS packet", fd_);
   return read_fully_with_timeout(&header_, sizeof(uint16_t)
                                , config_httpd_websocket_max_read_attempts()
@@ -249,11 +314,18 @@ StateFlowBase::Action WebSocketFlow::read_frame_header()
 StateFlowBase::Action WebSocketFlow::frame_header_received()
 {
   opcode_ = static_cast<WebSocketOpcode>(header_ & 0x0F);
+  final_ = (header_ & WEBSOCKET_FINAL_FRAME);
   masked_ = ((header_ >> 8) & WEBSOCKET_FRAME_IS_MASKED);
   uint8_t len = ((header_ >> 8) & 0x7F);
   LOG(CONFIG_HTTP_WS_LOG_LEVEL
-    , "[WebSocket fd:%d] opc: %d, masked: %d, len: %d", fd_, opcode_, masked_
-    , len);
+    , "[WebSocket fd:%d] opc: %d, fin: %d, masked: %d, len: %d", fd_, opcode_
+    , final_, masked_, len);
+  if ((opcode_ & WEBSOCKET_CONTROL_FRAME) &&
+      (!final_ || len > WEBSOCKET_MAX_CONTROL_PAYLOAD))
+  {
+    LOG_ERROR("[WebSocket fd:%d] Invalid control frame, disconnecting", fd_);
+    return yield_and_call(STATE(shutdown_connection));
+  }
   if (len < WEBSOCKET_FRAME_LEN_SINGLE)
   {
     frameLenType_ = 0;
@@ -295,7 +367,7 @@ StateFlowBase::Action WebSocketFlow::frame_data_len_received()
   else if (frameLenType_ == 2)
   {
     // byte swap frameLength_ (64 bit)
-    uint8_t *p = (uint8_t *)frameLength_;
+    uint8_t *p = (uint8_t *)&frameLength_;
     uint64_t temp =            p[7]        | (uint16_t)(p[6]) << 8
                   | (uint32_t)(p[5]) << 16 | (uint32_t)(p[4]) << 24
                   | (uint64_t)(p[3]) << 32 | (uint64_t)(p[2]) << 40
@@ -303,6 +375,8 @@ StateFlowBase::Action WebSocketFlow::frame_data_len_received()
     frameLength_ = temp;
   }
 
+  server_->metrics_.websocket_frame_received(frameLength_);
+
   if (masked_)
   {
     // frame uses data masking, read the mask and then start reading the
@@ -320,61 +394,182 @@ StateFlowBase::Action WebSocketFlow::start_recv_frame_data()
 {
   LOG(CONFIG_HTTP_WS_LOG_LEVEL, "[WebSocket fd:%d] Reading WS packet (%d len)"
     , fd_, (int)frameLength_);
-  // restrict the size of the fame buffer so we don't use all of the ram for
-  // one frame.
-  data_size_ = std::min(frameLength_, max_frame_size_);
-  return read_fully_with_timeout(data_, data_size_
+  frameOffset_ = 0;
+  if (opcode_ & WEBSOCKET_CONTROL_FRAME)
+  {
+    // control frames are read into a dedicated buffer since they may arrive
+    // between the fragments of a data message.
+    if (!frameLength_)
+    {
+      return call_immediately(STATE(process_control_frame));
+    }
+    return read_fully_with_timeout(control_, frameLength_
+                                 , config_httpd_websocket_max_read_attempts()
+                                 , STATE(process_control_frame)
+                                 , STATE(shutdown_connection));
+  }
+  if ((opcode_ == OP_CONTINUATION) == (message_opcode_ == OP_CONTINUATION))
+  {
+    LOG_ERROR("[WebSocket fd:%d] Unexpected %s frame, disconnecting", fd_
+            , opcode_ == OP_CONTINUATION ? "continuation" : "data");
+    return yield_and_call(STATE(shutdown_connection));
+  }
+  if (opcode_ != OP_CONTINUATION)
+  {
+    message_opcode_ = opcode_;
+    message_len_ = 0;
+    streaming_ = false;
+  }
+  if (!streaming_ && message_len_ + frameLength_ > max_message_size_)
+  {
+    // the message is too large to reassemble, deliver what has been received
+    // so far and the remainder as it arrives.
+    LOG(CONFIG_HTTP_WS_LOG_LEVEL
+      , "[WebSocket fd:%d] Message exceeds %zu bytes, delivering in pieces"
+      , fd_, max_message_size_);
+    streaming_ = true;
+    if (message_len_)
+    {
+      handler_(this, message_opcode_ == OP_TEXT ? WS_EVENT_TEXT
+                                                : WS_EVENT_BINARY
+             , data_, message_len_);
+      message_len_ = 0;
+    }
+  }
+  else if (!streaming_ && message_len_ + frameLength_ > data_capacity_)
+  {
+    size_t capacity = message_len_ + frameLength_;
+    uint8_t *data = (uint8_t *)realloc(data_, capacity);
+    if (data == nullptr)
+    {
+      LOG_ERROR("[WebSocket fd:%d] Unable to allocate %zu bytes for message"
+              , fd_, capacity);
+      return yield_and_call(STATE(shutdown_connection));
+    }
+    data_ = data;
+    data_capacity_ = capacity;
+  }
+  return call_immediately(STATE(recv_next_frame_data));
+}
+
+StateFlowBase::Action WebSocketFlow::recv_next_frame_data()
+{
+  // restrict the size of each read so that the timeout applies to a
+  // reasonable amount of data. The data is read directly into the position
+  // it will be delivered from.
+  data_size_ = std::min(frameLength_ - frameOffset_, max_frame_size_);
+  if (!data_size_)
+  {
+    return call_immediately(STATE(recv_frame_data));
+  }
+  return read_fully_with_timeout(streaming_ ? data_ : data_ + message_len_
+                               , data_size_
                                , config_httpd_websocket_max_read_attempts()
                                , STATE(recv_frame_data)
-                               , STATE(send_frame_header));
+                               , STATE(shutdown_connection));
 }
 
 StateFlowBase::Action WebSocketFlow::recv_frame_data()
 {
-  size_t received_len = data_size_ - helper_.remaining_;
-  if (received_len)
+  WebSocketEvent event =
+    message_opcode_ == OP_TEXT ? WS_EVENT_TEXT : WS_EVENT_BINARY;
+  uint8_t *data = streaming_ ? data_ : data_ + message_len_;
+  LOG(CONFIG_HTTP_WS_LOG_LEVEL
+    , "[WebSocket fd:%d] Received %zu bytes", fd_, data_size_);
+  if (masked_)
   {
-    LOG(CONFIG_HTTP_WS_LOG_LEVEL
-      , "[WebSocket fd:%d] Received %zu bytes", fd_, received_len);
-    if (masked_)
-    {
-      uint8_t *mask = reinterpret_cast<uint8_t *>(&maskingKey_);
-      char buf[10];
-      LOG(CONFIG_HTTP_WS_LOG_LEVEL
-        , "[WebSocket fd:%d] Demasking %zu bytes (mask: %s)", fd_, received_len
-        , unsigned_integer_to_buffer_hex(maskingKey_, buf));
-      for (size_t idx = 0; idx < received_len; idx++)
-      {
-        data_[idx] ^= mask[idx % 4];
-      }
-    }
-    if (opcode_ == OP_PING)
-    {
-      // send PONG
-    }
-    else if (opcode_ == OP_TEXT)
+    unmask(data, data_size_, maskingKey_, frameOffset_);
+  }
+  frameOffset_ += data_size_;
+  if (streaming_)
+  {
+    if (data_size_)
     {
-      handler_(this, WebSocketEvent::WS_EVENT_TEXT, data_, received_len);
+      handler_(this, event, data_, data_size_);
     }
-    else if (opcode_ == OP_BINARY)
+  }
+  else
+  {
+    message_len_ += data_size_;
+  }
+  if (close_requested_)
+  {
+    return yield_and_call(STATE(shutdown_connection));
+  }
+  if (frameOffset_ < frameLength_)
+  {
+    return call_immediately(STATE(recv_next_frame_data));
+  }
+  if (final_)
+  {
+    if (!streaming_)
     {
-      handler_(this, WebSocketEvent::WS_EVENT_BINARY, data_, received_len);
+      handler_(this, event, data_, message_len_);
     }
-    if (opcode_ == OP_CLOSE || close_requested_)
+    message_opcode_ = OP_CONTINUATION;
+    message_len_ = 0;
+    streaming_ = false;
+    // release any additional memory used for reassembling a large message.
+    if (data_capacity_ > max_frame_size_)
     {
-      return yield_and_call(STATE(shutdown_connection));
+      uint8_t *data = (uint8_t *)realloc(data_, max_frame_size_);
+      if (data)
+      {
+        data_ = data;
+        data_capacity_ = max_frame_size_;
+      }
     }
+    // send any response(s) before waiting for the next message.
+    return yield_and_call(STATE(send_frame_header));
+  }
+  return yield_and_call(STATE(read_frame_header));
+}
+
+StateFlowBase::Action WebSocketFlow::process_control_frame()
+{
+  if (masked_)
+  {
+    unmask(control_, frameLength_, maskingKey_, 0);
   }
-  frameLength_ -= received_len;
-  if (frameLength_)
+  if (opcode_ == OP_CLOSE)
   {
-    data_size_ = std::min(frameLength_, max_frame_size_);
-    return read_fully_with_timeout(data_, data_size_
-                                 , config_httpd_websocket_max_read_attempts()
-                                 , STATE(recv_frame_data)
-                                 , STATE(shutdown_connection));
+    return yield_and_call(STATE(shutdown_connection));
+  }
+  else if (opcode_ == OP_PING)
+  {
+    // the PONG is sent ahead of any queued messages and is not subject to the
+    // queue limit.
+    WebSocketFrame pong = encode(OP_PONG, control_, frameLength_);
+    OSMutexLock l(&queueLock_);
+    queued_bytes_ += pong->length();
+    queue_.push_front(std::move(pong));
+  }
+  return yield_and_call(STATE(send_frame_header));
+}
+
+void WebSocketFlow::unmask(uint8_t *data, size_t len, uint32_t mask
+                         , uint64_t offset)
+{
+  const uint8_t *key = reinterpret_cast<const uint8_t *>(&mask);
+  size_t idx = 0;
+  // unmask byte-wise until the data is word aligned.
+  for (; idx < len && ((uintptr_t)(data + idx) & 3); idx++)
+  {
+    data[idx] ^= key[(offset + idx) & 3];
+  }
+  // the mask is stored in network byte order, rotate it so the first byte
+  // lines up with the next aligned word (little-endian).
+  uint32_t shift = ((offset + idx) & 3) * 8;
+  uint32_t word_mask = shift ? (mask >> shift) | (mask << (32 - shift)) : mask;
+  uint32_t *words = reinterpret_cast<uint32_t *>(data + idx);
+  for (; idx + sizeof(uint32_t) <= len; idx += sizeof(uint32_t))
+  {
+    *words++ ^= word_mask;
+  }
+  for (; idx < len; idx++)
+  {
+    data[idx] ^= key[(offset + idx) & 3];
   }
-  return yield_and_call(STATE(read_frame_header));
 }
 
 StateFlowBase::Action WebSocketFlow::shutdown_connection()
@@ -389,47 +584,21 @@ StateFlowBase::Action WebSocketFlow::shutdown_connection()
 
 StateFlowBase::Action WebSocketFlow::send_frame_header()
 {
-  // TODO: add binary message sending support
-  OSMutexLock l(&textLock_);
-  if (textToSend_.empty())
-  {
-    return yield_and_call(STATE(read_frame_header));
-  }
-  bzero(data_, max_frame_size_);
-  size_t send_size = 0;
-  if (textToSend_.length() < WEBSOCKET_FRAME_LEN_SINGLE)
   {
-    data_[0] = WEBSOCKET_FINAL_FRAME | OP_TEXT;
-    data_[1] = textToSend_.length();
-    memcpy(data_ + 2, textToSend_.data(), textToSend_.length());
-    data_size_ = textToSend_.length();
-    send_size = data_size_ + 2;
-  }
-  else if (textToSend_.length() < max_frame_size_ - 4)
-  {
-    data_size_ = textToSend_.length();
-    data_[0] = WEBSOCKET_FINAL_FRAME | OP_TEXT;
-    data_[1] = WEBSOCKET_FRAME_LEN_UINT16;
-    data_[2] = (data_size_ >> 8) & 0xFF;
-    data_[3] = data_size_ & 0xFF;
-    memcpy(data_+ 4, textToSend_.data(), textToSend_.length());
-    send_size = data_size_ + 4;
-  }
-  else
-  {
-    // size is greater than our max frame, send it as fragments
-    data_size_ = max_frame_size_ - 4;
-    data_[0] = OP_CONTINUATION;
-    data_[1] = WEBSOCKET_FRAME_LEN_UINT16;
-    data_[2] = (data_size_ >> 8) & 0xFF;
-    data_[3] = data_size_ & 0xFF;
-    memcpy(data_+ 4, textToSend_.data(), data_size_);
-    send_size = data_size_ + 4;
+    OSMutexLock l(&queueLock_);
+    if (queue_.empty())
+    {
+      return yield_and_call(STATE(read_frame_header));
+    }
+    sending_ = std::move(queue_.front());
+    queue_.pop_front();
+    queued_bytes_ -= sending_->length();
   }
   LOG(CONFIG_HTTP_WS_LOG_LEVEL
-    , "[WebSocket fd:%d] send:%zu, text:%zu", fd_, send_size
-    , textToSend_.length());
-  return write_repeated(&helper_, fd_, data_, send_size, STATE(frame_sent));
+    , "[WebSocket fd:%d] send:%zu, queued:%zu", fd_, sending_->length()
+    , queued_bytes_);
+  return write_repeated(&helper_, fd_, sending_->data(), sending_->length()
+                      , STATE(frame_sent));
 }
 
 StateFlowBase::Action WebSocketFlow::frame_sent()
@@ -440,9 +609,11 @@ StateFlowBase::Action WebSocketFlow::frame_sent()
             , fd_, errno, strerror(errno));
     return yield_and_call(STATE(shutdown_connection));
   }
-  OSMutexLock l(&textLock_);
-  textToSend_.erase(0, data_size_);
-  if (textToSend_.empty())
+  server_->metrics_.websocket_frame_sent(sending_->length());
+  sending_.reset();
+  OSMutexLock l(&queueLock_);
+  dropped_ = 0;
+  if (queue_.empty() || close_requested_)
   {
     return yield_and_call(STATE(read_frame_header));
   }
@@ -34,6 +34,10 @@
 
 #include "Httpd.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace http
 {
 
@@ -127,7 +131,24 @@ string AbstractHttpResponse::to_string(bool include_body, bool keep_alive
                   , HTML_EOL));
   }
 
-  if (get_body_length())
+  if (is_chunked())
+  {
+    LOG(CONFIG_HTTP_RESP_LOG_LEVEL, "[resp-header] %s -> %s"
+      , well_known_http_headers[HttpHeader::TRANSFER_ENCODING]
+      , HTTP_TRANSFER_ENCODING_CHUNKED);
+    encoded_headers_.append(
+      StringPrintf("%s: %s%s"
+                 , well_known_http_headers[HttpHeader::TRANSFER_ENCODING]
+                 , HTTP_TRANSFER_ENCODING_CHUNKED, HTML_EOL));
+    LOG(CONFIG_HTTP_RESP_LOG_LEVEL, "[resp-header] %s -> %s"
+      , well_known_http_headers[HttpHeader::CONTENT_TYPE]
+      , get_body_mime_type().c_str());
+    encoded_headers_.append(
+      StringPrintf("%s: %s%s"
+                 , well_known_http_headers[HttpHeader::CONTENT_TYPE]
+                 , get_body_mime_type().c_str(), HTML_EOL));
+  }
+  else if (get_body_length())
   {
     LOG(CONFIG_HTTP_RESP_LOG_LEVEL, "[resp-header] %s -> %zu"
       , well_known_http_headers[HttpHeader::CONTENT_LENGTH]
@@ -197,7 +218,7 @@ StringResponse::StringResponse(const string &response, const string &mime_type)
 
 StaticResponse::StaticResponse(const uint8_t *payload, const size_t length
                              , const std::string mime_type
-                             , const std::string encoding)
+                             , const std::string encoding, bool immutable)
                              : AbstractHttpResponse(STATUS_OK, mime_type)
                              , payload_(payload), length_(length)
 {
@@ -206,13 +227,183 @@ StaticResponse::StaticResponse(const uint8_t *payload, const size_t length
     header(HttpHeader::CONTENT_ENCODING, encoding);
   }
   header(HttpHeader::LAST_MODIFIED, HTTP_BUILD_TIME);
-  // update the default cache strategy to set the must-revalidate and max-age
-  header(HttpHeader::CACHE_CONTROL
-       , StringPrintf("%s, %s, %s=%d"
-                    , HTTP_CACHE_CONTROL_NO_CACHE
-                    , HTTP_CACHE_CONTROL_MUST_REVALIDATE
-                    , HTTP_CACHE_CONTROL_MAX_AGE
-                    , config_httpd_cache_max_age_sec()));
+
+  // Calculate the entity tag from the payload (FNV-1a) so that it will only
+  // change when the content changes rather than with every build.
+  uint32_t hash = 2166136261UL;
+  for (size_t idx = 0; idx < length_; idx++)
+  {
+    hash = (hash ^ payload_[idx]) * 16777619UL;
+  }
+  etag_ = StringPrintf("\"%08x-%zx\"", (unsigned)hash, length_);
+  header(HttpHeader::ETAG, etag_);
+
+  if (immutable)
+  {
+    cache_control_ = StringPrintf("%s, %s=%u, %s"
+                                , HTTP_CACHE_CONTROL_PUBLIC
+                                , HTTP_CACHE_CONTROL_MAX_AGE
+                                , (unsigned)HTTP_CACHE_IMMUTABLE_MAX_AGE_SEC
+                                , HTTP_CACHE_CONTROL_IMMUTABLE);
+  }
+  else
+  {
+    // update the default cache strategy to set the must-revalidate and max-age
+    cache_control_ = StringPrintf("%s, %s, %s=%d"
+                                , HTTP_CACHE_CONTROL_NO_CACHE
+                                , HTTP_CACHE_CONTROL_MUST_REVALIDATE
+                                , HTTP_CACHE_CONTROL_MAX_AGE
+                                , config_httpd_cache_max_age_sec());
+  }
+  header(HttpHeader::CACHE_CONTROL, cache_control_);
+}
+
+NotModifiedResponse::NotModifiedResponse(StaticResponse *response)
+  : AbstractHttpResponse(STATUS_NOT_MODIFIED)
+{
+  header(HttpHeader::ETAG, response->etag());
+  header(HttpHeader::CACHE_CONTROL, response->cache_control());
+}
+
+ChunkedResponse::ChunkedResponse(BodyGenerator generator
+                               , const string &mime_type)
+  : AbstractHttpResponse(HttpStatusCode::STATUS_OK, mime_type)
+  , generator_(std::move(generator))
+{
+}
+
+JsonArrayResponse::JsonArrayResponse(BodyGenerator generator)
+  : ChunkedResponse(
+    [generator](size_t index, string &body)
+    {
+      size_t offs = body.length();
+      body.push_back(index ? ',' : '[');
+      if (!generator(index, body))
+      {
+        // no more elements, replace the separator with the array terminator.
+        body.resize(offs);
+        body.append(index ? "]" : "[]");
+        return false;
+      }
+      return true;
+    }, MIME_TYPE_APPLICATION_JSON)
+{
+}
+
+FileResponse::FileResponse(const string &path, const string &mime_type
+                         , HttpRequest *request)
+  : AbstractHttpResponse(HttpStatusCode::STATUS_OK, mime_type)
+{
+  struct stat statbuf;
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0 || fstat(fd_, &statbuf))
+  {
+    LOG_ERROR("[FileResp %p] Unable to open %s: %s", this, path.c_str()
+            , strerror(errno));
+    set_status(HttpStatusCode::STATUS_NOT_FOUND);
+    return;
+  }
+  length_ = statbuf.st_size;
+  header(HttpHeader::ACCEPT_RANGES, HTTP_RANGE_UNIT_BYTES);
+  if (request && request->has_header(HttpHeader::RANGE))
+  {
+    parse_range(request->header(HttpHeader::RANGE), length_);
+  }
+}
+
+FileResponse::~FileResponse()
+{
+  if (fd_ >= 0)
+  {
+    ::close(fd_);
+  }
+}
+
+size_t FileResponse::read_body(uint8_t *buf, size_t size)
+{
+  size_t offs = 0;
+  while (offs < size)
+  {
+    ssize_t res = ::read(fd_, buf + offs, size - offs);
+    if (res <= 0)
+    {
+      LOG_ERROR("[FileResp %p] Read failed: %s", this, strerror(errno));
+      break;
+    }
+    offs += res;
+  }
+  return offs;
+}
+
+void FileResponse::parse_range(const string &range, size_t size)
+{
+  // Only a single byte range is supported, any other form will result in the
+  // full file being sent as permitted by RFC-7233 sec. 3.1.
+  const size_t unit_len = strlen(HTTP_RANGE_UNIT_BYTES);
+  if (range.compare(0, unit_len, HTTP_RANGE_UNIT_BYTES) ||
+      range.length() <= unit_len || range[unit_len] != '=' ||
+      range.find(',') != string::npos)
+  {
+    return;
+  }
+  const char *spec = range.c_str() + unit_len + 1;
+  char *end = nullptr;
+  size_t first = 0;
+  size_t last = size - 1;
+  bool satisfiable = size > 0;
+  if (*spec == '-')
+  {
+    // suffix range (bytes=-N), this is the last N bytes of the file.
+    size_t suffix = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || *end)
+    {
+      return;
+    }
+    satisfiable &= suffix > 0;
+    first = suffix < size ? size - suffix : 0;
+  }
+  else
+  {
+    // bytes=first- or bytes=first-last
+    first = strtoul(spec, &end, 10);
+    if (end == spec || *end != '-')
+    {
+      return;
+    }
+    spec = end + 1;
+    if (*spec)
+    {
+      last = strtoul(spec, &end, 10);
+      if (*end || last < first)
+      {
+        return;
+      }
+      last = std::min(last, size - 1);
+    }
+    satisfiable &= first < size;
+  }
+
+  if (!satisfiable)
+  {
+    set_status(HttpStatusCode::STATUS_RANGE_NOT_SATISFIABLE);
+    header(HttpHeader::CONTENT_RANGE
+         , StringPrintf("%s */%zu", HTTP_RANGE_UNIT_BYTES, size));
+    length_ = 0;
+    return;
+  }
+  if (lseek(fd_, first, SEEK_SET) != (off_t)first)
+  {
+    LOG_ERROR("[FileResp %p] Unable to seek to %zu: %s", this, first
+            , strerror(errno));
+    set_status(HttpStatusCode::STATUS_SERVER_ERROR);
+    length_ = 0;
+    return;
+  }
+  set_status(HttpStatusCode::STATUS_PARTIAL_CONTENT);
+  header(HttpHeader::CONTENT_RANGE
+       , StringPrintf("%s %zu-%zu/%zu", HTTP_RANGE_UNIT_BYTES, first, last
+                    , size));
+  length_ = (last - first) + 1;
 }
 
 } // namespace http
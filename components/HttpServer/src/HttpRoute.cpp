@@ -0,0 +1,167 @@
+/** \copyright
+ * Copyright (c) 2019-2020, Mike Dunston
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file HttpRoute.cpp
+ *
+ * Implementation of the URI routing trie.
+ *
+ * @author Mike Dunston
+ * @date 18 Oct 2020
+ */
+
+#include "Httpd.h"
+
+namespace http
+{
+
+HttpRoute::HttpRoute(const string &segment)
+{
+  // parameter segments are in the form {name} or {name:type}
+  if (segment.length() > 2 && segment.front() == '{' && segment.back() == '}')
+  {
+    name_.assign(segment, 1, segment.length() - 2);
+    type_ = SegmentType::PARAM;
+    size_t sep = name_.find(':');
+    if (sep != string::npos)
+    {
+      if (!name_.compare(sep + 1, string::npos, "int"))
+      {
+        type_ = SegmentType::INT_PARAM;
+      }
+      else
+      {
+        LOG_ERROR("[HttpRoute] Unknown parameter type '%s', treating as a "
+                  "string parameter.", name_.c_str() + sep + 1);
+      }
+      name_.resize(sep);
+    }
+  }
+  else
+  {
+    name_.assign(segment);
+  }
+}
+
+HttpRoute *HttpRoute::add(const string &uri)
+{
+  HttpRoute *node = this;
+  size_t offs = 1;
+  while (offs < uri.length())
+  {
+    size_t end = uri.find('/', offs);
+    if (end == string::npos)
+    {
+      end = uri.length();
+    }
+    if (end > offs)
+    {
+      std::unique_ptr<HttpRoute> child(
+        new HttpRoute(uri.substr(offs, end - offs)));
+      auto ent = std::find_if(node->children_.begin(), node->children_.end()
+      , [&child](const std::unique_ptr<HttpRoute> &existing)
+        {
+          return existing->type_ == child->type_ &&
+                 existing->name_ == child->name_;
+        });
+      if (ent == node->children_.end())
+      {
+        // keep the children ordered by type so that literal segments are
+        // evaluated before parameter segments.
+        ent = std::upper_bound(node->children_.begin(), node->children_.end()
+                             , child
+        , [](const std::unique_ptr<HttpRoute> &lhs
+           , const std::unique_ptr<HttpRoute> &rhs)
+          {
+            return lhs->type_ < rhs->type_;
+          });
+        ent = node->children_.insert(ent, std::move(child));
+      }
+      node = ent->get();
+    }
+    offs = end + 1;
+  }
+  return node;
+}
+
+HttpRoute *HttpRoute::match(HttpRequest *request, size_t offs)
+{
+  const string &uri = request->uri();
+
+  // skip empty path segments (repeated or trailing "/").
+  while (offs < uri.length() && uri[offs] == '/')
+  {
+    offs++;
+  }
+  if (offs >= uri.length())
+  {
+    return method_mask_ ? this : nullptr;
+  }
+
+  size_t end = uri.find('/', offs);
+  if (end == string::npos)
+  {
+    end = uri.length();
+  }
+  size_t len = end - offs;
+  for (auto &child : children_)
+  {
+    if (!child->matches(uri.data() + offs, len))
+    {
+      continue;
+    }
+    size_t param_count = request->path_params_.size();
+    if (child->type_ != SegmentType::LITERAL &&
+        !request->add_path_param(&child->name_, offs, len))
+    {
+      continue;
+    }
+    HttpRoute *route = child->match(request, end);
+    if (route)
+    {
+      return route;
+    }
+    // discard any parameters recorded for this branch.
+    request->path_params_.resize(param_count);
+  }
+  return nullptr;
+}
+
+bool HttpRoute::matches(const char *segment, size_t len)
+{
+  switch (type_)
+  {
+    case SegmentType::LITERAL:
+      return len == name_.length() && !name_.compare(0, len, segment, len);
+    case SegmentType::INT_PARAM:
+      return len && std::all_of(segment, segment + len
+                              , [](char ch) { return ch >= '0' && ch <= '9'; });
+    case SegmentType::PARAM:
+      return len > 0;
+  }
+  return false;
+}
+
+} // namespace http
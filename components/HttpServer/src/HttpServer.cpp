@@ -97,22 +97,33 @@ Httpd::~Httpd()
   {
     executor_.shutdown();
   }
-  handlers_.clear();
   static_uris_.clear();
   redirect_uris_.clear();
   websocket_uris_.clear();
   websockets_.clear();
+  for (auto &pending : pending_connections_)
+  {
+    ::close(pending.first);
+  }
+  pending_connections_.clear();
+  idle_request_flows_.clear();
+  for (auto *flow : request_flows_)
+  {
+    delete flow;
+  }
+  request_flows_.clear();
 }
 
 void Httpd::uri(const std::string &uri, const size_t method_mask
-              , RequestProcessor handler, StreamProcessor stream_handler)
+              , RequestProcessor handler, StreamProcessor stream_handler
+              , RequestClass request_class)
 {
-  handlers_.insert(
-    std::make_pair(uri, std::make_pair(method_mask, std::move(handler))));
-  if (stream_handler)
-  {
-    stream_handlers_.insert(std::make_pair(uri, std::move(stream_handler)));
-  }
+  HttpRoute *route = routes_.add(uri);
+  route->uri_ = uri;
+  route->method_mask_ = method_mask;
+  route->handler_ = std::move(handler);
+  route->stream_handler_ = std::move(stream_handler);
+  route->request_class_ = request_class;
 }
 
 void Httpd::uri(const std::string &uri, RequestProcessor handler)
@@ -129,16 +140,14 @@ void Httpd::redirect_uri(const string &source, const string &target)
 
 void Httpd::static_uri(const string &uri, const uint8_t *payload
                      , const size_t length, const string &mime_type
-                     , const string &encoding)
+                     , const string &encoding, bool immutable)
 {
-  static_uris_.insert(
-    std::make_pair(uri
-                 , std::make_shared<StaticResponse>(payload, length, mime_type
-                                                  , encoding)));
+  auto response = std::make_shared<StaticResponse>(payload, length, mime_type
+                                                 , encoding, immutable);
+  static_uris_.insert(std::make_pair(uri, response));
   static_cached_.insert(
     std::make_pair(uri
-                 , std::make_shared<AbstractHttpResponse>(
-                    HttpStatusCode::STATUS_NOT_MODIFIED)));
+                 , std::make_shared<NotModifiedResponse>(response.get())));
 }
 
 void Httpd::websocket_uri(const string &uri, WebSocketHandler handler)
@@ -154,7 +163,7 @@ void Httpd::websocket_uri(const string &uri, WebSocketHandler handler)
   }
 }
 
-void Httpd::send_websocket_binary(int id, uint8_t *data, size_t len)
+void Httpd::send_websocket_binary(int id, const uint8_t *data, size_t len)
 {
   OSMutexLock l(&websocketsLock_);
   if (websockets_.find(id) == websockets_.end())
@@ -163,10 +172,10 @@ void Httpd::send_websocket_binary(int id, uint8_t *data, size_t len)
               "discarding.", id);
     return;
   }
-  //websockets_[id]->send_binary(data, len);
+  websockets_[id]->send_binary(data, len);
 }
 
-void Httpd::send_websocket_text(int id, std::string &text)
+void Httpd::send_websocket_text(int id, const std::string &text)
 {
   OSMutexLock l(&websocketsLock_);
   if (websockets_.find(id) == websockets_.end())
@@ -178,12 +187,38 @@ void Httpd::send_websocket_text(int id, std::string &text)
   websockets_[id]->send_text(text);
 }
 
-void Httpd::broadcast_websocket_text(std::string &text)
+void Httpd::send_websocket_frame(int id, WebSocketFrame frame)
+{
+  OSMutexLock l(&websocketsLock_);
+  if (websockets_.find(id) == websockets_.end())
+  {
+    LOG_ERROR("[Httpd] Attempt to send frame to unknown websocket:%d, "
+              "discarding frame.", id);
+    return;
+  }
+  websockets_[id]->send_frame(frame);
+}
+
+void Httpd::broadcast_websocket_text(const std::string &text)
+{
+  broadcast_websocket_frame(
+    WebSocketFlow::encode(OP_TEXT, (const uint8_t *)text.data()
+                        , text.length()));
+}
+
+void Httpd::broadcast_websocket_binary(const uint8_t *data, size_t length)
+{
+  broadcast_websocket_frame(WebSocketFlow::encode(OP_BINARY, data, length));
+}
+
+void Httpd::broadcast_websocket_frame(WebSocketFrame frame)
 {
+  // each client only takes a reference to the encoded frame, the socket
+  // writes happen later on the client's own flow.
   OSMutexLock l(&websocketsLock_);
   for (auto &client : websockets_)
   {
-    client.second->send_text(text);
+    client.second->send_frame(frame);
   }
 }
 
@@ -210,17 +245,71 @@ void Httpd::new_connection(int fd)
   // Reconfigure the socket for non-blocking operations
   ::fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK);
 
-  // Start the HTTP processing flow or close the socket if we fail to allocate
-  // the request handler.
-  auto *req =
-    new(std::nothrow) HttpRequestFlow(this, fd, ntohl(source.sin_addr.s_addr));
-  if (req == nullptr)
+  // Hand the socket to an idle HTTP processing flow, if there are none
+  // available queue the socket until one is released or reject it when the
+  // queue is also full.
+  HttpRequestFlow *flow = nullptr;
+  {
+    OSMutexLock l(&requestFlowsLock_);
+    if (!idle_request_flows_.empty())
+    {
+      flow = idle_request_flows_.back();
+      idle_request_flows_.pop_back();
+    }
+    else if (pending_connections_.size() <
+             (size_t)config_httpd_connection_queue_size())
+    {
+      LOG(CONFIG_HTTP_SERVER_LOG_LEVEL
+        , "[%s fd:%d/%s] All request handlers are busy, queued (%zu)"
+        , name_.c_str(), fd
+        , ipv4_to_string(ntohl(source.sin_addr.s_addr)).c_str()
+        , pending_connections_.size() + 1);
+      pending_connections_.emplace_back(fd, ntohl(source.sin_addr.s_addr));
+      return;
+    }
+  }
+  if (flow == nullptr)
+  {
+    reject_connection(fd, ntohl(source.sin_addr.s_addr));
+    return;
+  }
+  flow->start(fd, ntohl(source.sin_addr.s_addr));
+}
+
+void Httpd::release_request_flow(HttpRequestFlow *flow)
+{
+  OSMutexLock l(&requestFlowsLock_);
+  if (pending_connections_.empty())
   {
-    LOG_ERROR("[%s fd:%d/%s] Failed to allocate request handler, closing!"
-            , name_.c_str(), fd
-            , ipv4_to_string(ntohl(source.sin_addr.s_addr)).c_str());
-    ::close(fd);
+    idle_request_flows_.push_back(flow);
+    return;
   }
+  auto next = pending_connections_.front();
+  pending_connections_.erase(pending_connections_.begin());
+  flow->start(next.first, next.second);
+}
+
+bool Httpd::has_pending_connections()
+{
+  OSMutexLock l(&requestFlowsLock_);
+  return !pending_connections_.empty();
+}
+
+void Httpd::reject_connection(int fd, uint32_t remote_ip)
+{
+  static constexpr const char * SERVICE_UNAVAILABLE_RESPONSE =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+  LOG(WARNING, "[%s fd:%d/%s] All request handlers are busy, rejecting!"
+    , name_.c_str(), fd, ipv4_to_string(remote_ip).c_str());
+  metrics_.connection_rejected();
+  // the socket has an empty send buffer so this is expected to complete in
+  // a single call, if it does not the client will see the socket closed.
+  ::write(fd, SERVICE_UNAVAILABLE_RESPONSE
+        , strlen(SERVICE_UNAVAILABLE_RESPONSE));
+  ::close(fd);
 }
 
 void Httpd::captive_portal(string first_access_response
@@ -252,6 +341,18 @@ void Httpd::init_server()
   socket_timeout_.tv_sec = 0;
   socket_timeout_.tv_usec = MSEC_TO_USEC(config_httpd_socket_timeout_ms());
 
+  // allocate all HTTP processing flows up front, these will be reused for all
+  // connections.
+  request_flows_.reserve(config_httpd_max_connections());
+  idle_request_flows_.reserve(config_httpd_max_connections());
+  pending_connections_.reserve(config_httpd_connection_queue_size());
+  for (size_t idx = 0; idx < (size_t)config_httpd_max_connections(); idx++)
+  {
+    auto *flow = new HttpRequestFlow(this);
+    request_flows_.push_back(flow);
+    idle_request_flows_.push_back(flow);
+  }
+
 #if defined(CONFIG_IDF_TARGET)
   if (Singleton<Esp32WiFiManager>::exists())
   {
@@ -350,6 +451,7 @@ bool Httpd::add_websocket(int id, WebSocketFlow *ws)
   if (websockets_.size() < config_httpd_websocket_max_clients())
   {
     websockets_[id] = ws;
+    metrics_.websocket_opened();
     return true;
   }
   LOG_ERROR("[%s] Rejecting WebSocket client as maximum concurrent clients "
@@ -360,7 +462,10 @@ bool Httpd::add_websocket(int id, WebSocketFlow *ws)
 void Httpd::remove_websocket(int id)
 {
   OSMutexLock l(&websocketsLock_);
-  websockets_.erase(id);
+  if (websockets_.erase(id))
+  {
+    metrics_.websocket_closed();
+  }
 }
 
 bool Httpd::have_known_response(const string &uri)
@@ -370,14 +475,24 @@ bool Httpd::have_known_response(const string &uri)
 
 std::shared_ptr<AbstractHttpResponse> Httpd::response(HttpRequest *request)
 {
-  if (static_uris_.count(request->uri()))
+  auto static_uri = static_uris_.find(request->uri());
+  if (static_uri != static_uris_.end())
   {
-    if (request->has_header(HttpHeader::IF_MODIFIED_SINCE) &&
-       !request->header(HttpHeader::IF_MODIFIED_SINCE).compare(HTTP_BUILD_TIME))
+    // If-None-Match takes precedence over If-Modified-Since when both are
+    // present (RFC-7232 sec. 6).
+    if (request->has_header(HttpHeader::IF_NONE_MATCH))
+    {
+      if (request->if_none_match(static_uri->second->etag()))
+      {
+        return static_cached_[request->uri()];
+      }
+    }
+    else if (request->header_equals(HttpHeader::IF_MODIFIED_SINCE
+                                  , HTTP_BUILD_TIME.c_str()))
     {
       return static_cached_[request->uri()];
     }
-    return static_uris_[request->uri()];
+    return static_uri->second;
   }
   else if (redirect_uris_.count(request->uri()))
   {
@@ -394,10 +509,10 @@ bool Httpd::is_request_too_large(HttpRequest *req)
   // process it but it likely will fail.
   if (req->has_header(HttpHeader::CONTENT_LENGTH))
   {
-    uint32_t len = std::stoul(req->header(HttpHeader::CONTENT_LENGTH));
+    size_t len = req->content_length();
     if (len > config_httpd_max_req_size())
     {
-      LOG_ERROR("[Httpd uri:%s] Request body too large %d > %d!"
+      LOG_ERROR("[Httpd uri:%s] Request body too large %zu > %d!"
               , req->uri().c_str(), len, config_httpd_max_req_size());
       // request size too big
       return true;
@@ -419,6 +534,10 @@ bool Httpd::is_servicable_uri(HttpRequest *req)
 {
   HASSERT(req);
 
+  // resolve the route for the request, this will be used for all subsequent
+  // handler lookups for this request.
+  route(req);
+
   // check if it is a GET of a known URI or if it is a Websocket URI
   if ((req->method() == HttpMethod::GET && have_known_response(req->uri())) ||
       websocket_uris_.find(req->uri()) != websocket_uris_.end())
@@ -429,13 +548,12 @@ bool Httpd::is_servicable_uri(HttpRequest *req)
   }
 
   // check if it is a POST/PUT and there is a body payload
-  if (req->has_header(HttpHeader::CONTENT_LENGTH) &&
-      std::stoi(req->header(HttpHeader::CONTENT_LENGTH)) &&
+  if (req->content_length() &&
      (req->method() == HttpMethod::POST ||
       req->method() == HttpMethod::PUT) &&
       req->content_type() == ContentType::MULTIPART_FORMDATA)
   {
-    auto processor = stream_handler(req->uri());
+    auto processor = stream_handler(req);
     LOG(CONFIG_HTTP_SERVER_LOG_LEVEL
       , "[Httpd uri:%s] POST/PUT request, streamproc found: %d"
       , req->uri().c_str(), processor != nullptr);
@@ -443,42 +561,62 @@ bool Httpd::is_servicable_uri(HttpRequest *req)
   }
 
   // Check if we have a handler for the provided URI
-  auto processor = handler(req->method(), req->uri());
+  auto processor = handler(req);
   LOG(CONFIG_HTTP_SERVER_LOG_LEVEL, "[Httpd uri:%s] method: %s, proc: %d"
     , req->raw_method().c_str(), req->uri().c_str(), processor != nullptr);
   return processor != nullptr;
 }
 
-RequestProcessor Httpd::handler(HttpMethod method, const std::string &uri)
+HttpRoute *Httpd::route(HttpRequest *request)
+{
+  request->path_params_.clear();
+  request->route_ = routes_.match(request);
+  return request->route_;
+}
+
+RequestProcessor *Httpd::handler(HttpRequest *request)
 {
   LOG(CONFIG_HTTP_SERVER_LOG_LEVEL, "[Httpd uri:%s] Searching for URI handler"
-    , uri.c_str());
-  if (handlers_.count(uri))
+    , request->uri().c_str());
+  HttpRoute *route = request->route_;
+  if (route && route->handler_ && (route->method_mask_ & request->method()))
   {
-    auto handler = handlers_[uri];
-    if (handler.first & method)
-    {
-      return handler.second;
-    }
+    return &route->handler_;
   }
   LOG(CONFIG_HTTP_SERVER_LOG_LEVEL, "[Httpd uri:%s] No suitable handler found"
-    , uri.c_str());
+    , request->uri().c_str());
   return nullptr;
 }
 
-StreamProcessor Httpd::stream_handler(const std::string &uri)
+StreamProcessor *Httpd::stream_handler(HttpRequest *request)
 {
   LOG(CONFIG_HTTP_SERVER_LOG_LEVEL
-    , "[Httpd uri:%s] Searching for URI stream handler", uri.c_str());
-  if (stream_handlers_.count(uri))
+    , "[Httpd uri:%s] Searching for URI stream handler"
+    , request->uri().c_str());
+  HttpRoute *route = request->route_;
+  if (route && route->stream_handler_)
   {
-    return stream_handlers_[uri];
+    return &route->stream_handler_;
   }
   LOG(CONFIG_HTTP_SERVER_LOG_LEVEL
-    , "[Httpd uri:%s] No suitable stream handler found", uri.c_str());
+    , "[Httpd uri:%s] No suitable stream handler found"
+    , request->uri().c_str());
   return nullptr;
 }
 
+RequestClass Httpd::request_class(HttpRequest *request)
+{
+  if (request->route_)
+  {
+    return request->route_->request_class_;
+  }
+  if (static_uris_.count(request->uri()))
+  {
+    return REQUEST_CLASS_BULK;
+  }
+  return REQUEST_CLASS_CONTROL;
+}
+
 WebSocketHandler Httpd::ws_handler(const string &uri)
 {
   if (websocket_uris_.find(uri) != websocket_uris_.end())
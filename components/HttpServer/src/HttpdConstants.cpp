@@ -46,19 +46,31 @@ DEFAULT_CONST(httpd_server_priority, 0);
 DEFAULT_CONST(httpd_header_chunk_size, 512);
 DEFAULT_CONST(httpd_body_chunk_size, 3072);
 DEFAULT_CONST(httpd_response_chunk_size, 2048);
-DEFAULT_CONST(httpd_max_header_size, 1024);
+DEFAULT_CONST(httpd_max_header_size, 2048);
 DEFAULT_CONST(httpd_max_header_count, 20);
 DEFAULT_CONST(httpd_max_param_count, 20);
 DEFAULT_CONST(httpd_max_req_size, 4194304);
+DEFAULT_CONST(httpd_max_form_size, 2048);
 DEFAULT_CONST(httpd_max_req_per_connection, 5);
 DEFAULT_CONST(httpd_req_timeout_ms, 5);
 DEFAULT_CONST(httpd_socket_timeout_ms, 50);
+DEFAULT_CONST(httpd_keepalive_idle_ms, 2000);
 DEFAULT_CONST(httpd_websocket_timeout_ms, 200);
 DEFAULT_CONST(httpd_websocket_max_frame_size, 256);
 DEFAULT_CONST(httpd_websocket_max_read_attempts, 2);
 DEFAULT_CONST(httpd_websocket_max_uris, 1);
 DEFAULT_CONST(httpd_websocket_max_clients, 10);
+DEFAULT_CONST(httpd_websocket_fragment_size, 2048);
+DEFAULT_CONST(httpd_websocket_max_queue_size, 16384);
+DEFAULT_CONST(httpd_websocket_max_dropped, 8);
+DEFAULT_CONST(httpd_websocket_max_message_size, 4096);
 DEFAULT_CONST(httpd_cache_max_age_sec, 300);
+DEFAULT_CONST(httpd_max_connections, 4);
+DEFAULT_CONST(httpd_connection_queue_size, 8);
+DEFAULT_CONST(httpd_metrics_max_uris, 24);
+DEFAULT_CONST(httpd_bulk_time_slice_ms, 20);
+DEFAULT_CONST(httpd_bulk_yield_ms, 10);
+DEFAULT_CONST(httpd_bulk_rate_limit, 262144);
 
 ///////////////////////////////////////////////////////////////////////////////
 // Dnsd constants
@@ -18,8 +18,12 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #ifndef JMRI_CLIENT_FLOW_H_
 #define JMRI_CLIENT_FLOW_H_
 
+#include <atomic>
 #include <DCCppProtocol.h>
 #include <executor/StateFlow.hxx>
+#include <fcntl.h>
+
+#include "sdkconfig.h"
 
 class JmriClientFlow : private StateFlowBase, public DCCPPProtocolConsumer
 {
@@ -28,69 +32,96 @@ public:
     : StateFlowBase(service), DCCPPProtocolConsumer(), fd_(fd)
     , remoteIP_(remote_ip)
   {
-    LOG(INFO, "[JMRI %s] Connected", name().c_str());
-    bzero(buf_, BUFFER_SIZE);
+    ++activeClients_;
+    LOG(INFO, "[JMRI %s] Connected (%u/%d)", name().c_str()
+      , activeClients_.load(), CONFIG_JMRI_MAX_CLIENTS);
 
-    struct timeval tm;
-    tm.tv_sec = 0;
-    tm.tv_usec = MSEC_TO_USEC(10);
-    ERRNOCHECK("setsockopt_timeout",
-        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tm, sizeof(tm)));
+    // Reconfigure the socket for non-blocking operations so that the executor
+    // only wakes up this flow when there is data available to read.
+    ::fcntl(fd_, F_SETFL, O_RDWR | O_NONBLOCK);
 
-    start_flow(STATE(read_data));
+    start_flow(STATE(wait_for_data));
   }
 
   virtual ~JmriClientFlow()
   {
     LOG(INFO, "[JMRI %s] Disconnected", name().c_str());
     ::close(fd_);
+    --activeClients_;
   }
+
+  /// @return true if another client connection can be accepted.
+  static bool accepting_clients()
+  {
+    return activeClients_ < CONFIG_JMRI_MAX_CLIENTS;
+  }
+
 private:
-  static const size_t BUFFER_SIZE = 128;
+  static const size_t BUFFER_SIZE = CONFIG_JMRI_RECEIVE_BUFFER_SIZE;
+  static const size_t MAX_PENDING_RESPONSE_SIZE =
+    CONFIG_JMRI_MAX_PENDING_RESPONSE_SIZE;
+  static std::atomic_uint activeClients_;
   int fd_;
   uint32_t remoteIP_;
   uint8_t buf_[BUFFER_SIZE];
-  size_t buf_used_{0};
   string res_;
-  StateFlowTimedSelectHelper helper_{this};
+  StateFlowSelectHelper helper_{this};
 
-  Action read_data()
+  /// Waits (via select) for at least one byte to arrive from the client.
+  Action wait_for_data()
   {
-    // clear the buffer of data we have sent back
-    res_.clear();
-
-    return read_nonblocking(&helper_, fd_, buf_, BUFFER_SIZE
-                          , STATE(process_data));
+    return read_single(&helper_, fd_, buf_, BUFFER_SIZE
+                     , STATE(process_data));
   }
 
+  /// Processes any received data and drains the remainder of the current
+  /// burst so that all responses are sent back with a single write.
   Action process_data()
   {
     if (helper_.hasError_)
     {
       return delete_this();
     }
-    else if (helper_.remaining_ == BUFFER_SIZE)
+    size_t received = BUFFER_SIZE - helper_.remaining_;
+    if (received)
     {
-      return yield_and_call(STATE(read_data));
+      LOG(VERBOSE, "[JMRI %s] received %zu bytes", name().c_str(), received);
+      res_.append(feed(buf_, received));
+      if (res_.length() < MAX_PENDING_RESPONSE_SIZE)
+      {
+        return read_nonblocking(&helper_, fd_, buf_, BUFFER_SIZE
+                              , STATE(process_data));
+      }
     }
-    else
-    {
-      buf_used_ = BUFFER_SIZE - helper_.remaining_;
-      LOG(VERBOSE, "[JMRI %s] received %zu bytes", name().c_str(), buf_used_);
-    }
-    res_.append(feed(buf_, buf_used_));
-    buf_used_ = 0;
-    return yield_and_call(STATE(send_data));
+    return call_immediately(STATE(send_data));
   }
 
   Action send_data()
   {
-    if(res_.empty())
+    if (res_.empty())
     {
-      return yield_and_call(STATE(read_data));
+      return call_immediately(STATE(wait_for_data));
     }
+    LOG(VERBOSE, "[JMRI %s] sending %zu bytes", name().c_str()
+      , res_.length());
     return write_repeated(&helper_, fd_, res_.data(), res_.length()
-                        , STATE(read_data));
+                        , STATE(data_sent));
+  }
+
+  Action data_sent()
+  {
+    if (helper_.hasError_)
+    {
+      return delete_this();
+    }
+    res_.clear();
+    // release the response buffer if a large response grew it beyond the
+    // per-client limit.
+    if (res_.capacity() > MAX_PENDING_RESPONSE_SIZE)
+    {
+      string().swap(res_);
+    }
+    return call_immediately(STATE(wait_for_data));
   }
 
   string name()
@@ -26,6 +26,7 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include "JmriClientFlow.h"
 
 std::unique_ptr<SocketListener> listener;
+std::atomic_uint JmriClientFlow::activeClients_{0};
 
 void init_jmri_interface()
 {
@@ -43,6 +44,15 @@ void init_jmri_interface()
           socklen_t source_len = sizeof(sockaddr_in);
           bzero(&source, sizeof(sockaddr_in));
           getpeername(fd, (sockaddr *)&source, &source_len);
+          if (!JmriClientFlow::accepting_clients())
+          {
+            LOG(WARNING, "[JMRI %s/%d] Rejecting connection, limit of %d "
+                "clients reached"
+              , ipv4_to_string(ntohl(source.sin_addr.s_addr)).c_str()
+              , fd, CONFIG_JMRI_MAX_CLIENTS);
+            ::close(fd);
+            return;
+          }
           auto service =
             Singleton<esp32cs::LCCStackManager>::instance()->service();
           new JmriClientFlow(fd, ntohl(source.sin_addr.s_addr), service);
@@ -69,16 +69,29 @@ struct AllTrainNodes::Impl
 void AllTrainNodes::remove_train_impl(int address)
 {
   OSMutexLock l(&trainsLock_);
-  auto it = std::find_if(trains_.begin(), trains_.end(), [address](Impl *impl)
+  auto it = trainsByAddress_.find(address);
+  if (it != trainsByAddress_.end())
   {
-    return impl->train_->legacy_address() == address;
-  });
-  if (it != trains_.end())
-  {
-    Impl *impl = (*it);
+    Impl *impl = it->second;
+    trainsByAddress_.erase(it);
+    auto node = trainsByNodeId_.find(impl->node_->node_id());
+    if (node != trainsByNodeId_.end() && node->second == impl)
+    {
+      trainsByNodeId_.erase(node);
+    }
+    trains_.erase(std::remove(trains_.begin(), trains_.end(), impl)
+                , trains_.end());
+    // if another train shares the address it is now the indexed train.
+    for (auto *train : trains_)
+    {
+      if (train->train_->legacy_address() == (unsigned)address)
+      {
+        trainsByAddress_.emplace(address, train);
+        break;
+      }
+    }
     impl->node_->iface()->delete_local_node(impl->node_);
     delete impl;
-    trains_.erase(it);
   }
 }
 
@@ -96,13 +109,10 @@ openlcb::TrainImpl* AllTrainNodes::get_train_impl(DccMode drive_type, int addres
 {
   {
     OSMutexLock l(&trainsLock_);
-    auto it = std::find_if(trains_.begin(), trains_.end(), [address](Impl *impl)
+    auto it = trainsByAddress_.find(address);
+    if (it != trainsByAddress_.end())
     {
-      return impl->train_->legacy_address() == address;
-    });
-    if (it != trains_.end())
-    {
-      return (*it)->train_;
+      return it->second->train_;
     }
   }
   return find_node(allocate_node(drive_type, address))->train_;
@@ -110,20 +120,8 @@ openlcb::TrainImpl* AllTrainNodes::get_train_impl(DccMode drive_type, int addres
 
 AllTrainNodes::Impl* AllTrainNodes::find_node(openlcb::Node* node) 
 {
-  {
-    OSMutexLock l(&trainsLock_);
-    auto it = std::find_if(trains_.begin(), trains_.end(),
-      [node](Impl *impl)
-      {
-        return impl->node_ == node;
-      });
-    if (it != trains_.end())
-    {
-      return *it;
-    }
-  }
-  // no active train was found with the provided node reference, try to find
-  // one via the node-id instead.
+  // active trains are indexed by node-id, this will also find a train in the
+  // db which should have the node-id of the provided node.
   if (node != nullptr && node->node_id())
   {
     return find_node(node->node_id());
@@ -135,13 +133,10 @@ AllTrainNodes::Impl* AllTrainNodes::find_node(openlcb::NodeID node_id, bool allo
 {
   {
     OSMutexLock l(&trainsLock_);
-    auto it = std::find_if(trains_.begin(), trains_.end(), [node_id](Impl *impl)
+    auto it = trainsByNodeId_.find(node_id);
+    if (it != trainsByNodeId_.end())
     {
-      return impl->node_->node_id() == node_id;
-    });
-    if (it != trains_.end())
-    {
-      return *it;
+      return it->second;
     }
   }
   if (!allocate)
@@ -672,8 +667,13 @@ AllTrainNodes::Impl* AllTrainNodes::create_impl(int train_id, DccMode mode,
     {
       OSMutexLock l(&trainsLock_);
       trains_.push_back(impl);
+      trainsByAddress_.emplace(impl->train_->legacy_address(), impl);
     }
     impl->node_ = new openlcb::TrainNodeForProxy(train_service(), impl->train_);
+    {
+      OSMutexLock l(&trainsLock_);
+      trainsByNodeId_.emplace(impl->node_->node_id(), impl);
+    }
     return impl;
   }
   else
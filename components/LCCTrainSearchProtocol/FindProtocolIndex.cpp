@@ -0,0 +1,146 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "FindProtocolIndex.hxx"
+#include "FindProtocolDefs.hxx"
+#include "TrainDb.hxx"
+
+#include <algorithm>
+
+namespace commandstation
+{
+
+void FindProtocolIndex::reset(unsigned generation, size_t size)
+{
+  keys_.clear();
+  generation_ = generation;
+  size_ = size;
+  valid_ = false;
+}
+
+void FindProtocolIndex::add(unsigned train_id, TrainDbEntry *train)
+{
+  add_key(std::to_string(train->get_legacy_address()), train_id);
+
+  // a query can match the train name starting at any numeric run and
+  // continuing through the following runs, key on all digits of the name
+  // from the start of each run.
+  std::string name = train->get_train_name();
+  std::string digits;
+  std::vector<size_t> runs;
+  bool in_run = false;
+  for (char ch : name)
+  {
+    bool is_digit = ch >= '0' && ch <= '9';
+    if (is_digit)
+    {
+      if (!in_run)
+      {
+        runs.push_back(digits.size());
+      }
+      digits.push_back(ch);
+    }
+    in_run = is_digit;
+  }
+  for (size_t start : runs)
+  {
+    add_key(digits.substr(start, KEY_DIGITS), train_id);
+  }
+}
+
+void FindProtocolIndex::finalize()
+{
+  std::sort(keys_.begin(), keys_.end(), [](const Key &lhs, const Key &rhs)
+  {
+    return lhs.digits < rhs.digits ||
+          (lhs.digits == rhs.digits && lhs.train < rhs.train);
+  });
+  keys_.shrink_to_fit();
+  valid_ = true;
+}
+
+bool FindProtocolIndex::find(openlcb::EventId event
+                           , std::vector<uint16_t> *trains)
+{
+  std::string digits;
+  for (int shift = FindProtocolDefs::TRAIN_FIND_MASK - 4;
+       shift >= FindProtocolDefs::TRAIN_FIND_MASK_LOW; shift -= 4)
+  {
+    uint8_t nibble = (event >> shift) & 0xf;
+    if (nibble <= 9)
+    {
+      digits.push_back('0' + nibble);
+    }
+  }
+  if (digits.empty())
+  {
+    return false;
+  }
+  trains->clear();
+  // the train name is matched against all digits of the query.
+  find_prefix(digits, trains);
+
+  // the address is matched against the numeric value of the query which
+  // drops any leading zeros.
+  DccMode mode;
+  std::string address =
+    std::to_string(FindProtocolDefs::query_to_address(event, &mode));
+  if (address != digits)
+  {
+    find_prefix(address, trains);
+  }
+  std::sort(trains->begin(), trains->end());
+  trains->erase(std::unique(trains->begin(), trains->end()), trains->end());
+  return true;
+}
+
+uint32_t FindProtocolIndex::pack_digits(const std::string &digits
+                                      , uint8_t padding)
+{
+  uint32_t packed = 0;
+  for (size_t idx = 0; idx < KEY_DIGITS; idx++)
+  {
+    packed <<= 4;
+    packed |= idx < digits.size() ? (digits[idx] - '0') : padding;
+  }
+  return packed;
+}
+
+void FindProtocolIndex::add_key(const std::string &digits, uint16_t train_id)
+{
+  keys_.push_back({pack_digits(digits, 0xF), train_id});
+}
+
+void FindProtocolIndex::find_prefix(const std::string &digits
+                                  , std::vector<uint16_t> *trains)
+{
+  // all keys starting with the digits are between the digits padded with
+  // zeros and the digits padded with 0xF.
+  uint32_t low = pack_digits(digits, 0);
+  uint32_t high = pack_digits(digits, 0xF);
+  auto it = std::lower_bound(keys_.begin(), keys_.end(), low
+  , [](const Key &key, uint32_t value)
+    {
+      return key.digits < value;
+    });
+  for (; it != keys_.end() && it->digits <= high; ++it)
+  {
+    trains->push_back(it->train);
+  }
+}
+
+} // namespace commandstation
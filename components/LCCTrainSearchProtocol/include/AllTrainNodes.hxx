@@ -36,6 +36,7 @@
 #define _BRACZ_COMMANDSTATION_ALLTRAINNODES_HXX_
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <openlcb/SimpleInfoProtocol.hxx>
@@ -96,9 +97,21 @@ class AllTrainNodes : public AllTrainNodesInterface
   /// @return 0 if the allocation fails (invalid arguments)
   openlcb::NodeID allocate_node(DccMode drive_type, unsigned address) override;
 
+  /// @return the generation of the train database backing this instance.
+  unsigned traindb_generation() override
+  {
+    return db_->generation();
+  }
+
   /// Return the maximum number of locomotives currently being serviced.
   size_t size();
 
+  /// @return the train database backing this instance.
+  TrainDb *train_db()
+  {
+    return db_;
+  }
+
   /// @return true if the provided node is a known/active train.
   bool is_valid_train_node(openlcb::Node *node);
   
@@ -130,8 +143,16 @@ class AllTrainNodes : public AllTrainNodesInterface
 
   /// All train nodes that we know about.
   std::vector<Impl*> trains_;
+
+  /// Index of trains_ by legacy address. When multiple trains share an
+  /// address the first one created is indexed.
+  std::unordered_map<unsigned, Impl*> trainsByAddress_;
+
+  /// Index of trains_ by node id, entries are added once the node has been
+  /// created.
+  std::unordered_map<openlcb::NodeID, Impl*> trainsByNodeId_;
   
-  /// Lock to protect trains_.
+  /// Lock to protect trains_, trainsByAddress_ and trainsByNodeId_.
   OSMutex trainsLock_;
 
   friend class FindProtocolServer;
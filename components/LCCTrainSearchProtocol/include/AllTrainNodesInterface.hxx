@@ -101,6 +101,10 @@ public:
   /// @return the openlcb train node ID, or 0 if the arguments are not valid.
   virtual openlcb::NodeID allocate_node(DccMode mode, unsigned address) = 0;
 
+  /// @return a value which changes whenever the train database entries
+  /// returned by @ref get_traindb_entry are added, removed or modified.
+  virtual unsigned traindb_generation() = 0;
+
 #ifdef GTEST
   /// @return true if the locomotive find flow has completed processing all
   /// past requests.
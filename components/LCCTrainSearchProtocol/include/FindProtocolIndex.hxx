@@ -0,0 +1,121 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef _COMMANDSTATION_FINDPROTOCOLINDEX_HXX_
+#define _COMMANDSTATION_FINDPROTOCOLINDEX_HXX_
+
+#include <openlcb/EventHandler.hxx>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace commandstation
+{
+
+class TrainDbEntry;
+
+/// Sorted index of the digit sequences which a train search query can match
+/// against.
+///
+/// For each train the decimal digits of the legacy address and the digits of
+/// the train name starting at each numeric run are stored as a search key. A
+/// key holds the first digits of the sequence packed into nibbles so that all
+/// keys having the query digits as a prefix are a contiguous range of the
+/// index.
+///
+/// The index only narrows down the trains which need to be checked via
+/// @ref FindProtocolDefs::match_query_to_node, it does not decide the match.
+class FindProtocolIndex
+{
+public:
+  /// Maximum number of trains which can be indexed.
+  static constexpr size_t MAX_TRAINS = UINT16_MAX;
+
+  /// Discards all keys, the index will be rebuilt for the provided state.
+  ///
+  /// @param generation is the train database generation being indexed.
+  /// @param size is the number of trains being indexed.
+  void reset(unsigned generation, size_t size);
+
+  /// Adds the search keys for a train.
+  ///
+  /// @param train_id is the index of the train.
+  /// @param train is the train database entry for the train.
+  void add(unsigned train_id, TrainDbEntry *train);
+
+  /// Sorts the keys, the index is usable after this has been called.
+  void finalize();
+
+  /// @return true if the index was built for the provided state.
+  bool is_current(unsigned generation, size_t size)
+  {
+    return valid_ && generation_ == generation && size_ == size;
+  }
+
+  /// Finds all trains which may match a search query.
+  ///
+  /// @param event is the search query.
+  /// @param trains will receive the sorted train ids.
+  ///
+  /// @return false if the query has no digits, in which case all trains need
+  /// to be checked.
+  bool find(openlcb::EventId event, std::vector<uint16_t> *trains);
+
+private:
+  /// Number of digits stored in a search key, this matches the number of
+  /// nibbles in a search query.
+  static constexpr unsigned KEY_DIGITS = 6;
+
+  /// A single search key.
+  struct Key
+  {
+    /// Digits of the key, most significant nibble first, padded with 0xF.
+    uint32_t digits;
+
+    /// Index of the train this key belongs to.
+    uint16_t train;
+  };
+
+  /// @return the packed search key for a digit sequence.
+  ///
+  /// @param digits is the digit sequence, only the first @ref KEY_DIGITS
+  /// digits are used.
+  /// @param padding is the nibble used when there are fewer digits.
+  static uint32_t pack_digits(const std::string &digits, uint8_t padding);
+
+  /// Adds the search key for a digit sequence.
+  void add_key(const std::string &digits, uint16_t train_id);
+
+  /// Adds all trains having keys which start with the provided digits.
+  void find_prefix(const std::string &digits, std::vector<uint16_t> *trains);
+
+  /// Search keys, sorted after @ref finalize.
+  std::vector<Key> keys_;
+
+  /// Train database generation the index was built for.
+  unsigned generation_{0};
+
+  /// Number of trains the index was built for.
+  size_t size_{0};
+
+  /// Set to true when the index has been built.
+  bool valid_{false};
+};
+
+} // namespace commandstation
+
+#endif // _COMMANDSTATION_FINDPROTOCOLINDEX_HXX_
@@ -36,6 +36,7 @@
 #define _COMMANDSTATION_FINDPROTOCOLSERVER_HXX_
 
 #include "FindProtocolDefs.hxx"
+#include "FindProtocolIndex.hxx"
 #include "AllTrainNodesInterface.hxx"
 #include <openlcb/EventHandlerTemplates.hxx>
 #include <openlcb/TractionTrain.hxx>
@@ -208,9 +209,72 @@ public:
       LOG(VERBOSE, "starting iteration");
       nextTrainId_ = 0;
       hasMatches_ = false;
+      useIndex_ = false;
+      if (!isGlobal_ && nodes()->size() <= FindProtocolIndex::MAX_TRAINS)
+      {
+        unsigned generation = nodes()->traindb_generation();
+        if (!parent_->index_.is_current(generation, nodes()->size()))
+        {
+          LOG(VERBOSE, "rebuilding search index");
+          parent_->index_.reset(generation, nodes()->size());
+          return call_immediately(STATE(index_next));
+        }
+        return call_immediately(STATE(search_index));
+      }
       return call_immediately(STATE(iterate));
     }
 
+    /// Adds the next train to the search index, this performs asynchronous
+    /// waits in the same way as try_traindb_lookup.
+    Action index_next()
+    {
+      if (nextTrainId_ >= nodes()->size())
+      {
+        parent_->index_.finalize();
+        return call_immediately(STATE(search_index));
+      }
+      bn_.reset(this);
+      bn_.new_child();
+      auto db_entry = nodes()->get_traindb_entry(nextTrainId_, &bn_);
+      if (!bn_.abort_if_almost_done())
+      {
+        bn_.notify();
+        // Repeats this state after the notification arrives.
+        return wait();
+      }
+      if (db_entry)
+      {
+        parent_->index_.add(nextTrainId_, db_entry.get());
+      }
+      ++nextTrainId_;
+      return yield_and_call(STATE(index_next));
+    }
+
+    /// Looks up the trains which may match the query in the search index,
+    /// only these trains will be checked against the query.
+    Action search_index()
+    {
+      if (!parent_->index_.find(eventId_, &candidates_))
+      {
+        // queries without any digits need to check every train.
+        nextTrainId_ = 0;
+        return call_immediately(STATE(iterate));
+      }
+      useIndex_ = true;
+      nextCandidate_ = 0;
+      return call_immediately(STATE(next_candidate));
+    }
+
+    Action next_candidate()
+    {
+      if (nextCandidate_ >= candidates_.size())
+      {
+        return call_immediately(STATE(iteration_done));
+      }
+      nextTrainId_ = candidates_[nextCandidate_];
+      return call_immediately(STATE(try_traindb_lookup));
+    }
+
     Action iterate()
     {
       if (nextTrainId_ >= nodes()->size())
@@ -302,6 +366,11 @@ public:
 
     Action next_iterate()
     {
+      if (useIndex_)
+      {
+        ++nextCandidate_;
+        return call_immediately(STATE(next_candidate));
+      }
       ++nextTrainId_;
       return call_immediately(STATE(iterate));
     }
@@ -380,10 +449,16 @@ public:
       openlcb::NodeID newNodeId_;
     };
     BarrierNotifiable bn_;
+    /// Trains which may match the current query, from the search index.
+    std::vector<uint16_t> candidates_;
+    /// Offset in candidates_ of the train being checked.
+    size_t nextCandidate_;
     /// True if we found any matches during the iteration.
     bool hasMatches_ : 1;
     /// True if the current iteration has to touch every node.
     bool isGlobal_ : 1;
+    /// True if the current iteration only checks the trains in candidates_.
+    bool useIndex_ : 1;
     StateFlowTimer timer_{this};
   };
 
@@ -417,6 +492,9 @@ public:
   /// Same as pendingGlobalIdentify_ for the IS_TRAIN event producer.
   uint8_t pendingIsTrain_{false};
 
+  /// Search index of the trains, this is only accessed by flow_.
+  FindProtocolIndex index_;
+
   FindProtocolFlow flow_{this};
 };
 
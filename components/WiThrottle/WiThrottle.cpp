@@ -0,0 +1,239 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "sdkconfig.h"
+
+#if CONFIG_WITHROTTLE
+
+#include "WiThrottleClientFlow.h"
+#include "WiThrottleServer.h"
+
+#include <algorithm>
+#include <AllTrainNodes.hxx>
+#include <arpa/inet.h>
+#include <DCCSignalVFS.h>
+#include <freertos_drivers/esp32/Esp32WiFiManager.hxx>
+#include <LCCStackManager.h>
+#include <netinet/in.h>
+#include <openlcb/TractionDefs.hxx>
+#include <sys/socket.h>
+#include <Turnouts.h>
+#include <utils/format_utils.hxx>
+#include <utils/StringPrintf.hxx>
+#include <WiThrottle.h>
+
+using commandstation::AllTrainNodes;
+using commandstation::DccMode;
+using commandstation::TrainDbEntry;
+
+std::unique_ptr<WiThrottleServer> withrottle;
+
+/// Name used when publishing the WiThrottle service via mDNS.
+static constexpr const char *WITHROTTLE_MDNS_NAME = "ESP32 Command Station";
+
+/// Prefix used for the turnout system names.
+static constexpr const char *WITHROTTLE_TURNOUT_PREFIX = "DT";
+
+/// Turnout states as used by the WiThrottle protocol.
+static constexpr int WITHROTTLE_TURNOUT_CLOSED = 2;
+static constexpr int WITHROTTLE_TURNOUT_THROWN = 4;
+
+WiThrottleServer::WiThrottleServer(Service *service, MDNS *mdns)
+  : service_(service), mdns_(mdns)
+  , updateFlow_(service, MSEC_TO_NSEC(CONFIG_WITHROTTLE_UPDATE_INTERVAL_MS)
+              , std::bind(&WiThrottleServer::periodic_update, this))
+{
+  powerOn_ = esp32cs::is_ops_track_output_enabled();
+  Singleton<TurnoutManager>::instance()->register_state_listener(
+  [&](uint16_t address, bool thrown)
+  {
+    // turnout state changes can come from any thread, forward them to the
+    // executor for delivery to the clients.
+    service_->executor()->add(new CallbackExecutable([this, address, thrown]()
+    {
+      turnout_changed(address, thrown);
+    }));
+  });
+}
+
+void WiThrottleServer::start_listener()
+{
+  if (listener_)
+  {
+    return;
+  }
+  LOG(INFO, "[WiThrottle] Starting WiThrottle listener");
+  listener_.reset(
+    new SocketListener(CONFIG_WITHROTTLE_LISTENER_PORT,
+    [&](int fd)
+    {
+      sockaddr_in source;
+      socklen_t source_len = sizeof(sockaddr_in);
+      bzero(&source, sizeof(sockaddr_in));
+      getpeername(fd, (sockaddr *)&source, &source_len);
+      if (!accepting_clients())
+      {
+        LOG(WARNING, "[WiThrottle %s/%d] Rejecting connection, limit of %d "
+            "clients reached"
+          , ipv4_to_string(ntohl(source.sin_addr.s_addr)).c_str(), fd
+          , CONFIG_WITHROTTLE_MAX_CLIENTS);
+        ::close(fd);
+        return;
+      }
+      new WiThrottleClientFlow(this, fd, ntohl(source.sin_addr.s_addr));
+    }, "withrottle"));
+  if (mdns_)
+  {
+    mdns_->publish(WITHROTTLE_MDNS_NAME, CONFIG_WITHROTTLE_MDNS_SERVICE_NAME
+                 , CONFIG_WITHROTTLE_LISTENER_PORT);
+  }
+}
+
+void WiThrottleServer::stop_listener()
+{
+  LOG(INFO, "[WiThrottle] Shutting down WiThrottle listener");
+  listener_.reset(nullptr);
+  Singleton<Esp32WiFiManager>::instance()->mdns_unpublish(
+    CONFIG_WITHROTTLE_MDNS_SERVICE_NAME);
+}
+
+void WiThrottleServer::add_client(WiThrottleClientFlow *client)
+{
+  clients_.push_back(client);
+}
+
+void WiThrottleServer::remove_client(WiThrottleClientFlow *client)
+{
+  clients_.erase(std::remove(clients_.begin(), clients_.end(), client)
+               , clients_.end());
+}
+
+void WiThrottleServer::broadcast(const string &message)
+{
+  for (auto client : clients_)
+  {
+    client->send(message);
+  }
+}
+
+void WiThrottleServer::loco_changed(uint16_t address)
+{
+  for (auto client : clients_)
+  {
+    client->refresh_locos(address);
+  }
+}
+
+string WiThrottleServer::roster_message()
+{
+  auto db = Singleton<AllTrainNodes>::instance()->train_db();
+  size_t size = db->size();
+  size_t count = 0;
+  string roster;
+  for (size_t index = 0; index < size; index++)
+  {
+    auto entry = db->get_entry(index);
+    if (entry)
+    {
+      int address = entry->get_legacy_address();
+      roster.append(StringPrintf("]\\[%s}|{%d}|{%c"
+                               , entry->get_train_name().c_str(), address
+                               , address < 128 ? 'S' : 'L'));
+      count++;
+    }
+  }
+  // the count must match the entries sent, the database may contain empty
+  // slots.
+  return StringPrintf("RL%zu", count) + roster;
+}
+
+string WiThrottleServer::turnout_message()
+{
+  string turnouts =
+    StringPrintf("PTT]\\[Turnouts}|{Turnout]\\[Closed}|{%d]\\[Thrown}|{%d\nPTL"
+               , WITHROTTLE_TURNOUT_CLOSED, WITHROTTLE_TURNOUT_THROWN);
+  Singleton<TurnoutManager>::instance()->for_each([&](Turnout *turnout)
+  {
+    turnouts.append(
+      StringPrintf("]\\[%s%d}|{%d}|{%d", WITHROTTLE_TURNOUT_PREFIX
+                 , turnout->getAddress(), turnout->getID()
+                 , turnout->isThrown() ? WITHROTTLE_TURNOUT_THROWN
+                                       : WITHROTTLE_TURNOUT_CLOSED));
+  });
+  return turnouts;
+}
+
+string WiThrottleServer::power_message()
+{
+  return StringPrintf("PPA%d", powerOn_);
+}
+
+std::shared_ptr<TrainDbEntry> WiThrottleServer::roster_entry(uint16_t address)
+{
+  auto db = Singleton<AllTrainNodes>::instance()->train_db();
+  auto node_id = openlcb::TractionDefs::train_node_id_from_legacy(
+    commandstation::dcc_mode_to_address_type(DccMode::DCC_128, address)
+  , address);
+  return db->find_entry(node_id, address);
+}
+
+void WiThrottleServer::turnout_changed(uint16_t address, bool thrown)
+{
+  broadcast(StringPrintf("PTA%d%s%d"
+                       , thrown ? WITHROTTLE_TURNOUT_THROWN
+                                : WITHROTTLE_TURNOUT_CLOSED
+                       , WITHROTTLE_TURNOUT_PREFIX, address));
+}
+
+void WiThrottleServer::periodic_update()
+{
+  if (clients_.empty())
+  {
+    return;
+  }
+  bool power = esp32cs::is_ops_track_output_enabled();
+  if (power != powerOn_)
+  {
+    powerOn_ = power;
+    broadcast(power_message());
+  }
+  uint64_t now = os_get_time_monotonic();
+  for (auto client : clients_)
+  {
+    client->check_heartbeat(now);
+    client->refresh_locos();
+  }
+}
+
+void init_withrottle_interface(MDNS *mdns)
+{
+  withrottle.reset(
+    new WiThrottleServer(
+      Singleton<esp32cs::LCCStackManager>::instance()->service(), mdns));
+  Singleton<Esp32WiFiManager>::instance()->register_network_up_callback(
+  [&](esp_interface_t interface, uint32_t ip)
+  {
+    withrottle->start_listener();
+  });
+  Singleton<Esp32WiFiManager>::instance()->register_network_down_callback(
+  [&](esp_interface_t interface)
+  {
+    withrottle->stop_listener();
+  });
+}
+
+#endif // CONFIG_WITHROTTLE
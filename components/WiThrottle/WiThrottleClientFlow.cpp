@@ -0,0 +1,635 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "sdkconfig.h"
+
+#if CONFIG_WITHROTTLE
+
+#include "WiThrottleClientFlow.h"
+#include "WiThrottleServer.h"
+
+#include <AllTrainNodes.hxx>
+#include <DCCSignalVFS.h>
+#include <fcntl.h>
+#include <openlcb/TractionTrain.hxx>
+#include <Turnouts.h>
+#include <utils/format_utils.hxx>
+#include <utils/StringPrintf.hxx>
+
+using commandstation::AllTrainNodes;
+using commandstation::DccMode;
+using dcc::SpeedType;
+
+/// Separator used between the locomotive key and action in multi-throttle
+/// commands.
+static constexpr const char *WITHROTTLE_ACTION_SEPARATOR = "<;>";
+
+/// Converts a roster function label into the text to display on the throttle.
+///
+/// @param label is the roster function label.
+/// @param fn is the function number.
+/// @return text to display for the function.
+static string get_function_label(unsigned label, int fn)
+{
+  switch (label)
+  {
+    case commandstation::FN_NONEXISTANT:
+      return "";
+    case commandstation::LIGHT:
+      return "Light";
+    case commandstation::BEAMER:
+      return "Beamer";
+    case commandstation::BELL:
+      return "Bell";
+    case commandstation::HORN:
+      return "Horn";
+    case commandstation::SHUNT:
+      return "Shunt";
+    case commandstation::PANTO:
+      return "Pantograph";
+    case commandstation::SMOKE:
+      return "Smoke";
+    case commandstation::ABV:
+      return "Momentum";
+    case commandstation::WHISTLE:
+      return "Whistle";
+    case commandstation::SOUND:
+      return "Sound";
+    case commandstation::SPEECH:
+      return "Announce";
+    case commandstation::ENGINE:
+      return "Engine";
+    case commandstation::LIGHT1:
+      return "Light 1";
+    case commandstation::LIGHT2:
+      return "Light 2";
+    case commandstation::TELEX:
+      return "Coupler";
+  }
+  return StringPrintf("F%d", fn);
+}
+
+static openlcb::TrainImpl *get_train_impl(uint16_t address)
+{
+  return Singleton<AllTrainNodes>::instance()->get_train_impl(
+    DccMode::DCC_128, address);
+}
+
+WiThrottleClientFlow::WiThrottleClientFlow(WiThrottleServer *server, int fd
+                                         , uint32_t remote_ip)
+  : StateFlowBase(server->service()), server_(server), fd_(fd)
+  , remoteIP_(remote_ip), lastReceive_(os_get_time_monotonic())
+{
+  ++server_->clientCount_;
+  bzero(name_, sizeof(name_));
+  bzero(locos_, sizeof(locos_));
+  strncpy(name_, ipv4_to_string(remoteIP_).c_str(), MAX_NAME_LENGTH);
+  LOG(INFO, "[WiThrottle %s/%d] Connected", name_, fd_);
+
+  // Reconfigure the socket for non-blocking operations so that the executor
+  // only wakes up this flow when there is data available to read.
+  ::fcntl(fd_, F_SETFL, O_RDWR | O_NONBLOCK);
+
+  start_flow(STATE(register_client));
+}
+
+WiThrottleClientFlow::~WiThrottleClientFlow()
+{
+  LOG(INFO, "[WiThrottle %s/%d] Disconnected", name_, fd_);
+  ::close(fd_);
+  --server_->clientCount_;
+}
+
+bool WiThrottleClientFlow::send(const string &message, bool force)
+{
+  if (!force && pending_.length() + message.length() >= MAX_PENDING_SIZE)
+  {
+    LOG(WARNING
+      , "[WiThrottle %s/%d] Outbound limit reached, discarding: %s"
+      , name_, fd_, message.c_str());
+    return false;
+  }
+  LOG(CONFIG_WITHROTTLE_LOG_LEVEL, "[WiThrottle %s/%d] -> %s", name_, fd_
+    , message.c_str());
+  pending_.append(message);
+  pending_.append("\n");
+
+  // If the flow is currently waiting for data from the client remove it from
+  // the select() set and wake it up so the data will be sent.
+  if (waitingForData_ && service()->executor()->is_selected(&helper_))
+  {
+    service()->executor()->unselect(&helper_);
+    waitingForData_ = false;
+    notify();
+  }
+  return true;
+}
+
+void WiThrottleClientFlow::refresh_locos(uint16_t address)
+{
+  for (auto &loco : locos_)
+  {
+    if (loco.active && (!address || loco.address == address))
+    {
+      refresh_loco(&loco, false);
+    }
+  }
+}
+
+void WiThrottleClientFlow::check_heartbeat(uint64_t now)
+{
+  static constexpr uint64_t HEARTBEAT_TIMEOUT =
+    SEC_TO_NSEC(CONFIG_WITHROTTLE_HEARTBEAT_SEC +
+               (CONFIG_WITHROTTLE_HEARTBEAT_SEC / 2));
+  if (heartbeatEnabled_ && !heartbeatExpired_ &&
+      (now - lastReceive_) > HEARTBEAT_TIMEOUT)
+  {
+    LOG(WARNING, "[WiThrottle %s/%d] Heartbeat expired, stopping locomotives"
+      , name_, fd_);
+    heartbeatExpired_ = true;
+    stop_locos();
+  }
+}
+
+StateFlowBase::Action WiThrottleClientFlow::register_client()
+{
+  server_->add_client(this);
+  send("VN2.0", true);
+  send(server_->roster_message(), true);
+  send(server_->turnout_message(), true);
+  send(server_->power_message(), true);
+  send(StringPrintf("*%d", CONFIG_WITHROTTLE_HEARTBEAT_SEC), true);
+  return call_immediately(STATE(send_data));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::wait_for_data()
+{
+  if (closeRequested_)
+  {
+    return call_immediately(STATE(shutdown));
+  }
+  else if (!pending_.empty())
+  {
+    return call_immediately(STATE(send_data));
+  }
+  helper_.reset(Selectable::READ, fd_, Selectable::MAX_PRIO);
+  helper_.set_wakeup(this);
+  service()->executor()->select(&helper_);
+  waitingForData_ = true;
+  return wait_and_call(STATE(read_data));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::read_data()
+{
+  waitingForData_ = false;
+  return read_nonblocking(&helper_, fd_, buf_ + bufUsed_
+                        , BUFFER_SIZE - bufUsed_, STATE(process_data));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::process_data()
+{
+  if (helper_.hasError_)
+  {
+    return call_immediately(STATE(shutdown));
+  }
+  size_t received = (BUFFER_SIZE - bufUsed_) - helper_.remaining_;
+  if (received)
+  {
+    lastReceive_ = os_get_time_monotonic();
+    if (heartbeatExpired_)
+    {
+      LOG(INFO, "[WiThrottle %s/%d] Heartbeat restored", name_, fd_);
+      heartbeatExpired_ = false;
+    }
+    bufUsed_ += received;
+    // process all complete lines in place, any partial line will be moved to
+    // the start of the buffer.
+    char *start = buf_;
+    char *end = buf_ + bufUsed_;
+    for (char *pos = start; pos < end; pos++)
+    {
+      if (*pos == '\n' || *pos == '\r')
+      {
+        if (pos > start)
+        {
+          process_line(start, pos - start);
+        }
+        start = pos + 1;
+      }
+    }
+    bufUsed_ = end - start;
+    if (bufUsed_ == BUFFER_SIZE)
+    {
+      LOG_ERROR("[WiThrottle %s/%d] Command exceeds %zu bytes, discarding"
+              , name_, fd_, BUFFER_SIZE);
+      bufUsed_ = 0;
+    }
+    else if (bufUsed_ && start != buf_)
+    {
+      memmove(buf_, start, bufUsed_);
+    }
+  }
+  return call_immediately(STATE(send_data));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::send_data()
+{
+  if (pending_.empty())
+  {
+    return call_immediately(STATE(wait_for_data));
+  }
+  // swap the buffers so that any data queued while the write is in progress
+  // will not invalidate the buffer being sent.
+  sending_.swap(pending_);
+  pending_.clear();
+  return write_repeated(&helper_, fd_, sending_.data(), sending_.length()
+                      , STATE(data_sent));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::data_sent()
+{
+  if (helper_.hasError_)
+  {
+    return call_immediately(STATE(shutdown));
+  }
+  sending_.clear();
+  // release the buffer if it was grown by the initial roster or turnout list.
+  if (sending_.capacity() > MAX_PENDING_SIZE)
+  {
+    string().swap(sending_);
+  }
+  return call_immediately(STATE(wait_for_data));
+}
+
+StateFlowBase::Action WiThrottleClientFlow::shutdown()
+{
+  server_->remove_client(this);
+  stop_locos();
+  return delete_this();
+}
+
+void WiThrottleClientFlow::process_line(char *line, size_t len)
+{
+  string cmd(line, len);
+  LOG(CONFIG_WITHROTTLE_LOG_LEVEL, "[WiThrottle %s/%d] <- %s", name_, fd_
+    , cmd.c_str());
+  switch (cmd[0])
+  {
+    case 'N':
+      // Device name, the heartbeat interval is sent as a reply.
+      strncpy(name_, cmd.c_str() + 1, MAX_NAME_LENGTH);
+      send(StringPrintf("*%d", CONFIG_WITHROTTLE_HEARTBEAT_SEC));
+      break;
+    case '*':
+      // Heartbeat, *+ enables and *- disables heartbeat monitoring.
+      if (cmd.length() > 1)
+      {
+        heartbeatEnabled_ = (cmd[1] == '+');
+      }
+      break;
+    case 'P':
+      process_panel(cmd);
+      break;
+    case 'M':
+      process_throttle(cmd);
+      break;
+    case 'Q':
+      closeRequested_ = true;
+      break;
+    case 'H':
+      // Hardware identifier, no action required.
+      break;
+    default:
+      LOG(CONFIG_WITHROTTLE_LOG_LEVEL
+        , "[WiThrottle %s/%d] Unsupported command: %s", name_, fd_
+        , cmd.c_str());
+  }
+}
+
+void WiThrottleClientFlow::process_panel(const string &line)
+{
+  if (line.length() < 4)
+  {
+    return;
+  }
+  if (line[1] == 'P' && line[2] == 'A')
+  {
+    // PPA0 / PPA1 : track power off / on
+    if (line[3] == '1')
+    {
+      esp32cs::enable_ops_track_output();
+    }
+    else
+    {
+      esp32cs::disable_track_outputs();
+    }
+    server_->powerOn_ = (line[3] == '1');
+    server_->broadcast(server_->power_message());
+  }
+  else if (line[1] == 'T' && line[2] == 'A' && line.length() > 4)
+  {
+    // PTA{2|C|T}{system name} : toggle, close or throw a turnout. The system
+    // name is the turnout address with a non-numeric prefix.
+    size_t offs = line.find_first_of("0123456789", 4);
+    if (offs == string::npos)
+    {
+      return;
+    }
+    uint16_t address = std::atoi(line.c_str() + offs);
+    auto turnouts = Singleton<TurnoutManager>::instance();
+    if (line[3] == '2')
+    {
+      turnouts->toggle(address);
+    }
+    else
+    {
+      turnouts->set(address, line[3] == 'T');
+    }
+    // the turnout state change will be pushed to all clients via the state
+    // listener registered by the server.
+  }
+}
+
+void WiThrottleClientFlow::process_throttle(const string &line)
+{
+  // M{throttle}{op}{key}<;>{action}
+  size_t sep = line.find(WITHROTTLE_ACTION_SEPARATOR, 3);
+  if (line.length() < 4 || sep == string::npos)
+  {
+    return;
+  }
+  char throttle = line[1];
+  char op = line[2];
+  string key = line.substr(3, sep - 3);
+  string action = line.substr(sep + strlen(WITHROTTLE_ACTION_SEPARATOR));
+  if (op == '+' || op == 'S')
+  {
+    acquire(throttle, key);
+  }
+  else if (op == '-')
+  {
+    release(throttle, key);
+  }
+  else if (op == 'A' && !action.empty())
+  {
+    for (auto &loco : locos_)
+    {
+      if (matches(&loco, throttle, key))
+      {
+        apply_action(&loco, action);
+      }
+    }
+  }
+}
+
+void WiThrottleClientFlow::acquire(char throttle, const string &key)
+{
+  if (key.length() < 2 || (key[0] != 'S' && key[0] != 'L'))
+  {
+    return;
+  }
+  uint16_t address = std::atoi(key.c_str() + 1);
+  if (!address || address > 10239)
+  {
+    send(StringPrintf("HMInvalid locomotive address: %s", key.c_str()));
+    return;
+  }
+  ThrottleLoco *slot = nullptr;
+  for (auto &loco : locos_)
+  {
+    if (loco.active && loco.address == address && loco.throttle == throttle)
+    {
+      // already assigned to this throttle, resend the state
+      slot = &loco;
+      break;
+    }
+    else if (!loco.active && !slot)
+    {
+      slot = &loco;
+    }
+  }
+  if (!slot)
+  {
+    send(StringPrintf("HMLimit of %zu locomotives has been reached"
+                    , MAX_LOCOS));
+    return;
+  }
+  slot->active = true;
+  slot->throttle = throttle;
+  slot->address = address;
+  slot->long_address = (key[0] == 'L');
+  LOG(INFO, "[WiThrottle %s/%d] Throttle %c acquired %s", name_, fd_
+    , throttle, key.c_str());
+  send(StringPrintf("M%c+%s%s", throttle, key.c_str()
+                  , WITHROTTLE_ACTION_SEPARATOR));
+
+  // send function labels from the roster (if present)
+  auto entry = server_->roster_entry(address);
+  if (entry)
+  {
+    string labels = StringPrintf("M%cL%s%s", throttle, key.c_str()
+                               , WITHROTTLE_ACTION_SEPARATOR);
+    int max_fn = std::min(entry->get_max_fn(), (int)MAX_FUNCTION);
+    for (int fn = 0; fn <= max_fn; fn++)
+    {
+      labels.append("]\\[");
+      labels.append(get_function_label(entry->get_function_label(fn), fn));
+    }
+    send(labels);
+  }
+  refresh_loco(slot, true);
+}
+
+void WiThrottleClientFlow::release(char throttle, const string &key)
+{
+  for (auto &loco : locos_)
+  {
+    if (matches(&loco, throttle, key))
+    {
+      LOG(INFO, "[WiThrottle %s/%d] Throttle %c released %s", name_, fd_
+        , throttle, loco_key(&loco).c_str());
+      send(StringPrintf("M%c-%s%s", throttle, loco_key(&loco).c_str()
+                      , WITHROTTLE_ACTION_SEPARATOR));
+      loco.active = false;
+    }
+  }
+}
+
+void WiThrottleClientFlow::apply_action(ThrottleLoco *loco, const string &action)
+{
+  auto impl = get_train_impl(loco->address);
+  SpeedType speed(impl->get_speed());
+  switch (action[0])
+  {
+    case 'V':
+    {
+      // V{0-126} : set speed
+      int req_speed = std::atoi(action.c_str() + 1);
+      if (req_speed < 0)
+      {
+        impl->set_emergencystop();
+        loco->speed = 0;
+      }
+      else
+      {
+        loco->speed = std::min(req_speed, (int)MAX_SPEED);
+        SpeedType upd = SpeedType::from_mph(loco->speed);
+        upd.set_direction(speed.direction());
+        impl->set_speed(upd);
+      }
+      break;
+    }
+    case 'R':
+      // R{0|1} : set direction (0 = reverse, 1 = forward)
+      loco->forward = (action.length() > 1 && action[1] == '1');
+      speed.set_direction(loco->forward ? SpeedType::FORWARD
+                                        : SpeedType::REVERSE);
+      impl->set_speed(speed);
+      break;
+    case 'X':
+      // X : emergency stop
+      impl->set_emergencystop();
+      break;
+    case 'I':
+      // I : idle (speed zero)
+      speed.set_mph(0);
+      impl->set_speed(speed);
+      break;
+    case 'F':
+    case 'f':
+    {
+      // F{0|1}{fn} : function button released (0) or pressed (1)
+      // f{0|1}{fn} : force function state
+      if (action.length() < 3)
+      {
+        return;
+      }
+      bool pressed = (action[1] == '1');
+      unsigned fn = std::atoi(action.c_str() + 2);
+      if (fn > MAX_FUNCTION)
+      {
+        return;
+      }
+      if (action[0] == 'f')
+      {
+        impl->set_fn(fn, pressed);
+      }
+      else
+      {
+        auto entry = server_->roster_entry(loco->address);
+        bool momentary = entry &&
+          (entry->get_function_label(fn) & commandstation::MOMENTARY);
+        if (momentary)
+        {
+          impl->set_fn(fn, pressed);
+        }
+        else if (pressed)
+        {
+          impl->set_fn(fn, !impl->get_fn(fn));
+        }
+      }
+      break;
+    }
+    case 'q':
+      // qV / qR : query speed or direction
+      refresh_loco(loco, true);
+      return;
+    default:
+      // speed step mode (s), momentary (m) and other actions are not
+      // supported.
+      return;
+  }
+  server_->loco_changed(loco->address);
+}
+
+void WiThrottleClientFlow::refresh_loco(ThrottleLoco *loco, bool force)
+{
+  auto impl = get_train_impl(loco->address);
+  SpeedType speed(impl->get_speed());
+  uint8_t current_speed = 0;
+  if (!impl->get_emergencystop())
+  {
+    current_speed = std::min((int)(speed.mph() + 0.5f), (int)MAX_SPEED);
+  }
+  bool forward = speed.direction() == SpeedType::FORWARD;
+  uint32_t functions = 0;
+  for (uint8_t fn = 0; fn <= MAX_FUNCTION; fn++)
+  {
+    if (impl->get_fn(fn))
+    {
+      functions |= (1UL << fn);
+    }
+  }
+  string prefix = StringPrintf("M%cA%s%s", loco->throttle
+                             , loco_key(loco).c_str()
+                             , WITHROTTLE_ACTION_SEPARATOR);
+  // the cached state is only updated for messages which were queued, any
+  // which were discarded will be sent by a later refresh.
+  for (uint8_t fn = 0; fn <= MAX_FUNCTION; fn++)
+  {
+    uint32_t mask = (1UL << fn);
+    if ((force || ((functions & mask) != (loco->functions & mask))) &&
+        send(StringPrintf("%sF%d%d", prefix.c_str(), (functions & mask) != 0
+                        , fn)))
+    {
+      loco->functions = (loco->functions & ~mask) | (functions & mask);
+    }
+  }
+  if ((force || current_speed != loco->speed) &&
+      send(StringPrintf("%sV%d", prefix.c_str(), current_speed)))
+  {
+    loco->speed = current_speed;
+  }
+  if ((force || forward != loco->forward) &&
+      send(StringPrintf("%sR%d", prefix.c_str(), forward)))
+  {
+    loco->forward = forward;
+  }
+  if (force)
+  {
+    // speed step mode is always 128.
+    send(StringPrintf("%ss1", prefix.c_str()));
+  }
+}
+
+void WiThrottleClientFlow::stop_locos()
+{
+  for (auto &loco : locos_)
+  {
+    if (loco.active)
+    {
+      LOG(INFO, "[WiThrottle %s/%d] Stopping locomotive %d", name_, fd_
+        , loco.address);
+      get_train_impl(loco.address)->set_emergencystop();
+      server_->loco_changed(loco.address);
+    }
+  }
+}
+
+bool WiThrottleClientFlow::matches(ThrottleLoco *loco, char throttle
+                                 , const string &key)
+{
+  return loco->active && loco->throttle == throttle &&
+        (key == "*" || key == loco_key(loco));
+}
+
+string WiThrottleClientFlow::loco_key(ThrottleLoco *loco)
+{
+  return StringPrintf("%c%d", loco->long_address ? 'L' : 'S', loco->address);
+}
+
+#endif // CONFIG_WITHROTTLE
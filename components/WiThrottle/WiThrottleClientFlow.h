@@ -0,0 +1,131 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef WITHROTTLE_CLIENT_FLOW_H_
+#define WITHROTTLE_CLIENT_FLOW_H_
+
+#include <executor/StateFlow.hxx>
+#include <string>
+
+#include "sdkconfig.h"
+
+class WiThrottleServer;
+
+/// Handles a single WiThrottle client connection.
+///
+/// All memory used by the connection is allocated up front with the exception
+/// of the outbound buffers which are capped at
+/// CONFIG_WITHROTTLE_MAX_PENDING_SIZE bytes (each) once the initial roster and
+/// turnout lists have been sent.
+class WiThrottleClientFlow : private StateFlowBase
+{
+public:
+  WiThrottleClientFlow(WiThrottleServer *server, int fd, uint32_t remote_ip);
+
+  virtual ~WiThrottleClientFlow();
+
+  /// Queues a message to be sent to the client, a newline will be appended
+  /// automatically.
+  ///
+  /// @param message is the message to send.
+  /// @param force when true the pending size limit will not be enforced.
+  ///
+  /// @return true if the message was queued, false if it was discarded due to
+  /// the pending size limit.
+  bool send(const std::string &message, bool force = false);
+
+  /// Pushes any changes to the locomotive(s) assigned to this client.
+  ///
+  /// @param address is the locomotive address to check, zero for all.
+  void refresh_locos(uint16_t address = 0);
+
+  /// Checks if the client has missed the heartbeat deadline and stops all
+  /// assigned locomotives if it has.
+  ///
+  /// @param now is the current monotonic time.
+  void check_heartbeat(uint64_t now);
+
+private:
+  static constexpr size_t BUFFER_SIZE = CONFIG_WITHROTTLE_RECEIVE_BUFFER_SIZE;
+  static constexpr size_t MAX_PENDING_SIZE = CONFIG_WITHROTTLE_MAX_PENDING_SIZE;
+  static constexpr size_t MAX_LOCOS = CONFIG_WITHROTTLE_MAX_LOCOS_PER_CLIENT;
+  static constexpr size_t MAX_NAME_LENGTH = 32;
+  static constexpr uint8_t MAX_FUNCTION = 28;
+  static constexpr uint8_t MAX_SPEED = 126;
+
+  /// Locomotive assigned to one of the throttles of this client.
+  struct ThrottleLoco
+  {
+    /// Multi-throttle identifier (usually 'T', 'S' or '0' - '5').
+    char throttle;
+
+    /// Locomotive address.
+    uint16_t address;
+
+    /// Set to true when the address is a long address.
+    bool long_address;
+
+    /// Last reported speed (0 - 126).
+    uint8_t speed;
+
+    /// Last reported direction.
+    bool forward;
+
+    /// Last reported function states, one bit per function.
+    uint32_t functions;
+
+    /// Set to true when the throttle slot is in use.
+    bool active;
+  };
+
+  WiThrottleServer *server_;
+  int fd_;
+  uint32_t remoteIP_;
+  char name_[MAX_NAME_LENGTH + 1];
+  char buf_[BUFFER_SIZE];
+  size_t bufUsed_{0};
+  std::string pending_;
+  std::string sending_;
+  ThrottleLoco locos_[MAX_LOCOS];
+  uint64_t lastReceive_;
+  bool heartbeatEnabled_{false};
+  bool heartbeatExpired_{false};
+  bool waitingForData_{false};
+  bool closeRequested_{false};
+  StateFlowSelectHelper helper_{this};
+
+  STATE_FLOW_STATE(register_client);
+  STATE_FLOW_STATE(wait_for_data);
+  STATE_FLOW_STATE(read_data);
+  STATE_FLOW_STATE(process_data);
+  STATE_FLOW_STATE(send_data);
+  STATE_FLOW_STATE(data_sent);
+  STATE_FLOW_STATE(shutdown);
+
+  void process_line(char *line, size_t len);
+  void process_panel(const std::string &line);
+  void process_throttle(const std::string &line);
+  void acquire(char throttle, const std::string &key);
+  void release(char throttle, const std::string &key);
+  void apply_action(ThrottleLoco *loco, const std::string &action);
+  void refresh_loco(ThrottleLoco *loco, bool force);
+  void stop_locos();
+  bool matches(ThrottleLoco *loco, char throttle, const std::string &key);
+  std::string loco_key(ThrottleLoco *loco);
+};
+
+#endif // WITHROTTLE_CLIENT_FLOW_H_
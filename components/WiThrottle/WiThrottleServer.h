@@ -0,0 +1,108 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef WITHROTTLE_SERVER_H_
+#define WITHROTTLE_SERVER_H_
+
+#include <AutoPersistCallbackFlow.h>
+#include <atomic>
+#include <executor/Service.hxx>
+#include <memory>
+#include <os/MDNS.hxx>
+#include <TrainDb.hxx>
+#include <string>
+#include <utils/Singleton.hxx>
+#include <utils/socket_listener.hxx>
+#include <vector>
+
+#include "sdkconfig.h"
+
+class WiThrottleClientFlow;
+
+/// Manages the WiThrottle listener socket and all connected clients.
+///
+/// NOTE: With the exception of the listener management methods and
+/// @ref accepting_clients all methods must be called on the executor of the
+/// @ref Service passed to the constructor.
+class WiThrottleServer : public Singleton<WiThrottleServer>
+{
+public:
+  WiThrottleServer(Service *service, MDNS *mdns);
+
+  /// Starts the listener socket and publishes the mDNS service.
+  void start_listener();
+
+  /// Stops the listener socket and removes the mDNS service.
+  void stop_listener();
+
+  /// @return true if another client connection can be accepted.
+  bool accepting_clients()
+  {
+    return clientCount_ < CONFIG_WITHROTTLE_MAX_CLIENTS;
+  }
+
+  /// Registers a client to receive state updates.
+  void add_client(WiThrottleClientFlow *client);
+
+  /// Removes a client from receiving state updates.
+  void remove_client(WiThrottleClientFlow *client);
+
+  /// Sends a message to all connected clients.
+  void broadcast(const std::string &message);
+
+  /// Notifies all clients that the state of a locomotive has changed.
+  ///
+  /// @param address is the locomotive address that was modified.
+  void loco_changed(uint16_t address);
+
+  /// @return the roster list message.
+  std::string roster_message();
+
+  /// @return the turnout list messages.
+  std::string turnout_message();
+
+  /// @return the track power state message.
+  std::string power_message();
+
+  /// @return the roster entry for a locomotive or nullptr if not found.
+  std::shared_ptr<commandstation::TrainDbEntry> roster_entry(uint16_t address);
+
+  Service *service()
+  {
+    return service_;
+  }
+
+private:
+  /// Callback from the @ref TurnoutManager when a turnout changes state.
+  void turnout_changed(uint16_t address, bool thrown);
+
+  /// Periodic callback used for heartbeat validation and pushing changes
+  /// made by other interfaces.
+  void periodic_update();
+
+  Service *service_;
+  MDNS *mdns_;
+  std::unique_ptr<SocketListener> listener_;
+  std::vector<WiThrottleClientFlow *> clients_;
+  std::atomic_uint clientCount_{0};
+  AutoPersistFlow updateFlow_;
+  bool powerOn_{false};
+
+  friend class WiThrottleClientFlow;
+};
+
+#endif // WITHROTTLE_SERVER_H_
@@ -19,6 +19,7 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include "CSConfigDescriptor.h"
 #include "ESP32TrainDatabase.h"
 #include "OTAMonitor.h"
+#include "WebStatePublisher.h"
 
 #include <AllTrainNodes.hxx>
 #include <FileSystemManager.h>
@@ -72,6 +73,10 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include <JmriInterface.h>
 #endif
 
+#if CONFIG_WITHROTTLE
+#include <WiThrottle.h>
+#endif
+
 #if !CONFIG_ESP32CS_SINGLE_EXECUTOR
 ///////////////////////////////////////////////////////////////////////////////
 // Set the priority of the httpd executor to the effective value used for the
@@ -336,6 +341,18 @@ extern "C" void app_main()
   TurnoutManager turnoutManager(stackManager.node()
                               , stackManager.service());
 
+#if CONFIG_WITHROTTLE
+  // Initialize the WiThrottle interface, this must be done after the turnout
+  // manager has been created.
+  init_withrottle_interface(&mDNS);
+#endif // CONFIG_WITHROTTLE
+
+#if !defined(CONFIG_WIFI_MODE_DISABLED)
+  // Initialize the WebSocket state publisher, this must be done after the
+  // turnout manager has been created and before the sensors are started.
+  WebStatePublisher webStatePublisher(stackManager.service());
+#endif
+
 #if CONFIG_GPIO_OUTPUTS
   LOG(INFO, "[Config] Enabling GPIO Outputs");
   OutputManager::init();
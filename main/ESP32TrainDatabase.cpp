@@ -22,13 +22,24 @@ COPYRIGHT (c) 2019-2020 Mike Dunston
 #include <FileSystemManager.h>
 #include <json.hpp>
 #include <JsonConstants.h>
+#include <JsonEntryReader.h>
+#include <JsonWriter.h>
 #include <TrainDbCdi.hxx>
 #include <utils/FileUtils.hxx>
 
 namespace commandstation
 {
-// JSON serialization mappings for the commandstation::DccMode enum
-NLOHMANN_JSON_SERIALIZE_ENUM(DccMode,
+
+template <typename T>
+struct EnumName
+{
+  T value;
+  const char *name;
+};
+
+// display names for the commandstation::DccMode enum, the first entry is
+// used for any unknown value.
+static constexpr EnumName<DccMode> DCC_MODE_NAMES[] =
 {
   { DCCMODE_DEFAULT,     "DCC (default)" },
   { DCCMODE_OLCBUSER,    "DCC-OlcbUser" },
@@ -44,10 +55,11 @@ NLOHMANN_JSON_SERIALIZE_ENUM(DccMode,
   { DCC_14_LONG_ADDRESS, "DCC (14 speed step, long address)"},
   { DCC_28_LONG_ADDRESS, "DCC (28 speed step, long address)"},
   { DCC_128_LONG_ADDRESS,"DCC (128 speed step, long address)"},
-});
+};
 
-// JSON serialization mappings for the commandstation::Symbols enum
-NLOHMANN_JSON_SERIALIZE_ENUM(Symbols,
+// display names for the commandstation::Symbols enum, the first entry is
+// used for any unknown value.
+static constexpr EnumName<Symbols> SYMBOL_NAMES[] =
 {
   { FN_NONEXISTANT,   "N/A" },
   { LIGHT,            "Light" },
@@ -71,14 +83,31 @@ NLOHMANN_JSON_SERIALIZE_ENUM(Symbols,
   { FNP,              "fnp" },
   { SOUNDP,           "soundp" },
   { FN_UNINITIALIZED, "uninit" },
-})
+};
+
+template <typename T, size_t N>
+static const char *enum_name(const EnumName<T> (&names)[N], T value)
+{
+  for (const auto &ent : names)
+  {
+    if (ent.value == value)
+    {
+      return ent.name;
+    }
+  }
+  return names[0].name;
 }
 
+} // namespace commandstation
+
 namespace esp32cs
 {
 
 using nlohmann::json;
 using commandstation::DccMode;
+using commandstation::enum_name;
+using commandstation::DCC_MODE_NAMES;
+using commandstation::SYMBOL_NAMES;
 using commandstation::AllTrainNodes;
 using openlcb::TractionDefs;
 
@@ -224,18 +253,8 @@ Esp32TrainDatabase::Esp32TrainDatabase(openlcb::SimpleStackBase *stack)
                      , std::bind(&Esp32TrainDatabase::persist, this));
 
   LOG(INFO, "[TrainDB] Initializing...");
-  if (Singleton<FileSystemManager>::instance()->exists(TRAIN_DB_JSON_FILE))
-  {
-    auto roster =
-      Singleton<FileSystemManager>::instance()->load(TRAIN_DB_JSON_FILE);
-    json stored_trains = json::parse(roster, nullptr, false);
-    if (stored_trains.is_discarded())
-    {
-      LOG_ERROR("[TrainDB] database is corrupt, no trains loaded!");
-      Singleton<FileSystemManager>::instance()->remove(TRAIN_DB_JSON_FILE);
-      return;
-    }
-    for (auto &entry : stored_trains)
+  bool loaded = JsonEntryReader::load(TRAIN_DB_JSON_FILE, nullptr
+  , [&](json &entry)
     {
       auto data = entry.get<Esp32PersistentTrainData>();
       auto ent = std::find_if(knownTrains_.begin(), knownTrains_.end(),
@@ -268,6 +287,14 @@ Esp32TrainDatabase::Esp32TrainDatabase(openlcb::SimpleStackBase *stack)
                 , data.address);
       }
     }
+  );
+  if (!loaded)
+  {
+    // entries parsed before the corruption are kept, force the database to
+    // be rewritten so the corrupt content is dropped.
+    LOG_ERROR("[TrainDB] database is corrupt, recovered %zu entries."
+            , knownTrains_.size());
+    entryDeleted_ = true;
   }
 
   LOG(INFO, "[TrainDB] Found %d persistent roster entries."
@@ -305,6 +332,7 @@ std::shared_ptr<TrainDbEntry> Esp32TrainDatabase::create_if_not_found(unsigned a
   auto index = knownTrains_.size();
   knownTrains_.emplace_back(
     new Esp32TrainDbEntry(Esp32PersistentTrainData(address, name, mode)));
+  generation_++;
   LOG(VERBOSE, "[TrainDB] No entry was found, created new entry:%s."
     , knownTrains_[index]->identifier().c_str());
   return knownTrains_[index];
@@ -350,6 +378,7 @@ void Esp32TrainDatabase::delete_entry(unsigned address)
     LOG(VERBOSE, "[TrainDB] Removing persistent entry for address %u", address);
     knownTrains_.erase(entry);
     entryDeleted_ = true;
+    generation_++;
   }
 }
 
@@ -430,10 +459,17 @@ unsigned Esp32TrainDatabase::add_dynamic_entry(uint16_t address, DccMode mode)
         Esp32PersistentTrainData(address, std::to_string(address), mode)
       , false));
 #endif
+    generation_++;
   }
   return index;
 }
 
+unsigned Esp32TrainDatabase::generation()
+{
+  const std::lock_guard<std::mutex> lock(knownTrainsLock_);
+  return generation_;
+}
+
 std::set<uint16_t> Esp32TrainDatabase::get_default_train_addresses(uint16_t limit)
 {
   std::set<uint16_t> results;
@@ -465,6 +501,7 @@ void Esp32TrainDatabase::set_train_name(unsigned address, std::string name)
   {
     LOG(VERBOSE, "[TrainDB] Setting train(%u) name: %s", address, name.c_str());
     (*entry)->set_train_name(name);
+    generation_++;
   }
   else
   {
@@ -533,6 +570,7 @@ void Esp32TrainDatabase::set_train_drive_mode(unsigned address, commandstation::
   if (entry != knownTrains_.end())
   {
     (*entry)->set_legacy_drive_mode(mode);
+    generation_++;
   }
   else
   {
@@ -544,58 +582,71 @@ void Esp32TrainDatabase::set_train_drive_mode(unsigned address, commandstation::
 string Esp32TrainDatabase::get_all_entries_as_json()
 {
   const std::lock_guard<std::mutex> lock(knownTrainsLock_);
-  string res = "[";
+  string res;
+  JsonWriter writer(res);
+  writer.start_array();
   for (auto entry : knownTrains_)
   {
-    if (res.length() > 1)
-    {
-      res += ",";
-    }
-    res += get_entry_as_json_locked(entry->get_legacy_address());
+    write_entry_json(writer, entry);
   }
-  res += "]";
+  writer.end_array();
   return res;
 }
 
-string Esp32TrainDatabase::get_entry_as_json(unsigned address)
+bool Esp32TrainDatabase::append_entry_json(size_t index, string &json)
 {
   const std::lock_guard<std::mutex> lock(knownTrainsLock_);
-  return get_entry_as_json_locked(address);
+  if (index < knownTrains_.size())
+  {
+    JsonWriter writer(json);
+    write_entry_json(writer, knownTrains_[index]);
+    return true;
+  }
+  return false;
 }
 
-string Esp32TrainDatabase::get_entry_as_json_locked(unsigned address)
+string Esp32TrainDatabase::get_entry_as_json(unsigned address)
 {
+  const std::lock_guard<std::mutex> lock(knownTrainsLock_);
   auto entry = FIND_TRAIN(address);
   if (entry != knownTrains_.end())
   {
-    auto train = (*entry);
-    json j =
-    {
-      { "name", train->get_train_name() },
-      { "address", train->get_legacy_address() },
-      { "idleOnStartup", train->is_auto_idle() },
-      { "defaultOnThrottles", train->is_show_on_limited_throttles() },
-      { "mode",
-        {
-          { "name", static_cast<DccMode>(train->get_legacy_drive_mode()) },
-          { "type", train->get_legacy_drive_mode() }
-        }
-      }
-    };
-    for (size_t idx = 0; idx < DCC_MAX_FN; idx++)
-    {
-      j["functions"].push_back(
-      {
-        { "id", idx },
-        { "name", static_cast<Symbols>(train->get_function_label(idx)) },
-        { "type", train->get_function_label(idx) }
-      });
-    }
-    return j.dump();
+    string res;
+    JsonWriter writer(res);
+    write_entry_json(writer, *entry);
+    return res;
   }
   return "{}";
 }
 
+void Esp32TrainDatabase::write_entry_json(JsonWriter &writer
+                                        , std::shared_ptr<Esp32TrainDbEntry> train)
+{
+  // "mode.type" carries the display name of the mode, the same as
+  // "mode.name", as existing clients expect.
+  const char *mode = enum_name(DCC_MODE_NAMES, train->get_legacy_drive_mode());
+  writer.start_object()
+        .field("name", train->get_train_name())
+        .field("address", train->get_legacy_address())
+        .field("idleOnStartup", train->is_auto_idle())
+        .field("defaultOnThrottles", train->is_show_on_limited_throttles())
+        .key("mode").start_object()
+          .field("name", mode)
+          .field("type", mode)
+        .end_object()
+        .key("functions").start_array();
+  for (size_t idx = 0; idx < DCC_MAX_FN; idx++)
+  {
+    unsigned label = train->get_function_label(idx);
+    writer.start_object()
+          .field("id", idx)
+          .field("name", enum_name(SYMBOL_NAMES, static_cast<Symbols>(label)))
+          .field("type", label)
+          .end_object();
+  }
+  writer.end_array().end_object();
+}
+
 void Esp32TrainDatabase::persist()
 {
   const std::lock_guard<std::mutex> lock(knownTrainsLock_);
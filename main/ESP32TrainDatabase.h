@@ -42,6 +42,8 @@ namespace openlcb
   class SimpleStackBase;
 }
 
+class JsonWriter;
+
 namespace esp32cs
 {
   using namespace commandstation;
@@ -244,6 +246,8 @@ namespace esp32cs
 
     unsigned add_dynamic_entry(uint16_t address, DccMode mode) override;
 
+    unsigned generation() override;
+
     std::set<uint16_t> get_default_train_addresses(uint16_t limit);
 
     void set_train_name(unsigned address, std::string name);
@@ -253,6 +257,7 @@ namespace esp32cs
     void set_train_drive_mode(unsigned address, DccMode mode);
 
     std::string get_all_entries_as_json();
+    bool append_entry_json(size_t index, std::string &json);
     std::string get_entry_as_json(unsigned address);
 
     openlcb::MemorySpace *get_train_cdi()
@@ -268,9 +273,11 @@ namespace esp32cs
     void persist();
 
   private:
-    std::string get_entry_as_json_locked(unsigned address);
+    void write_entry_json(JsonWriter &writer
+                        , std::shared_ptr<Esp32TrainDbEntry> train);
     openlcb::SimpleStackBase *stack_;
     bool entryDeleted_{false};
+    unsigned generation_{0};
     std::mutex knownTrainsLock_;
     std::vector<std::shared_ptr<Esp32TrainDbEntry>> knownTrains_;
     std::unique_ptr<openlcb::MemorySpace> trainCdiFile_;
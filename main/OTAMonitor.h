@@ -38,9 +38,12 @@ public:
 #endif
   }
 
-  void report_start()
+  void report_start(size_t size)
   {
-    progress_ = 0;
+    size_ = size;
+    received_ = 0;
+    startTime_ = os_get_time_monotonic();
+    lastReport_ = 0;
 
 #if CONFIG_STATUS_LED
     // set blink pattern to alternating green blink
@@ -117,22 +120,44 @@ public:
     start_flow(STATE(reboot_node));
    }
 
-  void report_progress(uint32_t progress)
+  /// Reports the progress of the update.
+  ///
+  /// @param received is the number of bytes received since the last call.
+  /// @param written is the total number of bytes written to flash.
+  void report_progress(uint32_t received, uint32_t written)
   {
-    progress_ += progress;
+    received_ += received;
+    uint64_t now = os_get_time_monotonic();
+    // limit display updates since they are slower than the data arrives.
+    if (received_ < size_ && now - lastReport_ < REPORT_INTERVAL)
+    {
+      return;
+    }
+    lastReport_ = now;
+    uint32_t elapsed = NSEC_TO_MSEC(now - startTime_);
+    uint32_t rate = elapsed ? received_ / elapsed : 0;
+    uint32_t percent = size_ ? (uint64_t)written * 100 / size_ : 0;
+    LOG(VERBOSE, "[OTA] Recv: %u/%zu, Written: %u (%u%%), %u KiB/s"
+      , received_, size_, written, percent, rate);
 #if !CONFIG_DISPLAY_TYPE_NONE
-    Singleton<StatusDisplay>::instance()->status("Recv: %d", progress_);
+    Singleton<StatusDisplay>::instance()->status("OTA: %u%% %uKB/s", percent
+                                               , rate);
 #endif // !CONFIG_DISPLAY_TYPE_NONE
 #if CONFIG_NEXTION
     titlePage_->setStatusText(1
-                            , StringPrintf("Received: %d", progress_).c_str());
+                            , StringPrintf("Written: %u%% (%u KB/s)", percent
+                                         , rate).c_str());
 #endif
   }
 
 private:
   StateFlowTimer timer_{this};
   uint8_t countdown_{StatusLED::LED::MAX_LED};
-  uint32_t progress_{0};
+  size_t size_{0};
+  uint32_t received_{0};
+  uint64_t startTime_{0};
+  uint64_t lastReport_{0};
+  static constexpr uint64_t REPORT_INTERVAL = MSEC_TO_NSEC(500);
 #if CONFIG_NEXTION
   NextionTitlePage *titlePage_;
 #endif
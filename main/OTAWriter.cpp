@@ -0,0 +1,416 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#include "OTAWriter.h"
+
+#include <esp32/rom/crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+#include <utils/logging.h>
+
+OTAWriter::OTAWriter()
+{
+}
+
+OTAWriter::~OTAWriter()
+{
+  if (active_)
+  {
+    // the image is incomplete, stop the writer without setting the boot
+    // partition.
+    buffers_[fill_].len = 0;
+    filled_.post();
+    wait_for_writer();
+  }
+}
+
+void OTAWriter::begin(size_t size, bool compressed)
+{
+  if (active_)
+  {
+    LOG(WARNING, "[OTA] Aborting previous update");
+    buffers_[fill_].len = 0;
+    filled_.post();
+    wait_for_writer();
+  }
+  partition_ = esp_ota_get_next_update_partition(NULL);
+  size_ = size;
+  written_ = 0;
+  error_ = ESP_OK;
+  fill_ = 0;
+  drain_ = 0;
+  buffers_ = (Buffer *)malloc(sizeof(Buffer) * BUFFER_COUNT);
+  if (compressed)
+  {
+    inflater_ = (Inflater *)malloc(sizeof(Inflater));
+  }
+  if (buffers_ == nullptr || partition_ == nullptr ||
+      (compressed && inflater_ == nullptr))
+  {
+    free(buffers_);
+    free(inflater_);
+    buffers_ = nullptr;
+    inflater_ = nullptr;
+    error_ = ESP_ERR_NO_MEM;
+    return;
+  }
+  if (inflater_)
+  {
+    tinfl_init(&inflater_->decompressor);
+    inflater_->offset = 0;
+    inflater_->header = false;
+    inflater_->done = false;
+    inflater_->crc = 0;
+    inflater_->size = 0;
+    inflater_->trailing = 0;
+    memset(inflater_->tail, 0, GZIP_TRAILER_SIZE);
+  }
+  // the first buffer is used immediately, the remainder are available.
+  buffers_[fill_].len = 0;
+  for (size_t idx = 1; idx < BUFFER_COUNT; idx++)
+  {
+    free_.post();
+  }
+  active_ = true;
+  os_thread_t writer;
+  os_thread_create(&writer, "ota-writer", WRITER_PRIORITY, WRITER_STACK_SIZE
+                 , writer_task, this);
+}
+
+esp_err_t OTAWriter::write(const uint8_t *data, size_t len)
+{
+  if (!active_)
+  {
+    return error_ != ESP_OK ? (esp_err_t)error_ : ESP_ERR_INVALID_STATE;
+  }
+  while (len && error_ == ESP_OK)
+  {
+    Buffer *buf = &buffers_[fill_];
+    size_t count = std::min(len, BUFFER_SIZE - buf->len);
+    memcpy(buf->data + buf->len, data, count);
+    buf->len += count;
+    data += count;
+    len -= count;
+    if (buf->len == BUFFER_SIZE)
+    {
+      submit();
+    }
+  }
+  return error_;
+}
+
+esp_err_t OTAWriter::end()
+{
+  if (!active_)
+  {
+    return error_ != ESP_OK ? (esp_err_t)error_ : ESP_ERR_INVALID_STATE;
+  }
+  if (buffers_[fill_].len)
+  {
+    submit();
+  }
+  // an empty buffer signals the end of the image.
+  buffers_[fill_].len = 0;
+  filled_.post();
+  wait_for_writer();
+  return error_;
+}
+
+void OTAWriter::submit()
+{
+  filled_.post();
+  free_.wait();
+  fill_ = (fill_ + 1) % BUFFER_COUNT;
+  buffers_[fill_].len = 0;
+}
+
+void OTAWriter::wait_for_writer()
+{
+  done_.wait();
+  // drain any buffers that were released by the writer task.
+  while (!free_.timedwait(0))
+  {
+  }
+  free(buffers_);
+  free(inflater_);
+  buffers_ = nullptr;
+  inflater_ = nullptr;
+  active_ = false;
+}
+
+esp_err_t OTAWriter::inflate(const uint8_t *data, size_t len)
+{
+  Inflater *inf = inflater_;
+  // keep a copy of the last bytes received, the final copy is the trailer.
+  if (len >= GZIP_TRAILER_SIZE)
+  {
+    memcpy(inf->tail, data + len - GZIP_TRAILER_SIZE, GZIP_TRAILER_SIZE);
+  }
+  else
+  {
+    memmove(inf->tail, inf->tail + len, GZIP_TRAILER_SIZE - len);
+    memcpy(inf->tail + GZIP_TRAILER_SIZE - len, data, len);
+  }
+  if (!inf->header)
+  {
+    size_t header = parse_gzip_header(data, len);
+    if (!header)
+    {
+      LOG_ERROR("[OTA] Invalid gzip header");
+      return ESP_ERR_INVALID_ARG;
+    }
+    inf->header = true;
+    data += header;
+    len -= header;
+  }
+  tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  while (!inf->done && (len || status == TINFL_STATUS_HAS_MORE_OUTPUT))
+  {
+    size_t in_bytes = len;
+    size_t out_bytes = WINDOW_SIZE - inf->offset;
+    status =
+      tinfl_decompress(&inf->decompressor, data, &in_bytes, inf->window
+                     , inf->window + inf->offset, &out_bytes
+                     , TINFL_FLAG_HAS_MORE_INPUT);
+    data += in_bytes;
+    len -= in_bytes;
+    if (out_bytes)
+    {
+      esp_err_t err =
+        esp_ota_write(handle_, inf->window + inf->offset, out_bytes);
+      if (err != ESP_OK)
+      {
+        LOG_ERROR("[OTA] esp_ota_write failed: %s", esp_err_to_name(err));
+        return err;
+      }
+      inf->crc = crc32_le(inf->crc, inf->window + inf->offset, out_bytes);
+      inf->size += out_bytes;
+      // the window is a power of two so this wraps back to the start.
+      inf->offset = (inf->offset + out_bytes) & (WINDOW_SIZE - 1);
+    }
+    if (status == TINFL_STATUS_DONE)
+    {
+      inf->done = true;
+    }
+    else if (status < TINFL_STATUS_DONE)
+    {
+      LOG_ERROR("[OTA] Decompression failed: %d", status);
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  // anything remaining after the deflate stream is part of the gzip trailer,
+  // depending on how far the decompressor read ahead this may be none of it.
+  inf->trailing += len;
+  if (inf->trailing > GZIP_TRAILER_SIZE)
+  {
+    LOG_ERROR("[OTA] Unexpected data after gzip trailer");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return ESP_OK;
+}
+
+size_t OTAWriter::parse_gzip_header(const uint8_t *data, size_t len)
+{
+  static constexpr uint8_t GZIP_METHOD_DEFLATE = 8;
+  static constexpr uint8_t GZIP_FLAG_HCRC = 0x02;
+  static constexpr uint8_t GZIP_FLAG_EXTRA = 0x04;
+  static constexpr uint8_t GZIP_FLAG_NAME = 0x08;
+  static constexpr uint8_t GZIP_FLAG_COMMENT = 0x10;
+
+  if (len < GZIP_HEADER_SIZE || !is_compressed(data, len) ||
+      data[2] != GZIP_METHOD_DEFLATE)
+  {
+    return 0;
+  }
+  uint8_t flags = data[3];
+  size_t offset = GZIP_HEADER_SIZE;
+  if (flags & GZIP_FLAG_EXTRA)
+  {
+    if (offset + 2 > len)
+    {
+      return 0;
+    }
+    offset += 2 + (data[offset] | (data[offset + 1] << 8));
+  }
+  // the file name and comment are null terminated.
+  if (flags & GZIP_FLAG_NAME)
+  {
+    while (offset < len && data[offset++])
+    {
+    }
+  }
+  if (flags & GZIP_FLAG_COMMENT)
+  {
+    while (offset < len && data[offset++])
+    {
+    }
+  }
+  if (flags & GZIP_FLAG_HCRC)
+  {
+    offset += 2;
+  }
+  // the header must fit within the first buffer.
+  return offset < len ? offset : 0;
+}
+
+esp_err_t OTAWriter::verify_gzip_trailer()
+{
+  Inflater *inf = inflater_;
+  if (!inf->done)
+  {
+    LOG_ERROR("[OTA] Compressed image is incomplete");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint32_t crc = inf->tail[0] | (inf->tail[1] << 8) |
+                 (inf->tail[2] << 16) | (inf->tail[3] << 24);
+  uint32_t size = inf->tail[4] | (inf->tail[5] << 8) |
+                  (inf->tail[6] << 16) | (inf->tail[7] << 24);
+  if (crc != inf->crc || size != inf->size)
+  {
+    LOG_ERROR("[OTA] gzip trailer mismatch, crc:%08x/%08x, size:%u/%u"
+            , crc, inf->crc, size, inf->size);
+    return ESP_ERR_INVALID_CRC;
+  }
+  LOG(INFO, "[OTA] Decompressed %zu bytes to %u bytes", size_, inf->size);
+  return ESP_OK;
+}
+
+esp_err_t OTAWriter::verify_image()
+{
+  esp_app_desc_t desc;
+  esp_err_t err = esp_ota_get_partition_description(partition_, &desc);
+  if (err != ESP_OK)
+  {
+    LOG_ERROR("[OTA] Unable to read application description: %s"
+            , esp_err_to_name(err));
+    return err;
+  }
+  const esp_app_desc_t *running = esp_ota_get_app_description();
+  if (strncmp(desc.project_name, running->project_name
+            , sizeof(desc.project_name)))
+  {
+    LOG_ERROR("[OTA] Image is for %s, expected %s", desc.project_name
+            , running->project_name);
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  LOG(INFO, "[OTA] Image version %s (%s %s)", desc.version, desc.date
+    , desc.time);
+  return ESP_OK;
+}
+
+void *OTAWriter::writer_task(void *arg)
+{
+  OTAWriter *writer = static_cast<OTAWriter *>(arg);
+  uint64_t start = os_get_time_monotonic();
+  size_t image_size = writer->size_;
+  if (writer->inflater_)
+  {
+    // the decompressed size is not known until the trailer is received.
+#ifdef OTA_WITH_SEQUENTIAL_WRITES
+    image_size = OTA_WITH_SEQUENTIAL_WRITES;
+#else
+    image_size = OTA_SIZE_UNKNOWN;
+#endif // OTA_WITH_SEQUENTIAL_WRITES
+  }
+  LOG(INFO, "[OTA] Erasing partition %s for %zu bytes%s"
+    , writer->partition_->label, writer->size_
+    , writer->inflater_ ? " (compressed)" : "");
+  esp_err_t err =
+    esp_ota_begin(writer->partition_, image_size, &writer->handle_);
+  if (err != ESP_OK)
+  {
+    LOG_ERROR("[OTA] esp_ota_begin failed: %s", esp_err_to_name(err));
+    writer->error_ = err;
+  }
+  while (true)
+  {
+    writer->filled_.wait();
+    Buffer *buf = &writer->buffers_[writer->drain_];
+    writer->drain_ = (writer->drain_ + 1) % BUFFER_COUNT;
+    if (!buf->len)
+    {
+      break;
+    }
+    // after an error the remaining data is discarded, the buffers are still
+    // released so that the caller does not block.
+    if (writer->error_ == ESP_OK)
+    {
+      if (writer->inflater_)
+      {
+        err = writer->inflate(buf->data, buf->len);
+      }
+      else
+      {
+        err = esp_ota_write(writer->handle_, buf->data, buf->len);
+        if (err != ESP_OK)
+        {
+          LOG_ERROR("[OTA] esp_ota_write failed: %s", esp_err_to_name(err));
+        }
+      }
+      if (err != ESP_OK)
+      {
+        writer->error_ = err;
+      }
+      else
+      {
+        writer->written_ += buf->len;
+      }
+    }
+    writer->free_.post();
+  }
+  if (writer->written_ != writer->size_ && writer->error_ == ESP_OK)
+  {
+    LOG_ERROR("[OTA] Image incomplete, %zu/%zu bytes written"
+            , (size_t)writer->written_, writer->size_);
+    writer->error_ = ESP_ERR_INVALID_SIZE;
+  }
+  if (writer->inflater_ && writer->error_ == ESP_OK)
+  {
+    writer->error_ = writer->verify_gzip_trailer();
+  }
+  // esp_ota_end verifies the image checksum (and hash when present).
+  if (esp_ota_end(writer->handle_) != ESP_OK && writer->error_ == ESP_OK)
+  {
+    writer->error_ = ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  if (writer->error_ == ESP_OK)
+  {
+    writer->error_ = writer->verify_image();
+  }
+  if (writer->error_ == ESP_OK)
+  {
+    uint32_t elapsed = NSEC_TO_MSEC(os_get_time_monotonic() - start);
+    LOG(INFO, "[OTA] %zu bytes written in %u ms (%u KiB/s), setting boot "
+              "partition: %s", (size_t)writer->written_, elapsed
+      , elapsed ? (uint32_t)(writer->written_ / elapsed) : 0
+      , writer->partition_->label);
+    err = esp_ota_set_boot_partition(writer->partition_);
+    if (err != ESP_OK)
+    {
+      LOG_ERROR("[OTA] esp_ota_set_boot_partition failed: %s"
+              , esp_err_to_name(err));
+      writer->error_ = err;
+    }
+  }
+  // on the ESP32 the high water mark is reported in bytes.
+  LOG(INFO, "[OTA] Writer stack high water mark: %u/%zu bytes"
+    , (unsigned)uxTaskGetStackHighWaterMark(nullptr), WRITER_STACK_SIZE);
+  writer->done_.post();
+  return nullptr;
+}
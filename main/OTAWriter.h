@@ -0,0 +1,251 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef OTA_WRITER_H_
+#define OTA_WRITER_H_
+
+#include <atomic>
+#include <esp_err.h>
+#include <esp_ota_ops.h>
+#include <esp32/rom/miniz.h>
+#include <os/OS.hxx>
+
+/// Writes an OTA firmware image to flash using a dedicated task.
+///
+/// Received data is copied into one of @ref BUFFER_COUNT buffers which are
+/// written to flash by the writer task while the next buffer is being filled,
+/// this allows the network receive and flash erase/write operations to run in
+/// parallel. The caller will only block when all buffers are waiting to be
+/// written.
+///
+/// The partition erase (esp_ota_begin) and image validation (esp_ota_end) are
+/// also performed by the writer task.
+///
+/// gzip compressed images are decompressed by the writer task using the ROM
+/// inflate implementation with a fixed size window, the CRC32 and size from
+/// the gzip trailer are verified before the boot partition is changed.
+class OTAWriter
+{
+public:
+  /// Constructor.
+  OTAWriter();
+
+  /// Destructor.
+  ~OTAWriter();
+
+  /// Starts a new OTA update, any in-progress update will be aborted.
+  ///
+  /// @param size is the size of the firmware image as it will be received.
+  /// @param compressed should be true when the image is gzip compressed.
+  void begin(size_t size, bool compressed = false);
+
+  /// Checks if the provided data is the start of a gzip compressed image.
+  ///
+  /// @param data is the first chunk of the image.
+  /// @param len is the length of the data.
+  ///
+  /// @return true if the image is gzip compressed.
+  static bool is_compressed(const uint8_t *data, size_t len)
+  {
+    return len >= 2 && data[0] == GZIP_MAGIC_0 && data[1] == GZIP_MAGIC_1;
+  }
+
+  /// Queues data to be written to flash.
+  ///
+  /// @param data is the data to write.
+  /// @param len is the length of the data.
+  ///
+  /// @return ESP_OK if the data was queued, otherwise the error from the
+  /// writer task.
+  esp_err_t write(const uint8_t *data, size_t len);
+
+  /// Writes any remaining data, validates the image and marks the partition
+  /// as the boot partition. This will block until the writer task has
+  /// completed.
+  ///
+  /// @return ESP_OK if the update was successful.
+  esp_err_t end();
+
+  /// @return number of received bytes that have been written to flash, for
+  /// compressed images this is the number of compressed bytes consumed.
+  size_t written()
+  {
+    return written_;
+  }
+
+  /// @return the partition being updated.
+  const esp_partition_t *partition()
+  {
+    return partition_;
+  }
+
+private:
+  /// Number of buffers to use, two allows one buffer to be written while the
+  /// other is being filled.
+  static constexpr size_t BUFFER_COUNT = 2;
+
+  /// Size of each buffer, this matches the flash sector size.
+  static constexpr size_t BUFFER_SIZE = 4096;
+
+  /// Stack size for the writer task, this includes the ROM inflate and the
+  /// flash write paths. The high water mark is logged after each update.
+  static constexpr size_t WRITER_STACK_SIZE = 4096;
+
+  /// Priority for the writer task.
+  static constexpr int WRITER_PRIORITY = 1;
+
+  /// Size of the decompression window, this must be a power of two and at
+  /// least the deflate dictionary size.
+  static constexpr size_t WINDOW_SIZE = TINFL_LZ_DICT_SIZE;
+
+  /// gzip header magic bytes.
+  static constexpr uint8_t GZIP_MAGIC_0 = 0x1F;
+  static constexpr uint8_t GZIP_MAGIC_1 = 0x8B;
+
+  /// Size of the fixed portion of the gzip header.
+  static constexpr size_t GZIP_HEADER_SIZE = 10;
+
+  /// Size of the gzip trailer (CRC32 and uncompressed size).
+  static constexpr size_t GZIP_TRAILER_SIZE = 8;
+
+  /// State used while decompressing an image.
+  struct Inflater
+  {
+    /// ROM inflate state.
+    tinfl_decompressor decompressor;
+
+    /// Output window, this also holds the deflate dictionary.
+    uint8_t window[WINDOW_SIZE];
+
+    /// Offset in @ref window where the next output will be written.
+    size_t offset;
+
+    /// Set to true once the gzip header has been consumed.
+    bool header;
+
+    /// Set to true once the deflate stream has been fully decompressed.
+    bool done;
+
+    /// Running CRC32 of the decompressed data.
+    uint32_t crc;
+
+    /// Number of decompressed bytes.
+    uint32_t size;
+
+    /// Last @ref GZIP_TRAILER_SIZE bytes of the received image. The ROM
+    /// inflate implementation reads ahead into its bit buffer and does not
+    /// return the unused input at the end of the deflate stream, so the gzip
+    /// trailer is taken from the raw data instead.
+    uint8_t tail[GZIP_TRAILER_SIZE];
+
+    /// Number of bytes received after the end of the deflate stream which
+    /// were not consumed by the decompressor.
+    size_t trailing;
+  };
+
+  /// Buffer of data waiting to be written to flash.
+  struct Buffer
+  {
+    /// Data to be written.
+    uint8_t data[BUFFER_SIZE];
+
+    /// Number of bytes used in @ref data, zero indicates the end of the
+    /// image.
+    size_t len;
+  };
+
+  /// Entry point for the writer task.
+  ///
+  /// @param arg is the @ref OTAWriter instance.
+  static void *writer_task(void *arg);
+
+  /// Decompresses a block of received data and writes it to flash.
+  ///
+  /// @param data is the compressed data.
+  /// @param len is the length of the data.
+  ///
+  /// @return ESP_OK if the data was consumed.
+  esp_err_t inflate(const uint8_t *data, size_t len);
+
+  /// Consumes the gzip header from the first received block.
+  ///
+  /// @param data is the first block of the image.
+  /// @param len is the length of the data.
+  ///
+  /// @return the size of the header or zero if it is not valid.
+  size_t parse_gzip_header(const uint8_t *data, size_t len);
+
+  /// Verifies the gzip trailer against the decompressed data.
+  ///
+  /// @return ESP_OK if the CRC32 and size match.
+  esp_err_t verify_gzip_trailer();
+
+  /// Verifies that the written image is an application for this device.
+  ///
+  /// @return ESP_OK if the image is usable.
+  esp_err_t verify_image();
+
+  /// Sends the current buffer to the writer task and waits for the next
+  /// buffer to become available.
+  void submit();
+
+  /// Waits for the writer task to exit (if running).
+  void wait_for_writer();
+
+  /// Partition being updated.
+  const esp_partition_t *partition_{nullptr};
+
+  /// Size of the firmware image being written.
+  size_t size_{0};
+
+  /// Handle for the in-progress update, only used by the writer task.
+  esp_ota_handle_t handle_{0};
+
+  /// Decompression state, only allocated for compressed images.
+  Inflater *inflater_{nullptr};
+
+  /// Buffers used for the update, these are allocated only while an update
+  /// is in progress.
+  Buffer *buffers_{nullptr};
+
+  /// Index of the buffer being filled.
+  size_t fill_{0};
+
+  /// Index of the next buffer to be written by the writer task.
+  size_t drain_{0};
+
+  /// Number of buffers available to be filled.
+  OSSem free_{0};
+
+  /// Number of buffers waiting to be written.
+  OSSem filled_{0};
+
+  /// Signaled when the writer task exits.
+  OSSem done_{0};
+
+  /// Set to true while the writer task is running.
+  bool active_{false};
+
+  /// Number of bytes written to flash.
+  std::atomic<size_t> written_{0};
+
+  /// First error encountered by the writer task.
+  std::atomic<esp_err_t> error_{ESP_OK};
+};
+
+#endif // OTA_WRITER_H_
@@ -19,6 +19,7 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include "ESP32TrainDatabase.h"
 
 #include <AllTrainNodes.hxx>
+#include <ChangeLog.h>
 #include <FileSystemManager.h>
 #include <DCCppProtocol.h>
 #include <DCCProgrammer.h>
@@ -29,14 +30,21 @@ COPYRIGHT (c) 2017-2020 Mike Dunston
 #include <esp_ota_ops.h>
 #include <freertos_drivers/esp32/Esp32WiFiManager.hxx>
 #include <Httpd.h>
+#include <HttpStringUtils.h>
 #include <JsonConstants.h>
+#include <JsonWriter.h>
 #include <LCCStackManager.h>
 #include <LCCWiFiManager.h>
+#include <map>
 #include <Turnouts.h>
 #include <utils/FileUtils.hxx>
 #include <utils/SocketClientParams.hxx>
 #include <utils/StringPrintf.hxx>
 #include "OTAMonitor.h"
+#include "OTAWriter.h"
+#include "WebSocketThrottle.h"
+#include "WebStatePublisher.h"
+#include "WebAssets.h"
 
 #if CONFIG_GPIO_OUTPUTS
 #include <Outputs.h>
@@ -55,7 +63,10 @@ using http::HttpMethod;
 using http::HttpRequest;
 using http::HttpStatusCode;
 using http::AbstractHttpResponse;
+using http::ChunkedResponse;
+using http::FileResponse;
 using http::StringResponse;
+using http::JsonArrayResponse;
 using http::JsonResponse;
 using http::WebSocketFlow;
 using http::MIME_TYPE_TEXT_HTML;
@@ -63,8 +74,6 @@ using http::MIME_TYPE_TEXT_JAVASCRIPT;
 using http::MIME_TYPE_TEXT_PLAIN;
 using http::MIME_TYPE_TEXT_XML;
 using http::MIME_TYPE_TEXT_CSS;
-using http::MIME_TYPE_IMAGE_PNG;
-using http::MIME_TYPE_IMAGE_GIF;
 using http::HTTP_ENCODING_GZIP;
 using http::WebSocketEvent;
 using openlcb::TcpClientDefaultParams;
@@ -74,6 +83,7 @@ class WebSocketClient : public DCCPPProtocolConsumer
 public:
   WebSocketClient(int clientID, uint32_t remoteIP)
     : DCCPPProtocolConsumer(), _id(clientID), _remoteIP(remoteIP)
+    , _throttle(name())
   {
     LOG(INFO, "[WS %s] Connected", name().c_str());
   }
@@ -89,9 +99,14 @@ public:
   {
     return StringPrintf("%s/%d", ipv4_to_string(_remoteIP).c_str(), _id);
   }
+  WebSocketThrottle *throttle()
+  {
+    return &_throttle;
+  }
 private:
   uint32_t _id;
   uint32_t _remoteIP;
+  WebSocketThrottle _throttle;
 };
 
 // Captive Portal landing page
@@ -116,7 +131,11 @@ HTTP_HANDLER(process_power);
 HTTP_HANDLER(process_config);
 HTTP_HANDLER(process_prog);
 HTTP_HANDLER(process_turnouts);
+HTTP_HANDLER(process_turnouts_batch);
+HTTP_HANDLER(process_estop);
+HTTP_HANDLER(process_roster);
 HTTP_HANDLER(process_loco);
+HTTP_HANDLER(process_loco_fn);
 HTTP_HANDLER(process_outputs);
 HTTP_HANDLER(process_sensors);
 HTTP_HANDLER(process_remote_sensors);
@@ -125,26 +144,11 @@ HTTP_HANDLER(process_s88);
 extern const uint8_t indexHtmlGz[] asm("_binary_index_html_gz_start");
 extern const size_t indexHtmlGz_size asm("index_html_gz_length");
 
-extern const uint8_t loco32x32[] asm("_binary_loco_32x32_png_start");
-extern const size_t loco32x32_size asm("loco_32x32_png_length");
-
-extern const uint8_t jqueryJsGz[] asm("_binary_jquery_min_js_gz_start");
-extern const size_t jqueryJsGz_size asm("jquery_min_js_gz_length");
-
-extern const uint8_t jqueryMobileJsGz[] asm("_binary_jquery_mobile_1_5_0_rc1_min_js_gz_start");
-extern const size_t jqueryMobileJsGz_size asm("jquery_mobile_1_5_0_rc1_min_js_gz_length");
-
-extern const uint8_t jqueryMobileCssGz[] asm("_binary_jquery_mobile_1_5_0_rc1_min_css_gz_start");
-extern const size_t jqueryMobileCssGz_size asm("jquery_mobile_1_5_0_rc1_min_css_gz_length");
-
-extern const uint8_t jquerySimpleWebSocketGz[] asm("_binary_jquery_simple_websocket_min_js_gz_start");
-extern const size_t jquerySimpleWebSocketGz_size asm("jquery_simple_websocket_min_js_gz_length");
-
-extern const uint8_t jqClockGz[] asm("_binary_jqClock_lite_min_js_gz_start");
-extern const size_t jqClockGz_size asm("jqClock_lite_min_js_gz_length");
+extern const uint8_t bundleJsGz[] asm("_binary_bundle_js_gz_start");
+extern const size_t bundleJsGz_size asm("bundle_js_gz_length");
 
-extern const uint8_t ajaxLoader[] asm("_binary_ajax_loader_gif_start");
-extern const size_t ajaxLoader_size asm("ajax_loader_gif_length");
+extern const uint8_t bundleCssGz[] asm("_binary_bundle_css_gz_start");
+extern const size_t bundleCssGz_size asm("bundle_css_gz_length");
 
 // CDI Helper which sets the provided path if it is different than the value
 // passed in.
@@ -326,25 +330,17 @@ void init_webserver(const esp32cs::Esp32ConfigDef &cfg)
   } 
   httpd->static_uri("/index.html", indexHtmlGz, indexHtmlGz_size
                   , MIME_TYPE_TEXT_HTML, HTTP_ENCODING_GZIP);
-  httpd->static_uri("/loco-32x32.png", loco32x32, loco32x32_size
-                  , MIME_TYPE_IMAGE_PNG);
-  httpd->static_uri("/jquery.min.js", jqueryJsGz, jqueryJsGz_size
-                  , MIME_TYPE_TEXT_JAVASCRIPT, HTTP_ENCODING_GZIP);
-  httpd->static_uri("/jquery.mobile-1.5.0-rc1.min.js", jqueryMobileJsGz
-                  , jqueryMobileJsGz_size, MIME_TYPE_TEXT_JAVASCRIPT
-                  , HTTP_ENCODING_GZIP);
-  httpd->static_uri("/jquery.mobile-1.5.0-rc1.min.css", jqueryMobileCssGz
-                  , jqueryMobileCssGz_size, MIME_TYPE_TEXT_CSS
-                  , HTTP_ENCODING_GZIP);
-  httpd->static_uri("/jquery.simple.websocket.min.js"
-                  , jquerySimpleWebSocketGz, jquerySimpleWebSocketGz_size
-                  , MIME_TYPE_TEXT_JAVASCRIPT, HTTP_ENCODING_GZIP);
-  httpd->static_uri("/jqClock-lite.min.js", jqClockGz, jqClockGz_size
-                  , MIME_TYPE_TEXT_JAVASCRIPT, HTTP_ENCODING_GZIP);
-  httpd->static_uri("/images/ajax-loader.gif", ajaxLoader, ajaxLoader_size
-                  , MIME_TYPE_IMAGE_GIF);
+  // The bundles are referenced from index.html with a content hash in the
+  // URL so they can be cached by the browser without revalidation.
+  httpd->static_uri(WEB_BUNDLE_JS_URI, bundleJsGz, bundleJsGz_size
+                  , MIME_TYPE_TEXT_JAVASCRIPT, HTTP_ENCODING_GZIP, true);
+  httpd->static_uri(WEB_BUNDLE_CSS_URI, bundleCssGz, bundleCssGz_size
+                  , MIME_TYPE_TEXT_CSS, HTTP_ENCODING_GZIP, true);
   httpd->websocket_uri("/ws", process_websocket_event);
-  httpd->uri("/update", HttpMethod::POST, nullptr, process_ota);
+  // OTA uploads and file system downloads are throttled so that they do not
+  // delay the control endpoints.
+  httpd->uri("/update", HttpMethod::POST, nullptr, process_ota
+           , http::REQUEST_CLASS_BULK);
   httpd->uri("/features", [&](HttpRequest *req)
   {
     string features = StringPrintf("{");
@@ -380,6 +376,24 @@ void init_webserver(const esp32cs::Esp32ConfigDef &cfg)
                  , partition->label, esp_timer_get_time());
     return new JsonResponse(version);
   });
+  httpd->uri("/metrics", HttpMethod::GET,
+  [&](HttpRequest *request) -> AbstractHttpResponse *
+  {
+    // the metrics are generated one section at a time to avoid building the
+    // full document in memory.
+    auto metrics = Singleton<Httpd>::instance()->metrics();
+    if (request->param("format") == "json")
+    {
+      return new ChunkedResponse([metrics](size_t index, string &body)
+      {
+        return metrics->to_json(index, body);
+      }, http::MIME_TYPE_APPLICATION_JSON);
+    }
+    return new ChunkedResponse([metrics](size_t index, string &body)
+    {
+      return metrics->to_prometheus(index, body);
+    }, MIME_TYPE_TEXT_PLAIN);
+  });
   httpd->uri("/fs", HttpMethod::GET,
   [&](HttpRequest *request) -> AbstractHttpResponse *
   {
@@ -388,7 +402,6 @@ void init_webserver(const esp32cs::Esp32ConfigDef &cfg)
     // verify that the requested path exists
     if (!stat(path.c_str(), &statbuf))
     {
-      string data = read_file_to_string(path);
       string mimetype = http::MIME_TYPE_TEXT_PLAIN;
       if (path.find(".xml") != string::npos)
       {
@@ -398,11 +411,11 @@ void init_webserver(const esp32cs::Esp32ConfigDef &cfg)
       {
         mimetype = http::MIME_TYPE_APPLICATION_JSON;
       }
-      return new StringResponse(data, mimetype);
+      return new FileResponse(path, mimetype, request);
     }
     request->set_status(HttpStatusCode::STATUS_NOT_FOUND);
     return nullptr;
-  });
+  }, nullptr, http::REQUEST_CLASS_BULK);
   httpd->uri("/power", HttpMethod::GET | HttpMethod::PUT, process_power);
   httpd->uri("/config", HttpMethod::GET | HttpMethod::POST, process_config);
   httpd->uri("/programmer", HttpMethod::GET | HttpMethod::POST, process_prog);
@@ -410,18 +423,31 @@ void init_webserver(const esp32cs::Esp32ConfigDef &cfg)
            , HttpMethod::GET | HttpMethod::POST |
              HttpMethod::PUT | HttpMethod::DELETE
            , process_turnouts);
+  httpd->uri("/turnouts/batch", HttpMethod::POST | HttpMethod::PUT
+           , process_turnouts_batch);
   httpd->uri("/locomotive"
            , HttpMethod::GET | HttpMethod::POST |
              HttpMethod::PUT | HttpMethod::DELETE
            , process_loco);
-  httpd->uri("/locomotive/roster"
+  httpd->uri("/locomotive/{address:int}"
            , HttpMethod::GET | HttpMethod::POST |
              HttpMethod::PUT | HttpMethod::DELETE
            , process_loco);
+  httpd->uri("/locomotive/{address:int}/fn/{id:int}"
+           , HttpMethod::GET | HttpMethod::POST | HttpMethod::PUT
+           , process_loco_fn);
+  httpd->uri("/locomotive/roster"
+           , HttpMethod::GET | HttpMethod::POST |
+             HttpMethod::PUT | HttpMethod::DELETE
+           , process_roster);
+  httpd->uri("/locomotive/roster/{address:int}"
+           , HttpMethod::GET | HttpMethod::POST |
+             HttpMethod::PUT | HttpMethod::DELETE
+           , process_roster);
   httpd->uri("/locomotive/estop"
            , HttpMethod::GET | HttpMethod::POST |
              HttpMethod::PUT | HttpMethod::DELETE
-           , process_loco);
+           , process_estop);
 #if CONFIG_GPIO_OUTPUTS
   httpd->uri("/outputs"
            , HttpMethod::GET | HttpMethod::POST |
@@ -454,6 +480,10 @@ WEBSOCKET_STREAM_HANDLER_IMPL(process_websocket_event, client, event, data
   }
   else if (event == WebSocketEvent::WS_EVENT_DISCONNECT)
   {
+    if (Singleton<WebStatePublisher>::exists())
+    {
+      Singleton<WebStatePublisher>::instance()->remove_client(client->id());
+    }
     webSocketClients.erase(std::remove_if(webSocketClients.begin()
                                         , webSocketClients.end()
     , [client](const auto &inst) -> bool
@@ -463,6 +493,14 @@ WEBSOCKET_STREAM_HANDLER_IMPL(process_websocket_event, client, event, data
   }
   else if (event == WebSocketEvent::WS_EVENT_TEXT)
   {
+    // subscription messages are handled by the state publisher, everything
+    // else is treated as DCC++ commands.
+    if (Singleton<WebStatePublisher>::exists() &&
+        Singleton<WebStatePublisher>::instance()->process_message(
+          client->id(), data, data_len))
+    {
+      return;
+    }
     auto ent = std::find_if(webSocketClients.begin(), webSocketClients.end()
     , [client](const auto &inst) -> bool
       {
@@ -479,58 +517,65 @@ WEBSOCKET_STREAM_HANDLER_IMPL(process_websocket_event, client, event, data
       }
     }
   }
+  else if (event == WebSocketEvent::WS_EVENT_BINARY)
+  {
+    auto ent = std::find_if(webSocketClients.begin(), webSocketClients.end()
+    , [client](const auto &inst) -> bool
+      {
+        return inst->id() == client->id();
+      }
+    );
+    if (ent != webSocketClients.end())
+    {
+      (*ent)->throttle()->process(data, data_len);
+    }
+  }
 }
 
-esp_ota_handle_t otaHandle;
-esp_partition_t *ota_partition = nullptr;
+/// Writes the OTA image to flash while the next chunk is being received.
+static OTAWriter otaWriter;
 HTTP_STREAM_HANDLER_IMPL(process_ota, request, filename, size, data, length
                        , offset, final, abort_req)
 {
   if (!offset)
   {
     esp_log_level_set("esp_image", ESP_LOG_VERBOSE);
-    ota_partition = (esp_partition_t *)esp_ota_get_next_update_partition(NULL);
-    esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT(
-      esp_ota_begin(ota_partition, size, &otaHandle));
-    if (err != ESP_OK)
+    // the partition erase happens on the writer task, data received while
+    // the erase is in progress will be buffered. gzip compressed images are
+    // detected by their header and decompressed by the writer task.
+    otaWriter.begin(size, OTAWriter::is_compressed(data, length));
+    if (!otaWriter.partition())
     {
       LOG_ERROR("[WebSrv] OTA start failed, aborting!");
-      Singleton<OTAMonitorFlow>::instance()->report_failure(err);
+      Singleton<OTAMonitorFlow>::instance()->report_failure(ESP_ERR_NOT_FOUND);
       request->set_status(HttpStatusCode::STATUS_SERVER_ERROR);
       *abort_req = true;
       return nullptr;
     }
     LOG(INFO, "[WebSrv] OTA Update starting (%zu bytes, target:%s)...", size
-      , ota_partition->label);
+      , otaWriter.partition()->label);
     esp32cs::disable_track_outputs();
-    Singleton<OTAMonitorFlow>::instance()->report_start();
+    Singleton<OTAMonitorFlow>::instance()->report_start(size);
+  }
+  esp_err_t err = otaWriter.write(data, length);
+  if (err == ESP_OK && final)
+  {
+    err = otaWriter.end();
+  }
+  if (err != ESP_OK)
+  {
+    LOG_ERROR("[WebSrv] OTA write failed, aborting!");
+    // release the writer task and buffers (if still active).
+    otaWriter.end();
+    Singleton<OTAMonitorFlow>::instance()->report_failure(err);
+    request->set_status(HttpStatusCode::STATUS_SERVER_ERROR);
+    *abort_req = true;
+    return nullptr;
   }
-  HASSERT(ota_partition);
-  ESP_ERROR_CHECK(esp_ota_write(otaHandle, data, length));
-  Singleton<OTAMonitorFlow>::instance()->report_progress(length);
+  Singleton<OTAMonitorFlow>::instance()->report_progress(length
+                                                       , otaWriter.written());
   if (final)
   {
-    esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_end(otaHandle));
-    if (err != ESP_OK)
-    {
-      LOG_ERROR("[WebSrv] OTA end failed, aborting!");
-      Singleton<OTAMonitorFlow>::instance()->report_failure(err);
-      request->set_status(HttpStatusCode::STATUS_SERVER_ERROR);
-      *abort_req = true;
-      return nullptr;
-    }
-    LOG(INFO, "[WebSrv] OTA binary received, setting boot partition: %s"
-      , ota_partition->label);
-    err = ESP_ERROR_CHECK_WITHOUT_ABORT(
-      esp_ota_set_boot_partition(ota_partition));
-    if (err != ESP_OK)
-    {
-      LOG_ERROR("[WebSrv] OTA end failed, aborting!");
-      Singleton<OTAMonitorFlow>::instance()->report_failure(err);
-      request->set_status(HttpStatusCode::STATUS_SERVER_ERROR);
-      *abort_req = true;
-      return nullptr;
-    }
     LOG(INFO, "[WebSrv] OTA Update Complete!");
     Singleton<OTAMonitorFlow>::instance()->report_success();
     request->set_status(HttpStatusCode::STATUS_OK);
@@ -839,9 +884,22 @@ HTTP_HANDLER_IMPL(process_prog, request)
   return nullptr;
 }
 
+// Returns the collection version provided via the since parameter.
+//
+// List endpoints which accept ?since=<version> respond with:
+// {"version":<version>,"full":<bool>,"changed":[...],"removed":[<id>,...]}
+// When "full" is true the version was not recognized or is too old and
+// "changed" contains all entries. The returned version should be used for
+// the next query.
+static uint32_t since_param(HttpRequest *request)
+{
+  return strtoul(request->param(JSON_SINCE_NODE).c_str(), nullptr, 10);
+}
+
 // GET /turnouts - full list of turnouts, note that turnout state is STRING type for display
 // GET /turnouts?readbleStrings=[0,1] - full list of turnouts, turnout state will be returned as true/false (boolean) when readableStrings=0.
 // GET /turnouts?address=<address> - retrieve turnout by DCC address
+// GET /turnouts?since=<version> - turnouts changed or removed since <version>.
 // PUT /turnouts?address=<address> - toggle turnout by DCC address
 // POST /turnouts?address=<address>&type=<type> - creates a new turnout
 // DELETE /turnouts?address=<address> - delete turnout by DCC address
@@ -856,7 +914,16 @@ HTTP_HANDLER_IMPL(process_turnouts, request)
      !request->has_param(JSON_ADDRESS_NODE))
   {
     bool readable = request->param(JSON_TURNOUTS_READABLE_STRINGS_NODE, false);
-    return new JsonResponse(turnoutMgr->getStateAsJson(readable));
+    if (request->has_param(JSON_SINCE_NODE))
+    {
+      return new JsonResponse(
+        turnoutMgr->get_changes_as_json(since_param(request), readable));
+    }
+    return new JsonArrayResponse(
+    [turnoutMgr, readable](size_t index, string &body)
+    {
+      return turnoutMgr->append_json(index, body, readable);
+    });
   }
 
   uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
@@ -903,30 +970,175 @@ HTTP_HANDLER_IMPL(process_turnouts, request)
   return nullptr;
 }
 
+// PUT/POST /turnouts/batch?turnouts=<address>:<state>[,<address>:<state>...]
+// - sets multiple turnouts, <state> is 0 (closed), 1 (thrown) or 2 (toggle).
+// Turnouts which do not exist will be created.
+//
+// The result code will be 200 and the result will be:
+// {"turnouts":[<turnout>,...],"failed":[<address>,...]}
+// "failed" contains the addresses of any entries which could not be parsed
+// or were out of range. The result code will be 400 when no turnouts are
+// provided.
+HTTP_HANDLER_IMPL(process_turnouts_batch, request)
+{
+  vector<string> entries;
+  http::tokenize(request->param(JSON_TURNOUTS_NODE), entries, ",", true, true);
+  if (entries.empty())
+  {
+    request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+    return nullptr;
+  }
+  vector<TurnoutUpdate> updates;
+  vector<string> failed;
+  for (auto &entry : entries)
+  {
+    auto parts = http::break_string(entry, ":");
+    char *end = nullptr;
+    uint32_t address = strtoul(parts.first.c_str(), &end, 10);
+    bool valid = !parts.first.empty() && *end == '\0' &&
+                 address >= 1 && address <= 2044;
+    uint32_t state = strtoul(parts.second.c_str(), &end, 10);
+    if (valid && !parts.second.empty() && *end == '\0' && state <= 2)
+    {
+      updates.push_back({(uint16_t)address, state == 1, state == 2});
+    }
+    else
+    {
+      failed.push_back(parts.first);
+    }
+  }
+  string res;
+  JsonWriter writer(res);
+  writer.start_object().key(JSON_TURNOUTS_NODE).start_array();
+  Singleton<TurnoutManager>::instance()->set_batch(updates,
+  [&writer](Turnout *turnout)
+  {
+    turnout->writeJson(writer);
+  });
+  writer.end_array().key(JSON_FAILED_NODE).start_array();
+  for (auto &address : failed)
+  {
+    writer.value(address);
+  }
+  writer.end_array().end_object();
+  return new JsonResponse(res);
+}
+
 string convert_loco_to_json(openlcb::TrainImpl *t)
 {
   if (!t)
   {
     return "{}";
   }
-  string res =
-    StringPrintf("{\"%s\":%d,\"%s\":%d,\"%s\":\"%s\",\"%s\":["
-               , JSON_ADDRESS_NODE, t->legacy_address()
-               , JSON_SPEED_NODE, (int)t->get_speed().mph()
-               , JSON_DIRECTION_NODE
-               , t->get_speed().direction() == dcc::SpeedType::REVERSE ? JSON_VALUE_REVERSE
-                                                                       : JSON_VALUE_FORWARD
-               , JSON_FUNCTIONS_NODE);
+  string res;
+  JsonWriter writer(res);
+  writer.start_object()
+        .field(JSON_ADDRESS_NODE, t->legacy_address())
+        .field(JSON_SPEED_NODE, (int)t->get_speed().mph())
+        .field(JSON_DIRECTION_NODE
+             , t->get_speed().direction() == dcc::SpeedType::REVERSE ? JSON_VALUE_REVERSE
+                                                                     : JSON_VALUE_FORWARD)
+        .key(JSON_FUNCTIONS_NODE).start_array();
+  for (size_t funcID = 0; funcID < commandstation::DCC_MAX_FN; funcID++)
+  {
+    writer.start_object()
+          .field(JSON_ID_NODE, funcID)
+          .field(JSON_STATE_NODE, (int)t->get_fn(funcID))
+          .end_object();
+  }
+  writer.end_array().end_object();
+  return res;
+}
 
+static_assert(commandstation::DCC_MAX_FN <= 32
+            , "Function states do not fit in the locomotive state");
+
+// Change tracking for the active locomotives. The TrainImpl does not report
+// changes so the state of each locomotive is compared to the state seen by
+// the previous delta query.
+//
+// NOTE: these are only accessed from the Httpd executor.
+static ChangeLog locoChanges;
+static std::map<uint16_t, uint64_t> locoStates;
+
+// Packs the speed, direction and function states of a locomotive.
+static uint64_t get_loco_state(openlcb::TrainImpl *t)
+{
+  uint64_t state = (uint64_t)(uint8_t)t->get_speed().mph() << 32;
+  if (t->get_speed().direction() == dcc::SpeedType::REVERSE)
+  {
+    state |= 1ULL << 40;
+  }
   for (size_t funcID = 0; funcID < commandstation::DCC_MAX_FN; funcID++)
   {
-    if (funcID)
+    if (t->get_fn(funcID))
     {
-      res += ",";
+      state |= 1ULL << funcID;
     }
-    res += StringPrintf("{\"%s\":%d,\"%s\":%d}", JSON_ID_NODE, funcID, JSON_STATE_NODE, t->get_fn(funcID));
   }
-  res += "]}";
+  return state;
+}
+
+static string get_loco_changes_as_json(uint32_t since)
+{
+  std::map<uint16_t, openlcb::TrainImpl *> active;
+  auto trains = Singleton<commandstation::AllTrainNodes>::instance();
+  for (size_t id = 0; id < trains->size(); id++)
+  {
+    auto nodeid = trains->get_train_node_id_ext(id, false);
+    if (nodeid)
+    {
+      auto loco = trains->get_train_impl(nodeid, false);
+      if (loco)
+      {
+        active[loco->legacy_address()] = loco;
+      }
+    }
+  }
+  for (auto it = locoStates.begin(); it != locoStates.end();)
+  {
+    if (!active.count(it->first))
+    {
+      locoChanges.removed(it->first);
+      it = locoStates.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  for (auto &ent : active)
+  {
+    uint64_t state = get_loco_state(ent.second);
+    auto prev = locoStates.find(ent.first);
+    if (prev == locoStates.end() || prev->second != state)
+    {
+      locoStates[ent.first] = state;
+      locoChanges.changed(ent.first);
+    }
+  }
+
+  string res;
+  JsonWriter writer(res);
+  locoChanges.write_json(writer, since
+  , [&](JsonWriter &writer, uint32_t address)
+    {
+      auto ent = active.find(address);
+      if (ent != active.end())
+      {
+        writer.raw_value(convert_loco_to_json(ent->second));
+        return true;
+      }
+      return false;
+    }
+  , [&](JsonWriter &writer)
+    {
+      for (auto &ent : active)
+      {
+        writer.raw_value(convert_loco_to_json(ent.second));
+      }
+    }
+  );
   return res;
 }
 
@@ -958,204 +1170,236 @@ string convert_loco_to_json(openlcb::TrainImpl *t)
 
 // method - url pattern - meaning
 // ANY /locomotive/estop - send emergency stop to all locomotives
+HTTP_HANDLER_IMPL(process_estop, request)
+{
+  // we don't care how this gets sent to the command station (method).
+  esp32cs::toggle_estop();
+  request->set_status(HttpStatusCode::STATUS_OK);
+  return nullptr;
+}
+
+// method - url pattern - meaning
 // GET /locomotive/roster - roster
-// GET /locomotive/roster?address=<address> - get roster entry
-// PUT /locomotive/roster?address=<address> - update roster entry
-// POST /locomotive/roster?address=<address> - create roster entry
-// DELETE /locomotive/roster?address=<address> - delete roster entry
-// GET /locomotive - get active locomotives
-// POST /locomotive?address=<address> - add locomotive to active management
-// GET /locomotive?address=<address> - get locomotive state
-// PUT /locomotive?address=<address>&speed=<speed>&dir=[FWD|REV]&fX=[true|false] - Update locomotive state, fX is short for function X where X is 0-28.
-// DELETE /locomotive?address=<address> - removes locomotive from active management
-HTTP_HANDLER_IMPL(process_loco, request)
+// GET /locomotive/roster/<address> - get roster entry
+// PUT /locomotive/roster/<address> - update roster entry
+// POST /locomotive/roster/<address> - create roster entry
+// DELETE /locomotive/roster/<address> - delete roster entry
+//
+// The address can also be provided as /locomotive/roster?address=<address>.
+HTTP_HANDLER_IMPL(process_roster, request)
 {
-  string url = request->uri();
   auto traindb = Singleton<esp32cs::Esp32TrainDatabase>::instance();
   request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
-
-  // check if we have an eStop command, we don't care how this gets sent to the
-  // command station (method) so check it first
-  if (url.find("/estop") != string::npos)
+  if (request->method() == HttpMethod::GET &&
+     !request->has_param(JSON_ADDRESS_NODE))
   {
-    esp32cs::toggle_estop();
-    request->set_status(HttpStatusCode::STATUS_OK);
+    return new JsonArrayResponse(
+    [traindb](size_t index, string &body)
+    {
+      return traindb->append_entry_json(index, body);
+    });
   }
-  else if (url.find("/roster")  != string::npos)
+  else if (request->has_param(JSON_ADDRESS_NODE))
   {
-    if (request->method() == HttpMethod::GET &&
-       !request->has_param(JSON_ADDRESS_NODE))
+    uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
+    if (request->method() == HttpMethod::DELETE)
     {
-      return new JsonResponse(traindb->get_all_entries_as_json());
+      traindb->delete_entry(address);
+      request->set_status(HttpStatusCode::STATUS_NO_CONTENT);
     }
-    else if (request->has_param(JSON_ADDRESS_NODE))
+    else
     {
-      uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
-      if (request->method() == HttpMethod::DELETE)
-      {
-        traindb->delete_entry(address);
-        request->set_status(HttpStatusCode::STATUS_NO_CONTENT);
-      }
-      else
+      traindb->create_if_not_found(address, std::to_string(address));
+      if (request->has_param(JSON_NAME_NODE))
       {
-        traindb->create_if_not_found(address, std::to_string(address));
-        if (request->has_param(JSON_NAME_NODE))
+        auto name = request->param(JSON_NAME_NODE);
+        if (name.length() > 16)
         {
-          auto name = request->param(JSON_NAME_NODE);
-          if (name.length() > 16)
-          {
-            LOG_ERROR("[WebSrv] Received locomotive name that is too long, "
-                      "returning error.\n%s", request->to_string().c_str());
-            request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
-            return nullptr;
-          }
-          else if (name.empty())
-          {
-            name = integer_to_string(address);
-          }
-          traindb->set_train_name(address, name);
+          LOG_ERROR("[WebSrv] Received locomotive name that is too long, "
+                    "returning error.\n%s", request->to_string().c_str());
+          request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+          return nullptr;
         }
-        if (request->has_param(JSON_IDLE_ON_STARTUP_NODE))
+        else if (name.empty())
         {
-          traindb->set_train_auto_idle(address
-                                     , request->param(JSON_IDLE_ON_STARTUP_NODE
-                                                    , false));
+          name = integer_to_string(address);
         }
-        if (request->has_param(JSON_DEFAULT_ON_THROTTLE_NODE))
+        traindb->set_train_name(address, name);
+      }
+      if (request->has_param(JSON_IDLE_ON_STARTUP_NODE))
+      {
+        traindb->set_train_auto_idle(address
+                                   , request->param(JSON_IDLE_ON_STARTUP_NODE
+                                                  , false));
+      }
+      if (request->has_param(JSON_DEFAULT_ON_THROTTLE_NODE))
+      {
+        traindb->set_train_show_on_limited_throttle(
+          address, request->param(JSON_DEFAULT_ON_THROTTLE_NODE, false));
+      }
+      // search for and remap functions if present
+      for (uint8_t fn = 0; fn <= 28; fn++)
+      {
+        string fArg = StringPrintf("f%d", fn);
+        if (request->has_param(fArg.c_str()))
         {
-          traindb->set_train_show_on_limited_throttle(
-            address, request->param(JSON_DEFAULT_ON_THROTTLE_NODE, false));
+          commandstation::Symbols label =
+          static_cast<commandstation::Symbols>(
+            request->param(fArg, commandstation::Symbols::FN_UNKNOWN));
+          traindb->set_train_function_label(address, fn, label);
         }
-        // search for and remap functions if present
-        for (uint8_t fn = 0; fn <= 28; fn++)
-        {
-          string fArg = StringPrintf("f%d", fn);
-          if (request->has_param(fArg.c_str()))
-          {
-            commandstation::Symbols label =
-            static_cast<commandstation::Symbols>(
-              request->param(fArg, commandstation::Symbols::FN_UNKNOWN));
-            traindb->set_train_function_label(address, fn, label);
-          }
-        }
-        if (request->has_param(JSON_MODE_NODE))
+      }
+      if (request->has_param(JSON_MODE_NODE))
+      {
+        int8_t mode = request->param(JSON_MODE_NODE, -1);
+        if (mode < 0)
         {
-          int8_t mode = request->param(JSON_MODE_NODE, -1);
-          if (mode < 0)
-          {
-            LOG_ERROR("[WebSrv] Invalid parameters for setting mode:\n%s"
-                    , request->to_string().c_str());
-            request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
-            return nullptr;
-          }
-          commandstation::DccMode drive_mode =
-            static_cast<commandstation::DccMode>(mode);
-          traindb->set_train_drive_mode(address, drive_mode);
+          LOG_ERROR("[WebSrv] Invalid parameters for setting mode:\n%s"
+                  , request->to_string().c_str());
+          request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+          return nullptr;
         }
-        return new JsonResponse(traindb->get_entry_as_json(address));
+        commandstation::DccMode drive_mode =
+          static_cast<commandstation::DccMode>(mode);
+        traindb->set_train_drive_mode(address, drive_mode);
       }
+      return new JsonResponse(traindb->get_entry_as_json(address));
     }
   }
-  else
+  return nullptr;
+}
+
+// method - url pattern - meaning
+// GET /locomotive - get active locomotives
+// GET /locomotive?since=<version> - active locomotives changed or removed since <version>.
+// POST /locomotive/<address> - add locomotive to active management
+// GET /locomotive/<address> - get locomotive state
+// PUT /locomotive/<address>?speed=<speed>&dir=[FWD|REV]&fX=[true|false] - Update locomotive state, fX is short for function X where X is 0-28.
+// DELETE /locomotive/<address> - removes locomotive from active management
+//
+// The address can also be provided as /locomotive?address=<address>.
+HTTP_HANDLER_IMPL(process_loco, request)
+{
+  request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+  if (request->method() == HttpMethod::GET && 
+     !request->has_param(JSON_ADDRESS_NODE))
   {
-    // Since it is not an eStop or roster command we need to check the request
-    // method and ensure it contains the required arguments otherwise the
-    // request should be rejected
-    if (request->method() == HttpMethod::GET && 
-       !request->has_param(JSON_ADDRESS_NODE))
+    if (request->has_param(JSON_SINCE_NODE))
     {
-      // get all active locomotives
-      string res = "[";
-      auto trains = Singleton<commandstation::AllTrainNodes>::instance();
-      for (size_t id = 0; id < trains->size(); id++)
+      return new JsonResponse(get_loco_changes_as_json(since_param(request)));
+    }
+    // get all active locomotives
+    string res = "[";
+    auto trains = Singleton<commandstation::AllTrainNodes>::instance();
+    for (size_t id = 0; id < trains->size(); id++)
+    {
+      auto nodeid = trains->get_train_node_id_ext(id, false);
+      if (nodeid)
       {
-        auto nodeid = trains->get_train_node_id_ext(id, false);
-        if (nodeid)
+        auto loco = trains->get_train_impl(nodeid, false);
+        if (loco)
         {
-          auto loco = trains->get_train_impl(nodeid, false);
-          if (loco)
+          if (res.length() > 1)
           {
-            if (res.length() > 1)
-            {
-              res += ",";
-            }
-            res += convert_loco_to_json(loco);
+            res += ",";
           }
+          res += convert_loco_to_json(loco);
         }
       }
-      res += "]";
-      return new JsonResponse(res);
     }
-    else if (request->has_param(JSON_ADDRESS_NODE))
+    res += "]";
+    return new JsonResponse(res);
+  }
+  else if (request->has_param(JSON_ADDRESS_NODE))
+  {
+    uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
+    if (request->method() == HttpMethod::PUT ||
+        request->method() == HttpMethod::POST)
     {
-      uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
-      if (request->method() == HttpMethod::PUT ||
-          request->method() == HttpMethod::POST)
+      GET_LOCO_VIA_EXECUTOR(loco, address);
+      // Creation / Update of active locomotive
+      if (request->has_param(JSON_IDLE_NODE))
       {
-        GET_LOCO_VIA_EXECUTOR(loco, address);
-        // Creation / Update of active locomotive
-        if (request->has_param(JSON_IDLE_NODE))
-        {
-          loco->set_speed(dcc::SpeedType(0));
-        }
-        if (request->has_param(JSON_SPEED_NODE))
-        {
-          bool forward = true;
-          if (request->has_param(JSON_DIRECTION_NODE))
-          {
-            forward = !request->param(JSON_DIRECTION_NODE).compare(JSON_VALUE_FORWARD);
-          }
-          auto speed = dcc::SpeedType::from_mph(request->param(JSON_SPEED_NODE, 0));
-          if (!forward)
-          {
-            speed.set_direction(dcc::SpeedType::REVERSE);
-          }
-          loco->set_speed(speed);
-        }
-        else if (request->has_param(JSON_DIRECTION_NODE))
+        loco->set_speed(dcc::SpeedType(0));
+      }
+      if (request->has_param(JSON_SPEED_NODE))
+      {
+        bool forward = true;
+        if (request->has_param(JSON_DIRECTION_NODE))
         {
-          bool forward =
-            !request->param(JSON_DIRECTION_NODE).compare(JSON_VALUE_FORWARD);
-          auto upd_speed = loco->get_speed();
-          upd_speed.set_direction(forward ? dcc::SpeedType::FORWARD
-                                          : dcc::SpeedType::REVERSE);
-          loco->set_speed(upd_speed);
+          forward = !request->param(JSON_DIRECTION_NODE).compare(JSON_VALUE_FORWARD);
         }
-        
-        for (uint8_t funcID = 0; funcID <= 28; funcID++)
+        auto speed = dcc::SpeedType::from_mph(request->param(JSON_SPEED_NODE, 0));
+        if (!forward)
         {
-          string fArg = StringPrintf("f%d", funcID);
-          if (request->has_param(fArg.c_str()))
-          {
-            loco->set_fn(funcID, request->param(fArg, false));
-          }
+          speed.set_direction(dcc::SpeedType::REVERSE);
         }
-        return new JsonResponse(convert_loco_to_json(loco));
+        loco->set_speed(speed);
       }
-      else if (request->method() == HttpMethod::DELETE)
+      else if (request->has_param(JSON_DIRECTION_NODE))
       {
-        REMOVE_LOCO_VIA_EXECUTOR(address)
-#if CONFIG_NEXTION
-        static_cast<NextionThrottlePage *>(nextionPages[THROTTLE_PAGE])->invalidateLocomotive(address);
-#endif
-        request->set_status(HttpStatusCode::STATUS_NO_CONTENT);
+        bool forward =
+          !request->param(JSON_DIRECTION_NODE).compare(JSON_VALUE_FORWARD);
+        auto upd_speed = loco->get_speed();
+        upd_speed.set_direction(forward ? dcc::SpeedType::FORWARD
+                                        : dcc::SpeedType::REVERSE);
+        loco->set_speed(upd_speed);
       }
-      else
+      
+      for (uint8_t funcID = 0; funcID <= 28; funcID++)
       {
-        GET_LOCO_VIA_EXECUTOR(loco, address);
-        return new JsonResponse(convert_loco_to_json(loco));
+        string fArg = StringPrintf("f%d", funcID);
+        if (request->has_param(fArg.c_str()))
+        {
+          loco->set_fn(funcID, request->param(fArg, false));
+        }
       }
+      return new JsonResponse(convert_loco_to_json(loco));
+    }
+    else if (request->method() == HttpMethod::DELETE)
+    {
+      REMOVE_LOCO_VIA_EXECUTOR(address)
+#if CONFIG_NEXTION
+      static_cast<NextionThrottlePage *>(nextionPages[THROTTLE_PAGE])->invalidateLocomotive(address);
+#endif
+      request->set_status(HttpStatusCode::STATUS_NO_CONTENT);
+    }
+    else
+    {
+      GET_LOCO_VIA_EXECUTOR(loco, address);
+      return new JsonResponse(convert_loco_to_json(loco));
     }
   }
   return nullptr;
 }
 
+// method - url pattern - meaning
+// GET /locomotive/<address>/fn/<id> - get locomotive state
+// PUT /locomotive/<address>/fn/<id>?state=[true|false] - set function <id> (0-28), toggles the function when state is not provided.
+HTTP_HANDLER_IMPL(process_loco_fn, request)
+{
+  uint16_t address = request->param(JSON_ADDRESS_NODE, 0);
+  int function = request->param(JSON_ID_NODE, -1);
+  if (function < 0 || function > 28)
+  {
+    request->set_status(HttpStatusCode::STATUS_BAD_REQUEST);
+    return nullptr;
+  }
+  GET_LOCO_VIA_EXECUTOR(loco, address);
+  if (request->method() != HttpMethod::GET)
+  {
+    loco->set_fn(function
+               , request->param(JSON_STATE_NODE, !loco->get_fn(function)));
+  }
+  return new JsonResponse(convert_loco_to_json(loco));
+}
+
 #if CONFIG_GPIO_OUTPUTS
 HTTP_HANDLER_IMPL(process_outputs, request)
 {
   if (request->method() == HttpMethod::GET && !request->params())
   {
-    return new JsonResponse(OutputManager::getStateAsJson());
+    return new JsonArrayResponse(OutputManager::appendJson);
   }
   request->set_status(HttpStatusCode::STATUS_OK);
   int16_t output_id = request->param(JSON_ID_NODE, -1);
@@ -1220,7 +1464,12 @@ HTTP_HANDLER_IMPL(process_sensors, request)
   if (request->method() == HttpMethod::GET &&
      !request->has_param(JSON_ID_NODE))
   {
-    return new JsonResponse(SensorManager::getStateAsJson());
+    if (request->has_param(JSON_SINCE_NODE))
+    {
+      return new JsonResponse(
+        SensorManager::getChangesAsJson(since_param(request)));
+    }
+    return new JsonArrayResponse(SensorManager::appendJson);
   }
   else if (!request->has_param(JSON_ID_NODE))
   {
@@ -1285,7 +1534,7 @@ HTTP_HANDLER_IMPL(process_remote_sensors, request)
   request->set_status(HttpStatusCode::STATUS_OK);
   if (request->method() == HttpMethod::GET)
   {
-    return new JsonResponse(RemoteSensorManager::getStateAsJson());
+    return new JsonArrayResponse(RemoteSensorManager::appendJson);
   }
   else if (request->method() == HttpMethod::POST)
   {
@@ -1305,7 +1554,16 @@ HTTP_HANDLER_IMPL(process_s88, request)
   request->set_status(HttpStatusCode::STATUS_OK);
   if (request->method() == HttpMethod::GET)
   {
-    return new JsonResponse(S88BusManager::instance()->get_state_as_json());
+    if (request->has_param(JSON_SINCE_NODE))
+    {
+      return new JsonResponse(
+        S88BusManager::instance()->get_changes_as_json(since_param(request)));
+    }
+    return new JsonArrayResponse(
+    [](size_t index, string &body)
+    {
+      return S88BusManager::instance()->append_json(index, body);
+    });
   }
   else if (request->method() == HttpMethod::POST)
   {
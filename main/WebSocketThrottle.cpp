@@ -0,0 +1,168 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "sdkconfig.h"
+#include "WebSocketThrottle.h"
+
+#include <algorithm>
+#include <AllTrainNodes.hxx>
+#include <DCCSignalVFS.h>
+#include <dcc/Loco.hxx>
+#include <executor/Executable.hxx>
+#include <LCCStackManager.h>
+#include <openlcb/SimpleStack.hxx>
+#include <utils/logging.h>
+
+using commandstation::AllTrainNodes;
+using commandstation::DccMode;
+using dcc::SpeedType;
+
+/// Payload size for each opcode, indexed by opcode.
+static constexpr size_t PAYLOAD_SIZE[] =
+{
+  0 // unused
+, 2 // OP_SPEED
+, 1 // OP_DIRECTION
+, 2 // OP_FUNCTION
+, 0 // OP_ESTOP
+, 0 // OP_ACQUIRE
+, 0 // OP_RELEASE
+};
+
+bool WebSocketThrottle::process(const uint8_t *data, size_t length)
+{
+  if (length < HEADER_SIZE || data[0] != VERSION)
+  {
+    LOG_ERROR("[WS %s] Discarding binary throttle message, length:%zu "
+              "version:%d", name_.c_str(), length, length ? data[0] : 0);
+    return false;
+  }
+  uint8_t opcode = data[1];
+  uint16_t sequence = (data[2] << 8) | data[3];
+  uint16_t address = (data[4] << 8) | data[5];
+  if (opcode < OP_SPEED || opcode > OP_RELEASE ||
+      length < HEADER_SIZE + PAYLOAD_SIZE[opcode])
+  {
+    LOG_ERROR("[WS %s] Discarding binary throttle message, opcode:%d "
+              "length:%zu", name_.c_str(), opcode, length);
+    return false;
+  }
+  uint8_t arg1 = PAYLOAD_SIZE[opcode] > 0 ? data[HEADER_SIZE] : 0;
+  uint8_t arg2 = PAYLOAD_SIZE[opcode] > 1 ? data[HEADER_SIZE + 1] : 0;
+  if ((opcode == OP_SPEED && arg1 > MAX_SPEED) ||
+      (opcode == OP_FUNCTION && arg1 > MAX_FUNCTION) ||
+      (opcode != OP_ESTOP && !address))
+  {
+    LOG_ERROR("[WS %s] Discarding invalid binary throttle message, opcode:%d "
+              "address:%d", name_.c_str(), opcode, address);
+    return false;
+  }
+  if (!accept(opcode, address, sequence))
+  {
+    LOG(VERBOSE, "[WS %s] Discarding stale message for loco %d, sequence:%d"
+      , name_.c_str(), address, sequence);
+    return true;
+  }
+
+  // the locomotive is only accessed from the LCC executor, the message is
+  // executed asynchronously so the WebSocket is not blocked.
+  Singleton<esp32cs::LCCStackManager>::instance()->stack()->executor()->add(
+  new CallbackExecutable([opcode, address, arg1, arg2]()
+  {
+    auto trains = Singleton<AllTrainNodes>::instance();
+    if (opcode == OP_ESTOP && !address)
+    {
+      esp32cs::toggle_estop();
+      return;
+    }
+    else if (opcode == OP_RELEASE)
+    {
+      trains->remove_train_impl(address);
+      return;
+    }
+    auto impl = trains->get_train_impl(DccMode::DCC_128, address);
+    if (!impl)
+    {
+      return;
+    }
+    if (opcode == OP_SPEED)
+    {
+      SpeedType speed = SpeedType::from_mph(arg1);
+      if (arg2 == 0 || (arg2 == DIRECTION_UNCHANGED &&
+          impl->get_speed().direction() == SpeedType::REVERSE))
+      {
+        speed.set_direction(SpeedType::REVERSE);
+      }
+      impl->set_speed(speed);
+    }
+    else if (opcode == OP_DIRECTION)
+    {
+      SpeedType speed(impl->get_speed());
+      speed.set_direction(arg1 ? SpeedType::FORWARD : SpeedType::REVERSE);
+      impl->set_speed(speed);
+    }
+    else if (opcode == OP_FUNCTION)
+    {
+      impl->set_fn(arg1, arg2);
+    }
+    else if (opcode == OP_ESTOP)
+    {
+      impl->set_emergencystop();
+    }
+  }));
+  return true;
+}
+
+bool WebSocketThrottle::accept(uint8_t opcode, uint16_t address
+                             , uint16_t sequence)
+{
+  if (!address)
+  {
+    return true;
+  }
+  auto ent = std::find_if(locos_.begin(), locos_.end()
+  , [address](const auto &loco)
+    {
+      return loco.address == address;
+    }
+  );
+  if (opcode == OP_RELEASE)
+  {
+    if (ent != locos_.end())
+    {
+      locos_.erase(ent);
+    }
+    return true;
+  }
+  if (ent == locos_.end())
+  {
+    if (locos_.size() >= MAX_LOCOS)
+    {
+      locos_.erase(locos_.begin());
+    }
+    locos_.push_back({address, sequence});
+    return true;
+  }
+  // acquire always resets the sequence, otherwise the sequence must be newer
+  // than the last accepted message taking wrap around into account.
+  if (opcode != OP_ACQUIRE && (int16_t)(sequence - ent->sequence) <= 0)
+  {
+    return false;
+  }
+  ent->sequence = sequence;
+  return true;
+}
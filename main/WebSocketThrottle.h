@@ -0,0 +1,120 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef WEBSOCKET_THROTTLE_H_
+#define WEBSOCKET_THROTTLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Decodes binary throttle messages received from a single WebSocket client.
+///
+/// All messages start with a six byte header, multi-byte values are sent in
+/// network byte order (big endian):
+///   byte 0   : protocol version (@ref VERSION).
+///   byte 1   : @ref Opcode.
+///   byte 2-3 : sequence number, incremented by the client for each message.
+///   byte 4-5 : locomotive address.
+///
+/// The header is followed by the opcode specific payload:
+///   OP_SPEED     : speed (0 - 126), direction (0 = reverse, 1 = forward or
+///                  0xFF for no change).
+///   OP_DIRECTION : direction (0 = reverse, 1 = forward).
+///   OP_FUNCTION  : function number (0 - 28), state (0 = off, 1 = on).
+///   OP_ESTOP     : no payload, when the address is zero the e-stop state of
+///                  all locomotives will be toggled.
+///   OP_ACQUIRE   : no payload.
+///   OP_RELEASE   : no payload.
+///
+/// Messages for a locomotive which have a sequence number older than the last
+/// message received for that locomotive are discarded, this prevents a late
+/// slider update from overwriting a newer one.
+///
+/// Decoded messages are executed asynchronously on the LCC executor, no
+/// response is sent, locomotive state changes can be received by subscribing
+/// to the loco/<address> topic of the @ref WebStatePublisher.
+class WebSocketThrottle
+{
+public:
+  /// Version of the binary throttle protocol.
+  static constexpr uint8_t VERSION = 1;
+
+  /// Binary throttle message types.
+  enum Opcode : uint8_t
+  {
+    OP_SPEED = 0x01
+  , OP_DIRECTION = 0x02
+  , OP_FUNCTION = 0x03
+  , OP_ESTOP = 0x04
+  , OP_ACQUIRE = 0x05
+  , OP_RELEASE = 0x06
+  };
+
+  /// Constructor.
+  ///
+  /// @param name is the name of the client used in log messages.
+  WebSocketThrottle(const std::string &name) : name_(name)
+  {
+  }
+
+  /// Decodes and executes a binary throttle message.
+  ///
+  /// @param data is the message received from the client.
+  /// @param length is the length of the message.
+  ///
+  /// @return true if the message was valid, false otherwise.
+  bool process(const uint8_t *data, size_t length);
+
+private:
+  /// Size of the common message header.
+  static constexpr size_t HEADER_SIZE = 6;
+
+  /// Maximum number of locomotives tracked per client, when this limit is
+  /// reached the oldest locomotive will no longer be tracked.
+  static constexpr size_t MAX_LOCOS = 8;
+
+  /// Highest function number which can be controlled.
+  static constexpr uint8_t MAX_FUNCTION = 28;
+
+  /// Highest speed step which can be requested.
+  static constexpr uint8_t MAX_SPEED = 126;
+
+  /// Direction value used to leave the direction unchanged.
+  static constexpr uint8_t DIRECTION_UNCHANGED = 0xFF;
+
+  /// Last sequence number received for a locomotive.
+  struct LocoSequence
+  {
+    /// Locomotive address.
+    uint16_t address;
+
+    /// Last accepted sequence number.
+    uint16_t sequence;
+  };
+
+  /// Name of the client used in log messages.
+  std::string name_;
+
+  /// Locomotives this client has sent messages for.
+  std::vector<LocoSequence> locos_;
+
+  bool accept(uint8_t opcode, uint16_t address, uint16_t sequence);
+};
+
+#endif // WEBSOCKET_THROTTLE_H_
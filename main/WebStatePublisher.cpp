@@ -0,0 +1,410 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#include "sdkconfig.h"
+#include "WebStatePublisher.h"
+
+#include <algorithm>
+#include <AllTrainNodes.hxx>
+#include <DCCSignalVFS.h>
+#include <Httpd.h>
+#include <json.hpp>
+#include <openlcb/TractionDefs.hxx>
+#include <Turnouts.h>
+#include <utils/StringPrintf.hxx>
+
+#if CONFIG_GPIO_SENSORS
+#include <Sensors.h>
+#endif // CONFIG_GPIO_SENSORS
+
+using commandstation::AllTrainNodes;
+using commandstation::DccMode;
+using dcc::SpeedType;
+using http::Httpd;
+using http::WebSocketFlow;
+
+/// Interval at which track power and subscribed locomotives are checked for
+/// changes and pending topic updates are sent.
+static constexpr uint64_t UPDATE_INTERVAL = MSEC_TO_NSEC(100);
+
+/// Prefix used for locomotive topics, the address follows the prefix.
+static constexpr const char *LOCO_TOPIC_PREFIX = "loco/";
+
+/// Highest DCC address which can be subscribed to.
+static constexpr uint16_t MAX_LOCO_ADDRESS = 10239;
+
+const char * const WebStatePublisher::TOPIC_NAMES[TOPIC_COUNT] =
+{
+  "track", "turnouts", "sensors", "s88"
+};
+
+const uint64_t WebStatePublisher::TOPIC_INTERVALS[TOPIC_COUNT] =
+{
+  MSEC_TO_NSEC(250), MSEC_TO_NSEC(250), MSEC_TO_NSEC(250), MSEC_TO_NSEC(500)
+};
+
+WebStatePublisher::WebStatePublisher(Service *service)
+  : service_(service)
+  , updateFlow_(service, UPDATE_INTERVAL
+              , std::bind(&WebStatePublisher::periodic_update, this))
+{
+  powerOn_ = esp32cs::is_ops_track_output_enabled();
+  Singleton<TurnoutManager>::instance()->register_state_listener(
+  [&](uint16_t address, bool thrown)
+  {
+    // turnout state changes can come from any thread, forward them to the
+    // executor to be queued for the subscribed clients.
+    service_->executor()->add(new CallbackExecutable([this, address, thrown]()
+    {
+      queue_change(TOPIC_TURNOUTS, address, thrown);
+    }));
+  });
+#if CONFIG_GPIO_SENSORS
+  SensorManager::register_state_listener([&](Sensor *sensor)
+  {
+    // sensor state changes come from the sensor and S88 tasks, capture the
+    // state now and forward it to the executor.
+    Topic topic = sensor->isS88() ? TOPIC_S88 : TOPIC_SENSORS;
+    uint16_t id = sensor->getID();
+    bool active = sensor->isActive();
+    service_->executor()->add(new CallbackExecutable([this, topic, id, active]()
+    {
+      queue_change(topic, id, active);
+    }));
+  });
+#endif // CONFIG_GPIO_SENSORS
+}
+
+bool WebStatePublisher::process_message(int client, const uint8_t *data
+                                      , size_t length)
+{
+  // DCC++ commands always start with '<', anything else which starts with '{'
+  // is treated as a subscription message.
+  if (!length || data[0] != '{')
+  {
+    return false;
+  }
+  nlohmann::json message =
+    nlohmann::json::parse(data, data + length, nullptr, false);
+  if (message.is_discarded() || !message.is_object())
+  {
+    LOG_ERROR("[WebState %d] Discarding malformed subscription message"
+            , client);
+    return true;
+  }
+  std::vector<std::string> add;
+  std::vector<std::string> remove;
+  if (message.contains("sub") && message["sub"].is_array())
+  {
+    for (auto &topic : message["sub"])
+    {
+      if (topic.is_string())
+      {
+        add.push_back(topic.get<std::string>());
+      }
+    }
+  }
+  if (message.contains("unsub") && message["unsub"].is_array())
+  {
+    for (auto &topic : message["unsub"])
+    {
+      if (topic.is_string())
+      {
+        remove.push_back(topic.get<std::string>());
+      }
+    }
+  }
+  service_->executor()->add(new CallbackExecutable(
+  [this, client, add = std::move(add), remove = std::move(remove)]()
+  {
+    for (auto &topic : remove)
+    {
+      subscribe(client, topic, false);
+    }
+    for (auto &topic : add)
+    {
+      subscribe(client, topic, true);
+    }
+  }));
+  return true;
+}
+
+void WebStatePublisher::remove_client(int client)
+{
+  service_->executor()->add(new CallbackExecutable([this, client]()
+  {
+    unsubscribe_all(client);
+  }));
+}
+
+void WebStatePublisher::subscribe(int client, const std::string &topic
+                                , bool add)
+{
+  if (!topic.compare(0, strlen(LOCO_TOPIC_PREFIX), LOCO_TOPIC_PREFIX))
+  {
+    int address = std::atoi(topic.c_str() + strlen(LOCO_TOPIC_PREFIX));
+    if (address > 0 && address <= MAX_LOCO_ADDRESS)
+    {
+      subscribe_loco(client, address, add);
+      return;
+    }
+  }
+  for (size_t index = 0; index < TOPIC_COUNT; index++)
+  {
+    if (topic == TOPIC_NAMES[index])
+    {
+      auto &clients = topics_[index].clients;
+      auto ent = std::find(clients.begin(), clients.end(), client);
+      if (add && ent == clients.end())
+      {
+        clients.push_back(client);
+        // track state is sent immediately, all other topics only contain
+        // changes from this point on.
+        if (index == TOPIC_TRACK)
+        {
+          send(client, track_event());
+        }
+      }
+      else if (!add && ent != clients.end())
+      {
+        clients.erase(ent);
+        if (clients.empty())
+        {
+          topics_[index].pending.clear();
+          topics_[index].dirty = false;
+        }
+      }
+      return;
+    }
+  }
+  LOG(WARNING, "[WebState %d] Ignoring unknown topic: %s", client
+    , topic.c_str());
+}
+
+void WebStatePublisher::subscribe_loco(int client, uint16_t address, bool add)
+{
+  auto ent = std::find_if(locos_.begin(), locos_.end()
+  , [address](const auto &loco)
+    {
+      return loco.address == address;
+    }
+  );
+  if (!add)
+  {
+    if (ent != locos_.end())
+    {
+      ent->clients.erase(
+        std::remove(ent->clients.begin(), ent->clients.end(), client)
+      , ent->clients.end());
+      if (ent->clients.empty())
+      {
+        locos_.erase(ent);
+      }
+    }
+    return;
+  }
+  if (ent == locos_.end())
+  {
+    if (locos_.size() >= MAX_LOCOS)
+    {
+      LOG(WARNING, "[WebState %d] Unable to subscribe to loco %d, limit of %zu "
+          "locomotives reached", client, address, MAX_LOCOS);
+      return;
+    }
+    locos_.emplace_back();
+    ent = locos_.end() - 1;
+    ent->address = address;
+  }
+  if (std::find(ent->clients.begin(), ent->clients.end(), client) !=
+      ent->clients.end())
+  {
+    return;
+  }
+  ent->clients.push_back(client);
+  if (refresh_loco(&(*ent)))
+  {
+    send(ent->clients, loco_event(&(*ent)));
+  }
+  else if (ent->known)
+  {
+    send(client, loco_event(&(*ent)));
+  }
+}
+
+void WebStatePublisher::unsubscribe_all(int client)
+{
+  for (auto &topic : topics_)
+  {
+    topic.clients.erase(
+      std::remove(topic.clients.begin(), topic.clients.end(), client)
+    , topic.clients.end());
+    if (topic.clients.empty())
+    {
+      topic.pending.clear();
+      topic.dirty = false;
+    }
+  }
+  for (auto &loco : locos_)
+  {
+    loco.clients.erase(
+      std::remove(loco.clients.begin(), loco.clients.end(), client)
+    , loco.clients.end());
+  }
+  locos_.erase(std::remove_if(locos_.begin(), locos_.end()
+  , [](const auto &loco)
+    {
+      return loco.clients.empty();
+    }), locos_.end());
+}
+
+void WebStatePublisher::queue_change(Topic topic, uint16_t key, bool state)
+{
+  if (topics_[topic].clients.empty())
+  {
+    return;
+  }
+  // only the latest state is kept, multiple changes within the topic
+  // interval will be sent as a single update.
+  topics_[topic].pending[key] = state;
+  topics_[topic].dirty = true;
+}
+
+void WebStatePublisher::periodic_update()
+{
+  if (!topics_[TOPIC_TRACK].clients.empty())
+  {
+    bool power = esp32cs::is_ops_track_output_enabled();
+    if (power != powerOn_)
+    {
+      powerOn_ = power;
+      topics_[TOPIC_TRACK].dirty = true;
+    }
+  }
+  for (auto &loco : locos_)
+  {
+    if (refresh_loco(&loco))
+    {
+      send(loco.clients, loco_event(&loco));
+    }
+  }
+  uint64_t now = os_get_time_monotonic();
+  for (size_t index = 0; index < TOPIC_COUNT; index++)
+  {
+    if (topics_[index].dirty &&
+        (now - topics_[index].last_sent) >= TOPIC_INTERVALS[index])
+    {
+      publish((Topic)index);
+      topics_[index].last_sent = now;
+    }
+  }
+}
+
+void WebStatePublisher::publish(Topic topic)
+{
+  auto &state = topics_[topic];
+  string event;
+  if (topic == TOPIC_TRACK)
+  {
+    event = track_event();
+  }
+  else
+  {
+    event = StringPrintf("{\"t\":\"%s\",\"d\":[", TOPIC_NAMES[topic]);
+    for (auto &entry : state.pending)
+    {
+      event.append(StringPrintf("[%d,%d],", entry.first, entry.second));
+    }
+    // replace the trailing comma with the end of the array
+    event.back() = ']';
+    event.append("}");
+  }
+  state.pending.clear();
+  state.dirty = false;
+  send(state.clients, event);
+}
+
+bool WebStatePublisher::refresh_loco(LocoState *loco)
+{
+  // only locomotives which have already been allocated are checked, a
+  // subscription should not create a train node.
+  auto node_id = openlcb::TractionDefs::train_node_id_from_legacy(
+    commandstation::dcc_mode_to_address_type(DccMode::DCC_128, loco->address)
+  , loco->address);
+  auto impl =
+    Singleton<AllTrainNodes>::instance()->get_train_impl(node_id, false);
+  if (!impl)
+  {
+    return false;
+  }
+  SpeedType speed(impl->get_speed());
+  uint8_t mph = speed.mph() + 0.5f;
+  bool forward = speed.direction() == SpeedType::FORWARD;
+  uint32_t functions = 0;
+  for (uint8_t fn = 0; fn <= MAX_FUNCTION; fn++)
+  {
+    if (impl->get_fn(fn))
+    {
+      functions |= (1 << fn);
+    }
+  }
+  if (loco->known && loco->speed == mph && loco->forward == forward &&
+      loco->functions == functions)
+  {
+    return false;
+  }
+  loco->speed = mph;
+  loco->forward = forward;
+  loco->functions = functions;
+  loco->known = true;
+  return true;
+}
+
+string WebStatePublisher::track_event()
+{
+  powerOn_ = esp32cs::is_ops_track_output_enabled();
+  return StringPrintf("{\"t\":\"%s\",\"on\":%d}", TOPIC_NAMES[TOPIC_TRACK]
+                    , powerOn_);
+}
+
+string WebStatePublisher::loco_event(LocoState *loco)
+{
+  return StringPrintf("{\"t\":\"%s%d\",\"s\":%d,\"fwd\":%d,\"fn\":%u}"
+                    , LOCO_TOPIC_PREFIX, loco->address, loco->speed
+                    , loco->forward, loco->functions);
+}
+
+void WebStatePublisher::send(int client, const string &event)
+{
+  send(std::vector<int>{client}, event);
+}
+
+void WebStatePublisher::send(const std::vector<int> &clients
+                           , const string &event)
+{
+  if (clients.empty() || !Singleton<Httpd>::exists())
+  {
+    return;
+  }
+  // the event is encoded once and shared by all subscribed clients.
+  auto frame =
+    WebSocketFlow::encode(http::OP_TEXT, (const uint8_t *)event.data()
+                        , event.length());
+  for (int client : clients)
+  {
+    Singleton<Httpd>::instance()->send_websocket_frame(client, frame);
+  }
+}
@@ -0,0 +1,160 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+#ifndef WEB_STATE_PUBLISHER_H_
+#define WEB_STATE_PUBLISHER_H_
+
+#include <AutoPersistCallbackFlow.h>
+#include <executor/Service.hxx>
+#include <map>
+#include <string>
+#include <utils/Singleton.hxx>
+#include <vector>
+
+/// Pushes layout state changes to WebSocket clients which have subscribed to
+/// one or more topics.
+///
+/// Clients manage their subscriptions by sending a JSON message on the
+/// WebSocket:
+///   {"sub":["track","turnouts","sensors","s88","loco/3"]}
+///   {"unsub":["loco/3"]}
+///
+/// Events are sent as compact JSON messages containing only the state that
+/// changed:
+///   {"t":"track","on":1}
+///   {"t":"turnouts","d":[[<address>,<thrown>],...]}
+///   {"t":"sensors","d":[[<id>,<active>],...]}
+///   {"t":"s88","d":[[<id>,<active>],...]}
+///   {"t":"loco/3","s":<speed>,"fwd":<0|1>,"fn":<function bitmask>}
+///
+/// Changes to a topic are coalesced and sent at most once per topic interval,
+/// each event is encoded once and shared by all subscribed clients.
+///
+/// NOTE: With the exception of @ref process_message and @ref remove_client
+/// all methods must be called on the executor of the @ref Service passed to
+/// the constructor.
+class WebStatePublisher : public Singleton<WebStatePublisher>
+{
+public:
+  /// Constructor.
+  ///
+  /// @param service is the @ref Service to use for state polling and
+  /// delivery of events.
+  ///
+  /// NOTE: This must be created after the @ref TurnoutManager and before the
+  /// @ref SensorManager is started.
+  WebStatePublisher(Service *service);
+
+  /// Processes a subscription message received from a WebSocket client.
+  ///
+  /// @param client is the ID of the WebSocket client.
+  /// @param data is the message received from the client.
+  /// @param length is the length of the message.
+  ///
+  /// @return true if the message was a subscription message, false if it
+  /// should be processed by another handler.
+  bool process_message(int client, const uint8_t *data, size_t length);
+
+  /// Removes all subscriptions for a WebSocket client.
+  ///
+  /// @param client is the ID of the WebSocket client.
+  void remove_client(int client);
+
+private:
+  /// Topics which track a collection of state, changes are queued until the
+  /// next update is sent.
+  enum Topic : uint8_t
+  {
+    TOPIC_TRACK
+  , TOPIC_TURNOUTS
+  , TOPIC_SENSORS
+  , TOPIC_S88
+  , TOPIC_COUNT
+  };
+
+  /// State of a single topic.
+  struct TopicState
+  {
+    /// Subscribed WebSocket client IDs.
+    std::vector<int> clients;
+
+    /// Changes which have not yet been sent, key is the turnout address or
+    /// sensor ID.
+    std::map<uint16_t, bool> pending;
+
+    /// Set to true when the topic has changes to send.
+    bool dirty{false};
+
+    /// Time of the last event sent for this topic.
+    uint64_t last_sent{0};
+  };
+
+  /// State of a subscribed locomotive.
+  struct LocoState
+  {
+    /// Locomotive address.
+    uint16_t address;
+
+    /// Subscribed WebSocket client IDs.
+    std::vector<int> clients;
+
+    /// Last published speed (0 - 126).
+    uint8_t speed{0};
+
+    /// Last published direction.
+    bool forward{true};
+
+    /// Last published function states, one bit per function.
+    uint32_t functions{0};
+
+    /// Set to true when the state has been published at least once.
+    bool known{false};
+  };
+
+  /// Maximum number of locomotives which can be subscribed to across all
+  /// clients.
+  static constexpr size_t MAX_LOCOS = 16;
+
+  /// Highest function number that will be published.
+  static constexpr uint8_t MAX_FUNCTION = 28;
+
+  /// Topic names as used in subscription messages and events.
+  static const char * const TOPIC_NAMES[TOPIC_COUNT];
+
+  /// Minimum interval between events for each topic.
+  static const uint64_t TOPIC_INTERVALS[TOPIC_COUNT];
+
+  Service *service_;
+  TopicState topics_[TOPIC_COUNT];
+  std::vector<LocoState> locos_;
+  AutoPersistFlow updateFlow_;
+  bool powerOn_{false};
+
+  void subscribe(int client, const std::string &topic, bool add);
+  void subscribe_loco(int client, uint16_t address, bool add);
+  void unsubscribe_all(int client);
+  void queue_change(Topic topic, uint16_t key, bool state);
+  void periodic_update();
+  void publish(Topic topic);
+  bool refresh_loco(LocoState *loco);
+  std::string track_event();
+  std::string loco_event(LocoState *loco);
+  void send(int client, const std::string &event);
+  void send(const std::vector<int> &clients, const std::string &event);
+};
+
+#endif // WEB_STATE_PUBLISHER_H_
@@ -0,0 +1,102 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#include "OTAMock.h"
+
+#include <esp_ota_ops.h>
+#include <string.h>
+
+std::vector<uint8_t> ota_mock_flash;
+bool ota_mock_boot_set = false;
+
+static const esp_partition_t mock_partition = {"ota_1"};
+
+static const esp_app_desc_t mock_app =
+{
+  "host", "ESP32CommandStation", "00:00:00", "Jan 1 2020"
+};
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_INVALID_RESPONSE:
+      return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:
+      return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_OTA_VALIDATE_FAILED:
+      return "ESP_ERR_OTA_VALIDATE_FAILED";
+  }
+  return "ESP_FAIL";
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(
+  const esp_partition_t *start_from)
+{
+  return &mock_partition;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size
+                      , esp_ota_handle_t *out_handle)
+{
+  ota_mock_flash.clear();
+  ota_mock_boot_set = false;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data
+                      , size_t size)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  ota_mock_flash.insert(ota_mock_flash.end(), bytes, bytes + size);
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+  ota_mock_boot_set = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition
+                                          , esp_app_desc_t *app_desc)
+{
+  memcpy(app_desc, &mock_app, sizeof(esp_app_desc_t));
+  return ESP_OK;
+}
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+  return &mock_app;
+}
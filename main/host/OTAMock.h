@@ -0,0 +1,32 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef OTA_MOCK_H_
+#define OTA_MOCK_H_
+
+#include <stdint.h>
+#include <vector>
+
+/// Contents of the mock update partition, esp_ota_begin clears this and
+/// esp_ota_write appends to it.
+extern std::vector<uint8_t> ota_mock_flash;
+
+/// Set by esp_ota_set_boot_partition.
+extern bool ota_mock_boot_set;
+
+#endif // OTA_MOCK_H_
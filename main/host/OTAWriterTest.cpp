@@ -0,0 +1,214 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#include "OTAMock.h"
+#include "OTAWriter.h"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+/// Size of the buffers used by @ref OTAWriter, the image is handed to the
+/// decompressor in blocks of this size.
+static constexpr size_t OTA_BLOCK_SIZE = 4096;
+
+/// Size of the gzip trailer.
+static constexpr size_t GZIP_TRAILER = 8;
+
+class OTAWriterTest : public testing::Test
+{
+protected:
+  static void SetUpTestCase()
+  {
+    char tmpl[] = "/tmp/ota-test-XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(tmpl));
+    dir_ = tmpl;
+
+    // firmware like data, partly compressible with some incompressible
+    // sections.
+    std::mt19937 rng(20201018);
+    for (unsigned idx = 0; idx < 4000; idx++)
+    {
+      std::string line = "entry " + std::to_string(idx) + " value " +
+        std::to_string(rng() % 1000) + "\n";
+      image_.insert(image_.end(), line.begin(), line.end());
+      if (idx % 500 == 0)
+      {
+        for (unsigned pad = 0; pad < 1024; pad++)
+        {
+          image_.push_back(rng());
+        }
+      }
+    }
+    // extend the image with incompressible data until a short file name
+    // places the end of the compressed image just past a block boundary,
+    // longer names then move the trailer across the boundary.
+    while (true)
+    {
+      size_t size = gzip(image_, "x").size();
+      size_t remain = (OTA_BLOCK_SIZE - (size % OTA_BLOCK_SIZE)) %
+        OTA_BLOCK_SIZE;
+      if (remain < 160)
+      {
+        base_name_len_ = 1 + remain;
+        break;
+      }
+      for (unsigned pad = 0; pad < 128; pad++)
+      {
+        image_.push_back(rng());
+      }
+    }
+  }
+
+  static void TearDownTestCase()
+  {
+    rmdir(dir_.c_str());
+  }
+
+  /// Compresses data with the gzip command line tool.
+  ///
+  /// @param data is the data to compress.
+  /// @param name is the file name, this is stored in the gzip header.
+  ///
+  /// @return the compressed data.
+  static std::vector<uint8_t> gzip(const std::vector<uint8_t> &data
+                                 , const std::string &name)
+  {
+    std::string path = dir_ + "/" + name;
+    FILE *f = fopen(path.c_str(), "wb");
+    EXPECT_NE(nullptr, f);
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    std::string cmd = "gzip -9 -c " + path;
+    FILE *p = popen(cmd.c_str(), "r");
+    EXPECT_NE(nullptr, p);
+    std::vector<uint8_t> result;
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), p)) > 0)
+    {
+      result.insert(result.end(), buf, buf + len);
+    }
+    EXPECT_EQ(0, pclose(p));
+    unlink(path.c_str());
+    return result;
+  }
+
+  /// Writes an image through the @ref OTAWriter.
+  ///
+  /// @param data is the image to write.
+  /// @param chunk is the size of each write, this emulates the HTTP body.
+  ///
+  /// @return the result from @ref OTAWriter::end.
+  esp_err_t write_image(const std::vector<uint8_t> &data, size_t chunk)
+  {
+    writer_.begin(data.size(), OTAWriter::is_compressed(data.data()
+                                                      , data.size()));
+    for (size_t offs = 0; offs < data.size(); offs += chunk)
+    {
+      esp_err_t err =
+        writer_.write(data.data() + offs, std::min(chunk, data.size() - offs));
+      if (err != ESP_OK)
+      {
+        return err;
+      }
+    }
+    return writer_.end();
+  }
+
+  static std::string dir_;
+  static std::vector<uint8_t> image_;
+  static size_t base_name_len_;
+  OTAWriter writer_;
+};
+
+std::string OTAWriterTest::dir_;
+std::vector<uint8_t> OTAWriterTest::image_;
+size_t OTAWriterTest::base_name_len_;
+
+TEST_F(OTAWriterTest, uncompressed_image)
+{
+  EXPECT_EQ(ESP_OK, write_image(image_, 1460));
+  EXPECT_EQ(image_, ota_mock_flash);
+  EXPECT_TRUE(ota_mock_boot_set);
+}
+
+TEST_F(OTAWriterTest, gzip_image)
+{
+  std::vector<uint8_t> gz = gzip(image_, "firmware.bin");
+  EXPECT_EQ(ESP_OK, write_image(gz, 1460));
+  EXPECT_EQ(image_, ota_mock_flash);
+  EXPECT_TRUE(ota_mock_boot_set);
+  EXPECT_EQ(gz.size(), writer_.written());
+}
+
+TEST_F(OTAWriterTest, gzip_trailer_across_blocks)
+{
+  // moves the end of the image from exactly on a block boundary to where the
+  // trailer is entirely in the final block.
+  for (size_t extra = 0; extra <= GZIP_TRAILER + 2; extra++)
+  {
+    std::string name(base_name_len_ + extra, 'f');
+    std::vector<uint8_t> gz = gzip(image_, name);
+    ASSERT_EQ(extra, gz.size() % OTA_BLOCK_SIZE);
+    EXPECT_EQ(ESP_OK, write_image(gz, 1460)) << "extra: " << extra;
+    EXPECT_EQ(image_, ota_mock_flash) << "extra: " << extra;
+    EXPECT_TRUE(ota_mock_boot_set) << "extra: " << extra;
+  }
+}
+
+TEST_F(OTAWriterTest, gzip_bad_crc)
+{
+  std::vector<uint8_t> gz = gzip(image_, "firmware.bin");
+  gz[gz.size() - GZIP_TRAILER] ^= 0xFF;
+  EXPECT_EQ(ESP_ERR_INVALID_CRC, write_image(gz, 1460));
+  EXPECT_FALSE(ota_mock_boot_set);
+}
+
+TEST_F(OTAWriterTest, gzip_bad_size)
+{
+  std::vector<uint8_t> gz = gzip(image_, "firmware.bin");
+  gz[gz.size() - 1] ^= 0xFF;
+  EXPECT_EQ(ESP_ERR_INVALID_CRC, write_image(gz, 1460));
+  EXPECT_FALSE(ota_mock_boot_set);
+}
+
+TEST_F(OTAWriterTest, gzip_truncated)
+{
+  std::vector<uint8_t> gz = gzip(image_, "firmware.bin");
+  gz.resize(gz.size() - GZIP_TRAILER - 16);
+  EXPECT_NE(ESP_OK, write_image(gz, 1460));
+  EXPECT_FALSE(ota_mock_boot_set);
+}
+
+TEST_F(OTAWriterTest, gzip_trailing_data)
+{
+  std::vector<uint8_t> gz = gzip(image_, "firmware.bin");
+  gz.resize(gz.size() + 16, 0);
+  EXPECT_NE(ESP_OK, write_image(gz, 1460));
+  EXPECT_FALSE(ota_mock_boot_set);
+}
+
+int appl_main(int argc, char *argv[])
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
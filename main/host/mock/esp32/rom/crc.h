@@ -0,0 +1,31 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef ROM_CRC_H_
+#define ROM_CRC_H_
+
+#include <stdint.h>
+#include <zlib.h>
+
+/// The ROM CRC32 matches the zlib (and gzip) CRC32 when started from zero.
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+  return crc32(crc, buf, len);
+}
+
+#endif // ROM_CRC_H_
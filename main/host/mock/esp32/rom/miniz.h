@@ -0,0 +1,122 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+// Host replacement for the ROM tinfl API, implemented on top of zlib.
+//
+// The ROM (miniz v1.x) tinfl reads ahead into its bit buffer and does not
+// give the unused bytes back when the end of the deflate stream is reached.
+// This is emulated by reporting up to TINFL_MOCK_READ_AHEAD extra bytes as
+// consumed once the stream is done.
+
+#ifndef ROM_MINIZ_H_
+#define ROM_MINIZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+#define TINFL_MOCK_READ_AHEAD 4
+
+typedef unsigned char mz_uint8;
+typedef unsigned int mz_uint32;
+
+enum
+{
+  TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+  TINFL_FLAG_HAS_MORE_INPUT = 2,
+  TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+  TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum
+{
+  TINFL_STATUS_BAD_PARAM = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+typedef struct
+{
+  mz_uint32 m_state;
+  z_stream stream;
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->m_state = 0; } while (0)
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r
+  , const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size
+  , mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size
+  , const mz_uint32 decomp_flags)
+{
+  if (r->m_state == 0)
+  {
+    r->stream.zalloc = Z_NULL;
+    r->stream.zfree = Z_NULL;
+    r->stream.opaque = Z_NULL;
+    // raw deflate stream, tinfl only parses the zlib header when requested.
+    if (inflateInit2(&r->stream, -MAX_WBITS) != Z_OK)
+    {
+      return TINFL_STATUS_FAILED;
+    }
+    r->m_state = 1;
+  }
+  else if (r->m_state == 2)
+  {
+    *pIn_buf_size = 0;
+    *pOut_buf_size = 0;
+    return TINFL_STATUS_DONE;
+  }
+  r->stream.next_in = (Bytef *)pIn_buf_next;
+  r->stream.avail_in = *pIn_buf_size;
+  r->stream.next_out = pOut_buf_next;
+  r->stream.avail_out = *pOut_buf_size;
+  int res = inflate(&r->stream, Z_NO_FLUSH);
+  size_t consumed = *pIn_buf_size - r->stream.avail_in;
+  *pOut_buf_size -= r->stream.avail_out;
+  if (res == Z_STREAM_END)
+  {
+    size_t extra = r->stream.avail_in;
+    if (extra > TINFL_MOCK_READ_AHEAD)
+    {
+      extra = TINFL_MOCK_READ_AHEAD;
+    }
+    *pIn_buf_size = consumed + extra;
+    inflateEnd(&r->stream);
+    r->m_state = 2;
+    return TINFL_STATUS_DONE;
+  }
+  *pIn_buf_size = consumed;
+  if (res != Z_OK && res != Z_BUF_ERROR)
+  {
+    inflateEnd(&r->stream);
+    r->m_state = 2;
+    return TINFL_STATUS_FAILED;
+  }
+  if (!r->stream.avail_out)
+  {
+    return TINFL_STATUS_HAS_MORE_OUTPUT;
+  }
+  return TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+#endif // ROM_MINIZ_H_
@@ -0,0 +1,45 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef ESP_ERR_H_
+#define ESP_ERR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int esp_err_t;
+
+#define ESP_OK                       0
+#define ESP_FAIL                     -1
+#define ESP_ERR_NO_MEM               0x101
+#define ESP_ERR_INVALID_ARG          0x102
+#define ESP_ERR_INVALID_STATE        0x103
+#define ESP_ERR_INVALID_SIZE         0x104
+#define ESP_ERR_INVALID_RESPONSE     0x108
+#define ESP_ERR_INVALID_CRC          0x109
+#define ESP_ERR_OTA_BASE             0x1500
+#define ESP_ERR_OTA_VALIDATE_FAILED  (ESP_ERR_OTA_BASE + 0x03)
+
+const char *esp_err_to_name(esp_err_t code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ESP_ERR_H_
@@ -0,0 +1,64 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef ESP_OTA_OPS_H_
+#define ESP_OTA_OPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_SIZE_UNKNOWN 0xffffffff
+
+typedef uint32_t esp_ota_handle_t;
+
+typedef struct
+{
+  char label[17];
+} esp_partition_t;
+
+typedef struct
+{
+  char version[32];
+  char project_name[32];
+  char time[16];
+  char date[16];
+} esp_app_desc_t;
+
+const esp_partition_t *esp_ota_get_next_update_partition(
+  const esp_partition_t *start_from);
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size
+                      , esp_ota_handle_t *out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data
+                      , size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition
+                                          , esp_app_desc_t *app_desc);
+const esp_app_desc_t *esp_ota_get_app_description(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ESP_OTA_OPS_H_
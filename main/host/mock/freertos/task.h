@@ -0,0 +1,30 @@
+/**********************************************************************
+ESP32 COMMAND STATION
+
+COPYRIGHT (c) 2020 Mike Dunston
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see http://www.gnu.org/licenses
+**********************************************************************/
+
+
+#ifndef TASK_H_
+#define TASK_H_
+
+#include "FreeRTOS.h"
+
+/// The host threads do not track their stack usage.
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  return 0;
+}
+
+#endif // TASK_H_
@@ -0,0 +1,145 @@
+#!/usr/bin/env python
+#
+# ESP32 COMMAND STATION
+#
+# COPYRIGHT (c) 2020 Mike Dunston
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see http://www.gnu.org/licenses
+"""Bundles the web UI into the files which are embedded in the firmware.
+
+The stylesheets and scripts referenced by index.html are concatenated (in the
+order they are referenced) into a single CSS and a single JS bundle, images
+from the web content which are referenced by the page or stylesheets are
+inlined as data URIs and index.html is stripped of indentation and comments.
+All outputs are gzip compressed.
+
+The bundles are served with a content hash in their URI so they can be cached
+by the browser as immutable, the URIs are written to a generated header for
+WebServer.cpp:
+
+  index.html.gz, bundle.js.gz, bundle.css.gz, WebAssets.h
+"""
+from __future__ import print_function
+import argparse
+import base64
+import gzip
+import hashlib
+import io
+import os
+import re
+
+SCRIPT_TAG = re.compile(r'<script src="([^":]+?)(\?[^"]*)?"></script>')
+STYLESHEET_TAG = re.compile(r'<link rel="stylesheet" href="([^":]+?)(\?[^"]*)?">')
+ICON_HREF = re.compile(r'(<link rel="icon" type="([^"]+)" href=")([^":]+)(")')
+CSS_URL = re.compile(r'url\(([^):"\']+)\)')
+HTML_COMMENT = re.compile(r'^<!--.*-->$')
+
+MIME_TYPES = {
+    '.gif': 'image/gif',
+    '.png': 'image/png',
+}
+
+# Number of hex digits of the content hash included in the bundle URIs.
+HASH_LENGTH = 10
+
+
+def read(src, name):
+    with io.open(os.path.join(src, name.lstrip('/')), 'rb') as f:
+        return f.read()
+
+
+def data_uri(src, name, mimetype=None):
+    name = os.path.basename(name)
+    if not mimetype:
+        mimetype = MIME_TYPES[os.path.splitext(name)[1]]
+    return 'data:%s;base64,%s' % (
+        mimetype, base64.b64encode(read(src, name)).decode('ascii'))
+
+
+def inline_url(src, match):
+    # references to files which are not part of the web content are retained.
+    name = match.group(1)
+    if not os.path.isfile(os.path.join(src, os.path.basename(name))):
+        return match.group(0)
+    return 'url(%s)' % data_uri(src, name)
+
+
+def minify_html(html):
+    # only leading/trailing whitespace, blank lines and full line comments are
+    # removed, the line structure is retained so the inline script does not
+    # depend on automatic semicolon insertion changing.
+    lines = []
+    for line in html.splitlines():
+        line = line.strip()
+        if not line or HTML_COMMENT.match(line) or line.startswith('//'):
+            continue
+        lines.append(line)
+    return '\n'.join(lines) + '\n'
+
+
+def bundle_uri(content, extension):
+    return '/app.%s.%s' % (
+        hashlib.sha1(content).hexdigest()[:HASH_LENGTH], extension)
+
+
+def write_gzip(path, content):
+    # mtime is fixed so that the output is reproducible for unchanged input.
+    with open(path, 'wb') as raw:
+        with gzip.GzipFile(filename='', mode='wb', fileobj=raw, mtime=0,
+                           compresslevel=9) as f:
+            f.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('src', help='directory holding index.html')
+    parser.add_argument('out', help='directory to write the bundles to')
+    args = parser.parse_args()
+
+    html = read(args.src, 'index.html').decode('utf-8')
+
+    scripts = [m.group(1) for m in SCRIPT_TAG.finditer(html)]
+    js = b';\n'.join(read(args.src, name).rstrip() for name in scripts) + b';\n'
+    js_uri = bundle_uri(js, 'js')
+
+    stylesheets = [m.group(1) for m in STYLESHEET_TAG.finditer(html)]
+    css = b'\n'.join(read(args.src, name).rstrip() for name in stylesheets)
+    css = CSS_URL.sub(lambda m: inline_url(args.src, m),
+                      css.decode('utf-8')).encode('utf-8')
+    css_uri = bundle_uri(css, 'css')
+
+    # replace the first reference with the bundle and drop the others.
+    html = STYLESHEET_TAG.sub('<link rel="stylesheet" href="%s">' % css_uri,
+                              html, count=1)
+    html = STYLESHEET_TAG.sub('', html)
+    html = SCRIPT_TAG.sub('<script src="%s"></script>' % js_uri, html, count=1)
+    html = SCRIPT_TAG.sub('', html)
+    html = ICON_HREF.sub(
+        lambda m: m.group(1) + data_uri(args.src, m.group(3), m.group(2)) +
+        m.group(4), html)
+    html = minify_html(html)
+
+    if not os.path.isdir(args.out):
+        os.makedirs(args.out)
+    write_gzip(os.path.join(args.out, 'index.html.gz'), html.encode('utf-8'))
+    write_gzip(os.path.join(args.out, 'bundle.js.gz'), js)
+    write_gzip(os.path.join(args.out, 'bundle.css.gz'), css)
+    with open(os.path.join(args.out, 'WebAssets.h'), 'w') as f:
+        f.write('// Generated by tools/web_bundle.py, do not edit.\n')
+        f.write('#define WEB_BUNDLE_JS_URI "%s"\n' % js_uri)
+        f.write('#define WEB_BUNDLE_CSS_URI "%s"\n' % css_uri)
+    print('Bundled %d script(s) as %s and %d stylesheet(s) as %s' % (
+        len(scripts), js_uri, len(stylesheets), css_uri))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,233 @@
+#!/usr/bin/env python
+#
+# ESP32 COMMAND STATION
+#
+# COPYRIGHT (c) 2020 Mike Dunston
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see http://www.gnu.org/licenses
+"""Multi-client load test for the WiThrottle server.
+
+Opens a number of concurrent throttle connections to the command station and
+runs the sequence a phone throttle performs on each of them:
+
+  1. connect and wait for the server greeting (VN2.0 ... *<heartbeat>)
+  2. send the device name (N) and hardware id (HU), enable the heartbeat (*+)
+  3. acquire a locomotive (MT+L<addr><;>L<addr>) and wait for the confirmation
+  4. send bursts of speed changes, keeping the heartbeat alive between bursts
+  5. query the speed (qV) and verify that the last requested speed is reported
+  6. stop and release the locomotive (MT-L<addr><;>r) and disconnect (Q)
+
+Every client uses its own locomotive address. The script exits with a non-zero
+status if any client fails a step, which makes it usable from CI against a
+bench command station:
+
+  tools/withrottle_load.py 192.168.4.1 --clients 20 --bursts 10
+"""
+from __future__ import print_function
+import argparse
+import socket
+import sys
+import threading
+import time
+
+SEPARATOR = '<;>'
+
+
+class ThrottleError(Exception):
+    pass
+
+
+class Throttle(object):
+    def __init__(self, args, index):
+        self.args = args
+        self.index = index
+        self.address = args.base_address + index
+        self.key = 'L%d' % self.address
+        self.prefix = 'MTA%s%s' % (self.key, SEPARATOR)
+        self.sock = None
+        self.buffer = b''
+        self.received = 0
+        self.sent = 0
+        self.pushed = 0
+        self.latencies = []
+        self.error = None
+
+    def send(self, line):
+        self.sock.sendall((line + '\n').encode('ascii'))
+        self.sent += 1
+
+    def readline(self, deadline):
+        while b'\n' not in self.buffer:
+            remaining = deadline - time.time()
+            if remaining <= 0:
+                raise ThrottleError('timed out waiting for data')
+            self.sock.settimeout(remaining)
+            try:
+                data = self.sock.recv(1024)
+            except socket.timeout:
+                raise ThrottleError('timed out waiting for data')
+            if not data:
+                raise ThrottleError('connection closed by the server')
+            self.buffer += data
+        line, self.buffer = self.buffer.split(b'\n', 1)
+        self.received += 1
+        return line.decode('ascii', 'replace').strip('\r')
+
+    def expect(self, predicate, what):
+        # lines which are not the expected response (roster, turnout and state
+        # pushes) are counted and skipped.
+        start = time.time()
+        deadline = start + self.args.timeout
+        while True:
+            try:
+                line = self.readline(deadline)
+            except ThrottleError as e:
+                raise ThrottleError('%s: %s' % (what, e))
+            if line.startswith('HM'):
+                raise ThrottleError('server message: %s' % line[2:])
+            if predicate(line):
+                self.latencies.append(time.time() - start)
+                return line
+            self.pushed += 1
+
+    def check_roster(self, line):
+        # RL<count> followed by one ]\[name}|{address}|{S|L entry per
+        # locomotive, the count must match the entries.
+        entries = line.split(']\\[')
+        try:
+            count = int(entries[0][2:])
+        except ValueError:
+            raise ThrottleError('invalid roster: %s' % line)
+        if count != len(entries) - 1:
+            raise ThrottleError('roster count %d does not match %d entries'
+                                % (count, len(entries) - 1))
+
+    def drain(self):
+        # consume any pushed updates without blocking.
+        self.sock.setblocking(False)
+        try:
+            while True:
+                data = self.sock.recv(4096)
+                if not data:
+                    raise ThrottleError('connection closed by the server')
+                self.buffer += data
+        except socket.error:
+            pass
+        lines = self.buffer.count(b'\n')
+        self.received += lines
+        self.pushed += lines
+        self.buffer = self.buffer.rsplit(b'\n', 1)[-1]
+
+    def run(self):
+        try:
+            self.sock = socket.create_connection(
+                (self.args.host, self.args.port), self.args.timeout)
+            self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self.expect(lambda l: l == 'VN2.0', 'protocol version')
+            roster = self.expect(lambda l: l.startswith('RL'), 'roster')
+            self.check_roster(roster)
+            self.expect(lambda l: l.startswith('*'), 'heartbeat interval')
+            self.send('Nload-%d' % self.index)
+            self.expect(lambda l: l.startswith('*'), 'name acknowledgement')
+            self.send('HUload-test-%d' % self.index)
+            self.send('*+')
+
+            self.send('MT+%s%s%s' % (self.key, SEPARATOR, self.key))
+            self.expect(lambda l: l == 'MT+%s%s' % (self.key, SEPARATOR),
+                        'acquire')
+
+            speed = 0
+            for burst in range(self.args.bursts):
+                for step in range(self.args.burst_size):
+                    speed = (burst * self.args.burst_size + step) % 126 + 1
+                    self.send('%sV%d' % (self.prefix, speed))
+                self.send('*')
+                time.sleep(self.args.interval)
+                self.drain()
+
+            self.send('%sqV' % self.prefix)
+            line = self.expect(lambda l: l.startswith(self.prefix + 'V'),
+                               'speed query')
+            reported = int(line[len(self.prefix) + 1:])
+            if reported != speed:
+                raise ThrottleError('speed %d was reported, expected %d'
+                                    % (reported, speed))
+
+            self.send('%sV0' % self.prefix)
+            self.send('MT-%s%sr' % (self.key, SEPARATOR))
+            self.expect(lambda l: l == 'MT-%s%s' % (self.key, SEPARATOR),
+                        'release')
+            self.send('Q')
+        except (ThrottleError, socket.error, ValueError) as e:
+            self.error = str(e)
+        finally:
+            if self.sock:
+                self.sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('host', help='command station hostname or IP')
+    parser.add_argument('--port', type=int, default=12090,
+                        help='WiThrottle port (default: %(default)s)')
+    parser.add_argument('--clients', type=int, default=20,
+                        help='number of concurrent throttles '
+                             '(default: %(default)s)')
+    parser.add_argument('--base-address', type=int, default=1000,
+                        help='locomotive address used by the first throttle, '
+                             'each throttle uses the next address '
+                             '(default: %(default)s)')
+    parser.add_argument('--bursts', type=int, default=10,
+                        help='number of speed bursts (default: %(default)s)')
+    parser.add_argument('--burst-size', type=int, default=20,
+                        help='speed commands per burst (default: %(default)s)')
+    parser.add_argument('--interval', type=float, default=0.5,
+                        help='seconds between bursts (default: %(default)s)')
+    parser.add_argument('--stagger', type=float, default=0.05,
+                        help='seconds between starting each client, the '
+                             'listen backlog of the command station is small '
+                             '(default: %(default)s)')
+    parser.add_argument('--timeout', type=float, default=10,
+                        help='seconds to wait for a response '
+                             '(default: %(default)s)')
+    args = parser.parse_args()
+
+    throttles = [Throttle(args, idx) for idx in range(args.clients)]
+    threads = [threading.Thread(target=t.run) for t in throttles]
+    start = time.time()
+    for thread in threads:
+        thread.start()
+        time.sleep(args.stagger)
+    for thread in threads:
+        thread.join()
+    elapsed = time.time() - start
+
+    failed = [t for t in throttles if t.error]
+    for t in failed:
+        print('client %d (%s): %s' % (t.index, t.key, t.error))
+    latencies = sorted(l for t in throttles for l in t.latencies)
+    sent = sum(t.sent for t in throttles)
+    print('%d/%d clients completed in %.1fs' % (
+        len(throttles) - len(failed), len(throttles), elapsed))
+    print('%d commands sent (%.0f/s), %d lines received, %d pushed updates' % (
+        sent, sent / elapsed, sum(t.received for t in throttles),
+        sum(t.pushed for t in throttles)))
+    if latencies:
+        print('response latency: median %.0fms, p95 %.0fms, max %.0fms' % (
+            latencies[len(latencies) // 2] * 1000,
+            latencies[int(len(latencies) * 0.95)] * 1000,
+            latencies[-1] * 1000))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())